@@ -0,0 +1,46 @@
+# Generates a C++ source file which embeds the given SPIR-V binaries as constexpr arrays, together with
+# a lookup by shader name. This is run as a script with cmake -P, with these variables defined:
+#   SPIRV_FILES: A list of .spv files. The shader name is the file name without the .spv extension.
+#   OUTPUT_FILE: The path of the generated C++ source file.
+cmake_minimum_required(VERSION 3.20)
+
+set(SHADER_ARRAYS "")
+set(SHADER_TABLE "")
+list(LENGTH SPIRV_FILES SHADER_COUNT)
+foreach(SPIRV_FILE ${SPIRV_FILES})
+    cmake_path(GET SPIRV_FILE STEM LAST_ONLY SHADER_NAME)
+    string(MAKE_C_IDENTIFIER "${SHADER_NAME}" SHADER_IDENTIFIER)
+
+    # SPIR-V is a stream of 32-bit words, which glslang writes in little-endian byte order.
+    file(READ ${SPIRV_FILE} SPIRV_HEX HEX)
+    string(LENGTH "${SPIRV_HEX}" SPIRV_HEX_LENGTH)
+    math(EXPR SPIRV_REMAINDER "${SPIRV_HEX_LENGTH} % 8")
+    if (NOT SPIRV_REMAINDER EQUAL 0)
+        message(FATAL_ERROR "${SPIRV_FILE} is not a valid SPIR-V binary")
+    endif()
+    string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1," SPIRV_WORDS "${SPIRV_HEX}")
+
+    string(APPEND SHADER_ARRAYS "\tconstexpr std::uint32_t ${SHADER_IDENTIFIER}[] = {${SPIRV_WORDS}};\n")
+    string(APPEND SHADER_TABLE "\t\t{ \"${SHADER_NAME}\", ${SHADER_IDENTIFIER} },\n")
+endforeach()
+
+file(CONFIGURE OUTPUT ${OUTPUT_FILE} @ONLY CONTENT [=[// This file is generated by cmake/embed_spirv.cmake. Do not edit.
+#include <array>
+#include <utility>
+
+#include <vk_gltf_viewer/embedded_shaders.hpp>
+
+namespace {
+@SHADER_ARRAYS@
+	constexpr std::array<std::pair<std::string_view, std::span<const std::uint32_t>>, @SHADER_COUNT@> shaderTable {{
+@SHADER_TABLE@	}};
+} // namespace
+
+std::span<const std::uint32_t> shaders::find(std::string_view name) noexcept {
+	for (const auto& [shaderName, code] : shaderTable) {
+		if (shaderName == name)
+			return code;
+	}
+	return {};
+}
+]=])
@@ -11,9 +11,10 @@
 class BufferUploadTask : public enki::ITaskSet {
 	std::span<const std::byte> data;
 	VkBuffer destinationBuffer;
+	VkDeviceSize destinationOffset;
 
 public:
-	explicit BufferUploadTask(std::span<const std::byte> data, VkBuffer destinationBuffer);
+	explicit BufferUploadTask(std::span<const std::byte> data, VkBuffer destinationBuffer, VkDeviceSize destinationOffset = 0);
 
 	void ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) override;
 };
@@ -26,9 +27,11 @@ class ImageUploadTask : public enki::ITaskSet {
 	VkImage destinationImage;
 	VkExtent3D imageExtent;
 	VkImageLayout destinationLayout;
+	std::uint32_t mipLevel;
 
 public:
-	explicit ImageUploadTask(std::span<const std::byte> data, VkImage destinationImage, VkExtent3D imageExtent, VkImageLayout destinationLayout, std::size_t channelCount);
+	/** imageExtent is the extent of the given mip level, not of the whole image */
+	explicit ImageUploadTask(std::span<const std::byte> data, VkImage destinationImage, VkExtent3D imageExtent, VkImageLayout destinationLayout, std::size_t channelCount, std::uint32_t mipLevel = 0);
 
 	void SetDependency(enki::ICompletable* task) {
 		ITaskSet::SetDependency(dependency, task);
@@ -37,6 +40,24 @@ public:
 	void ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) override;
 };
 
+/**
+ * An upload which has been submitted to a transfer queue without waiting for it. The owner
+ * polls BufferUploader::isComplete and releases the staging memory with BufferUploader::destroy.
+ */
+struct PendingUpload {
+	VkBuffer stagingBuffer = VK_NULL_HANDLE;
+	VmaAllocation stagingAllocation = VK_NULL_HANDLE;
+	VkCommandPool commandPool = VK_NULL_HANDLE;
+	VkFence fence = VK_NULL_HANDLE;
+};
+
+/** A range of a buffer written by BufferUploader::submitBufferUpload */
+struct BufferUploadRegion {
+	std::span<const std::byte> data;
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+};
+
 /** Simple class that contains functions to copy any buffer into DEVICE_LOCAL memory through staging buffers */
 class BufferUploader {
 	friend class BufferUploadTask;
@@ -74,6 +95,11 @@ class BufferUploader {
 
 	std::size_t stagingBufferSize = 0;
 
+	/** Creates the staging buffer, command pool and fence of a pending upload, and begins its command buffer */
+	[[nodiscard]] VkCommandBuffer beginPendingUpload(VkDeviceSize stagingSize, PendingUpload& upload);
+	/** Ends the command buffer and submits it, signalling the upload's fence */
+	void submitPendingUpload(VkCommandBuffer cmd, PendingUpload& upload);
+
 	TransferQueue& getNextQueueHandle() {
 		// Generally it shouldn't matter if we don't guard the idx variable, as then we might just use the same queue twice in succession.
 		// However, just to be completely correct we'll use this.
@@ -91,8 +117,26 @@ public:
 		return stagingBufferSize;
 	}
 
-	bool init(VkDevice device, VmaAllocator allocator, std::uint32_t transferQueueIndex, std::size_t transferQueueCount);
+	/**
+	 * Uploads through queueCount queues of the family, starting at firstQueue. Without a dedicated transfer queue these
+	 * may be queues of the graphics family, in which case the renderer has to hold getQueueLock for its own submits.
+	 */
+	bool init(VkDevice device, VmaAllocator allocator, std::uint32_t transferQueueIndex, std::uint32_t firstQueue, std::size_t transferQueueCount);
+	/** The lock guarding submits to the queue, if the uploader uses it as well */
+	[[nodiscard]] std::mutex* getQueueLock(VkQueue queue) const;
 	void destroy();
 
-	[[nodiscard]] std::unique_ptr<BufferUploadTask> uploadToBuffer(std::span<const std::byte> data, VkBuffer buffer);
+	/** Copies the data into the buffer, starting at the given offset */
+	[[nodiscard]] std::unique_ptr<BufferUploadTask> uploadToBuffer(std::span<const std::byte> data, VkBuffer buffer, VkDeviceSize offset = 0);
+
+	/**
+	 * Copies the mips into a dedicated staging buffer and submits the copy into the image. This never waits
+	 * on the GPU, so it is safe to call from any worker thread. mips[0] is written to mip level 0 of the image.
+	 */
+	void submitImageUpload(std::span<const std::span<const std::byte>> mips, VkImage image, VkExtent3D extent,
+						   VkImageLayout destinationLayout, std::size_t channelCount, PendingUpload& upload);
+	/** Copies the regions into a dedicated staging buffer and submits their copies with a single fence, like submitImageUpload */
+	void submitBufferUpload(std::span<const BufferUploadRegion> regions, PendingUpload& upload);
+	[[nodiscard]] bool isComplete(const PendingUpload& upload) const;
+	void destroy(PendingUpload& upload);
 };
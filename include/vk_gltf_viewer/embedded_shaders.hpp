@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace shaders {
+	/**
+	 * Returns the SPIR-V of the shader with the given file name, e.g. "main.frag.glsl". The shaders are
+	 * compiled and embedded into the executable at build time. Returns an empty span if there's no such shader.
+	 */
+	[[nodiscard]] std::span<const std::uint32_t> find(std::string_view name) noexcept;
+} // namespace shaders
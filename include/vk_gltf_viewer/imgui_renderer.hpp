@@ -1,5 +1,7 @@
 #pragma once
 
+#include <chrono>
+#include <memory>
 #include <vector>
 
 #include <glm/glm.hpp>
@@ -29,11 +31,16 @@ namespace imgui {
 		VkDeviceSize indexBufferSize = 0;
 	};
 
+	class ShaderLoadTask;
+	class PipelineBuildTask;
+
 	class Renderer final {
 		friend class ShaderLoadTask;
+		friend class PipelineBuildTask;
 
 		VkDevice device = VK_NULL_HANDLE;
 		VmaAllocator allocator = VK_NULL_HANDLE;
+		GLFWwindow* window = nullptr;
 
 		PushConstants pushConstants = {};
 		std::vector<PerFrameBuffers> buffers;
@@ -52,10 +59,16 @@ namespace imgui {
 		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
 		VkPipeline pipeline = VK_NULL_HANDLE;
 		VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
-		VkPipelineCache pipelineCache = VK_NULL_HANDLE;
 		VkShaderModule fragmentShader = VK_NULL_HANDLE;
 		VkShaderModule vertexShader = VK_NULL_HANDLE;
 
+		VkFormat swapchainImageFormat = VK_FORMAT_UNDEFINED;
+		VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+		std::shared_ptr<ShaderLoadTask> shaderLoadTask;
+		std::shared_ptr<PipelineBuildTask> pipelineBuildTask;
+		std::chrono::duration<double, std::milli> pipelineBuildTime {};
+
+		VkResult buildPipeline();
 		VkResult createGeometryBuffers(std::size_t index, VkDeviceSize vertexSize, VkDeviceSize indexSize);
 
 	public:
@@ -68,7 +81,17 @@ namespace imgui {
 		void createFontAtlas();
 		void destroy();
 		void draw(VkCommandBuffer commandBuffer, VkImageView swapchainImageView, glm::u32vec2 framebufferSize, std::size_t currentFrame);
-		auto init(VkDevice device, VmaAllocator allocator, GLFWwindow* window, VkFormat swapchainImageFormat) -> VkResult;
+		/**
+		 * Sets up the renderer, while the pipeline gets built in the background. The window may be null
+		 * when rendering headless, in which case the caller has to set the display size and delta time.
+		 */
+		auto init(VkDevice device, VmaAllocator allocator, GLFWwindow* window, VkFormat swapchainImageFormat, VkPipelineCache pipelineCache) -> VkResult;
+		/** Waits for the pipeline build started by init, and returns its result */
+		auto joinPipelineBuild() -> VkResult;
+		/** How long creating the pipeline took, once joinPipelineBuild has returned */
+		[[nodiscard]] auto getPipelineBuildTime() const noexcept {
+			return pipelineBuildTime;
+		}
 		auto initFrameData(std::uint32_t frameCount) -> VkResult;
 		void newFrame();
 	};
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include <TaskScheduler.h>
+
+struct io_uring;
+
+/** A blocking read or write. Once submitted to the I/O threads, other tasks can depend on it like on any other task. */
+class IoRequest : public enki::IPinnedTask {
+	void Execute() final;
+
+protected:
+	/** Performs the blocking I/O, and returns the number of bytes read or written */
+	virtual std::size_t execute() = 0;
+};
+
+/**
+ * Replaces the file through a temporary file, which is flushed to disk before the rename. The file therefore holds
+ * either its previous or its new contents, even after a crash or power loss. This blocks, so call it from an IoRequest.
+ */
+bool replaceFileDurably(const std::filesystem::path& path, std::span<const std::byte> data);
+
+/** Reads a file, or a range of it, into memory */
+class FileReadRequest final : public IoRequest {
+	friend class FileReadBatch;
+	std::size_t execute() override;
+
+public:
+	std::filesystem::path path;
+	std::uint64_t offset = 0;
+	std::optional<std::uint64_t> size; // Reads up to the end of the file if empty
+
+	std::vector<std::uint8_t> bytes;
+	bool succeeded = false;
+
+	/** Called on the I/O thread once the read has completed, whether it succeeded or not */
+	std::function<void(FileReadRequest&)> onRead;
+
+	FileReadRequest() = default;
+	explicit FileReadRequest(std::filesystem::path path, std::uint64_t offset = 0, std::optional<std::uint64_t> size = std::nullopt)
+			: path(std::move(path)), offset(offset), size(size) {}
+};
+
+/**
+ * Reads many files as one request. With io_uring, the reads of all files are in flight at once, up to the queue
+ * depth, and large files are split into several reads. Otherwise the files are read one after another.
+ * The onRead callback of each file is called as soon as that file has been read, in the order they complete.
+ */
+class FileReadBatch final : public IoRequest {
+	std::size_t execute() override;
+	std::size_t readWithRing(io_uring& ring, std::uint32_t depth);
+
+public:
+	static constexpr std::uint32_t readChunkSize = 1024 * 1024;
+
+	std::vector<FileReadRequest*> requests;
+};
+
+enum class IoBackend {
+	Blocking, // pread on POSIX systems, std::ifstream elsewhere
+	IoUring,
+};
+
+struct IoStatistics {
+	std::uint64_t requests = 0;
+	std::uint64_t bytes = 0;
+	std::chrono::duration<double, std::milli> waitTime {}; // Summed over every I/O thread
+	std::chrono::duration<double, std::milli> busyTime {}; // Wall time during which any I/O thread was busy
+
+	/** The read and write bandwidth while the I/O threads were busy, in MiB/s */
+	[[nodiscard]] double getBandwidth() const noexcept {
+		if (busyTime.count() <= 0.0)
+			return 0.0;
+		return static_cast<double>(bytes) / (1024.0 * 1024.0) / (busyTime.count() / 1000.0);
+	}
+};
+
+/**
+ * Dedicated enkiTS threads for blocking file I/O, so that the general workers never sit idle on slow storage.
+ * Each I/O thread runs a pinned task which sleeps until new pinned tasks arrive for its thread, and then runs
+ * them. The task scheduler has to be created with these threads on top of its compute threads.
+ */
+class IoThreads {
+	class LoopTask final : public enki::IPinnedTask {
+	public:
+		void Execute() override;
+	};
+
+	/** One io_uring per I/O thread, as the submission queue may only be used by one thread at a time */
+	struct Ring;
+
+	std::vector<LoopTask> loopTasks;
+	std::vector<std::unique_ptr<Ring>> rings;
+	IoBackend backend = IoBackend::Blocking;
+	std::uint32_t firstThread = 0;
+	std::uint32_t queueDepth = 0;
+	std::unique_ptr<std::atomic<std::uint32_t>[]> queuedRequests; // Per I/O thread
+	std::atomic<std::uint32_t> nextThread = 0;
+
+	std::atomic<std::uint64_t> requestCount = 0;
+	std::atomic<std::uint64_t> byteCount = 0;
+	std::atomic<std::int64_t> waitNanoseconds = 0;
+
+	mutable std::mutex busyMutex;
+	std::uint32_t busyThreads = 0;
+	std::chrono::steady_clock::time_point busyStart;
+	std::chrono::nanoseconds busyTime {};
+
+	friend class IoRequest;
+	friend class FileReadBatch;
+	std::chrono::steady_clock::time_point begin() noexcept;
+	void complete(std::uint32_t threadNum, std::chrono::steady_clock::time_point start, std::size_t bytes) noexcept;
+	[[nodiscard]] io_uring* getRing(std::uint32_t threadNum) const noexcept;
+	void dropRing(std::uint32_t threadNum) noexcept;
+
+public:
+	static constexpr std::uint32_t defaultThreadCount = 2;
+	static constexpr std::uint32_t defaultQueueDepth = 16;
+
+	IoThreads();
+	~IoThreads();
+
+	/** Whether this build can use io_uring at all. It may still be unavailable at runtime. */
+	[[nodiscard]] static bool isIoUringSupported() noexcept;
+
+	/**
+	 * Starts the I/O loops on the last threadCount threads of the task scheduler. With IoBackend::IoUring, every
+	 * I/O thread gets a ring with queueDepth entries, and we fall back to blocking reads if it can't be created.
+	 */
+	void start(std::uint32_t threadCount, std::uint32_t depth, IoBackend requestedBackend);
+
+	/**
+	 * Queues the request on the next I/O thread with room in its queue, going round-robin. While every thread
+	 * already has queueDepth requests queued, the caller runs other tasks until one of them completes.
+	 */
+	void submit(IoRequest* request);
+
+	/**
+	 * Reads the files in one batch per I/O thread, so that every thread keeps its reads in flight. The returned
+	 * batches have to be kept alive until they have completed, and the requests until their onRead was called.
+	 */
+	[[nodiscard]] std::vector<std::unique_ptr<FileReadBatch>> submitReads(std::span<FileReadRequest* const> reads);
+
+	/** The threads of the task scheduler which are not I/O threads, including the main thread */
+	[[nodiscard]] std::uint32_t getComputeThreadCount() const noexcept {
+		return firstThread;
+	}
+	[[nodiscard]] std::uint32_t getThreadCount() const noexcept {
+		return static_cast<std::uint32_t>(loopTasks.size());
+	}
+	[[nodiscard]] std::uint32_t getQueueDepth() const noexcept {
+		return queueDepth;
+	}
+	[[nodiscard]] IoBackend getBackend() const noexcept {
+		return backend;
+	}
+	[[nodiscard]] std::string_view getBackendName() const noexcept;
+	[[nodiscard]] IoStatistics getStatistics() const noexcept;
+};
+
+// See main.cpp for the declaration
+extern IoThreads ioThreads;
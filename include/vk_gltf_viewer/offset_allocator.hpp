@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+/**
+ * A two-level segregated fit (TLSF) allocator for ranges of a buffer. It only manages offsets and never
+ * touches the memory itself, so any buffer can be sub-allocated in any unit. Allocating and freeing are
+ * O(1): the first level splits the sizes into powers of two, the second level splits each of those into
+ * eight linear bins. Freed ranges are merged with their free neighbours right away.
+ */
+class OffsetAllocator {
+public:
+	static constexpr std::uint32_t invalidIndex = std::numeric_limits<std::uint32_t>::max();
+
+	struct Allocation {
+		std::uint32_t offset = invalidIndex;
+		std::uint32_t node = invalidIndex; // Used to free the allocation again
+
+		[[nodiscard]] bool isValid() const noexcept {
+			return node != invalidIndex;
+		}
+	};
+
+private:
+	static constexpr std::uint32_t secondLevelBits = 3;
+	static constexpr std::uint32_t secondLevelCount = 1U << secondLevelBits;
+	static constexpr std::uint32_t firstLevelCount = 32;
+	static constexpr std::uint32_t binCount = firstLevelCount * secondLevelCount;
+
+	struct Node {
+		std::uint32_t offset = 0;
+		std::uint32_t size = 0;
+		std::uint32_t previousNeighbour = invalidIndex; // The adjacent ranges, used or not
+		std::uint32_t nextNeighbour = invalidIndex;
+		std::uint32_t previousFree = invalidIndex; // The other free ranges in the same bin
+		std::uint32_t nextFree = invalidIndex;
+		bool used = false;
+	};
+
+	std::uint32_t size = 0;
+	std::uint32_t freeSize = 0;
+	std::uint32_t allocationCount = 0;
+
+	std::uint32_t firstLevelBitmap = 0;
+	std::array<std::uint8_t, firstLevelCount> secondLevelBitmaps {};
+	std::array<std::uint32_t, binCount> binHeads {};
+
+	std::vector<Node> nodes;
+	std::vector<std::uint32_t> unusedNodes;
+
+	std::uint32_t createNode(std::uint32_t offset, std::uint32_t nodeSize);
+	void insertFreeNode(std::uint32_t nodeIndex);
+	void removeFreeNode(std::uint32_t nodeIndex);
+
+public:
+	OffsetAllocator() = default;
+	explicit OffsetAllocator(std::uint32_t size);
+
+	/** Resets the allocator to a single free range of the given size */
+	void reset(std::uint32_t size);
+
+	/** Returns an invalid allocation if there's no free range large enough */
+	[[nodiscard]] Allocation allocate(std::uint32_t allocationSize);
+	void free(Allocation allocation);
+
+	[[nodiscard]] std::uint32_t getSize() const noexcept {
+		return size;
+	}
+	[[nodiscard]] std::uint32_t getFreeSize() const noexcept {
+		return freeSize;
+	}
+	[[nodiscard]] std::uint32_t getAllocationCount() const noexcept {
+		return allocationCount;
+	}
+	/** The size of the range an allocation is guaranteed to fit into, which is at most the largest free range */
+	[[nodiscard]] std::uint32_t getLargestFreeRange() const noexcept;
+	[[nodiscard]] std::uint32_t getAllocationSize(Allocation allocation) const noexcept {
+		return nodes[allocation.node].size;
+	}
+};
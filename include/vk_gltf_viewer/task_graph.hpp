@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <TaskScheduler.h>
+
+/**
+ * A graph of enkiTS tasks, built from steps which declare the resources they read and write. A step depends
+ * on the last step writing any of its inputs, and a step writing a resource additionally waits for the steps
+ * reading its previous contents, so the order in which steps are added only matters for shared resources.
+ * Every step is timed, which lets us print the chain of steps bounding the total time of the graph.
+ */
+class TaskGraph {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	enum class Thread {
+		Any,
+		Main, // The thread calling run(), for APIs like GLFW which have to be called from the main thread
+	};
+
+private:
+	struct Node;
+
+	class NodeTask final : public enki::ITaskSet {
+		Node& node;
+	public:
+		explicit NodeTask(Node& node) noexcept : node(node) {}
+		void ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) override;
+	};
+
+	class PinnedNodeTask final : public enki::IPinnedTask {
+		Node& node;
+	public:
+		explicit PinnedNodeTask(Node& node) noexcept : node(node) {}
+		void Execute() override;
+	};
+
+	struct Node {
+		TaskGraph& graph;
+		std::string name;
+		std::function<void()> function;
+		Thread thread;
+
+		std::vector<std::size_t> dependencies;
+		std::vector<enki::Dependency> taskDependencies;
+		std::unique_ptr<enki::ITaskSet> task;
+		std::unique_ptr<enki::IPinnedTask> pinnedTask;
+
+		Clock::time_point start;
+		Clock::time_point end;
+		std::exception_ptr exception;
+
+		void execute();
+		[[nodiscard]] enki::ICompletable* getTask() const noexcept;
+	};
+
+	struct Resource {
+		std::size_t writer;
+		std::vector<std::size_t> readers;
+	};
+
+	std::vector<std::unique_ptr<Node>> nodes;
+	std::unordered_map<std::string, Resource> resources;
+	Clock::time_point startTime;
+	std::atomic<bool> failed = false;
+
+public:
+	/** Throws if any input has not been written by a previously added step */
+	void add(std::string name, std::initializer_list<std::string_view> inputs, std::initializer_list<std::string_view> outputs,
+			 std::function<void()> function, Thread thread = Thread::Any);
+
+	/**
+	 * Runs every step and waits for all of them. Once a step has thrown, the steps which have not started yet
+	 * are skipped, and the exception of the first failed step in the order they were added is rethrown.
+	 */
+	void run();
+
+	/** Prints the steps which bounded the total time of the last run, with their durations */
+	void printCriticalPath() const;
+};
@@ -1,11 +1,19 @@
 #pragma once
 
+#include <array>
+#include <chrono>
 #include <deque>
+#include <mutex>
+#include <optional>
 #include <ranges>
+#include <span>
+#include <utility>
 #include <vector>
 
 #include <vulkan/vk.hpp>
 #include <vulkan/vma.hpp>
+#include <vulkan/gpu_profiler.hpp>
+#include <vulkan/deferred_destruction.hpp>
 #include <VkBootstrap.h>
 
 #include <TaskScheduler.h>
@@ -21,6 +29,8 @@
 #include <fastgltf/types.hpp>
 
 #include <vk_gltf_viewer/imgui_renderer.hpp>
+#include <vk_gltf_viewer/io_threads.hpp>
+#include <vk_gltf_viewer/offset_allocator.hpp>
 
 extern enki::TaskScheduler taskScheduler;
 
@@ -35,21 +45,58 @@ struct FrameCommandPools {
     std::vector<VkCommandBuffer> commandBuffers;
 };
 
-static constexpr const std::size_t frameOverlap = 2;
+// The number of frames in flight, which --frames-in-flight overrides. The descriptor pool has room for up to maxFrameOverlap.
+static constexpr const std::size_t defaultFrameOverlap = 2;
+static constexpr const std::size_t maxFrameOverlap = 4;
 
 class FileLoadTask;
+struct ImageLoadJob;
+struct MeshLoadJob;
+struct CompressedBufferDataAdapter;
+struct ShaderModuleLoadTask;
+struct PipelineBuildTask;
 
 struct PerFrameCameraBuffer {
 	VkBuffer handle;
 	VmaAllocation allocation;
 
+	// The culling counters written by the task shader, bound next to the camera buffer
+	VkBuffer cullingStatsHandle;
+	VmaAllocation cullingStatsAllocation;
+
 	VkDescriptorSet cameraSet;
 };
 
+/** The counters written by main.task.glsl, which have to match the CullingStatsBuffer block */
+struct CullingStats {
+	std::uint32_t meshletsTested;
+	std::uint32_t meshletsEmitted;
+	std::array<std::uint32_t, 6> frustumRejections; // Left, right, bottom, top, near, far
+	std::uint32_t lodRejections; // Clusters of a level which is too fine or too coarse for their distance
+	std::uint32_t instanceRejections; // Instances whose whole primitive is outside of the frustum
+};
+
+/**
+ * The pipeline statistics of the meshlet passes. The members are in the order of their
+ * VkQueryPipelineStatisticFlagBits, which is the order in which Vulkan writes them.
+ */
+struct PipelineStatistics {
+	std::uint64_t clippingInvocations;
+	std::uint64_t clippingPrimitives;
+	std::uint64_t fragmentShaderInvocations;
+	std::uint64_t taskShaderInvocations;
+	std::uint64_t meshShaderInvocations;
+};
+
 struct Camera {
 	glm::mat4 viewProjectionMatrix;
 
 	std::array<glm::vec4, 6> frustum;
+
+	// The position the cluster LOD errors are measured from, and the factor which turns an error at a distance
+	// of 1 into a multiple of the error threshold. Both are frozen together with the frustum.
+	glm::vec3 lodOrigin;
+	float lodErrorScale;
 };
 
 struct CameraMovement {
@@ -66,6 +113,16 @@ struct CameraMovement {
 	float speedMultiplier = 2.0f;
 };
 
+/**
+ * The camera of a single frame in a recorded camera path. This is either the free camera, or a glTF camera
+ * from cameraNodes, in which case only its index is stored.
+ */
+struct CameraPathFrame {
+	glm::vec3 position = glm::vec3(0.0f);
+	glm::vec3 direction = glm::vec3(0.0f, 0.0f, -1.0f);
+	fastgltf::Optional<std::size_t> cameraIndex;
+};
+
 struct Vertex {
 	glm::vec4 position;
 	glm::vec4 color;
@@ -77,53 +134,302 @@ struct Meshlet {
 
 	glm::vec3 aabbExtents;
 	glm::vec3 aabbCenter;
+
+	// The bounding sphere and simplification error of the group this cluster was simplified from, and of the
+	// group it was merged into for the next coarser level. A cluster is drawn when its own error projects below
+	// the threshold, but its parent's does not. Clusters of the coarsest level have an infinite parent error.
+	glm::vec4 lodBounds;
+	glm::vec4 parentLodBounds;
+	float lodError;
+	float parentLodError;
+};
+
+/**
+ * The buffers of a geometry shard in which each primitive allocates a range. The vertex shading path additionally
+ * has a buffer of 32-bit indices, which shares the ranges of the triangle indices.
+ */
+enum class GeometryRange : std::uint32_t {
+	Meshlets = 0,
+	VertexIndices = 1,
+	TriangleIndices = 2,
+	Vertices = 3,
+};
+static constexpr std::size_t geometryRangeCount = 4;
+static constexpr std::array<VkDeviceSize, geometryRangeCount> geometryElementSizes {{
+	sizeof(Meshlet), sizeof(unsigned int), sizeof(unsigned char), sizeof(Vertex),
+}};
+
+/** The ranges of a primitive's data within the buffers of its geometry shard, in elements */
+struct GeometryAllocation {
+	std::uint32_t shardIndex = 0;
+	std::array<OffsetAllocator::Allocation, geometryRangeCount> ranges {};
+	std::array<std::uint32_t, geometryRangeCount> counts {};
+
+	/** Empty ranges are never allocated, and start at zero */
+	[[nodiscard]] std::uint32_t getOffset(GeometryRange range) const noexcept {
+		const auto& allocation = ranges[static_cast<std::size_t>(range)];
+		return allocation.isValid() ? allocation.offset : 0;
+	}
 };
 
 struct Primitive {
-	std::uint32_t descOffset;
-	std::uint32_t vertexIndicesOffset;
-	std::uint32_t triangleIndicesOffset;
-	std::uint32_t verticesOffset;
+	GeometryAllocation geometry; // Only valid while the mesh is resident
 
-	std::size_t meshlet_count;
+	std::size_t meshlet_count; // The clusters of every LOD level
 	std::uint32_t materialIndex;
+	std::size_t finestLevelMeshletCount; // The clusters of the finest LOD level come first
+	std::uint32_t primitiveIndex; // The index of the primitive's record in the primitive buffer
+
+	glm::vec3 aabbCenter; // The bounds of every meshlet, used to cull whole instances
+	glm::vec3 aabbExtents;
 };
 
 struct Mesh {
 	std::vector<Primitive> primitives;
+
+	// Whether the geometry is in the geometry heap. Nodes referencing a mesh which isn't resident are not drawn.
+	bool resident = false;
+	bool loading = false; // Whether a MeshLoadJob is building or uploading the geometry
+
+	glm::vec4 boundingSphere; // In the mesh's space, for the MSFT_lod screen coverage
+	std::size_t triangleCount; // Of every primitive at full resolution
 };
 
-struct MeshBuffers {
-	VkBuffer descHandle = VK_NULL_HANDLE;
-	VmaAllocation descAllocation = VK_NULL_HANDLE;
+/**
+ * The discrete levels of detail of a node from MSFT_lod, where level 0 is the node's own mesh. A level is drawn
+ * while the node's screen coverage is at least its minimum coverage. Levels without a minimum coverage are
+ * drawn down to a coverage of zero, while a minimum for the last level culls the node below it.
+ */
+struct NodeLods {
+	std::vector<std::size_t> meshIndices;
+	std::vector<float> minScreenCoverages;
+
+	// The level of the previous frame, which the hysteresis depends on. Shared by every instance of the node.
+	std::size_t currentLevel = 0;
+};
+
+/**
+ * The range of a node's instances in the instance transform buffer. Nodes without EXT_mesh_gpu_instancing
+ * use the single identity transform at index 0.
+ */
+struct NodeInstances {
+	std::uint32_t offset = 0;
+	std::uint32_t count = 1;
+
+	bool operator==(const NodeInstances&) const = default;
+};
+
+/** The triangles of the meshes drawn this frame, before any meshlet culling */
+struct DiscreteLodStats {
+	std::uint64_t drawnTriangles;
+	std::uint64_t fullDetailTriangles; // If every node used its finest MSFT_lod level
+	std::uint32_t culledNodes;
+};
+
+/** The geometry of a shard while it is being built, before it is uploaded */
+struct GeometryShardData {
+	std::vector<Meshlet> meshlets;
+	std::vector<unsigned int> meshletVertices;
+	std::vector<unsigned char> meshletTriangles;
+	std::vector<std::uint32_t> meshletIndices;
+	std::vector<Vertex> vertices;
 
-	VkBuffer vertexIndiciesHandle = VK_NULL_HANDLE;
-	VmaAllocation vertexIndiciesAllocation = VK_NULL_HANDLE;
+	// The mesh and primitive index of every primitive in the data, in order
+	std::vector<std::pair<std::size_t, std::size_t>> primitives;
+};
 
-	VkBuffer triangleIndicesHandle = VK_NULL_HANDLE;
-	VmaAllocation triangleIndicesAllocation = VK_NULL_HANDLE;
+struct GeometryBuffer {
+	VkBuffer handle = VK_NULL_HANDLE;
+	VmaAllocation allocation = VK_NULL_HANDLE;
+	VkDeviceAddress address = 0;
+};
 
-	VkBuffer verticesHandle = VK_NULL_HANDLE;
-	VmaAllocation verticesAllocation = VK_NULL_HANDLE;
+/**
+ * A page of the geometry heap, with its own buffers. When loading the scene, primitives are packed into a shard
+ * until one of its buffers would grow beyond the shard size limit, so that no single buffer or allocation has
+ * to hold the geometry of the entire scene. Each buffer keeps some free space for meshes loaded at runtime,
+ * which allocate their ranges through the shard's offset allocators. The shaders address the data through
+ * the primitive records.
+ */
+struct GeometryShard {
+	std::array<GeometryBuffer, geometryRangeCount> buffers;
+	std::array<OffsetAllocator, geometryRangeCount> allocators; // In elements of each buffer
+
+	// The meshlet triangles resolved to vertex indices, only used by the vertex shading path
+	GeometryBuffer meshletIndices;
+
+	VkDeviceSize byteSize = 0; // The capacity of every buffer combined
+	bool evacuating = false; // Compaction moves the primitives out, and destroys the shard once its last range is released
+
+	[[nodiscard]] bool isLive() const noexcept {
+		return buffers[0].handle != VK_NULL_HANDLE;
+	}
+};
+
+/** A range of geometry moved between two shards by compaction, which is copied at the start of the next frame */
+struct GeometryCopy {
+	VkBuffer source;
+	VkBuffer destination;
+	VkBufferCopy region;
+};
+
+struct MeshBuffers {
+	// Shards destroyed by compaction keep their index with null handles, and are reused for new shards
+	std::vector<GeometryShard> shards;
+
+	// The transforms of every EXT_mesh_gpu_instancing instance, relative to their node
+	VkBuffer instancesHandle = VK_NULL_HANDLE;
+	VmaAllocation instancesAllocation = VK_NULL_HANDLE;
+
+	// The PrimitiveRecord of every primitive
+	VkBuffer primitivesHandle = VK_NULL_HANDLE;
+	VmaAllocation primitivesAllocation = VK_NULL_HANDLE;
 
 	std::vector<VkDescriptorSet> descriptors;
 };
 
-struct PrimitiveDraw {
-	VkDrawMeshTasksIndirectCommandEXT command;
+/**
+ * A node drawing a mesh this frame. These are collected while walking the scene, and then grouped by their
+ * mesh, so that every primitive of a mesh is drawn once for all nodes referencing it.
+ */
+struct MeshReference {
+	std::uint32_t meshIndex;
+	std::uint32_t nodeIndex;
+	NodeInstances instances;
 
-	// The matrix from the glTF is technically per-mesh, but we define it for each primitive.
-	// We could optimise this slightly, but there's many models where each mesh has only one primitive.
-	glm::mat4x4 modelMatrix;
+	bool operator==(const MeshReference&) const = default;
+};
 
-	// TODO: Switch these to VkDeviceSize/uint64_t
-	std::uint32_t descOffset;
-	std::uint32_t vertexIndicesOffset;
-	std::uint32_t triangleIndicesOffset;
-	std::uint32_t verticesOffset;
+/** A single instance of a draw, which has to match the DrawInstance struct in instancing.glsl.h */
+struct DrawInstance {
+	std::uint32_t nodeIndex; // The index into the node transforms
+	std::uint32_t instanceIndex; // The index into the EXT_mesh_gpu_instancing transforms
+};
+
+/** The affine world transform of a node, stored as the first three rows of its matrix */
+struct NodeTransform {
+	std::array<glm::vec4, 3> rows;
+};
+
+/** The time from sampling the input of a frame in flight until its fence was observed as signaled */
+struct FrameLatency {
+	std::uint64_t frameNumber = 0; // Zero if the slot has not been used yet
+	std::chrono::steady_clock::time_point inputTime;
+	std::optional<double> latencyMs;
+};
+
+struct FrameLatencyStats {
+	static constexpr std::size_t historySize = 64;
+	std::array<double, historySize> history = {};
+	std::size_t sampleCount = 0;
+	double lastMs = 0.0;
+	double averageMs = 0.0; // Over the last historySize frames
+};
+
+/** The size and CPU build time of the draw list of the last frame */
+struct DrawListStats {
+	std::uint32_t drawCount;
+	std::uint64_t instanceCount;
+	VkDeviceSize indirectBytes; // The primitive draws
+	VkDeviceSize instanceBytes; // The draw instances and the node transforms
+	VkDeviceSize uploadBytes; // Everything written to the frame's buffers, which is zero for a static scene
+	double buildMs;
+};
+
+/**
+ * The static data of a primitive, which is uploaded once together with the meshlets. This has to match
+ * the Primitive struct in mesh_common.glsl.h.
+ */
+struct PrimitiveRecord {
+	// The device addresses of the primitive's data within its shard
+	VkDeviceAddress meshlets;
+	VkDeviceAddress vertexIndices;
+	VkDeviceAddress triangleIndices;
+	VkDeviceAddress vertices;
+
+	// The vertex shading path binds the index buffer of the shard, in which the primitive's indices start at firstIndex
+	std::uint32_t shardIndex;
+	std::uint32_t firstIndex;
 
 	std::uint32_t meshletCount;
 	std::uint32_t materialIndex;
+
+	glm::vec3 aabbCenter;
+	glm::vec3 aabbExtents;
+	std::uint32_t finestMeshletCount; // Only used by the AABB visualization
+	std::uint32_t padding; // The scalar layout aligns the records to the addresses
+};
+static_assert(sizeof(PrimitiveRecord) == 80);
+
+struct PrimitiveDraw {
+	VkDrawMeshTasksIndirectCommandEXT command;
+
+	std::uint32_t primitiveIndex; // The index into the primitive buffer
+
+	// The range of draw instances, each of which is culled on its own. The task shader handles one instance
+	// per workgroup in the y dimension, while the vertex shading path has one meshlet draw per instance.
+	std::uint32_t instanceOffset;
+	std::uint32_t instanceCount;
+
+	// The index of the first meshlet draw of this primitive, only used by the vertex shading path
+	std::uint32_t meshletDrawOffset;
+};
+
+/**
+ * The variants of the mesh pipeline, one for each glTF alpha mode. The value is passed to the fragment
+ * shader as a specialization constant, and the draws are recorded in this order.
+ */
+enum class MaterialPass : std::uint32_t {
+	Opaque = 0,
+	Mask = 1,
+	Blend = 2,
+};
+static constexpr std::size_t materialPassCount = 3;
+
+/**
+ * How the meshlets get drawn. Vertex shading culls the meshlets in a compute pass and draws each of
+ * them with vkCmdDrawIndexedIndirect, which works on devices without VK_EXT_mesh_shader.
+ */
+enum class RenderPath {
+	MeshShading,
+	VertexShading,
+};
+
+/** The geometry limits of a single meshlet, and the workgroup size of the mesh shader processing it */
+struct MeshletLimits {
+	std::uint32_t maxVertices = 64;
+	std::uint32_t maxTriangles = 124; // meshopt requires a multiple of 4
+	std::uint32_t meshWorkgroupSize = 32;
+};
+
+/**
+ * The vertex and triangle limits main.mesh.glsl is compiled for, as its output limits can't be specialization
+ * constants. This has to match MESHLET_LIMIT_VARIANTS in CMakeLists.txt.
+ */
+static constexpr std::array<std::pair<std::uint32_t, std::uint32_t>, 4> meshletLimitVariants {{
+	{ 64, 64 }, { 64, 124 }, { 128, 124 }, { 128, 252 },
+}};
+/** The workgroup sizes of the mesh shader, which is a specialization constant */
+static constexpr std::array<std::uint32_t, 3> meshWorkgroupSizes {{ 32, 64, 128 }};
+
+/** A range of draws within the indirect draw buffer, or of instances within the draw instance buffer */
+struct DrawRange {
+	std::uint32_t offset;
+	std::uint32_t count;
+};
+
+/**
+ * The meshlet draws of the vertex shading path which use the index buffer of the same geometry shard.
+ * Each material pass is split into one batch per shard it draws from.
+ */
+struct MeshletDrawBatch {
+	std::uint32_t shardIndex;
+	DrawRange draws;
+};
+
+/** Pushed before each indirect draw, as gl_DrawID restarts at zero for every draw call */
+struct MeshPushConstants {
+	std::uint32_t drawIdOffset;
 };
 
 struct FrameDrawCommandBuffers {
@@ -135,7 +441,49 @@ struct FrameDrawCommandBuffers {
 	VmaAllocation aabbDrawAllocation;
 	VkDeviceSize aabbDrawBufferSize;
 
+	// The instances of every draw, and the world transforms of every node
+	VkBuffer drawInstanceHandle;
+	VmaAllocation drawInstanceAllocation;
+	VkDeviceSize drawInstanceBufferSize;
+
+	VkBuffer transformHandle;
+	VmaAllocation transformAllocation;
+	VkDeviceSize transformBufferSize;
+
+	// The draws are only uploaded if this differs from the version of the DrawList, and the
+	// transforms only for the nodes which changed since this frame's buffers were last used.
+	std::uint64_t drawListVersion;
+	std::vector<std::uint32_t> dirtyTransforms;
+
 	std::uint32_t drawCount;
+	std::array<DrawRange, materialPassCount> passDraws;
+	std::uint64_t meshletCount; // The number of meshlets of every draw and instance, before culling
+
+	// One indexed draw per meshlet, written by the meshlet cull pass of the vertex shading path
+	VkBuffer meshletDrawHandle;
+	VmaAllocation meshletDrawAllocation;
+	VkDeviceSize meshletDrawBufferSize;
+	std::array<std::vector<MeshletDrawBatch>, materialPassCount> passMeshletDraws;
+	std::uint32_t maxDrawMeshletCount; // The most meshlets of all instances of a draw, which sizes the cull dispatch
+};
+
+/**
+ * The draws of every referenced mesh, which are only rebuilt when the meshes the nodes reference change.
+ * Each frame in flight uploads every version once.
+ */
+struct DrawList {
+	std::vector<MeshReference> references;
+	std::vector<PrimitiveDraw> draws; // Ordered by material pass
+	std::vector<VkDrawIndirectCommand> aabbDraws;
+	std::vector<DrawInstance> instances;
+
+	std::array<DrawRange, materialPassCount> passDraws;
+	std::array<std::vector<MeshletDrawBatch>, materialPassCount> passMeshletDraws;
+	std::uint64_t meshletCount = 0;
+	std::uint32_t maxDrawMeshletCount = 0;
+
+	std::uint64_t version = 0;
+	bool stale = false; // Set when primitives move to another shard, which the meshlet draw batches depend on
 };
 
 struct Material {
@@ -152,13 +500,121 @@ struct SampledImage {
 	VkImageView imageView = VK_NULL_HANDLE;
 };
 
+/** Tracks which mips of a glTF image are currently resident in VRAM */
+struct ImageResidency {
+	VkExtent2D extent = {};
+	std::uint32_t mipLevels = 1;
+	std::uint32_t droppedMips = 0; // The number of top-level mips which are currently not resident
+	VkDeviceSize residentBytes = 0;
+	std::uint64_t lastUsedFrame = 0;
+	bool changePending = false;
+};
+
+struct ImageLoadStats {
+	std::chrono::steady_clock::time_point startTime;
+	std::chrono::nanoseconds taskTime {}; // Spent in the decode, submit and view tasks of the initial loads
+	std::size_t remaining = 0; // The number of images which haven't been loaded for the first time yet
+	std::chrono::duration<double, std::milli> loadTime {}; // Set once every image has been loaded
+};
+
+struct TextureResidencyStats {
+	VkDeviceSize budget = 0;
+	VkDeviceSize usage = 0;
+	VkDeviceSize residentBytes = 0;
+	std::size_t evictions = 0;
+	std::size_t restores = 0;
+};
+
+/**
+ * Hands out indices into the bindless texture array of the material descriptor set. Freed slots
+ * are only handed out again once every frame that could still be reading them has retired, as
+ * we'd otherwise overwrite a descriptor which is still in use by the GPU.
+ */
+class TextureSlotTable {
+	std::uint32_t capacity = 0;
+	std::uint32_t highWatermark = 0;
+	std::vector<std::uint32_t> freeSlots;
+	std::deque<std::pair<std::uint64_t, std::uint32_t>> retiredSlots;
+
+public:
+	void init(std::uint32_t newCapacity) {
+		capacity = newCapacity;
+		highWatermark = 0;
+		freeSlots.clear();
+		retiredSlots.clear();
+	}
+
+	[[nodiscard]] std::uint32_t getCapacity() const noexcept {
+		return capacity;
+	}
+
+	[[nodiscard]] std::uint32_t getUsedCount() const noexcept {
+		return highWatermark - static_cast<std::uint32_t>(freeSlots.size() + retiredSlots.size());
+	}
+
+	[[nodiscard]] std::optional<std::uint32_t> allocate() {
+		if (!freeSlots.empty()) {
+			auto slot = freeSlots.back();
+			freeSlots.pop_back();
+			return slot;
+		}
+		if (highWatermark < capacity) {
+			return highWatermark++;
+		}
+		return std::nullopt;
+	}
+
+	/** Releases the slot. frameNumber is the last frame which might still reference the slot. */
+	void free(std::uint32_t slot, std::uint64_t frameNumber) {
+		retiredSlots.emplace_back(frameNumber, slot);
+	}
+
+	/** Moves every slot last used in or before completedFrame back into the free list. */
+	void recycle(std::uint64_t completedFrame) {
+		while (!retiredSlots.empty() && retiredSlots.front().first <= completedFrame) {
+			freeSlots.emplace_back(retiredSlots.front().second);
+			retiredSlots.pop_front();
+		}
+	}
+};
+
 struct Viewer {
     vkb::Instance instance;
     vkb::Device device;
 	VmaAllocator allocator = VK_NULL_HANDLE;
 	TracyVkCtx tracyCtx = nullptr;
+	vk::GpuProfiler gpuProfiler;
+	std::string gpuProfilerCsvPath = "gpu_timings.csv";
+
+	// Pipeline statistics and culling counters of the last completed frame. The statistics are
+	// optional, and pipelineStatisticsFlags is 0 if the device doesn't support them.
+	VkQueryPipelineStatisticFlags pipelineStatisticsFlags = 0;
+	std::vector<VkQueryPool> pipelineStatisticsPools;
+	PipelineStatistics pipelineStatistics = {};
+	CullingStats cullingStats = {};
 
     VkQueue graphicsQueue = VK_NULL_HANDLE;
+	std::mutex* graphicsQueueLock = nullptr; // Set if the BufferUploader submits to the graphics queue as well
+
+	// Mesh shading is used whenever the device supports it, unless a render path is forced
+	std::optional<RenderPath> forcedRenderPath;
+	RenderPath renderPath = RenderPath::MeshShading;
+	VkShaderStageFlags meshletShaderStages = 0; // Task & mesh, or vertex & compute for the vertex shading path
+	VkPhysicalDeviceMeshShaderPropertiesEXT meshShaderProperties = {}; // Only queried for the mesh shading path
+
+	// The defaults are chosen from meshShaderProperties, and can be swept with --sweep-meshlet-limits
+	MeshletLimits meshletLimits;
+
+	// The largest buffer of a geometry shard, which is at most the device's maxBufferSize and maxMemoryAllocationSize
+	static constexpr VkDeviceSize defaultMaxShardSize = 1ULL << 30;
+	std::optional<VkDeviceSize> forcedMaxShardSize; // From --max-shard-size
+	VkDeviceSize maxShardSize = defaultMaxShardSize;
+	VkDeviceSize maxGeometryBufferSize = defaultMaxShardSize; // The device limit, which a single primitive may not exceed
+
+	// Shards created for meshes loaded at runtime are at least this large, and leave room for more meshes
+	static constexpr VkDeviceSize minRuntimeShardSize = 16ULL << 20;
+	// Compaction evacuates the shards which are less than this full
+	static constexpr double compactionThreshold = 0.5;
 
     GLFWwindow* window = nullptr;
     VkSurfaceKHR surface = VK_NULL_HANDLE;
@@ -167,29 +623,68 @@ struct Viewer {
     std::vector<VkImageView> swapchainImageViews;
     bool swapchainNeedsRebuild = false;
 
+	// In headless mode, there is no window or swapchain. Instead, swapchainImages holds offscreen images.
+	bool headless = false;
+	static constexpr VkFormat offscreenImageFormat = VK_FORMAT_R8G8B8A8_SRGB;
+	std::vector<VmaAllocation> offscreenImageAllocations;
+
 	VkImage depthImage = VK_NULL_HANDLE;
 	VmaAllocation depthImageAllocation = VK_NULL_HANDLE;
 	VkImageView depthImageView = VK_NULL_HANDLE;
 
+	std::size_t frameOverlap = defaultFrameOverlap; // The size of every per-frame array
     std::vector<FrameSyncData> frameSyncData;
     std::vector<FrameCommandPools> frameCommandPools;
 
 	std::vector<PerFrameCameraBuffer> cameraBuffers;
 	float lastFrame = 0.0f;
 	float deltaTime = 0.0f;
+	std::uint64_t frameNumber = 0; // Monotonically increasing, unlike the index into the per-frame arrays
+	std::chrono::steady_clock::time_point inputTime; // When the input of the next frame was sampled
+	std::vector<FrameLatency> frameLatencies; // Indexed like the per-frame arrays
+	FrameLatencyStats latencyStats;
 	CameraMovement movement;
+	std::vector<CameraPathFrame> recordedCameraPath;
 
 	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
 	VkDescriptorSetLayout cameraSetLayout = VK_NULL_HANDLE;
 
+	// Shared by every pipeline, and persisted to disk between runs
+	VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+	bool pipelineCacheWarm = false;
+
+	// Shader loads and pipeline builds which run in the background during startup
+	std::vector<std::shared_ptr<ShaderModuleLoadTask>> shaderLoadTasks;
+	std::vector<std::shared_ptr<PipelineBuildTask>> pipelineBuildTasks;
+
     VkPipelineLayout meshPipelineLayout = VK_NULL_HANDLE;
-    VkPipeline meshPipeline = VK_NULL_HANDLE;
+	std::array<VkPipeline, materialPassCount> meshPipelines = {};
+
+	// The pipelines of the vertex shading path, which share the mesh pipeline layout
+	VkPipeline meshletCullPipeline = VK_NULL_HANDLE;
+	std::array<VkPipeline, materialPassCount> vertexPipelines = {};
 
 	VkPipeline aabbVisualizingPipeline = VK_NULL_HANDLE;
 	bool enableAabbVisualization = false;
 	bool freezeCameraFrustum = false;
+	float lodErrorThreshold = 1.0f; // The projected cluster error in pixels. Zero always draws the finest level.
+
+	// MSFT_lod levels, indexed by node. Nodes without levels of detail have no mesh indices.
+	std::vector<NodeLods> nodeLods;
+	float lodHysteresis = 0.1f; // The relative margin around each coverage threshold before switching levels
+	DiscreteLodStats discreteLodStats = {};
+	DrawListStats drawListStats = {};
+	double drawListBuildMs = 0.0; // The time updateDrawList took for the next frame
+
+	// The camera of the next frame, which is copied into the frame's camera buffer once the frame's fence has been waited on
+	Camera frameCamera = {};
+
+	// The camera which the levels of detail are selected for, frozen together with the frustum
+	glm::vec3 lodOrigin = glm::vec3(0.0f);
+	float lodProjectionScale = 1.0f;
 
     fastgltf::Asset asset {};
+	std::filesystem::path assetDirectory; // External buffers and images are relative to this
     std::vector<std::shared_ptr<FileLoadTask>> fileLoadTasks;
 
 	// The mesh data required for rendering the meshlets
@@ -197,19 +692,57 @@ struct Viewer {
 	VkDescriptorSetLayout meshletSetLayout = VK_NULL_HANDLE;
 	std::vector<Mesh> meshes;
 	MeshBuffers globalMeshBuffers;
+	std::vector<NodeInstances> nodeInstances; // Indexed by node
+	std::vector<PrimitiveRecord> primitiveRecords; // A copy of the primitive buffer
+	std::shared_ptr<CompressedBufferDataAdapter> bufferAdapter; // Kept to load meshes again at runtime
+
+	// The geometry heap. Freed ranges are only released once the last frame which could read them has retired,
+	// while the copies of compaction and the records of moved primitives are written at the start of the next frame.
+	std::deque<std::pair<std::uint64_t, GeometryAllocation>> retiredGeometry;
+	std::vector<GeometryCopy> pendingGeometryCopies;
+	std::vector<std::uint32_t> pendingRecordWrites; // Indices into primitiveRecords
+	std::vector<std::shared_ptr<MeshLoadJob>> meshLoadJobs;
+	int selectedMeshIndex = 0; // The mesh loaded or unloaded from the UI
+	std::vector<glm::mat4> nodeTransforms; // The world transform of each node, as last uploaded
+	DrawList drawList;
 
 	// TODO: Differentiate between numDefaultTextures and numDefaultImages?
 	static constexpr std::size_t numDefaultTextures = 1;
 	static constexpr std::size_t numDefaultMaterials = 1;
 	static constexpr std::size_t numDefaultSamplers = 1;
 
+	// Upper bound for the bindless texture array. The actual size is additionally limited by the device.
+	static constexpr std::uint32_t maxBindlessTextures = 16384;
+
 	// Image/material data
+	VkDescriptorPool materialDescriptorPool = VK_NULL_HANDLE;
 	VkDescriptorSetLayout materialSetLayout = VK_NULL_HANDLE;
 	VkDescriptorSet materialSet = VK_NULL_HANDLE;
+	TextureSlotTable textureSlots;
+	std::vector<std::uint32_t> gltfTextureSlots; // Maps each glTF texture index to its slot in the bindless array
 	std::vector<VkSampler> samplers;
 	std::vector<SampledImage> images;
 	VkBuffer materialBuffer = VK_NULL_HANDLE;
 	VmaAllocation materialAllocation = VK_NULL_HANDLE;
+	std::vector<Material> materialData; // Copied into the material buffer by the next recorded frame if materialsDirty is set
+	bool materialsDirty = false;
+	std::vector<std::optional<std::size_t>> materialImages; // The index into images used by each material
+	std::vector<MaterialPass> materialPasses; // The pipeline variant used by each material
+
+	// Texture residency. Textures which haven't been drawn in a while lose their top mips when we get
+	// close to the VRAM budget, and get restored once they're used again and there's space.
+	static constexpr double residencyHighWatermark = 0.9;
+	static constexpr double residencyLowWatermark = 0.75;
+	static constexpr std::uint64_t residencyColdFrames = 240;
+	static constexpr std::uint32_t minResidentExtent = 32;
+	static constexpr std::size_t maxResidencyTasksInFlight = 2;
+	std::vector<ImageResidency> imageResidency;
+	std::vector<std::shared_ptr<ImageLoadJob>> imageLoadJobs;
+	std::vector<std::unique_ptr<FileReadBatch>> imageReadBatches; // Reading the files of imageLoadJobs
+	std::deque<std::pair<std::size_t, std::uint32_t>> queuedImageLoads; // The image index and the number of mips to drop
+	ImageLoadStats imageLoadStats;
+	float textureBudgetMiB = 0.0f; // 0 uses the budget VMA reports for all DEVICE_LOCAL heaps
+	TextureResidencyStats residencyStats;
 
 	// ImGUI / UI objects
 	imgui::Renderer imgui;
@@ -224,9 +757,11 @@ struct Viewer {
     class DeletionQueue {
         friend struct Viewer;
         std::deque<std::function<void()>> deletors;
+		std::mutex mutex; // The startup steps run concurrently and push their objects from any thread
 
     public:
         void push(std::function<void()>&& function) {
+			std::lock_guard lock(mutex);
             deletors.emplace_back(function);
         }
 
@@ -239,6 +774,10 @@ struct Viewer {
     };
     DeletionQueue deletionQueue;
 
+	// Objects replaced at runtime, which are destroyed once the frames in flight have retired. The deletion
+	// queue above only tears down the objects which live until shutdown.
+	vk::DeferredDestructionQueue deferredDestruction;
+
     Viewer() = default;
     ~Viewer() = default;
 
@@ -248,40 +787,161 @@ struct Viewer {
     }
 
 	void loadGltf(const std::filesystem::path& file);
+	/** Reads every buffer in a separate file on the I/O threads, and replaces its URI with the data */
+	void loadExternalBuffers();
+	/** Reads the MSFT_lod node extensions from the glTF JSON, which fastgltf does not parse */
+	void loadMsftLod(std::span<const std::uint8_t> fileBytes, const std::filesystem::path& file);
 
 	/** This function uploads a buffer to DEVICE_LOCAL memory on the GPU using a staging buffer. */
-	VkResult createGpuTransferBuffer(std::size_t byteSize, VkBuffer* buffer, VmaAllocation* allocation) noexcept;
-	void uploadMeshlets(std::vector<Meshlet>& meshlets,
-						std::vector<unsigned int>& meshletVertices, std::vector<unsigned char>& meshletTriangles,
-						std::vector<Vertex>& vertices);
+	VkResult createGpuTransferBuffer(std::size_t byteSize, VkBuffer* buffer, VmaAllocation* allocation, VkBufferUsageFlags extraUsage = 0) noexcept;
+	/** Uploads the geometry of a full shard into a new shard with some free space, and clears the data */
+	void uploadGeometryShard(GeometryShardData& data);
+	/**
+	 * Creates a shard which holds at least the given number of elements in each buffer, and up to the given capacity
+	 * as far as the shard size limit allows. Returns the index of the shard.
+	 */
+	std::uint32_t createGeometryShard(const std::array<VkDeviceSize, geometryRangeCount>& counts,
+									  const std::array<VkDeviceSize, geometryRangeCount>& capacities);
+	void destroyGeometryShard(GeometryShard& shard);
+	/** The size of a geometry element, including the 32-bit index of each triangle index for the vertex shading path */
+	[[nodiscard]] VkDeviceSize getGeometryElementSize(GeometryRange range) const noexcept;
+	/** Allocates the ranges in any shard with enough space, or in a new shard if allowed */
+	[[nodiscard]] std::optional<GeometryAllocation> allocateGeometry(const std::array<std::uint32_t, geometryRangeCount>& counts, bool allowNewShard);
+	/** Frees the ranges once lastUsedFrame has retired */
+	void retireGeometry(GeometryAllocation& allocation, std::uint64_t lastUsedFrame);
+	/** Releases the ranges retired in or before completedFrame, and destroys evacuated shards once they're empty */
+	void releaseRetiredGeometry(std::uint64_t completedFrame);
+	[[nodiscard]] PrimitiveRecord getPrimitiveRecord(const Primitive& primitive) const;
+	/** Uploads the instance transforms and primitive records, and writes the meshlet descriptors */
+	void uploadMeshlets(std::vector<glm::mat4>& instances, std::vector<PrimitiveRecord>& primitives);
+	/** Creates the descriptor layout for the meshlet buffers, required for the pipeline creation */
+	void createMeshletSetLayout();
 	/** Takes glTF meshes and uploads them to the GPU */
 	void loadGltfMeshes();
-
-	/** Asynchronously loads all gltf images into GPU memory */
+	/** Decodes the EXT_mesh_gpu_instancing transforms of every node in parallel, and fills nodeInstances */
+	[[nodiscard]] std::vector<glm::mat4> loadGltfInstances(const CompressedBufferDataAdapter& adapter);
+	void destroyMeshBuffers();
+
+	/** Starts rebuilding the meshlets of the mesh in a task, which are then uploaded into the geometry heap */
+	void loadMesh(std::size_t meshIndex);
+	/** Uploads the meshes whose meshlets have been built, and makes those whose upload has finished resident. Never waits. */
+	void updateMeshLoads();
+	/** Waits for the mesh loads in flight and drops them, as their geometry ranges are about to be destroyed */
+	void cancelMeshLoads();
+	/** Stops drawing the mesh, and frees its geometry once the frames in flight have retired */
+	void unloadMesh(std::size_t meshIndex);
+	/** Moves the primitives of sparse shards into the others through GPU copies, so that the shards can be destroyed */
+	void compactGeometry();
+	/** Records the pending geometry copies and primitive record writes of the geometry heap */
+	void recordGeometryUpdates(VkCommandBuffer cmd);
+
+	/** Picks the meshlet limits suggested by the mesh shader properties, or the previous defaults for vertex shading */
+	[[nodiscard]] MeshletLimits getDefaultMeshletLimits() const;
+	/** Whether meshopt, the device and the compiled mesh shader variants support these limits */
+	[[nodiscard]] bool supportsMeshletLimits(const MeshletLimits& limits) const;
+	/** Regenerates every meshlet and rebuilds the mesh shading pipelines with new limits. Waits for the device to be idle. */
+	void rebuildMeshlets(const MeshletLimits& limits);
+
+	/** Queues all glTF images to be loaded into GPU memory, and sets up the material descriptors */
 	void loadGltfImages();
+	/** Queues the image to be (re)loaded, with the given number of top-level mips left out */
+	void queueImageLoad(std::size_t imageIdx, std::uint32_t droppedMips);
+	/** Swaps in finished image loads and starts queued ones. Never waits on a task or the GPU. */
+	void updateImageLoads();
+	/** Blocks until the oldest image load can be swapped in, running other tasks in the meantime */
+	void waitForImageLoad();
+	/** Makes the image created by a finished ImageLoadJob visible to the materials */
+	void installImage(ImageLoadJob& job);
+	/** Destroys what a failed ImageLoadJob created, and keeps the previous image */
+	void discardImageLoad(ImageLoadJob& job);
+	/** Counts a finished initial load, and prints the statistics once every image has been loaded */
+	void countInitialImageLoad(const ImageLoadJob& job);
 	void createDefaultImages();
+	/** Creates the bindless material descriptor layout, pool and set */
+	void createMaterialDescriptors();
 	void loadGltfMaterials();
+	/** Rebuilds the materials with the current texture slots, and marks them to be copied by the next recorded frame */
+	void writeMaterialBuffer();
+	/** Copies the materials into the material buffer, ordered after the frames in flight which still read it */
+	void recordMaterialUpdates(VkCommandBuffer cmd);
+
+	/** Reserves a slot in the bindless texture array and points it at the given image view */
+	std::uint32_t allocateTextureSlot(VkImageView imageView, VkSampler sampler);
+	/** Updates the slot while frames may be in flight, which UPDATE_AFTER_BIND allows */
+	void updateTextureSlot(std::uint32_t slot, VkImageView imageView, VkSampler sampler);
+	/** Releases the slot, which is recycled once the current frame has retired */
+	void freeTextureSlot(std::uint32_t slot);
+
+	/** Marks the textures of the draws passing the CPU frustum test as used this frame */
+	void markVisibleTextures();
+	/** Evicts or restores texture mips depending on the VRAM budget. Called once per frame. */
+	void updateTextureResidency();
 
     void setupVulkanInstance();
     void setupVulkanDevice();
+	/** Locks the graphics queue for a submit or present, if the BufferUploader shares it */
+	[[nodiscard]] std::unique_lock<std::mutex> lockGraphicsQueue() const;
 
 	/** Rebuilds the swapchain after a resize, including other screen targets such as the depth texture */
     void rebuildSwapchain(std::uint32_t width, std::uint32_t height);
+	/** Creates one offscreen color image per frame in flight, which are used instead of a swapchain in headless mode */
+	void createOffscreenTargets(std::uint32_t width, std::uint32_t height);
+	void createDepthImage(std::uint32_t width, std::uint32_t height);
 
 	void createDescriptorPool();
 	void buildCameraDescriptor();
+	void createStatisticsQueries();
 
-    /** Builds the Vulkan pipeline used for rendering meshes */
+    /** Schedules the tasks loading the shaders and building the mesh and AABB pipelines */
     void buildMeshPipeline();
+	/** Schedules the mesh shading pipelines for the current meshlet limits, without starting their shader loads */
+	void buildMeshShadingPipelines();
+	/** Waits for every pipeline build task to finish. This has to be called before the first frame. */
+	void joinPipelineBuilds();
 
     void createFrameData();
 
+	/**
+	 * Does the CPU work of the next frame which doesn't touch any resource of a frame in flight: integrating the
+	 * camera movement and building the draw list. This runs before waiting for a frame slot, so that it overlaps
+	 * with the GPU still working on the previous frames.
+	 */
+	void prepareFrameCpu();
+	/** Waits until the frame's resources are no longer in use, and copies the prepared data into every buffer the frame reads */
+	void prepareFrame(std::size_t currentFrame);
+	/** Records the mesh shading and UI passes. The color image is left in COLOR_ATTACHMENT_OPTIMAL. */
+	void recordFrame(VkCommandBuffer cmd, std::size_t currentFrame, VkImage colorImage, VkImageView colorImageView);
+
+	/** Moves the camera and computes its matrices and frustum into frameCamera */
+	void updateCamera();
+	/** Collects the meshes drawn this frame and rebuilds the draw list if they changed */
+	void updateDrawList();
+
 	/** Functions dedicated to updating GPU buffers at the start of every frame*/
 	void updateCameraBuffer(std::size_t currentFrame);
+	/** Reads the statistics of the frame which previously used this index. Never waits for the GPU. */
+	void readFrameStatistics(std::size_t currentFrame);
 	void updateDrawBuffer(std::size_t currentFrame);
 
-	void drawNode(std::vector<PrimitiveDraw>& cmd, std::vector<VkDrawIndirectCommand>& aabbCmd, std::size_t nodeIndex, glm::mat4 matrix);
-	void drawMesh(std::vector<PrimitiveDraw>& cmd, std::vector<VkDrawIndirectCommand>& aabbCmd, std::size_t meshIndex, glm::mat4 matrix);
+	/** Completes the latency of every frame in flight whose fence has been signaled since the last call */
+	void pollFrameLatencies();
+	/** Completes the latency of the frame which last used this index, if it hasn't been completed yet */
+	void completeFrameLatency(std::size_t frameIndex, std::chrono::steady_clock::time_point completionTime);
+
+	/** Collects the meshes drawn by the node and its children, and marks every node whose world transform changed */
+	void drawNode(std::vector<MeshReference>& references, std::size_t nodeIndex, glm::mat4 matrix);
+	/** Draws every primitive of the mesh once for the given range of draw instances, bucketed by material pass */
+	void drawMesh(std::array<std::vector<PrimitiveDraw>, materialPassCount>& passDraws,
+				  std::array<std::vector<VkDrawIndirectCommand>, materialPassCount>& passAabbDraws, std::size_t meshIndex, DrawRange instances);
+	/** Rebuilds the draw list from the mesh references, grouping them by mesh */
+	void buildDrawList(std::vector<MeshReference>&& references);
+	/** The most instances of a primitive a single draw can cover, as the task or cull dispatch size is limited */
+	[[nodiscard]] std::uint32_t getMaxInstancesPerDraw(std::size_t meshletCount) const;
+	/** Picks the MSFT_lod level of the node from its screen coverage. Returns no mesh if the node is culled. */
+	std::optional<std::size_t> selectNodeLod(std::size_t nodeIndex, std::size_t meshIndex, const glm::mat4& matrix);
+
+	/** Replaces the current camera with the camera of a recorded frame, without any movement */
+	void applyCameraPathFrame(const CameraPathFrame& frame);
 
 	/** Fills the cameraNodes vector */
 	void updateCameraNodes(std::size_t nodeIndex);
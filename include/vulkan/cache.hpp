@@ -1,25 +1,66 @@
+#pragma once
+
+#include <array>
+#include <cstring>
 #include <fstream>
 #include <filesystem>
+#include <span>
 
 #include <TaskScheduler.h>
 #include <tracy/Tracy.hpp>
 
 #include <fastgltf/types.hpp>
 
+#include <vk_gltf_viewer/io_threads.hpp>
+
 #include <vulkan/vk.hpp>
 
 namespace fs = std::filesystem;
 
 namespace vk {
+#ifdef _MSC_VER
+#pragma pack (push, 1)
+#endif
+	/** The header Vulkan writes in front of the data returned by vkGetPipelineCacheData */
+	struct [[gnu::packed]] PipelineCacheHeader {
+		std::uint32_t headerSize;
+		VkPipelineCacheHeaderVersion headerVersion;
+		std::uint32_t vendorID;
+		std::uint32_t deviceID;
+		std::array<std::uint8_t, VK_UUID_SIZE> pipelineCacheUUID; // Same size as normal array on MSVC, Clang, and GCC.
+	};
+	static_assert(sizeof(PipelineCacheHeader) == 32, "Vulkan spec requires header to be 32 bytes");
+	static_assert(sizeof(std::array<std::uint8_t, VK_UUID_SIZE>) == sizeof(std::uint8_t[VK_UUID_SIZE]));
+#ifdef _MSC_VER
+#pragma pack(pop)
+#endif
+
+	/** Checks that the cache data was written by the same driver for the same device */
+	inline bool isPipelineCacheCompatible(std::span<const std::byte> data, const VkPhysicalDeviceProperties& properties) {
+		if (data.size_bytes() < sizeof(PipelineCacheHeader))
+			return false;
+
+		PipelineCacheHeader header;
+		std::memcpy(&header, data.data(), sizeof(header));
+		return header.headerSize >= sizeof(PipelineCacheHeader)
+			&& header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+			&& header.vendorID == properties.vendorID
+			&& header.deviceID == properties.deviceID
+			&& std::memcmp(header.pipelineCacheUUID.data(), properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+	}
+
 	/**
-	 * enkiTS task that asynchronously loads a file into a VkPipelineCache object.
+	 * I/O request that loads a file into a VkPipelineCache object. If the file is missing
+	 * or was written for a different device or driver, an empty cache is created instead.
 	 */
-	class PipelineCacheLoadTask : public enki::ITaskSet {
+	class PipelineCacheLoadTask : public IoRequest {
 		VkDevice device;
+		VkPhysicalDeviceProperties properties;
 		VkPipelineCache* cache;
 		fs::path cachePath;
 
 		VkResult result = VK_SUCCESS;
+		bool loadedFromDisk = false;
 
 		VkResult createCache(std::size_t size, void* data) {
 			ZoneScoped;
@@ -32,29 +73,45 @@ namespace vk {
 		}
 
 	public:
-		explicit PipelineCacheLoadTask(VkDevice device, VkPipelineCache* cache, fs::path cachePath) :
-			device(device), cache(cache), cachePath(std::move(cachePath)) {}
+		explicit PipelineCacheLoadTask(VkDevice device, const VkPhysicalDeviceProperties& properties, VkPipelineCache* cache, fs::path cachePath) :
+			device(device), properties(properties), cache(cache), cachePath(std::move(cachePath)) {}
 
 		VkResult getResult() const { return result; }
 
-		void ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) override {
+		/** Whether the cache was created with data from disk, or started out empty */
+		bool wasLoadedFromDisk() const { return loadedFromDisk; }
+
+		std::size_t execute() override {
 			ZoneScoped;
 			std::ifstream cacheFile(cachePath, std::ios::binary | std::ios::ate);
 			if (!cacheFile.is_open() || cacheFile.fail()) {
 				result = createCache(0, nullptr);
-				return;
+				return 0;
 			}
 
 			fastgltf::StaticVector<std::byte> bytes(cacheFile.tellg());
+			cacheFile.seekg(0);
 			cacheFile.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+			if (cacheFile.fail() || !isPipelineCacheCompatible(std::span(bytes.data(), bytes.size()), properties)) {
+				// Drivers are supposed to reject incompatible data themselves, but not all of them do so reliably.
+				result = createCache(0, nullptr);
+				return bytes.size();
+			}
+
 			result = createCache(bytes.size(), bytes.data());
+			loadedFromDisk = result == VK_SUCCESS;
+			if (result != VK_SUCCESS) {
+				result = createCache(0, nullptr);
+			}
+			return bytes.size();
 		}
 	};
 
 	/**
-	 * enkiTS task that saves data from a VkPipelineCache to a file.
+	 * I/O request that saves data from a VkPipelineCache to a file. The data is first written and flushed to a
+	 * temporary file which then replaces the cache file, so that a crash never leaves a partial file behind.
 	 */
-	class PipelineCacheSaveTask : public enki::ITaskSet {
+	class PipelineCacheSaveTask : public IoRequest {
 		VkDevice device;
 		VkPipelineCache* cache;
 		fs::path cachePath;
@@ -69,37 +126,31 @@ namespace vk {
 			return success;
 		}
 
-		void ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) override {
+		std::size_t execute() override {
 			ZoneScoped;
 			if (*cache == VK_NULL_HANDLE) {
-				return;
-			}
-
-			if (!fs::exists(cachePath.parent_path())) {
-				fs::create_directory(cachePath.parent_path());
+				return 0;
 			}
 
-			std::ofstream cacheFile(cachePath, std::ios::binary);
-			if (!cacheFile.is_open() || cacheFile.fail()) {
-				success = false;
-				return;
-			}
+			std::error_code error;
+			fs::create_directories(cachePath.parent_path(), error);
 
 			std::size_t size = 0;
 			auto result = vkGetPipelineCacheData(device, *cache, &size, nullptr);
 			if (result != VK_SUCCESS) {
 				success = false;
-				return;
+				return 0;
 			}
 
 			fastgltf::StaticVector<std::byte> bytes(size);
 			result = vkGetPipelineCacheData(device, *cache, &size, bytes.data());
 			if (result != VK_SUCCESS) {
 				success = false;
-				return;
+				return 0;
 			}
 
-			cacheFile.write(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+			success = replaceFileDurably(cachePath, std::span(bytes.data(), size));
+			return size;
 		}
 	};
 } // namespace vk
\ No newline at end of file
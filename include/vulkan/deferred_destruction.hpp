@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+#include <vulkan/vk.hpp>
+#include <vulkan/vma.hpp>
+
+namespace vk {
+	/**
+	 * Destroys Vulkan and VMA objects once the last frame which used them has retired, so that objects can be
+	 * replaced while frames are in flight without waiting for the device. The handles are stored in flat arrays
+	 * by their type, with one batch per frame. Released batches keep their capacity and are reused.
+	 */
+	class DeferredDestructionQueue {
+		struct Batch {
+			std::uint64_t frameNumber = 0;
+			std::vector<std::pair<VkBuffer, VmaAllocation>> buffers;
+			std::vector<std::pair<VkImage, VmaAllocation>> images;
+			std::vector<VkImageView> imageViews;
+			std::vector<VkSwapchainKHR> swapchains;
+		};
+
+		VkDevice device = VK_NULL_HANDLE;
+		VmaAllocator allocator = VK_NULL_HANDLE;
+
+		std::deque<Batch> batches; // Ordered by their frame number
+		std::vector<Batch> freeBatches;
+		std::size_t pendingCount = 0;
+
+		/** Objects of a frame older than the newest batch go into that batch, which only delays their destruction */
+		Batch& getBatch(std::uint64_t lastUsedFrame);
+		void destroyBatch(Batch& batch);
+
+	public:
+		void init(VkDevice device, VmaAllocator allocator);
+
+		/** Queues the object to be destroyed once lastUsedFrame has retired. Null handles are ignored. */
+		void destroyBuffer(std::uint64_t lastUsedFrame, VkBuffer buffer, VmaAllocation allocation);
+		void destroyImage(std::uint64_t lastUsedFrame, VkImage image, VmaAllocation allocation);
+		void destroyImageView(std::uint64_t lastUsedFrame, VkImageView imageView);
+		void destroySwapchain(std::uint64_t lastUsedFrame, VkSwapchainKHR swapchain);
+
+		/** Destroys the objects of every frame up to and including completedFrame */
+		void release(std::uint64_t completedFrame);
+		/** Destroys every queued object. The device has to be idle. */
+		void flush();
+
+		/** The number of objects waiting for their frame to retire */
+		[[nodiscard]] std::size_t getPendingCount() const noexcept {
+			return pendingCount;
+		}
+	};
+} // namespace vk
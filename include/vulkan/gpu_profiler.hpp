@@ -0,0 +1,97 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <vulkan/vk.hpp>
+
+namespace vk {
+	/**
+	 * Measures the GPU time of named passes with timestamp queries. Every frame in flight has its own
+	 * query pool, which is read and reset from the host once the frame's fence has been waited on, so
+	 * reading the results never stalls. This works without Tracy or VK_EXT_calibrated_timestamps.
+	 */
+	class GpuProfiler {
+	public:
+		static constexpr std::uint32_t maxScopesPerFrame = 32;
+		static constexpr std::size_t historySize = 64;
+
+		/** The timings of a single pass, averaged over the last historySize frames it was recorded in */
+		struct ScopeStats {
+			std::string name;
+			std::array<double, historySize> history = {};
+			std::size_t sampleCount = 0;
+			double lastMs = 0.0;
+			double averageMs = 0.0;
+		};
+
+	private:
+		struct FrameQueries {
+			VkQueryPool pool = VK_NULL_HANDLE;
+			std::uint64_t frameNumber = 0;
+			std::vector<std::size_t> scopes; // The index into stats for each pair of queries
+		};
+
+		VkDevice device = VK_NULL_HANDLE;
+		double timestampPeriod = 1.0; // Nanoseconds per tick
+		std::uint64_t timestampMask = ~0ULL;
+
+		std::vector<FrameQueries> frames;
+		std::size_t currentFrame = 0;
+		std::vector<ScopeStats> stats;
+
+		std::ofstream csvFile;
+
+		std::size_t getScopeIndex(std::string_view name);
+		void readResults(FrameQueries& frame);
+
+	public:
+		/** timestampValidBits is the value of the queue family the command buffers are submitted to */
+		VkResult init(VkDevice device, float timestampPeriod, std::uint32_t timestampValidBits, std::size_t frameCount);
+		void destroy();
+
+		/**
+		 * Reads the results of the frame which previously used this index and resets its queries. This has to
+		 * be called after waiting on that frame's fence, and before recording any scopes for the new frame.
+		 */
+		void beginFrame(std::size_t frameIndex, std::uint64_t frameNumber);
+
+		/** Writes the starting timestamp of a scope and returns its handle. Returns UINT32_MAX if there's no query left. */
+		[[nodiscard]] std::uint32_t beginScope(VkCommandBuffer cmd, std::string_view name);
+		void endScope(VkCommandBuffer cmd, std::uint32_t scope);
+
+		[[nodiscard]] std::span<const ScopeStats> getStats() const noexcept {
+			return stats;
+		}
+
+		/** Appends every frame's timings to the CSV file until stopCsv is called */
+		bool startCsv(const std::filesystem::path& path);
+		void stopCsv();
+		[[nodiscard]] bool isWritingCsv() const noexcept {
+			return csvFile.is_open();
+		}
+	};
+
+	/** Wraps the commands recorded within its lifetime in a GpuProfiler scope */
+	class ScopedGpuZone {
+		GpuProfiler& profiler;
+		VkCommandBuffer cmd;
+		std::uint32_t scope;
+
+	public:
+		ScopedGpuZone(GpuProfiler& profiler, VkCommandBuffer cmd, std::string_view name)
+				: profiler(profiler), cmd(cmd), scope(profiler.beginScope(cmd, name)) {}
+		~ScopedGpuZone() {
+			profiler.endScope(cmd, scope);
+		}
+
+		ScopedGpuZone(const ScopedGpuZone&) = delete;
+		ScopedGpuZone& operator=(const ScopedGpuZone&) = delete;
+	};
+} // namespace vk
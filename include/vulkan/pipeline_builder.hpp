@@ -11,7 +11,8 @@
 #include <vulkan/vk.hpp>
 
 namespace vk {
-    VkResult loadShaderModule(std::filesystem::path filePath, VkDevice device, VkShaderModule* pShaderModule);
+    /** Creates a shader module from SPIR-V code, e.g. from the shaders embedded into the executable */
+    VkResult loadShaderModule(std::span<const std::uint32_t> code, VkDevice device, VkShaderModule* pShaderModule);
 
     class PipelineBuilder {
     protected:
@@ -20,23 +21,7 @@ namespace vk {
 
         VkPipelineCache pipelineCache = nullptr;
 
-#ifdef _MSC_VER
-#pragma pack (push, 1)
-#endif
-        struct [[gnu::packed]] PipelineCacheHeader {
-            std::uint32_t headerSize;
-            VkPipelineCacheHeaderVersion headerVersion;
-            std::uint32_t vendorID;
-            std::uint32_t deviceID;
-            std::array<std::uint8_t, VK_UUID_SIZE> pipelineCacheUUID; // Same size as normal array on MSVC, Clang, and GCC.
-        };
-        static_assert(sizeof(PipelineCacheHeader) == 32, "Vulkan spec requires header to be 32 bytes");
-        static_assert(sizeof(std::array<std::uint8_t, VK_UUID_SIZE>) == sizeof(std::uint8_t[VK_UUID_SIZE]));
-#ifdef _MSC_VER
-#pragma pack(pop)
-#endif
-
-        explicit PipelineBuilder(VkDevice device, VkPhysicalDevice physicalDevice);
+        explicit PipelineBuilder(VkDevice device, VkPhysicalDevice physicalDevice, VkPipelineCache pipelineCache);
 
         virtual VkResult build(VkPipeline* pipeline) noexcept = 0;
         virtual PipelineBuilder& pushPNext(std::uint32_t idx, const void* pNext) = 0;
@@ -54,10 +39,12 @@ namespace vk {
         std::vector<VkComputePipelineCreateInfo> pipelineInfos;
 
     public:
-        explicit ComputePipelineBuilder(VkDevice device, VkPhysicalDevice physicalDevice);
+        /** The pipeline cache may be VK_NULL_HANDLE */
+        explicit ComputePipelineBuilder(VkDevice device, VkPhysicalDevice physicalDevice, VkPipelineCache pipelineCache);
 
         VkResult build(VkPipeline* pipeline) noexcept override;
         ComputePipelineBuilder& pushPNext(std::uint32_t idx, const void* pNext) override;
+        ComputePipelineBuilder& setPipelineCache(VkPipelineCache cache) override;
         ComputePipelineBuilder& setPipelineCount(std::uint32_t count) override;
         ComputePipelineBuilder& setPipelineLayout(std::uint32_t idx, VkPipelineLayout layout) override;
         ComputePipelineBuilder& setPipelineFlags(std::uint32_t idx, VkPipelineCreateFlags flags) override;
@@ -82,7 +69,8 @@ namespace vk {
         std::vector<PipelineBuildInfos> pipelineBuildInfos;
 
     public:
-        explicit GraphicsPipelineBuilder(VkDevice device, VkPhysicalDevice physicalDevice);
+        /** The pipeline cache may be VK_NULL_HANDLE */
+        explicit GraphicsPipelineBuilder(VkDevice device, VkPhysicalDevice physicalDevice, VkPipelineCache pipelineCache);
 
         GraphicsPipelineBuilder& addDynamicState(std::uint32_t idx, VkDynamicState state);
         GraphicsPipelineBuilder& addShaderStage(std::uint32_t idx, VkShaderStageFlagBits stage, VkShaderModule module, std::string_view name, const VkSpecializationInfo* specInfo = nullptr);
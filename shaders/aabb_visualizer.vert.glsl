@@ -2,6 +2,9 @@
 #extension GL_GOOGLE_include_directive : require
 
 #extension GL_EXT_scalar_block_layout : require
+#extension GL_EXT_buffer_reference : require
+#extension GL_EXT_shader_8bit_storage : require
+#extension GL_EXT_shader_explicit_arithmetic_types_int8 : require
 
 #include "mesh_common.glsl.h"
 
@@ -11,14 +14,16 @@ layout(set = 0, binding = 0) uniform Camera {
     vec4 frustum[6];
 } camera;
 
-layout(set = 1, binding = 0, scalar) readonly buffer MeshletDescBuffer {
-    Meshlet meshlets[];
+layout(set = 1, binding = 4, scalar) readonly buffer PrimitiveDrawBuffer {
+    PrimitiveDraw draws[];
 };
 
-layout(set = 1, binding = 4, scalar) readonly buffer PrimitiveDrawBuffer {
+layout(set = 1, binding = 9, scalar) readonly buffer PrimitiveBuffer {
     Primitive primitives[];
 };
 
+#include "instancing.glsl.h"
+
 // Vertices of a basic cube
 const vec3 positions[8] = vec3[8](
     vec3(1, -1, -1),
@@ -49,11 +54,14 @@ const uint edges[12 * 2] = uint[12 * 2](
 
 // Simple shader to take meshlet AABBs and transform them into a visible cube using line topology.
 void main() {
-    Primitive primitive = primitives[gl_DrawID];
-    Meshlet meshlet = meshlets[primitive.descOffset + gl_InstanceIndex];
+    PrimitiveDraw draw = draws[gl_DrawID];
+    Primitive primitive = primitives[draw.primitiveIndex];
+    // The meshlets of every instance follow each other
+    Meshlet meshlet = primitive.meshlets.meshlets[gl_InstanceIndex % primitive.finestMeshletCount];
+    mat4 modelMatrix = getInstanceMatrix(draw.instanceOffset + gl_InstanceIndex / primitive.finestMeshletCount);
 
     vec3 position = positions[edges[gl_VertexIndex]];
     vec3 pos = position * meshlet.aabbExtents.xyz + meshlet.aabbCenter.xyz;
 
-    gl_Position = camera.viewProjection * primitive.modelMatrix * vec4(pos, 1.0f);
+    gl_Position = camera.viewProjection * modelMatrix * vec4(pos, 1.0f);
 }
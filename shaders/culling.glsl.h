@@ -0,0 +1,44 @@
+// Culling functions shared by the task shader and the meshlet cull pass of the vertex shading path.
+// This requires GL_EXT_control_flow_attributes, and mesh_common.glsl.h to be included first.
+
+// Frustum culling using 6 planes on an AABB. Returns the index of the plane which rejected
+// the AABB, or 6 if the AABB is visible.
+uint getRejectingFrustumPlane(in vec4 frustum[6], in vec3 center, in vec3 extents) {
+    [[unroll]] for (uint i = 0; i < 6; ++i) {
+        const vec4 plane = frustum[i];
+
+        const float radius = dot(extents, abs(plane.xyz));
+        const float distance = dot(plane.xyz, center) - plane.w;
+        if (-radius > distance) {
+            return i;
+        }
+    }
+    return 6;
+}
+
+// See https://gist.github.com/cmf028/81e8d3907035640ee0e3fdd69ada543f#file-aabb_transform-comp-L109-L132
+vec3 getWorldSpaceAabbExtent(in vec3 extent, in mat4 transform) {
+    const mat3 transformExtents = mat3(
+        abs(vec3(transform[0])),
+        abs(vec3(transform[1])),
+        abs(vec3(transform[2]))
+    );
+    return transformExtents * extent;
+}
+
+// Returns the error of a LOD group projected onto the screen, as a multiple of the error threshold.
+// The distance is measured to the closest point of the group's bounding sphere, so that the projected
+// error never shrinks from a group to its parent, whose sphere contains it and whose error is larger.
+float getProjectedLodError(in vec4 sphere, in float error, in mat4 transform, in vec3 origin, in float errorScale) {
+    const float scale = max(length(transform[0].xyz), max(length(transform[1].xyz), length(transform[2].xyz)));
+    const vec3 center = (transform * vec4(sphere.xyz, 1.0f)).xyz;
+    const float distance = max(length(center - origin) - sphere.w * scale, 1e-6f);
+    return error * scale * errorScale / distance;
+}
+
+// Whether the cluster belongs to the LOD cut for this view, that is, its own error is small enough while
+// the error of the coarser clusters replacing it is not.
+bool isClusterLodSelected(in Meshlet meshlet, in mat4 transform, in vec3 origin, in float errorScale) {
+    return getProjectedLodError(meshlet.lodBounds, meshlet.lodError, transform, origin, errorScale) <= 1.0f
+        && getProjectedLodError(meshlet.parentLodBounds, meshlet.parentLodError, transform, origin, errorScale) > 1.0f;
+}
@@ -0,0 +1,33 @@
+// The instance buffers of the meshlet draws. Every draw covers a range of draw instances, each of which
+// combines the world transform of a node with one of the node's EXT_mesh_gpu_instancing transforms.
+// The node transforms are affine, and stored as the first three rows of the matrix.
+// Nodes without instancing use the identity transform at index 0 of the InstanceBuffer.
+// This requires GL_EXT_scalar_block_layout.
+
+struct DrawInstance {
+    uint nodeIndex;
+    uint instanceIndex;
+};
+
+struct NodeTransform {
+    vec4 rows[3];
+};
+
+layout(set = 1, binding = 6, scalar) readonly buffer InstanceBuffer {
+    mat4 instances[];
+};
+
+layout(set = 1, binding = 7, scalar) readonly buffer DrawInstanceBuffer {
+    DrawInstance drawInstances[];
+};
+
+layout(set = 1, binding = 8, scalar) readonly buffer TransformBuffer {
+    NodeTransform transforms[];
+};
+
+mat4 getInstanceMatrix(in uint drawInstanceIndex) {
+    const DrawInstance instance = drawInstances[drawInstanceIndex];
+    const NodeTransform transform = transforms[instance.nodeIndex];
+    const mat4 nodeMatrix = transpose(mat4(transform.rows[0], transform.rows[1], transform.rows[2], vec4(0.0f, 0.0f, 0.0f, 1.0f)));
+    return nodeMatrix * instances[instance.instanceIndex];
+}
@@ -2,6 +2,10 @@
 #extension GL_EXT_nonuniform_qualifier : enable
 #extension GL_EXT_scalar_block_layout : require
 
+// The alpha mode of the materials drawn with this pipeline: 0 = opaque, 1 = mask, 2 = blend.
+// Only the masked variant may discard, so that opaque geometry keeps early depth testing.
+layout(constant_id = 0) const uint alphaMode = 0;
+
 layout(location = 0) in vec4 color;
 layout(location = 1) in vec2 uv;
 layout(location = 2) flat in uint materialIndex;
@@ -26,7 +30,12 @@ void main() {
     Material material = materials[materialIndex];
     vec4 outColor = color * material.albedoFactor * texture(textures[nonuniformEXT(material.albedoIdx)], uv);
 
-    if (outColor.a < material.alphaCutoff)
-        discard;
+    if (alphaMode == 0) {
+        outColor.a = 1.0f;
+    } else if (alphaMode == 1) {
+        if (outColor.a < material.alphaCutoff)
+            discard;
+        outColor.a = 1.0f;
+    }
     fragColor = outColor;
 }
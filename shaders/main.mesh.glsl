@@ -9,7 +9,9 @@
 #extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
 #extension GL_EXT_control_flow_attributes : require
 
-layout(local_size_x = 32, local_size_y = 1, local_size_z = 1) in;
+// The workgroup size is chosen by the host, depending on the device's preferred mesh workgroup size
+layout(constant_id = 0) const uint meshWorkgroupSize = 32;
+layout(local_size_x_id = 0, local_size_y = 1, local_size_z = 1) in;
 
 #include "mesh_common.glsl.h"
 
@@ -21,29 +23,24 @@ layout(set = 0, binding = 0) uniform Camera {
     vec4 frustum[6];
 } camera;
 
-layout(set = 1, binding = 0, scalar) readonly buffer MeshletDescBuffer {
-    Meshlet meshlets[];
+layout(set = 1, binding = 4, scalar) readonly buffer PrimitiveDrawBuffer {
+    PrimitiveDraw draws[];
 };
 
-layout(set = 1, binding = 1, scalar) readonly buffer VertexIndexBuffer {
-    uint vertexIndices[];
+layout(set = 1, binding = 9, scalar) readonly buffer PrimitiveBuffer {
+    Primitive primitives[];
 };
 
-layout(set = 1, binding = 2, scalar) readonly buffer PrimitiveIndexBuffer {
-    uint8_t primitiveIndices[];
-};
+#include "instancing.glsl.h"
 
-layout(set = 1, binding = 3, scalar) readonly buffer VertexBuffer {
-    Vertex vertices[];
-};
-
-layout(set = 1, binding = 4, scalar) readonly buffer PrimitiveDrawBuffer {
-    Primitive primitives[];
+layout(push_constant) uniform DrawParameters {
+    uint drawIdOffset;
 };
 
 struct Task {
     uint baseID;
-    uint8_t deltaIDs[128];
+    uint instanceIndex;
+    uint8_t deltaIDs[maxMeshlets];
 };
 
 taskPayloadSharedEXT Task taskPayload;
@@ -53,9 +50,10 @@ layout(location = 1) out vec2 uvs[];
 layout(location = 2) flat out uint materialIndex[];
 
 void main() {
-    const Primitive primitive = primitives[gl_DrawID];
+    const Primitive primitive = primitives[draws[drawIdOffset + gl_DrawID].primitiveIndex];
     uint deltaId = taskPayload.baseID + uint(taskPayload.deltaIDs[gl_WorkGroupID.x]);
-    const Meshlet meshlet = meshlets[primitive.descOffset + deltaId];
+    const Meshlet meshlet = primitive.meshlets.meshlets[deltaId];
+    const mat4 modelMatrix = getInstanceMatrix(taskPayload.instanceIndex);
 
     // This defines the array size of gl_MeshVerticesEXT
     if (gl_LocalInvocationID.x == 0) {
@@ -74,10 +72,10 @@ void main() {
         // Lowering the workgroup size will reduce this over-computation.
         vidx = min(vidx, meshlet.vertexCount - 1);
 
-        uint vertexIndex = vertexIndices[primitive.vertexIndicesOffset + meshlet.vertexOffset + vidx];
-        Vertex vertex = vertices[primitive.verticesOffset + vertexIndex];
+        uint vertexIndex = primitive.vertexIndices.vertexIndices[meshlet.vertexOffset + vidx];
+        Vertex vertex = primitive.vertices.vertices[vertexIndex];
 
-        gl_MeshVerticesEXT[vidx].gl_Position = camera.viewProjection * primitive.modelMatrix * vertex.position;
+        gl_MeshVerticesEXT[vidx].gl_Position = camera.viewProjection * modelMatrix * vertex.position;
 
         colors[vidx] = vertex.color;
         uvs[vidx] = vertex.uv;
@@ -90,9 +88,9 @@ void main() {
 
         pidx = min(pidx, meshlet.triangleCount - 1);
 
-        uvec3 indices = uvec3(primitiveIndices[primitive.triangleIndicesOffset + meshlet.triangleOffset + pidx * 3 + 0],
-                              primitiveIndices[primitive.triangleIndicesOffset + meshlet.triangleOffset + pidx * 3 + 1],
-                              primitiveIndices[primitive.triangleIndicesOffset + meshlet.triangleOffset + pidx * 3 + 2]);
+        uvec3 indices = uvec3(primitive.triangleIndices.triangleIndices[meshlet.triangleOffset + pidx * 3 + 0],
+                              primitive.triangleIndices.triangleIndices[meshlet.triangleOffset + pidx * 3 + 1],
+                              primitive.triangleIndices.triangleIndices[meshlet.triangleOffset + pidx * 3 + 2]);
 
         gl_PrimitiveTriangleIndicesEXT[pidx] = indices;
     }
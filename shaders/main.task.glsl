@@ -4,6 +4,8 @@
 #extension GL_EXT_mesh_shader : require
 #extension GL_EXT_shader_explicit_arithmetic_types_int8 : require
 #extension GL_EXT_scalar_block_layout : require
+#extension GL_EXT_buffer_reference : require
+#extension GL_EXT_shader_8bit_storage : require
 #extension GL_EXT_control_flow_attributes: require
 
 #extension GL_KHR_shader_subgroup_basic : require
@@ -15,75 +17,97 @@ layout(constant_id = 0) const uint subgroupSize = 32;
 layout(local_size_x_id = 0, local_size_y = 1, local_size_z = 1) in;
 
 #include "mesh_common.glsl.h"
+#include "culling.glsl.h"
 
 layout(set = 0, binding = 0) uniform Camera {
     mat4 viewProjection;
 
     // We represent a plane using a single vec4, in the form of ax + by + cz + d = 0
     vec4 frustum[6];
+
+    vec3 lodOrigin;
+    float lodErrorScale;
 } camera;
 
-layout(set = 1, binding = 0, scalar) readonly buffer MeshletDescBuffer {
-    Meshlet meshlets[];
-};
+// Culling counters which are read back by the host for the statistics UI
+layout(set = 0, binding = 1, scalar) buffer CullingStatsBuffer {
+    uint meshletsTested;
+    uint meshletsEmitted;
+    uint frustumRejections[6];
+    uint lodRejections;
+    uint instanceRejections;
+} cullingStats;
 
 layout(set = 1, binding = 4, scalar) readonly buffer PrimitiveDrawBuffer {
+    PrimitiveDraw draws[];
+};
+
+layout(set = 1, binding = 9, scalar) readonly buffer PrimitiveBuffer {
     Primitive primitives[];
 };
 
+#include "instancing.glsl.h"
+
+layout(push_constant) uniform DrawParameters {
+    uint drawIdOffset;
+};
+
 // This is essentially a replacement for gl_WorkGroupID.x, but one which can store any index
 // between 0..256 instead of the linear requirement of the work group ID.
 struct Task {
     uint baseID;
+    uint instanceIndex;
     uint8_t deltaIDs[maxMeshlets];
 };
 
 taskPayloadSharedEXT Task taskPayload;
 
-// Frustum culling using 6 planes on an AABB
-bool isMeshletVisibleAabb(in vec3 center, in vec3 extents) {
-    [[unroll]] for (uint i = 0; i < 6; ++i) {
-        const vec4 plane = camera.frustum[i];
-
-        const float radius = dot(extents, abs(plane.xyz));
-        const float distance = dot(plane.xyz, center) - plane.w;
-        if (-radius > distance) {
-            return false;
-        }
-    }
-    return true;
-}
-
-// See https://gist.github.com/cmf028/81e8d3907035640ee0e3fdd69ada543f#file-aabb_transform-comp-L109-L132
-vec3 getWorldSpaceAabbExtent(in vec3 extent, in mat4 transform) {
-    const mat3 transformExtents = mat3(
-        abs(vec3(transform[0])),
-        abs(vec3(transform[1])),
-        abs(vec3(transform[2]))
-    );
-    return transformExtents * extent;
-}
-
 void main() {
-    const Primitive primitive = primitives[gl_DrawID];
+    const PrimitiveDraw draw = draws[drawIdOffset + gl_DrawID];
+    const Primitive primitive = primitives[draw.primitiveIndex];
+
+    // Every row of workgroups handles a single instance. If the entire primitive of this instance is
+    // outside of the frustum, none of its meshlets are tested.
+    const uint instanceIndex = draw.instanceOffset + gl_WorkGroupID.y;
+    const mat4 modelMatrix = getInstanceMatrix(instanceIndex);
+    const bool instanceVisible = getRejectingFrustumPlane(camera.frustum,
+        (modelMatrix * vec4(primitive.aabbCenter, 1.0f)).xyz, getWorldSpaceAabbExtent(primitive.aabbExtents, modelMatrix)) == 6;
+    if (!instanceVisible && gl_WorkGroupID.x == 0 && gl_LocalInvocationIndex == 0) {
+        atomicAdd(cullingStats.instanceRejections, 1);
+    }
 
     // Every task shader workgroup only gets 128 meshlets to handle. This calculates how many
     // this specific work group should handle, and sets the baseID accordingly.
-    uint meshletCount = min(maxMeshlets, primitive.meshletCount - (gl_WorkGroupID.x * maxMeshlets));
+    uint meshletCount = instanceVisible ? min(maxMeshlets, primitive.meshletCount - (gl_WorkGroupID.x * maxMeshlets)) : 0;
     taskPayload.baseID = gl_WorkGroupID.x * maxMeshlets;
+    taskPayload.instanceIndex = instanceIndex;
 
     // Generate the delta IDs by iterating over every meshlet.
     const uint meshletLoops = (meshletCount + gl_WorkGroupSize.x - 1) / gl_WorkGroupSize.x;
     uint visibleMeshlets = 0;
+    uint rejections[6] = uint[6](0, 0, 0, 0, 0, 0);
+    uint lodRejections = 0;
     [[unroll]] for (uint i = 0; i < meshletLoops; ++i) {
         uint idx = gl_LocalInvocationIndex.x + i * gl_WorkGroupSize.x;
+        // Invocations past the last meshlet must not emit it a second time
+        const bool inRange = idx < meshletCount;
         idx = min(idx, meshletCount - 1);
-        const Meshlet meshlet = meshlets[primitive.descOffset + taskPayload.baseID + idx];
+        const Meshlet meshlet = primitive.meshlets.meshlets[taskPayload.baseID + idx];
+
+        // The meshlets hold every LOD level of the primitive, of which only one cut gets drawn
+        const bool lodSelected = isClusterLodSelected(meshlet, modelMatrix, camera.lodOrigin, camera.lodErrorScale);
+        if (inRange && !lodSelected) {
+            lodRejections++;
+        }
 
         // Do some culling
-        const vec3 worldAabbCenter = (primitive.modelMatrix * vec4(meshlet.aabbCenter, 1.0f)).xyz;
-        const vec3 worldAabbExtent = getWorldSpaceAabbExtent(meshlet.aabbExtents.xyz, primitive.modelMatrix);
-        const bool visible = isMeshletVisibleAabb(worldAabbCenter, worldAabbExtent);
+        const vec3 worldAabbCenter = (modelMatrix * vec4(meshlet.aabbCenter, 1.0f)).xyz;
+        const vec3 worldAabbExtent = getWorldSpaceAabbExtent(meshlet.aabbExtents.xyz, modelMatrix);
+        const uint rejectingPlane = getRejectingFrustumPlane(camera.frustum, worldAabbCenter, worldAabbExtent);
+        const bool visible = inRange && lodSelected && rejectingPlane == 6;
+        if (inRange && lodSelected && rejectingPlane < 6) {
+            rejections[rejectingPlane]++;
+        }
 
         // Get the index for this thread for this subgroup
         uint payloadIndex = subgroupExclusiveAdd(uint(visible));
@@ -93,5 +117,19 @@ void main() {
         visibleMeshlets += subgroupAdd(uint(visible));
     }
 
+    // The workgroup is a single subgroup, so one atomic per counter is enough
+    [[unroll]] for (uint i = 0; i < 6; ++i) {
+        const uint planeRejections = subgroupAdd(rejections[i]);
+        if (subgroupElect() && planeRejections != 0) {
+            atomicAdd(cullingStats.frustumRejections[i], planeRejections);
+        }
+    }
+    const uint subgroupLodRejections = subgroupAdd(lodRejections);
+    if (subgroupElect()) {
+        atomicAdd(cullingStats.meshletsTested, meshletCount);
+        atomicAdd(cullingStats.lodRejections, subgroupLodRejections);
+        atomicAdd(cullingStats.meshletsEmitted, visibleMeshlets);
+    }
+
     EmitMeshTasksEXT(visibleMeshlets, 1, 1);
 }
@@ -0,0 +1,52 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+#extension GL_EXT_scalar_block_layout : require
+#extension GL_EXT_buffer_reference : require
+#extension GL_EXT_shader_8bit_storage : require
+#extension GL_EXT_shader_explicit_arithmetic_types_int8 : require
+
+#include "mesh_common.glsl.h"
+
+// The vertex shader of the vertex shading path, which draws every meshlet with its own indexed draw.
+layout(set = 0, binding = 0) uniform Camera {
+    mat4 viewProjection;
+
+    vec4 frustum[6];
+} camera;
+
+layout(set = 1, binding = 4, scalar) readonly buffer PrimitiveDrawBuffer {
+    PrimitiveDraw draws[];
+};
+
+layout(set = 1, binding = 9, scalar) readonly buffer PrimitiveBuffer {
+    Primitive primitives[];
+};
+
+#include "instancing.glsl.h"
+
+layout(push_constant) uniform DrawParameters {
+    uint drawIdOffset;
+};
+
+layout(location = 0) out vec4 color;
+layout(location = 1) out vec2 uv;
+layout(location = 2) flat out uint materialIndex;
+
+void main() {
+    // The cull pass stores the index of the draw as the first instance of every meshlet draw
+    const PrimitiveDraw draw = draws[gl_InstanceIndex];
+    const Primitive primitive = primitives[draw.primitiveIndex];
+
+    // Each instance has its own meshlet draws, which follow each other
+    const uint instanceIndex = (drawIdOffset + gl_DrawID - draw.meshletDrawOffset) / primitive.meshletCount;
+    const mat4 modelMatrix = getInstanceMatrix(draw.instanceOffset + instanceIndex);
+
+    // The indices are relative to the primitive's first vertex
+    const Vertex vertex = primitive.vertices.vertices[gl_VertexIndex];
+
+    gl_Position = camera.viewProjection * modelMatrix * vertex.position;
+    color = vertex.color;
+    uv = vertex.uv;
+    materialIndex = primitive.materialIndex;
+}
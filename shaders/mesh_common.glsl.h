@@ -1,5 +1,14 @@
-const uint maxVertices = 64;
-const uint maxPrimitives = 126;
+// The mesh shader's output limits, which CMake defines for every compiled variant of main.mesh.glsl.
+// These are upper bounds, the meshlets themselves are built with the same limits.
+#ifndef MAX_VERTICES
+#define MAX_VERTICES 64
+#endif
+#ifndef MAX_PRIMITIVES
+#define MAX_PRIMITIVES 124
+#endif
+
+const uint maxVertices = MAX_VERTICES;
+const uint maxPrimitives = MAX_PRIMITIVES;
 const uint maxMeshlets = 128;
 
 struct Meshlet {
@@ -11,6 +20,12 @@ struct Meshlet {
 
     vec3 aabbExtents;
     vec3 aabbCenter;
+
+    // See the Meshlet struct in viewer.hpp
+    vec4 lodBounds;
+    vec4 parentLodBounds;
+    float lodError;
+    float parentLodError;
 };
 
 struct Vertex {
@@ -19,23 +34,59 @@ struct Vertex {
     vec2 uv;
 };
 
+// The geometry is split into shards of multiple buffers, so every primitive addresses its data directly
+layout(buffer_reference, scalar, buffer_reference_align = 4) readonly buffer MeshletBuffer {
+    Meshlet meshlets[];
+};
+
+layout(buffer_reference, scalar, buffer_reference_align = 4) readonly buffer VertexIndexBuffer {
+    uint vertexIndices[];
+};
+
+layout(buffer_reference, scalar, buffer_reference_align = 1) readonly buffer TriangleIndexBuffer {
+    uint8_t triangleIndices[];
+};
+
+layout(buffer_reference, scalar, buffer_reference_align = 4) readonly buffer VertexBuffer {
+    Vertex vertices[];
+};
+
 struct VkDrawMeshTasksIndirectCommandEXT {
     uint groupCountX;
     uint groupCountY;
     uint groupCountZ;
 };
 
+// The static data of a primitive, which is uploaded once together with its meshlets
 struct Primitive {
-    // TODO: Get rid of this command struct here?
-    VkDrawMeshTasksIndirectCommandEXT command;
+    MeshletBuffer meshlets;
+    VertexIndexBuffer vertexIndices;
+    TriangleIndexBuffer triangleIndices;
+    VertexBuffer vertices;
 
-    mat4x4 modelMatrix;
-
-    uint descOffset;
-    uint vertexIndicesOffset;
-    uint triangleIndicesOffset;
-    uint verticesOffset;
+    // The shard whose index buffer the vertex shading path binds, and the primitive's first index in it
+    uint shardIndex;
+    uint firstIndex;
 
     uint meshletCount;
     uint materialIndex;
+
+    vec3 aabbCenter;
+    vec3 aabbExtents;
+    uint finestMeshletCount;
+    uint padding;
+};
+
+// A draw of a primitive for a range of instances, which is only rebuilt when the drawn meshes change
+struct PrimitiveDraw {
+    VkDrawMeshTasksIndirectCommandEXT command;
+
+    uint primitiveIndex;
+
+    // The range of the draw's instances in the DrawInstanceBuffer
+    uint instanceOffset;
+    uint instanceCount;
+
+    // The index of the first meshlet draw of this primitive, only used by the vertex shading path
+    uint meshletDrawOffset;
 };
@@ -0,0 +1,123 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+#extension GL_EXT_scalar_block_layout : require
+#extension GL_EXT_buffer_reference : require
+#extension GL_EXT_shader_8bit_storage : require
+#extension GL_EXT_shader_explicit_arithmetic_types_int8 : require
+#extension GL_EXT_control_flow_attributes : require
+
+#extension GL_KHR_shader_subgroup_basic : require
+#extension GL_KHR_shader_subgroup_arithmetic : require
+
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+#include "mesh_common.glsl.h"
+#include "culling.glsl.h"
+
+// The meshlet cull pass of the vertex shading path. Every invocation culls a single meshlet, and
+// writes an indexed draw for it, which has an instance count of zero if the meshlet is not visible.
+layout(set = 0, binding = 0) uniform Camera {
+    mat4 viewProjection;
+
+    vec4 frustum[6];
+
+    vec3 lodOrigin;
+    float lodErrorScale;
+} camera;
+
+layout(set = 0, binding = 1, scalar) buffer CullingStatsBuffer {
+    uint meshletsTested;
+    uint meshletsEmitted;
+    uint frustumRejections[6];
+    uint lodRejections;
+    uint instanceRejections;
+} cullingStats;
+
+layout(set = 1, binding = 4, scalar) readonly buffer PrimitiveDrawBuffer {
+    PrimitiveDraw draws[];
+};
+
+layout(set = 1, binding = 9, scalar) readonly buffer PrimitiveBuffer {
+    Primitive primitives[];
+};
+
+struct VkDrawIndexedIndirectCommand {
+    uint indexCount;
+    uint instanceCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint firstInstance;
+};
+
+layout(set = 1, binding = 5, scalar) writeonly buffer MeshletDrawBuffer {
+    VkDrawIndexedIndirectCommand meshletDraws[];
+};
+
+#include "instancing.glsl.h"
+
+layout(push_constant) uniform DrawParameters {
+    uint drawIdOffset;
+};
+
+void main() {
+    // The y dimension selects the draw, which is also used as the instance index in the vertex shader
+    const uint drawIndex = drawIdOffset + gl_WorkGroupID.y;
+    const PrimitiveDraw draw = draws[drawIndex];
+    const Primitive primitive = primitives[draw.primitiveIndex];
+
+    // The meshlets of every instance follow each other in the x dimension
+    const uint drawMeshletIndex = gl_GlobalInvocationID.x;
+    const bool inRange = drawMeshletIndex < primitive.meshletCount * draw.instanceCount;
+
+    uint meshletIndex = 0;
+    uint rejectingPlane = 6;
+    bool lodSelected = false;
+    bool instanceVisible = true;
+    if (inRange) {
+        // Only divide once we know the primitive has any meshlets
+        meshletIndex = drawMeshletIndex % primitive.meshletCount;
+        const Meshlet meshlet = primitive.meshlets.meshlets[meshletIndex];
+        const mat4 modelMatrix = getInstanceMatrix(draw.instanceOffset + drawMeshletIndex / primitive.meshletCount);
+
+        // If the entire primitive of this instance is outside of the frustum, none of its meshlets are tested
+        instanceVisible = getRejectingFrustumPlane(camera.frustum,
+            (modelMatrix * vec4(primitive.aabbCenter, 1.0f)).xyz, getWorldSpaceAabbExtent(primitive.aabbExtents, modelMatrix)) == 6;
+        if (instanceVisible) {
+            // The meshlets hold every LOD level of the primitive, of which only one cut gets drawn
+            lodSelected = isClusterLodSelected(meshlet, modelMatrix, camera.lodOrigin, camera.lodErrorScale);
+
+            const vec3 worldAabbCenter = (modelMatrix * vec4(meshlet.aabbCenter, 1.0f)).xyz;
+            const vec3 worldAabbExtent = getWorldSpaceAabbExtent(meshlet.aabbExtents.xyz, modelMatrix);
+            rejectingPlane = getRejectingFrustumPlane(camera.frustum, worldAabbCenter, worldAabbExtent);
+        }
+
+        // The indices of a meshlet are at the same offsets as its micro indices, within the index buffer of
+        // the primitive's shard. They are relative to the primitive's vertices, which the vertex shader addresses.
+        meshletDraws[draw.meshletDrawOffset + drawMeshletIndex] = VkDrawIndexedIndirectCommand(
+            meshlet.triangleCount * 3,
+            instanceVisible && lodSelected && rejectingPlane == 6 ? 1 : 0,
+            primitive.firstIndex + meshlet.triangleOffset,
+            0,
+            drawIndex);
+    }
+
+    // Update the culling counters with one atomic per subgroup. Meshlets of rejected instances are not tested.
+    const bool tested = inRange && instanceVisible;
+    [[unroll]] for (uint i = 0; i < 6; ++i) {
+        const uint planeRejections = subgroupAdd(uint(tested && lodSelected && rejectingPlane == i));
+        if (subgroupElect() && planeRejections != 0) {
+            atomicAdd(cullingStats.frustumRejections[i], planeRejections);
+        }
+    }
+    const uint testedCount = subgroupAdd(uint(tested));
+    const uint emitted = subgroupAdd(uint(tested && lodSelected && rejectingPlane == 6));
+    const uint lodRejections = subgroupAdd(uint(tested && !lodSelected));
+    const uint instanceRejections = subgroupAdd(uint(inRange && !instanceVisible && meshletIndex == 0));
+    if (subgroupElect()) {
+        atomicAdd(cullingStats.meshletsTested, testedCount);
+        atomicAdd(cullingStats.meshletsEmitted, emitted);
+        atomicAdd(cullingStats.lodRejections, lodRejections);
+        atomicAdd(cullingStats.instanceRejections, instanceRejections);
+    }
+}
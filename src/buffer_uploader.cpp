@@ -6,7 +6,8 @@
 #include <vk_gltf_viewer/buffer_uploader.hpp>
 #include <vk_gltf_viewer/scheduler.hpp>
 
-BufferUploadTask::BufferUploadTask(std::span<const std::byte> data, VkBuffer destinationBuffer) : data(data), destinationBuffer(destinationBuffer) {
+BufferUploadTask::BufferUploadTask(std::span<const std::byte> data, VkBuffer destinationBuffer, VkDeviceSize destinationOffset)
+		: data(data), destinationBuffer(destinationBuffer), destinationOffset(destinationOffset) {
 	// This is required so that every task's range has this size to fit with the staging buffers.
 	auto& uploader = BufferUploader::getInstance();
 	m_SetSize = (data.size_bytes() + uploader.getStagingBufferSize() - 1) / uploader.getStagingBufferSize();
@@ -45,7 +46,7 @@ void BufferUploadTask::ExecuteRange(enki::TaskSetPartition range, std::uint32_t
 
 		const VkBufferCopy region {
 			.srcOffset = 0,
-			.dstOffset = i * stagingBufferSize,
+			.dstOffset = destinationOffset + i * stagingBufferSize,
 			.size = sub.size_bytes(),
 		};
 		vkCmdCopyBuffer(cmd, stagingBuffer.handle, destinationBuffer, 1, &region);
@@ -74,8 +75,8 @@ void BufferUploadTask::ExecuteRange(enki::TaskSetPartition range, std::uint32_t
 	}
 }
 
-ImageUploadTask::ImageUploadTask(std::span<const std::byte> data, VkImage destinationImage, VkExtent3D imageExtent, VkImageLayout destinationLayout, std::size_t channelCount)
-		: data(data), destinationImage(destinationImage), imageExtent(imageExtent), destinationLayout(destinationLayout), channelCount(channelCount) {
+ImageUploadTask::ImageUploadTask(std::span<const std::byte> data, VkImage destinationImage, VkExtent3D imageExtent, VkImageLayout destinationLayout, std::size_t channelCount, std::uint32_t mipLevel)
+		: data(data), destinationImage(destinationImage), imageExtent(imageExtent), destinationLayout(destinationLayout), channelCount(channelCount), mipLevel(mipLevel) {
 	m_SetSize = imageExtent.height;
 	m_MinRange = util::min(150U, imageExtent.height); // TODO. This *only* works when 150 rows is not larger than a staging buffer.
 }
@@ -123,6 +124,7 @@ void ImageUploadTask::ExecuteRange(enki::TaskSetPartition range, std::uint32_t t
 		.image = destinationImage,
 		.subresourceRange = {
 			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.baseMipLevel = mipLevel,
 			.levelCount = 1,
 			.layerCount = 1,
 		},
@@ -140,6 +142,7 @@ void ImageUploadTask::ExecuteRange(enki::TaskSetPartition range, std::uint32_t t
 		.bufferImageHeight = 0,
 		.imageSubresource = {
 			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.mipLevel = mipLevel,
 			.layerCount = 1,
 		},
 		.imageOffset = {
@@ -187,14 +190,14 @@ void ImageUploadTask::ExecuteRange(enki::TaskSetPartition range, std::uint32_t t
 	vkWaitForFences(uploader.device, 1, &fence, VK_TRUE, 9999999999);
 }
 
-bool BufferUploader::init(VkDevice nDevice, VmaAllocator nAllocator, std::uint32_t nTransferQueueIndex, std::size_t transferQueueCount) {
+bool BufferUploader::init(VkDevice nDevice, VmaAllocator nAllocator, std::uint32_t nTransferQueueIndex, std::uint32_t firstQueue, std::size_t transferQueueCount) {
 	ZoneScoped;
 	device = nDevice;
 	allocator = nAllocator;
 	transferQueueIndex = nTransferQueueIndex;
 
 	transferQueues.resize(transferQueueCount);
-	for (std::size_t i = 0; auto& transferQueue : transferQueues) {
+	for (std::uint32_t i = firstQueue; auto& transferQueue : transferQueues) {
 		transferQueue.lock = std::make_unique<std::mutex>();
 		vkGetDeviceQueue(device, transferQueueIndex, i++, &transferQueue.handle);
 	}
@@ -261,6 +264,14 @@ bool BufferUploader::init(VkDevice nDevice, VmaAllocator nAllocator, std::uint32
 	return true;
 }
 
+std::mutex* BufferUploader::getQueueLock(VkQueue queue) const {
+	for (const auto& transferQueue : transferQueues) {
+		if (transferQueue.handle == queue)
+			return transferQueue.lock.get();
+	}
+	return nullptr;
+}
+
 void BufferUploader::destroy() {
 	for (auto& stagingBuffer: stagingBuffers) {
 		vmaDestroyBuffer(allocator, stagingBuffer.handle, stagingBuffer.allocation);
@@ -273,8 +284,190 @@ void BufferUploader::destroy() {
 	}
 }
 
-std::unique_ptr<BufferUploadTask> BufferUploader::uploadToBuffer(std::span<const std::byte> data, VkBuffer buffer) {
-	auto task = std::make_unique<BufferUploadTask>(data, buffer);
+std::unique_ptr<BufferUploadTask> BufferUploader::uploadToBuffer(std::span<const std::byte> data, VkBuffer buffer, VkDeviceSize offset) {
+	auto task = std::make_unique<BufferUploadTask>(data, buffer, offset);
 	taskScheduler.AddTaskSetToPipe(task.get());
 	return task;
 }
+
+VkCommandBuffer BufferUploader::beginPendingUpload(VkDeviceSize stagingSize, PendingUpload& upload) {
+	const VmaAllocationCreateInfo allocationInfo {
+		.usage = VMA_MEMORY_USAGE_CPU_ONLY,
+	};
+	const VkBufferCreateInfo bufferCreateInfo {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = stagingSize,
+		.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+	};
+	auto result = vmaCreateBuffer(allocator, &bufferCreateInfo, &allocationInfo,
+								  &upload.stagingBuffer, &upload.stagingAllocation, VK_NULL_HANDLE);
+	vk::checkResult(result, "Failed to allocate upload staging buffer: {}");
+
+	// The per-thread command pools are reset by the next upload on that thread, so every pending upload
+	// needs its own pool and fence.
+	const VkCommandPoolCreateInfo commandPoolInfo {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+		.queueFamilyIndex = transferQueueIndex,
+	};
+	result = vkCreateCommandPool(device, &commandPoolInfo, nullptr, &upload.commandPool);
+	vk::checkResult(result, "Failed to create upload command pool: {}");
+
+	VkCommandBuffer cmd;
+	const VkCommandBufferAllocateInfo allocateInfo {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.commandPool = upload.commandPool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = 1,
+	};
+	result = vkAllocateCommandBuffers(device, &allocateInfo, &cmd);
+	vk::checkResult(result, "Failed to allocate upload command buffer: {}");
+
+	const VkFenceCreateInfo fenceCreateInfo {
+		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+	};
+	result = vkCreateFence(device, &fenceCreateInfo, nullptr, &upload.fence);
+	vk::checkResult(result, "Failed to create upload fence: {}");
+
+	const VkCommandBufferBeginInfo beginInfo {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	};
+	vkBeginCommandBuffer(cmd, &beginInfo);
+	return cmd;
+}
+
+void BufferUploader::submitPendingUpload(VkCommandBuffer cmd, PendingUpload& upload) {
+	vkEndCommandBuffer(cmd);
+
+	auto& queue = getNextQueueHandle();
+	{
+		// We need to guard the vkQueueSubmit call
+		std::lock_guard lock(*queue.lock);
+
+		const VkSubmitInfo submitInfo {
+			.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+			.commandBufferCount = 1,
+			.pCommandBuffers = &cmd,
+		};
+		auto submitResult = vkQueueSubmit(queue.handle, 1, &submitInfo, upload.fence);
+		vk::checkResult(submitResult, "Failed to submit upload: {}");
+	}
+}
+
+void BufferUploader::submitImageUpload(std::span<const std::span<const std::byte>> mips, VkImage image, VkExtent3D extent,
+									   VkImageLayout destinationLayout, std::size_t channelCount, PendingUpload& upload) {
+	ZoneScoped;
+	// Every mip starts at a 16-byte boundary, which satisfies the bufferOffset alignment for any texel size we use.
+	std::vector<VkBufferImageCopy> copies; copies.reserve(mips.size());
+	VkDeviceSize stagingSize = 0;
+	for (std::uint32_t level = 0; auto& mip : mips) {
+		auto& copy = copies.emplace_back();
+		copy.bufferOffset = stagingSize;
+		copy.imageSubresource = {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.mipLevel = level,
+			.layerCount = 1,
+		};
+		copy.imageExtent = {
+			.width = util::max(1U, extent.width >> level),
+			.height = util::max(1U, extent.height >> level),
+			.depth = 1,
+		};
+		assert(mip.size_bytes() == copy.imageExtent.width * copy.imageExtent.height * channelCount);
+		stagingSize += (mip.size_bytes() + 15) & ~VkDeviceSize(15);
+		++level;
+	}
+
+	auto cmd = beginPendingUpload(stagingSize, upload);
+	{
+		vk::ScopedMap<std::byte> map(allocator, upload.stagingAllocation);
+		for (std::size_t i = 0; i < mips.size(); ++i) {
+			std::memcpy(map.get() + copies[i].bufferOffset, mips[i].data(), mips[i].size_bytes());
+		}
+	}
+	vmaFlushAllocation(allocator, upload.stagingAllocation, 0, VK_WHOLE_SIZE);
+
+	// Transition every mip to TRANSFER_DST_OPTIMAL
+	VkImageMemoryBarrier2 imageBarrier {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+		.srcStageMask = VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT,
+		.srcAccessMask = VK_ACCESS_2_NONE,
+		.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+		.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+		.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = image,
+		.subresourceRange = {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.levelCount = static_cast<std::uint32_t>(mips.size()),
+			.layerCount = 1,
+		},
+	};
+	const VkDependencyInfo dependencyInfo {
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.imageMemoryBarrierCount = 1,
+		.pImageMemoryBarriers = &imageBarrier,
+	};
+	vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+
+	vkCmdCopyBufferToImage(cmd, upload.stagingBuffer, image, imageBarrier.newLayout,
+						   static_cast<std::uint32_t>(copies.size()), copies.data());
+
+	// Transition the image into the destinationLayout
+	imageBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+	imageBarrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+	imageBarrier.dstStageMask = VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT;
+	imageBarrier.dstAccessMask = VK_ACCESS_2_NONE;
+	imageBarrier.oldLayout = imageBarrier.newLayout;
+	imageBarrier.newLayout = destinationLayout;
+	vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+
+	submitPendingUpload(cmd, upload);
+}
+
+void BufferUploader::submitBufferUpload(std::span<const BufferUploadRegion> regions, PendingUpload& upload) {
+	ZoneScoped;
+	// The regions are packed into one staging buffer, each starting at a 16-byte boundary
+	std::vector<VkDeviceSize> stagingOffsets; stagingOffsets.reserve(regions.size());
+	VkDeviceSize stagingSize = 0;
+	for (const auto& region : regions) {
+		stagingOffsets.emplace_back(stagingSize);
+		stagingSize += (region.data.size_bytes() + 15) & ~VkDeviceSize(15);
+	}
+
+	auto cmd = beginPendingUpload(util::max<VkDeviceSize>(stagingSize, 16), upload);
+	{
+		vk::ScopedMap<std::byte> map(allocator, upload.stagingAllocation);
+		for (std::size_t i = 0; i < regions.size(); ++i) {
+			std::memcpy(map.get() + stagingOffsets[i], regions[i].data.data(), regions[i].data.size_bytes());
+		}
+	}
+	vmaFlushAllocation(allocator, upload.stagingAllocation, 0, VK_WHOLE_SIZE);
+
+	for (std::size_t i = 0; i < regions.size(); ++i) {
+		if (regions[i].data.empty())
+			continue;
+		const VkBufferCopy copy {
+			.srcOffset = stagingOffsets[i],
+			.dstOffset = regions[i].offset,
+			.size = regions[i].data.size_bytes(),
+		};
+		vkCmdCopyBuffer(cmd, upload.stagingBuffer, regions[i].buffer, 1, &copy);
+	}
+
+	submitPendingUpload(cmd, upload);
+}
+
+bool BufferUploader::isComplete(const PendingUpload& upload) const {
+	return vkGetFenceStatus(device, upload.fence) == VK_SUCCESS;
+}
+
+void BufferUploader::destroy(PendingUpload& upload) {
+	vkDestroyFence(device, upload.fence, VK_NULL_HANDLE);
+	vkDestroyCommandPool(device, upload.commandPool, VK_NULL_HANDLE);
+	vmaDestroyBuffer(allocator, upload.stagingBuffer, upload.stagingAllocation);
+	upload = {};
+}
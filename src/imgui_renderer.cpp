@@ -12,18 +12,16 @@
 #include <vk_gltf_viewer/util.hpp>
 #include <vk_gltf_viewer/viewer.hpp>
 #include <vk_gltf_viewer/buffer_uploader.hpp>
+#include <vk_gltf_viewer/embedded_shaders.hpp>
 #include <vk_gltf_viewer/imgui_renderer.hpp>
 #include <vulkan/vk.hpp>
 #include <vulkan/debug_utils.hpp>
 #include <vulkan/fmt.hpp>
 #include <vulkan/pipeline_builder.hpp>
-#include <vulkan/cache.hpp>
 
 namespace fs = std::filesystem;
 
 namespace imgui {
-	const auto pipelineCacheFile = std::filesystem::current_path() / "cache/imgui.cache";
-
 	class ShaderLoadTask : public enki::ITaskSet {
 		Renderer* renderer;
 
@@ -32,8 +30,28 @@ namespace imgui {
 
 		void ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) override {
 			ZoneScoped;
-			vk::loadShaderModule("ui.frag.glsl.spv", renderer->device, &renderer->fragmentShader);
-			vk::loadShaderModule("ui.vert.glsl.spv", renderer->device, &renderer->vertexShader);
+			vk::loadShaderModule(shaders::find("ui.frag.glsl"), renderer->device, &renderer->fragmentShader);
+			vk::loadShaderModule(shaders::find("ui.vert.glsl"), renderer->device, &renderer->vertexShader);
+		}
+	};
+
+	class PipelineBuildTask : public enki::ITaskSet {
+		enki::Dependency dependency;
+		Renderer* renderer;
+
+	public:
+		VkResult result = VK_NOT_READY;
+		std::chrono::duration<double, std::milli> buildTime {};
+
+		explicit PipelineBuildTask(Renderer* renderer, ShaderLoadTask* shaderLoadTask) : renderer(renderer) {
+			SetDependency(dependency, shaderLoadTask);
+		}
+
+		void ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) override {
+			ZoneScoped;
+			const auto start = std::chrono::steady_clock::now();
+			result = renderer->buildPipeline();
+			buildTime = std::chrono::steady_clock::now() - start;
 		}
 	};
 } // namespace imgui
@@ -129,11 +147,7 @@ void imgui::Renderer::createFontAtlas() {
 
 void imgui::Renderer::destroy() {
 	ZoneScoped;
-	vk::PipelineCacheSaveTask cacheSaveTask(device, &pipelineCache, pipelineCacheFile);
-
 	if (volkGetLoadedDevice() != nullptr) {
-		taskScheduler.AddTaskSetToPipe(&cacheSaveTask);
-
 		for (auto& buf : buffers) {
 			vmaDestroyBuffer(allocator, buf.vertexBuffer, buf.vertexAllocation);
 			vmaDestroyBuffer(allocator, buf.indexBuffer, buf.indexAllocation);
@@ -155,13 +169,9 @@ void imgui::Renderer::destroy() {
 		vkDestroyShaderModule(device, vertexShader, nullptr);
 	}
 
-	ImGui_ImplGlfw_Shutdown();
+	if (window != nullptr)
+		ImGui_ImplGlfw_Shutdown();
 	ImGui::DestroyContext();
-
-	if (volkGetLoadedDevice() != nullptr) {
-		taskScheduler.WaitforTask(&cacheSaveTask);
-		vkDestroyPipelineCache(device, pipelineCache, nullptr);
-	}
 }
 
 VkResult imgui::Renderer::createGeometryBuffers(std::size_t index, VkDeviceSize vertexSize, VkDeviceSize indexSize) {
@@ -393,21 +403,19 @@ void imgui::Renderer::draw(VkCommandBuffer commandBuffer, VkImageView swapchainI
 	vkCmdEndRendering(commandBuffer);
 }
 
-VkResult imgui::Renderer::init(VkDevice newDevice, VmaAllocator newAllocator, GLFWwindow* window, VkFormat swapchainImageFormat) {
+VkResult imgui::Renderer::init(VkDevice newDevice, VmaAllocator newAllocator, GLFWwindow* newWindow, VkFormat newSwapchainImageFormat,
+							   VkPipelineCache newPipelineCache) {
 	ZoneScoped;
 	device = newDevice;
 	allocator = newAllocator;
-
-	vk::PipelineCacheLoadTask cacheLoadTask(device, &pipelineCache, pipelineCacheFile);
-	taskScheduler.AddTaskSetToPipe(&cacheLoadTask);
-
-	ShaderLoadTask shaderLoadTask(this);
-	taskScheduler.AddTaskSetToPipe(&shaderLoadTask);
+	window = newWindow;
+	pipelineCache = newPipelineCache;
 
 	IMGUI_CHECKVERSION();
 	ImGui::CreateContext();
 	ImGui::StyleColorsDark();
-	ImGui_ImplGlfw_InitForVulkan(window, true);
+	if (window != nullptr)
+		ImGui_ImplGlfw_InitForVulkan(window, true);
 
 	auto& io = ImGui::GetIO();
 	io.BackendFlags |= ImGuiBackendFlags_RendererHasVtxOffset;
@@ -477,7 +485,17 @@ VkResult imgui::Renderer::init(VkDevice newDevice, VmaAllocator newAllocator, GL
 		return result;
 	}
 
-	// Create the pipeline
+	// Load the shaders and build the pipeline in the background. joinPipelineBuild has to be called
+	// before the first draw.
+	swapchainImageFormat = newSwapchainImageFormat;
+	shaderLoadTask = std::make_shared<ShaderLoadTask>(this);
+	pipelineBuildTask = std::make_shared<PipelineBuildTask>(this, shaderLoadTask.get());
+	taskScheduler.AddTaskSetToPipe(shaderLoadTask.get());
+	return VK_SUCCESS;
+}
+
+VkResult imgui::Renderer::buildPipeline() {
+	ZoneScoped;
 	const VkFormat colorAttachmentFormat = swapchainImageFormat;
 	const VkPipelineRenderingCreateInfo renderingCreateInfo = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
@@ -496,7 +514,7 @@ VkResult imgui::Renderer::init(VkDevice newDevice, VmaAllocator newAllocator, GL
 		.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
 	};
 
-	auto builder = vk::GraphicsPipelineBuilder(device, nullptr)
+	auto builder = vk::GraphicsPipelineBuilder(device, nullptr, pipelineCache)
 		.setPipelineCount(1)
 		.setPipelineLayout(0, pipelineLayout)
 		.addDynamicState(0, VK_DYNAMIC_STATE_SCISSOR)
@@ -510,21 +528,22 @@ VkResult imgui::Renderer::init(VkDevice newDevice, VmaAllocator newAllocator, GL
 		.setScissorCount(0, 1U)
 		.setViewportCount(0, 1U);
 
-	taskScheduler.WaitforTask(&shaderLoadTask);
 	builder.addShaderStage(0, VK_SHADER_STAGE_VERTEX_BIT, vertexShader, "main")
 		.addShaderStage(0, VK_SHADER_STAGE_FRAGMENT_BIT, fragmentShader, "main");
 
-	taskScheduler.WaitforTask(&cacheLoadTask);
-	if (cacheLoadTask.getResult() == VK_SUCCESS) {
-		fmt::print("Successfully created ImGui pipeline cache\n");
-		builder.setPipelineCache(pipelineCache);
-	} else {
-		fmt::print(stderr, "Failed to load ImGui pipeline cache: {}\n", cacheLoadTask.getResult());
-	}
-
 	return builder.build(&pipeline);
 }
 
+VkResult imgui::Renderer::joinPipelineBuild() {
+	ZoneScoped;
+	taskScheduler.WaitforTask(pipelineBuildTask.get());
+	auto result = pipelineBuildTask->result;
+	pipelineBuildTime = pipelineBuildTask->buildTime;
+	pipelineBuildTask.reset();
+	shaderLoadTask.reset();
+	return result;
+}
+
 VkResult imgui::Renderer::initFrameData(std::uint32_t frameCount) {
 	ZoneScoped;
 	// Create the index/vertex buffers. As the swapchain implementation might have multiple
@@ -539,5 +558,6 @@ VkResult imgui::Renderer::initFrameData(std::uint32_t frameCount) {
 
 void imgui::Renderer::newFrame() {
 	ZoneScoped;
-	ImGui_ImplGlfw_NewFrame();
+	if (window != nullptr)
+		ImGui_ImplGlfw_NewFrame();
 }
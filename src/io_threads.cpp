@@ -0,0 +1,529 @@
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <limits>
+#include <thread>
+
+#if defined(_WIN32)
+#include <cstdio>
+#include <io.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if VK_GLTF_VIEWER_IO_URING
+#include <liburing.h>
+#endif
+
+#include <tracy/Tracy.hpp>
+
+#include <vk_gltf_viewer/io_threads.hpp>
+#include <vk_gltf_viewer/scheduler.hpp>
+
+namespace {
+	/** Sizes the destination of the request, and checks the requested range against the size of the file */
+	bool resizeForRange(FileReadRequest& request, std::uint64_t fileSize) {
+		if (request.offset > fileSize || (request.size.has_value() && *request.size > fileSize - request.offset))
+			return false;
+		request.bytes.resize(request.size.value_or(fileSize - request.offset));
+		return true;
+	}
+
+#if defined(_WIN32)
+	bool readBlocking(FileReadRequest& request) {
+		std::ifstream file(request.path, std::ios::binary | std::ios::ate);
+		if (!file.is_open() || !resizeForRange(request, static_cast<std::uint64_t>(file.tellg())))
+			return false;
+
+		file.seekg(static_cast<std::streamoff>(request.offset));
+		file.read(reinterpret_cast<char*>(request.bytes.data()), static_cast<std::streamsize>(request.bytes.size()));
+		return !file.fail();
+	}
+#else
+	/** Opens the file of the request and sizes its destination. Returns -1 on failure. */
+	int openForRead(FileReadRequest& request) {
+		const int fd = ::open(request.path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return -1;
+
+		struct stat status {};
+		if (::fstat(fd, &status) != 0 || !resizeForRange(request, static_cast<std::uint64_t>(status.st_size))) {
+			::close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	bool readBlocking(FileReadRequest& request) {
+		const int fd = openForRead(request);
+		if (fd < 0)
+			return false;
+
+		// pread may return less than requested, for example when interrupted by a signal
+		std::size_t done = 0;
+		while (done < request.bytes.size()) {
+			const auto result = ::pread(fd, request.bytes.data() + done, request.bytes.size() - done,
+										static_cast<off_t>(request.offset + done));
+			if (result < 0 && errno == EINTR)
+				continue;
+			if (result <= 0)
+				break;
+			done += static_cast<std::size_t>(result);
+		}
+		::close(fd);
+		return done == request.bytes.size();
+	}
+#endif
+} // namespace
+
+bool replaceFileDurably(const std::filesystem::path& path, std::span<const std::byte> data) {
+	ZoneScoped;
+	auto tempPath = path;
+	tempPath += ".tmp";
+
+#if defined(_WIN32)
+	auto* file = ::_wfopen(tempPath.c_str(), L"wb");
+	if (file == nullptr)
+		return false;
+	const bool written = std::fwrite(data.data(), 1, data.size(), file) == data.size()
+		&& std::fflush(file) == 0 && ::_commit(::_fileno(file)) == 0;
+	std::fclose(file);
+#else
+	const int fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return false;
+
+	std::size_t done = 0;
+	while (done < data.size()) {
+		const auto result = ::write(fd, data.data() + done, data.size() - done);
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result <= 0)
+			break;
+		done += static_cast<std::size_t>(result);
+	}
+	const bool written = done == data.size() && ::fsync(fd) == 0;
+	::close(fd);
+#endif
+
+	std::error_code error;
+	if (!written) {
+		std::filesystem::remove(tempPath, error);
+		return false;
+	}
+
+	// Renaming over the existing file is atomic on the same filesystem
+	std::filesystem::rename(tempPath, path, error);
+	if (error) {
+		std::filesystem::remove(tempPath, error);
+		return false;
+	}
+
+#if !defined(_WIN32)
+	// The rename itself is only durable once the directory has been flushed as well
+	const auto directory = path.has_parent_path() ? path.parent_path() : std::filesystem::path(".");
+	if (const int dirFd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC); dirFd >= 0) {
+		::fsync(dirFd);
+		::close(dirFd);
+	}
+#endif
+	return true;
+}
+
+void IoRequest::Execute() {
+	ZoneScoped;
+	const auto start = ioThreads.begin();
+	const auto bytes = execute();
+	ioThreads.complete(threadNum, start, bytes);
+}
+
+std::size_t FileReadRequest::execute() {
+	ZoneScoped;
+	succeeded = readBlocking(*this);
+	const auto readBytes = succeeded ? bytes.size() : 0;
+	if (onRead)
+		onRead(*this);
+	return readBytes;
+}
+
+std::size_t FileReadBatch::execute() {
+	ZoneScoped;
+#if VK_GLTF_VIEWER_IO_URING
+	if (auto* ring = ioThreads.getRing(threadNum); ring != nullptr)
+		return readWithRing(*ring, ioThreads.getQueueDepth());
+#endif
+
+	std::size_t bytes = 0;
+	for (auto* request : requests) {
+		bytes += request->execute();
+	}
+	return bytes;
+}
+
+#if VK_GLTF_VIEWER_IO_URING
+std::size_t FileReadBatch::readWithRing(io_uring& ring, std::uint32_t depth) {
+	ZoneScoped;
+	struct File {
+		int fd = -1;
+		std::uint32_t pendingReads = 0; // Reads which have been issued, but not completed yet
+		bool issued = false; // Whether every read of the file has been issued
+		bool failed = false;
+		bool finished = false;
+	};
+	struct Read {
+		std::size_t file;
+		std::uint64_t offset; // Relative to the start of the request
+		std::uint32_t size;
+	};
+
+	std::vector<File> files(requests.size());
+	std::vector<Read> reads; // Indexed by the user data of the submission, and reused once a read completes
+	std::vector<std::size_t> freeReads;
+	std::deque<Read> retries; // Short reads, which continue where they stopped
+	std::size_t nextFile = 0;
+	std::uint64_t nextOffset = 0;
+	std::uint32_t prepared = 0, inFlight = 0;
+	std::size_t bytesRead = 0;
+	bool aborted = false;
+
+	auto finish = [&](std::size_t fileIdx) {
+		auto& file = files[fileIdx];
+		auto& request = *requests[fileIdx];
+		if (file.fd >= 0)
+			::close(file.fd);
+		file.fd = -1;
+		file.finished = true;
+		request.succeeded = !file.failed;
+		if (request.succeeded)
+			bytesRead += request.bytes.size();
+		if (request.onRead)
+			request.onRead(request);
+	};
+	auto finishIfDone = [&](std::size_t fileIdx) {
+		if (files[fileIdx].issued && files[fileIdx].pendingReads == 0)
+			finish(fileIdx);
+	};
+
+	// Files are only opened once their first read is issued, which keeps the open files and memory bounded by the queue depth
+	auto nextRead = [&]() -> std::optional<Read> {
+		if (aborted)
+			return std::nullopt;
+		if (!retries.empty()) {
+			auto read = retries.front();
+			retries.pop_front();
+			return read;
+		}
+		while (nextFile < requests.size()) {
+			const auto fileIdx = nextFile;
+			auto& file = files[fileIdx];
+			auto& request = *requests[fileIdx];
+			if (nextOffset == 0) {
+				file.fd = openForRead(request);
+				file.failed = file.fd < 0;
+			}
+			if (file.failed || request.bytes.empty()) {
+				file.issued = true;
+				++nextFile;
+				nextOffset = 0;
+				finishIfDone(fileIdx);
+				continue;
+			}
+
+			const Read read {
+				.file = fileIdx,
+				.offset = nextOffset,
+				.size = static_cast<std::uint32_t>(std::min<std::uint64_t>(readChunkSize, request.bytes.size() - nextOffset)),
+			};
+			++file.pendingReads;
+			nextOffset += read.size;
+			if (nextOffset == request.bytes.size()) {
+				file.issued = true;
+				++nextFile;
+				nextOffset = 0;
+			}
+			return read;
+		}
+		return std::nullopt;
+	};
+
+	// Cancels every read in flight, whose completions then arrive with -ECANCELED
+	void* const cancelTag = reinterpret_cast<void*>(std::numeric_limits<std::uintptr_t>::max());
+	auto cancelInFlight = [&]() -> bool {
+		aborted = true;
+		std::vector<bool> isFree(reads.size(), false);
+		for (auto slot : freeReads)
+			isFree[slot] = true;
+		for (std::size_t slot = 0; slot < reads.size(); ++slot) {
+			if (isFree[slot])
+				continue;
+			auto* sqe = io_uring_get_sqe(&ring);
+			if (sqe == nullptr)
+				return false;
+			io_uring_prep_cancel(sqe, reinterpret_cast<void*>(slot), 0);
+			io_uring_sqe_set_data(sqe, cancelTag);
+		}
+		return io_uring_submit(&ring) >= 0;
+	};
+
+	while (true) {
+		while (prepared + inFlight < depth) {
+			auto read = nextRead();
+			if (!read)
+				break;
+			auto* sqe = io_uring_get_sqe(&ring);
+			if (sqe == nullptr) {
+				retries.push_front(*read);
+				break;
+			}
+
+			std::size_t slot = reads.size();
+			if (freeReads.empty()) {
+				reads.emplace_back(*read);
+			} else {
+				slot = freeReads.back();
+				freeReads.pop_back();
+				reads[slot] = *read;
+			}
+			auto& request = *requests[read->file];
+			io_uring_prep_read(sqe, files[read->file].fd, request.bytes.data() + read->offset, read->size, request.offset + read->offset);
+			io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(slot));
+			++prepared;
+		}
+		if (prepared + inFlight == 0)
+			break;
+
+		if (prepared > 0) {
+			const int result = io_uring_submit_and_wait(&ring, 1);
+			if (result >= 0) {
+				inFlight += prepared;
+				prepared = 0;
+			} else if (result != -EINTR && result != -EAGAIN && result != -EBUSY) {
+				// The prepared reads never reached the kernel. We still have to wait for the ones which did.
+				aborted = true;
+				prepared = 0;
+			}
+		} else {
+			io_uring_cqe* cqe = nullptr;
+			const int result = io_uring_wait_cqe(&ring, &cqe);
+			if (result < 0 && result != -EINTR && result != -EAGAIN) {
+				// The kernel still owns the buffers of the reads in flight, so they are cancelled and drained before we give up.
+				// A ring which already failed, or fails again, is not waited on any further, and we leak their buffers below.
+				if (aborted || !cancelInFlight())
+					break;
+				continue;
+			}
+		}
+
+		io_uring_cqe* cqe = nullptr;
+		unsigned head = 0, count = 0;
+		io_uring_for_each_cqe(&ring, head, cqe) {
+			++count;
+			if (io_uring_cqe_get_data(cqe) == cancelTag)
+				continue;
+			--inFlight;
+			const auto slot = reinterpret_cast<std::size_t>(io_uring_cqe_get_data(cqe));
+			auto read = reads[slot];
+			freeReads.emplace_back(slot);
+
+			auto& file = files[read.file];
+			if (cqe->res == -EINTR || cqe->res == -EAGAIN) {
+				retries.emplace_back(read);
+				continue;
+			}
+			if (cqe->res > 0 && static_cast<std::uint32_t>(cqe->res) < read.size) {
+				read.offset += static_cast<std::uint32_t>(cqe->res);
+				read.size -= static_cast<std::uint32_t>(cqe->res);
+				retries.emplace_back(read);
+				continue;
+			}
+			if (cqe->res <= 0)
+				file.failed = true;
+			--file.pendingReads;
+			finishIfDone(read.file);
+		}
+		io_uring_cq_advance(&ring, count);
+	}
+
+	// A ring which failed still holds the reads we prepared or cancelled, so this thread stops using it
+	if (aborted)
+		ioThreads.dropRing(threadNum);
+
+	// The kernel may still write into the buffers of reads we could not drain, so they are never freed
+	if (inFlight > 0) {
+		for (std::size_t i = 0; i < files.size(); ++i) {
+			if (!files[i].finished && files[i].pendingReads > 0)
+				new std::vector<std::uint8_t>(std::move(requests[i]->bytes));
+		}
+	}
+
+	// Anything we could not read is reported as failed, so that every onRead gets called
+	for (std::size_t i = 0; i < files.size(); ++i) {
+		if (!files[i].finished) {
+			files[i].failed = true;
+			finish(i);
+		}
+	}
+	return bytesRead;
+}
+#else
+std::size_t FileReadBatch::readWithRing(io_uring& ring, std::uint32_t depth) {
+	return 0;
+}
+#endif
+
+#if VK_GLTF_VIEWER_IO_URING
+struct IoThreads::Ring {
+	io_uring ring {};
+
+	~Ring() {
+		io_uring_queue_exit(&ring);
+	}
+};
+#else
+struct IoThreads::Ring {};
+#endif
+
+void IoThreads::LoopTask::Execute() {
+	// Sleep until new pinned tasks arrive for this thread. WaitforAllAndShutdown wakes us up for the last time.
+	while (!taskScheduler.GetIsShutdownRequested()) {
+		taskScheduler.WaitForNewPinnedTasks();
+		taskScheduler.RunPinnedTasks();
+	}
+}
+
+IoThreads::IoThreads() = default;
+IoThreads::~IoThreads() = default;
+
+bool IoThreads::isIoUringSupported() noexcept {
+#if VK_GLTF_VIEWER_IO_URING
+	return true;
+#else
+	return false;
+#endif
+}
+
+void IoThreads::start(std::uint32_t threadCount, std::uint32_t depth, IoBackend requestedBackend) {
+	queueDepth = depth;
+	queuedRequests = std::make_unique<std::atomic<std::uint32_t>[]>(threadCount);
+	loopTasks = std::vector<LoopTask>(threadCount);
+	firstThread = taskScheduler.GetNumTaskThreads() - threadCount;
+
+	// io_uring may be disabled by the kernel configuration or a seccomp filter, in which case we use blocking reads
+	backend = IoBackend::Blocking;
+#if VK_GLTF_VIEWER_IO_URING
+	if (requestedBackend == IoBackend::IoUring) {
+		rings.resize(threadCount);
+		backend = IoBackend::IoUring;
+		for (auto& ring : rings) {
+			ring = std::make_unique<Ring>();
+			if (io_uring_queue_init(depth, &ring->ring, 0) < 0) {
+				ring.reset();
+				rings.clear();
+				backend = IoBackend::Blocking;
+				break;
+			}
+		}
+	}
+#endif
+
+	for (std::uint32_t i = 0; auto& task : loopTasks) {
+		task.threadNum = firstThread + i++;
+		taskScheduler.AddPinnedTask(&task);
+	}
+}
+
+void IoThreads::submit(IoRequest* request) {
+	ZoneScoped;
+	const auto threadCount = getThreadCount();
+	while (true) {
+		// Start searching at a rotating thread, so that ties don't always go to the first thread
+		const auto start = nextThread.fetch_add(1, std::memory_order_relaxed);
+		for (std::uint32_t i = 0; i < threadCount; ++i) {
+			const auto thread = (start + i) % threadCount;
+			auto queued = queuedRequests[thread].load(std::memory_order_relaxed);
+			if (queued < queueDepth && queuedRequests[thread].compare_exchange_strong(queued, queued + 1)) {
+				request->threadNum = firstThread + thread;
+				requestCount.fetch_add(1, std::memory_order_relaxed);
+				taskScheduler.AddPinnedTask(request);
+				return;
+			}
+		}
+
+		// Every queue is full. Passing no task runs a single other task if one is available.
+		taskScheduler.WaitforTask(nullptr);
+		std::this_thread::yield();
+	}
+}
+
+std::vector<std::unique_ptr<FileReadBatch>> IoThreads::submitReads(std::span<FileReadRequest* const> reads) {
+	ZoneScoped;
+	std::vector<std::unique_ptr<FileReadBatch>> batches;
+	const auto batchCount = std::min<std::size_t>(getThreadCount(), reads.size());
+	for (std::size_t i = 0; i < batchCount; ++i) {
+		auto& batch = *batches.emplace_back(std::make_unique<FileReadBatch>());
+		for (std::size_t j = i; j < reads.size(); j += batchCount) {
+			batch.requests.emplace_back(reads[j]);
+		}
+		submit(&batch);
+	}
+	return batches;
+}
+
+std::chrono::steady_clock::time_point IoThreads::begin() noexcept {
+	const auto now = std::chrono::steady_clock::now();
+	std::lock_guard lock(busyMutex);
+	if (busyThreads++ == 0)
+		busyStart = now;
+	return now;
+}
+
+void IoThreads::complete(std::uint32_t threadNum, std::chrono::steady_clock::time_point start, std::size_t bytes) noexcept {
+	const auto now = std::chrono::steady_clock::now();
+	byteCount.fetch_add(bytes, std::memory_order_relaxed);
+	waitNanoseconds.fetch_add(std::chrono::nanoseconds(now - start).count(), std::memory_order_relaxed);
+	{
+		std::lock_guard lock(busyMutex);
+		if (--busyThreads == 0)
+			busyTime += now - busyStart;
+	}
+	queuedRequests[threadNum - firstThread].fetch_sub(1, std::memory_order_release);
+}
+
+io_uring* IoThreads::getRing(std::uint32_t threadNum) const noexcept {
+#if VK_GLTF_VIEWER_IO_URING
+	if (!rings.empty() && rings[threadNum - firstThread])
+		return &rings[threadNum - firstThread]->ring;
+#endif
+	return nullptr;
+}
+
+void IoThreads::dropRing(std::uint32_t threadNum) noexcept {
+	rings[threadNum - firstThread].reset();
+}
+
+std::string_view IoThreads::getBackendName() const noexcept {
+	switch (backend) {
+		case IoBackend::IoUring:
+			return "io_uring";
+		case IoBackend::Blocking:
+		default:
+#if defined(_WIN32)
+			return "blocking";
+#else
+			return "pread";
+#endif
+	}
+}
+
+IoStatistics IoThreads::getStatistics() const noexcept {
+	std::lock_guard lock(busyMutex);
+	return {
+		.requests = requestCount.load(std::memory_order_relaxed),
+		.bytes = byteCount.load(std::memory_order_relaxed),
+		.waitTime = std::chrono::nanoseconds(waitNanoseconds.load(std::memory_order_relaxed)),
+		.busyTime = busyTime,
+	};
+}
@@ -1,10 +1,22 @@
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <functional>
 #include <iostream>
+#include <limits>
+#include <numeric>
+#include <span>
 #include <string_view>
 
 #include <TaskScheduler.h>
 
 #include "stb_image.h"
+#include "stb_image_write.h"
 
 #include <tracy/Tracy.hpp>
 
@@ -15,6 +27,7 @@
 
 #include <vulkan/pipeline_builder.hpp>
 #include <vulkan/debug_utils.hpp>
+#include <vulkan/cache.hpp>
 
 #include <imgui.h>
 #include <imgui_stdlib.h>
@@ -35,14 +48,21 @@
 #include <fastgltf/glm_element_traits.hpp>
 #include <fastgltf/tools.hpp>
 
+// fastgltf parses the JSON with simdjson, which we reuse for extensions fastgltf does not support
+#include <simdjson.h>
+
 #include <meshoptimizer.h>
 
 #include <vk_gltf_viewer/util.hpp>
 #include <vk_gltf_viewer/viewer.hpp>
 #include <vk_gltf_viewer/buffer_uploader.hpp>
+#include <vk_gltf_viewer/embedded_shaders.hpp>
 #include <vk_gltf_viewer/scheduler.hpp>
+#include <vk_gltf_viewer/task_graph.hpp>
+#include <vk_gltf_viewer/io_threads.hpp>
 
 enki::TaskScheduler taskScheduler;
+IoThreads ioThreads;
 
 struct Viewer;
 
@@ -296,8 +316,8 @@ void Viewer::setupVulkanInstance() {
 
     vkb::InstanceBuilder builder;
 
-    // Enable GLFW extensions
-    {
+    // Enable GLFW extensions. Headless rendering does not need any surface extensions.
+    if (!headless) {
         std::uint32_t glfwExtensionCount = 0;
         const auto* glfwExtensionArray = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
         builder.enable_extensions(glfwExtensionCount, glfwExtensionArray);
@@ -319,10 +339,17 @@ void Viewer::setupVulkanInstance() {
     volkLoadInstanceOnly(instance);
 }
 
+std::unique_lock<std::mutex> Viewer::lockGraphicsQueue() const {
+	if (graphicsQueueLock == nullptr)
+		return {};
+	return std::unique_lock(*graphicsQueueLock);
+}
+
 void Viewer::setupVulkanDevice() {
 	ZoneScoped;
 	const VkPhysicalDeviceFeatures vulkan10features {
 		.multiDrawIndirect = VK_TRUE,
+		.drawIndirectFirstInstance = VK_TRUE, // The meshlet draws of the vertex shading path pass their draw in firstInstance
 	};
 
 	const VkPhysicalDeviceVulkan11Features vulkan11Features {
@@ -335,7 +362,10 @@ void Viewer::setupVulkanDevice() {
 		.storageBuffer8BitAccess = VK_TRUE,
 		.shaderInt8 = VK_TRUE,
 		.shaderSampledImageArrayNonUniformIndexing = VK_TRUE,
+		.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+		.descriptorBindingUpdateUnusedWhilePending = VK_TRUE,
 		.descriptorBindingPartiallyBound = VK_TRUE,
+		.descriptorBindingVariableDescriptorCount = VK_TRUE,
 		.runtimeDescriptorArray = VK_TRUE,
 		.scalarBlockLayout = VK_TRUE,
 		.hostQueryReset = VK_TRUE,
@@ -356,40 +386,125 @@ void Viewer::setupVulkanDevice() {
     };
 
 	// Select an appropriate device with the given requirements.
-    vkb::PhysicalDeviceSelector selector(instance);
+	auto selectDevice = [&](bool meshShading) {
+		vkb::PhysicalDeviceSelector selector(instance);
+
+		// Headless rendering neither has a surface nor presents, which allows using e.g. software implementations.
+		if (headless) {
+			selector.require_present(false);
+		} else {
+			selector.set_surface(surface).require_present();
+		}
+
+		if (meshShading) {
+			selector
+				.add_required_extension(VK_EXT_MESH_SHADER_EXTENSION_NAME)
+				.add_required_extension_features(meshShaderFeatures);
+		}
 
-    auto selectionResult = selector
-            .set_surface(surface)
-            .set_minimum_version(1, 3) // We want Vulkan 1.3.
+		return selector
+			.set_minimum_version(1, 3) // We want Vulkan 1.3.
 			.set_required_features(vulkan10features)
 			.set_required_features_11(vulkan11Features)
-            .set_required_features_12(vulkan12Features)
-            .set_required_features_13(vulkan13Features)
-            .add_required_extension(VK_EXT_MESH_SHADER_EXTENSION_NAME)
+			.set_required_features_12(vulkan12Features)
+			.set_required_features_13(vulkan13Features)
 #if TRACY_ENABLE
 			.add_required_extension(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME)
 #endif
-            .add_required_extension_features(meshShaderFeatures)
-            .require_present()
-            .require_dedicated_transfer_queue()
-            .select();
-    checkResult(selectionResult);
+			.select();
+	};
+
+	// Without a forced render path, we fall back to vertex shading if no device supports mesh shaders.
+	renderPath = forcedRenderPath.value_or(RenderPath::MeshShading);
+	auto selectionResult = selectDevice(renderPath == RenderPath::MeshShading);
+	if (!selectionResult && !forcedRenderPath.has_value()) {
+		fmt::print(stderr, "No device is suitable for mesh shading ({}), falling back to vertex shading\n",
+				   selectionResult.error().message());
+		renderPath = RenderPath::VertexShading;
+		selectionResult = selectDevice(false);
+	}
+	checkResult(selectionResult);
+
+	// Stage flags of the mesh shader extension are only valid if it's enabled
+	meshletShaderStages = renderPath == RenderPath::MeshShading
+		? VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT
+		: VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
 
 	VmaAllocatorCreateFlags allocatorFlags = 0;
 	auto& physicalDevice = selectionResult.value();
+
+	// The mesh shader properties suggest the default meshlet limits for this device
+	if (renderPath == RenderPath::MeshShading) {
+		meshShaderProperties = {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_PROPERTIES_EXT,
+		};
+		VkPhysicalDeviceProperties2 properties {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+			.pNext = &meshShaderProperties,
+		};
+		vkGetPhysicalDeviceProperties2(physicalDevice.physical_device, &properties);
+	}
+	meshletLimits = getDefaultMeshletLimits();
+
+	// A geometry buffer can't be larger than a single buffer or allocation may be
+	{
+		VkPhysicalDeviceVulkan13Properties vulkan13Properties {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_PROPERTIES,
+		};
+		VkPhysicalDeviceVulkan11Properties vulkan11Properties {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_PROPERTIES,
+			.pNext = &vulkan13Properties,
+		};
+		VkPhysicalDeviceProperties2 properties {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+			.pNext = &vulkan11Properties,
+		};
+		vkGetPhysicalDeviceProperties2(physicalDevice.physical_device, &properties);
+		maxGeometryBufferSize = util::min(vulkan11Properties.maxMemoryAllocationSize, vulkan13Properties.maxBufferSize);
+		maxShardSize = util::min(forcedMaxShardSize.value_or(defaultMaxShardSize), maxGeometryBufferSize);
+	}
 	if (physicalDevice.enable_extension_if_present(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) {
 		allocatorFlags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
 	}
 
-	// Generate the queue descriptions for vkb. Use one queue for everything except
-	// for dedicated transfer queues.
+	// Pipeline statistics are only used for the statistics UI, so they're optional. Task and mesh
+	// shader invocations additionally require meshShaderQueries.
+	if (physicalDevice.enable_features_if_present(VkPhysicalDeviceFeatures { .pipelineStatisticsQuery = VK_TRUE })) {
+		pipelineStatisticsFlags = VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT
+			| VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT
+			| VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+		const VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderQueryFeatures {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT,
+			.meshShaderQueries = VK_TRUE,
+		};
+		if (renderPath == RenderPath::MeshShading && physicalDevice.enable_extension_features_if_present(meshShaderQueryFeatures)) {
+			pipelineStatisticsFlags |= VK_QUERY_PIPELINE_STATISTIC_TASK_SHADER_INVOCATIONS_BIT_EXT
+				| VK_QUERY_PIPELINE_STATISTIC_MESH_SHADER_INVOCATIONS_BIT_EXT;
+		}
+	}
+
+	// Generate the queue descriptions for vkb. Use one queue for everything except for dedicated transfer queues.
+	// Software implementations like lavapipe often have no dedicated transfer queue, in which case the uploads
+	// use a second queue of the graphics family if there is one.
 	std::vector<vkb::CustomQueueDescription> queues;
 	auto queueFamilies = physicalDevice.get_queue_families();
+	const auto isDedicatedTransferFamily = [&](std::uint32_t i) {
+		// Does not support graphics or present
+		return (queueFamilies[i].queueFlags & VK_QUEUE_TRANSFER_BIT) && (queueFamilies[i].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) == 0;
+	};
+	std::optional<std::uint32_t> transferFamily;
+	for (std::uint32_t i = 0; i < queueFamilies.size() && !transferFamily.has_value(); i++) {
+		if (isDedicatedTransferFamily(i))
+			transferFamily = i;
+	}
 	for (std::uint32_t i = 0; i < queueFamilies.size(); i++) {
 		std::size_t queueCount = 1;
-		// Dedicated transfer queue; does not support graphics or present
-		if ((queueFamilies[i].queueFlags & VK_QUEUE_TRANSFER_BIT) && (queueFamilies[i].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) == 0)
+		if (isDedicatedTransferFamily(i)) {
 			queueCount = queueFamilies[i].queueCount;
+		} else if (!transferFamily.has_value() && (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+			queueCount = util::min(2U, queueFamilies[i].queueCount);
+		}
 		std::vector<float> priorities(queueCount, 1.0f);
 		queues.emplace_back(i, std::move(priorities));
 	}
@@ -435,20 +550,45 @@ void Viewer::setupVulkanDevice() {
 	deletionQueue.push([&]() {
 		vmaDestroyAllocator(allocator);
 	});
+	deferredDestruction.init(device, allocator);
 
 	// Get the queues
     auto graphicsQueueRes = device.get_queue(vkb::QueueType::graphics);
     checkResult(graphicsQueueRes);
     graphicsQueue = graphicsQueueRes.value();
 
-	auto transferQueueIndexRes = device.get_dedicated_queue_index(vkb::QueueType::transfer);
-	checkResult(transferQueueIndexRes);
+	auto graphicsQueueIndexRes = device.get_queue_index(vkb::QueueType::graphics);
+	checkResult(graphicsQueueIndexRes);
 
-	BufferUploader::getInstance().init(device, allocator, transferQueueIndexRes.value(),
-									   queueFamilies[transferQueueIndexRes.value()].queueCount);
+	auto& uploader = BufferUploader::getInstance();
+	if (transferFamily.has_value()) {
+		uploader.init(device, allocator, *transferFamily, 0, queueFamilies[*transferFamily].queueCount);
+	} else {
+		// Without a second graphics queue, the uploads and the frames have to take turns submitting to the same queue
+		const auto graphicsFamily = graphicsQueueIndexRes.value();
+		const bool secondQueue = queueFamilies[graphicsFamily].queueCount > 1;
+		uploader.init(device, allocator, graphicsFamily, secondQueue ? 1 : 0, 1);
+		if (!secondQueue) {
+			graphicsQueueLock = uploader.getQueueLock(graphicsQueue);
+		}
+		fmt::print(stderr, "No dedicated transfer queue, uploading through {} graphics queue\n", secondQueue ? "a second" : "the");
+	}
 	deletionQueue.push([&]() {
 		BufferUploader::getInstance().destroy();
 	});
+
+	// Create the query pools for the built-in GPU profiler. If the graphics queue doesn't support
+	// timestamps, the profiler simply does nothing.
+	result = gpuProfiler.init(device, device.physical_device.properties.limits.timestampPeriod,
+							  queueFamilies[graphicsQueueIndexRes.value()].timestampValidBits, frameOverlap);
+	if (result == VK_ERROR_FEATURE_NOT_PRESENT) {
+		fmt::print(stderr, "The graphics queue does not support timestamps, GPU timings will not be available\n");
+	} else {
+		vk::checkResult(result, "Failed to create GPU profiler query pools: {}");
+	}
+	deletionQueue.push([&]() {
+		gpuProfiler.destroy();
+	});
 }
 
 void Viewer::rebuildSwapchain(std::uint32_t width, std::uint32_t height) {
@@ -457,14 +597,16 @@ void Viewer::rebuildSwapchain(std::uint32_t width, std::uint32_t height) {
     auto swapchainResult = swapchainBuilder
             .set_old_swapchain(swapchain)
 			.set_desired_extent(width, height)
+			.set_desired_min_image_count(static_cast<std::uint32_t>(frameOverlap) + 1) // So that acquiring never waits on the frames in flight
             .build();
     checkResult(swapchainResult);
 
     // The swapchain is not added to the deletionQueue, as it gets recreated throughout the application's lifetime.
+	// The frames in flight may still render into the old images, so they are only destroyed once they've retired.
 	for (auto& view : swapchainImageViews)
-		vkDestroyImageView(device, view, nullptr);
+		deferredDestruction.destroyImageView(frameNumber, view);
 	swapchainImageViews.clear();
-    vkb::destroy_swapchain(swapchain);
+	deferredDestruction.destroySwapchain(frameNumber, swapchain.swapchain);
     swapchain = swapchainResult.value();
 
 	swapchainImages = std::move(vk::enumerateVector<VkImage, decltype(swapchainImages)>(vkGetSwapchainImagesKHR, device, swapchain));
@@ -474,11 +616,70 @@ void Viewer::rebuildSwapchain(std::uint32_t width, std::uint32_t height) {
 	for (auto& view : imageViewResult.value())
 		swapchainImageViews.emplace_back(view);
 
-	if (depthImage != VK_NULL_HANDLE) {
-		vkDestroyImageView(device, depthImageView, VK_NULL_HANDLE);
-		vmaDestroyImage(allocator, depthImage, depthImageAllocation);
+	createDepthImage(width, height);
+}
+
+void Viewer::createOffscreenTargets(std::uint32_t width, std::uint32_t height) {
+	ZoneScoped;
+	// Fill in the swapchain properties which the pipelines and the camera read, without creating a swapchain.
+	swapchain.image_format = offscreenImageFormat;
+	swapchain.extent = { width, height };
+
+	// Every frame in flight renders into its own image, just like with a swapchain.
+	const VmaAllocationCreateInfo allocationInfo {
+		.usage = VMA_MEMORY_USAGE_GPU_ONLY,
+	};
+	const VkImageCreateInfo imageInfo {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+		.imageType = VK_IMAGE_TYPE_2D,
+		.format = offscreenImageFormat,
+		.extent = {
+			.width = width,
+			.height = height,
+			.depth = 1,
+		},
+		.mipLevels = 1,
+		.arrayLayers = 1,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.tiling = VK_IMAGE_TILING_OPTIMAL,
+		.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+	};
+	for (std::size_t i = 0; i < frameOverlap; ++i) {
+		auto& image = swapchainImages.emplace_back();
+		auto& allocation = offscreenImageAllocations.emplace_back();
+		auto result = vmaCreateImage(allocator, &imageInfo, &allocationInfo, &image, &allocation, VK_NULL_HANDLE);
+		vk::checkResult(result, "Failed to create offscreen image: {}");
+		vk::setDebugUtilsName(device, image, fmt::format("Offscreen image {}", i));
+
+		const VkImageViewCreateInfo imageViewInfo {
+			.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+			.image = image,
+			.viewType = VK_IMAGE_VIEW_TYPE_2D,
+			.format = imageInfo.format,
+			.subresourceRange = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.baseMipLevel = 0,
+				.levelCount = 1,
+				.baseArrayLayer = 0,
+				.layerCount = 1,
+			}
+		};
+		auto& view = swapchainImageViews.emplace_back();
+		result = vkCreateImageView(device, &imageViewInfo, VK_NULL_HANDLE, &view);
+		vk::checkResult(result, "Failed to create offscreen image view: {}");
 	}
 
+	createDepthImage(width, height);
+}
+
+void Viewer::createDepthImage(std::uint32_t width, std::uint32_t height) {
+	ZoneScoped;
+	// The frames in flight may still use the previous depth image
+	deferredDestruction.destroyImageView(frameNumber, depthImageView);
+	deferredDestruction.destroyImage(frameNumber, depthImage, depthImageAllocation);
+
 	const VmaAllocationCreateInfo allocationInfo {
 		.usage = VMA_MEMORY_USAGE_GPU_ONLY,
 	};
@@ -557,12 +758,18 @@ void Viewer::createDescriptorPool() {
 void Viewer::buildCameraDescriptor() {
 	ZoneScoped;
 	// The camera descriptor layout
-	std::array<VkDescriptorSetLayoutBinding, 1> layoutBindings = {{
+	std::array<VkDescriptorSetLayoutBinding, 2> layoutBindings = {{
 		{
 			.binding = 0,
 			.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
 			.descriptorCount = 1,
-			.stageFlags = VK_SHADER_STAGE_MESH_BIT_EXT | VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_VERTEX_BIT,
+			.stageFlags = meshletShaderStages | VK_SHADER_STAGE_VERTEX_BIT,
+		},
+		{
+			.binding = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = meshletShaderStages,
 		},
 	}};
 	const VkDescriptorSetLayoutCreateInfo descriptorLayoutCreateInfo {
@@ -595,8 +802,8 @@ void Viewer::buildCameraDescriptor() {
 	vk::checkResult(result, "Failed to allocate camera descriptor sets: {}");
 
 	// Generate descriptor writes to update the descriptor
-	std::array<VkDescriptorBufferInfo, frameOverlap> bufferInfos {};
-	std::array<VkWriteDescriptorSet, frameOverlap> descriptorWrites {};
+	std::vector<VkDescriptorBufferInfo> bufferInfos(frameOverlap * 2);
+	std::vector<VkWriteDescriptorSet> descriptorWrites(frameOverlap * 2);
 	cameraBuffers.resize(frameOverlap);
 
 	for (std::size_t i = 0; auto& cameraBuffer : cameraBuffers) {
@@ -623,24 +830,62 @@ void Viewer::buildCameraDescriptor() {
 			vmaDestroyBuffer(allocator, cameraBuffer.handle, cameraBuffer.allocation);
 		});
 
+		// Create the culling statistics buffer. The task shader increments the counters, and the
+		// host reads and resets them once the frame's fence has been signaled.
+		const VmaAllocationCreateInfo statsAllocationCreateInfo {
+			.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT,
+			.usage = VMA_MEMORY_USAGE_GPU_TO_CPU,
+			.requiredFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		};
+		const VkBufferCreateInfo statsBufferCreateInfo {
+			.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+			.size = sizeof(CullingStats),
+			.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		};
+		result = vmaCreateBuffer(allocator, &statsBufferCreateInfo, &statsAllocationCreateInfo,
+								 &cameraBuffer.cullingStatsHandle, &cameraBuffer.cullingStatsAllocation, VK_NULL_HANDLE);
+		vk::checkResult(result, "Failed to allocate culling statistics buffer: {}");
+		vk::setDebugUtilsName(device, cameraBuffer.cullingStatsHandle, fmt::format("Culling statistics buffer {}", i));
+
+		deletionQueue.push([&]() {
+			vmaDestroyBuffer(allocator, cameraBuffer.cullingStatsHandle, cameraBuffer.cullingStatsAllocation);
+		});
+
+		{
+			vk::ScopedMap<CullingStats> map(allocator, cameraBuffer.cullingStatsAllocation);
+			*map.get() = {};
+		}
+
 		// Initialise the camera descriptor set
-		const VkDescriptorBufferInfo bufferInfo = {
+		bufferInfos[i * 2] = {
 			.buffer = cameraBuffer.handle,
 			.offset = 0,
 			.range = VK_WHOLE_SIZE,
 		};
-		bufferInfos[i] = bufferInfo;
+		bufferInfos[i * 2 + 1] = {
+			.buffer = cameraBuffer.cullingStatsHandle,
+			.offset = 0,
+			.range = VK_WHOLE_SIZE,
+		};
 
-		const VkWriteDescriptorSet descriptorWrite = {
+		descriptorWrites[i * 2] = {
 			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
 			.dstSet = cameraBuffer.cameraSet,
 			.dstBinding = 0,
 			.dstArrayElement = 0,
 			.descriptorCount = 1,
 			.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-			.pBufferInfo = &bufferInfos[i],
+			.pBufferInfo = &bufferInfos[i * 2],
+		};
+		descriptorWrites[i * 2 + 1] = {
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = cameraBuffer.cameraSet,
+			.dstBinding = 1,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.pBufferInfo = &bufferInfos[i * 2 + 1],
 		};
-		descriptorWrites[i] = descriptorWrite;
 		++i;
 	}
 
@@ -649,143 +894,357 @@ void Viewer::buildCameraDescriptor() {
 						   descriptorWrites.data(), 0, nullptr);
 }
 
+void Viewer::createStatisticsQueries() {
+	ZoneScoped;
+	if (pipelineStatisticsFlags == 0)
+		return;
+
+	const VkQueryPoolCreateInfo poolInfo {
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+		.queryCount = 1,
+		.pipelineStatistics = pipelineStatisticsFlags,
+	};
+	pipelineStatisticsPools.resize(frameOverlap);
+	for (std::size_t i = 0; auto& pool : pipelineStatisticsPools) {
+		auto result = vkCreateQueryPool(device, &poolInfo, VK_NULL_HANDLE, &pool);
+		vk::checkResult(result, "Failed to create pipeline statistics query pool: {}");
+		vk::setDebugUtilsName(device, pool, fmt::format("Pipeline statistics queries {}", i++));
+
+		vkResetQueryPool(device, pool, 0, 1);
+	}
+
+	deletionQueue.push([&]() {
+		for (auto& pool : pipelineStatisticsPools)
+			vkDestroyQueryPool(device, pool, VK_NULL_HANDLE);
+	});
+}
+
+/** Creates a shader module from the embedded SPIR-V on a worker thread */
+struct ShaderModuleLoadTask : public enki::ITaskSet {
+	VkDevice device;
+	std::string name; // Owned, as the names of shader variants are built at runtime
+	VkShaderModule module = VK_NULL_HANDLE;
+	VkResult result = VK_NOT_READY;
+
+	explicit ShaderModuleLoadTask(VkDevice device, std::string name) noexcept : device(device), name(std::move(name)) {
+		m_SetSize = 1;
+	}
+
+	void ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) override {
+		ZoneScoped;
+		result = vk::loadShaderModule(shaders::find(name), device, &module);
+	}
+};
+
+/** Builds pipelines once every shader module they use has been loaded */
+struct PipelineBuildTask : public enki::ITaskSet {
+	std::string name;
+	std::vector<std::shared_ptr<ShaderModuleLoadTask>> shaders;
+	std::vector<enki::Dependency> dependencies;
+	std::function<VkResult()> build;
+
+	VkResult result = VK_NOT_READY;
+	std::chrono::duration<double, std::milli> buildTime {};
+
+	explicit PipelineBuildTask(std::string name, std::vector<std::shared_ptr<ShaderModuleLoadTask>> shaderTasks, std::function<VkResult()> build)
+			: name(std::move(name)), shaders(std::move(shaderTasks)), dependencies(shaders.size()), build(std::move(build)) {
+		m_SetSize = 1;
+		// The shader tasks must not have been started yet, as enkiTS would otherwise miss their completion.
+		for (std::size_t i = 0; i < shaders.size(); ++i) {
+			SetDependency(dependencies[i], shaders[i].get());
+		}
+	}
+
+	void ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) override {
+		ZoneScoped;
+		for (auto& shader : shaders) {
+			if (shader->result != VK_SUCCESS) {
+				result = shader->result;
+				return;
+			}
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		result = build();
+		buildTime = std::chrono::steady_clock::now() - start;
+	}
+};
+
+/** The state shared by the material pass variants of both render paths, which has to outlive the pipeline builder */
+struct MaterialPassStates {
+	VkFormat colorAttachmentFormat;
+	VkPipelineRenderingCreateInfo renderingCreateInfo;
+	VkPipelineColorBlendAttachmentState blendAttachment;
+	VkPipelineColorBlendAttachmentState alphaBlendAttachment;
+	std::array<MaterialPass, materialPassCount> passes;
+	VkSpecializationMapEntry alphaModeSpecMapEntry;
+	std::array<VkSpecializationInfo, materialPassCount> alphaModeSpecializations;
+	std::array<VkPipelineRenderingCreateInfo, materialPassCount> renderingCreateInfos;
+};
+
+void setupMaterialPasses(vk::GraphicsPipelineBuilder& builder, MaterialPassStates& states, VkFormat colorAttachmentFormat,
+						 VkPipelineLayout layout, VkShaderModule fragModule) {
+	states.colorAttachmentFormat = colorAttachmentFormat;
+	states.renderingCreateInfo = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+		.colorAttachmentCount = 1,
+		.pColorAttachmentFormats = &states.colorAttachmentFormat,
+		.depthAttachmentFormat = VK_FORMAT_D32_SFLOAT,
+	};
+
+	// Opaque and masked materials overwrite the color, while blended materials use regular alpha blending.
+	states.blendAttachment = {
+		.blendEnable = VK_FALSE,
+		.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+	};
+	states.alphaBlendAttachment = {
+		.blendEnable = VK_TRUE,
+		.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
+		.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+		.colorBlendOp = VK_BLEND_OP_ADD,
+		.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+		.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+		.alphaBlendOp = VK_BLEND_OP_ADD,
+		.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+	};
+
+	// The fragment shader is specialized for each alpha mode, so that only the masked variant contains
+	// the discard. All variants are created with a single call, so that the driver can compile them in parallel.
+	states.passes = {{ MaterialPass::Opaque, MaterialPass::Mask, MaterialPass::Blend }};
+	states.alphaModeSpecMapEntry = {
+		.constantID = 0,
+		.offset = 0,
+		.size = sizeof(MaterialPass),
+	};
+
+	builder.setPipelineCount(static_cast<std::uint32_t>(materialPassCount));
+	for (std::uint32_t i = 0; i < materialPassCount; ++i) {
+		const bool blend = states.passes[i] == MaterialPass::Blend;
+		states.alphaModeSpecializations[i] = {
+			.mapEntryCount = 1,
+			.pMapEntries = &states.alphaModeSpecMapEntry,
+			.dataSize = states.alphaModeSpecMapEntry.size,
+			.pData = &states.passes[i],
+		};
+		states.renderingCreateInfos[i] = states.renderingCreateInfo;
+		builder
+			.setPipelineLayout(i, layout)
+			.pushPNext(i, &states.renderingCreateInfos[i])
+			.addDynamicState(i, VK_DYNAMIC_STATE_SCISSOR)
+			.addDynamicState(i, VK_DYNAMIC_STATE_VIEWPORT)
+			.setBlendAttachment(i, blend ? &states.alphaBlendAttachment : &states.blendAttachment)
+			.setTopology(i, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST)
+			.setDepthState(i, VK_TRUE, blend ? VK_FALSE : VK_TRUE, VK_COMPARE_OP_LESS_OR_EQUAL)
+			.setRasterState(i, VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE)
+			.setMultisampleCount(i, VK_SAMPLE_COUNT_1_BIT)
+			.setScissorCount(i, 1U)
+			.setViewportCount(i, 1U)
+			.addShaderStage(i, VK_SHADER_STAGE_FRAGMENT_BIT, fragModule, "main", &states.alphaModeSpecializations[i]);
+	}
+}
+
+/** Returns the name of the main.mesh.glsl variant compiled for the given vertex and triangle limits */
+std::string getMeshShaderName(const MeshletLimits& limits) {
+	return fmt::format("main.mesh.glsl.{}x{}", limits.maxVertices, limits.maxTriangles);
+}
+
 void Viewer::buildMeshPipeline() {
 	ZoneScoped;
     // Build the mesh pipeline layout
     std::array<VkDescriptorSetLayout, 3> layouts {{ cameraSetLayout, meshletSetLayout, materialSetLayout }};
+	const VkPushConstantRange pushConstantRange {
+		.stageFlags = meshletShaderStages,
+		.offset = 0,
+		.size = sizeof(MeshPushConstants),
+	};
     const VkPipelineLayoutCreateInfo layoutCreateInfo {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
         .setLayoutCount = static_cast<std::uint32_t>(layouts.size()),
         .pSetLayouts = layouts.data(),
-        .pushConstantRangeCount = 0,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushConstantRange,
     };
     auto result = vkCreatePipelineLayout(device, &layoutCreateInfo, VK_NULL_HANDLE, &meshPipelineLayout);
 	vk::checkResult(result, "Failed to create mesh pipeline layout");
 	vk::setDebugUtilsName(device, meshPipelineLayout, "Mesh shading pipeline layout");
 
-    // Load the mesh pipeline shaders
-	// TODO: Check return value of loadShaderModule
-    VkShaderModule fragModule, meshModule, taskModule;
-    vk::loadShaderModule("main.frag.glsl.spv", device, &fragModule);
-    vk::loadShaderModule("main.mesh.glsl.spv", device, &meshModule);
-	vk::loadShaderModule("main.task.glsl.spv", device, &taskModule);
-
-	// Load AABB visualizer shaders
-	VkShaderModule aabbFragModule, aabbVertModule;
-	vk::loadShaderModule("aabb_visualizer.frag.glsl.spv", device, &aabbFragModule);
-	vk::loadShaderModule("aabb_visualizer.vert.glsl.spv", device, &aabbVertModule);
-
-	// Build the mesh pipeline
-    const auto colorAttachmentFormat = swapchain.image_format;
-	const auto depthAttachmentFormat = VK_FORMAT_D32_SFLOAT;
-    const VkPipelineRenderingCreateInfo renderingCreateInfo {
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
-            .colorAttachmentCount = 1,
-            .pColorAttachmentFormats = &colorAttachmentFormat,
-			.depthAttachmentFormat = depthAttachmentFormat,
-    };
-
-    const VkPipelineColorBlendAttachmentState blendAttachment {
-        .blendEnable = VK_FALSE,
-        .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
-    };
-
-	// We specialize the task shader to have a local workgroup size which is exactly the subgroup size,
-	// to efficiently use subgroup intrinsics for counting the total number of passed meshlets.
-	VkPhysicalDeviceVulkan11Properties vulkan11Properties {
-		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_PROPERTIES,
-	};
-	VkPhysicalDeviceProperties2 properties {
-		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
-		.pNext = &vulkan11Properties,
-	};
-	vkGetPhysicalDeviceProperties2(device.physical_device, &properties);
-	const VkSpecializationMapEntry taskSubgroupSizeSpecMapEntry {
-		.constantID = 0,
-		.offset = 0,
-		.size = sizeof(decltype(vulkan11Properties.subgroupSize)),
-	};
-	const VkSpecializationInfo taskSubgroupSizeSpecialization {
-		.mapEntryCount = 1,
-		.pMapEntries = &taskSubgroupSizeSpecMapEntry,
-		.dataSize = taskSubgroupSizeSpecMapEntry.size,
-		.pData = &vulkan11Properties.subgroupSize,
-	};
-
-    auto builder = vk::GraphicsPipelineBuilder(device, nullptr)
-        .setPipelineCount(2);
-
-	// Create mesh pipeline
-	builder
-        .setPipelineLayout(0, meshPipelineLayout)
-        .pushPNext(0, &renderingCreateInfo)
-        .addDynamicState(0, VK_DYNAMIC_STATE_SCISSOR)
-        .addDynamicState(0, VK_DYNAMIC_STATE_VIEWPORT)
-        .setBlendAttachment(0, &blendAttachment)
-        .setTopology(0, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST)
-        .setDepthState(0, VK_TRUE, VK_TRUE, VK_COMPARE_OP_LESS_OR_EQUAL)
-        .setRasterState(0, VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE)
-        .setMultisampleCount(0, VK_SAMPLE_COUNT_1_BIT)
-        .setScissorCount(0, 1U)
-        .setViewportCount(0, 1U)
-        .addShaderStage(0, VK_SHADER_STAGE_FRAGMENT_BIT, fragModule, "main")
-        .addShaderStage(0, VK_SHADER_STAGE_MESH_BIT_EXT, meshModule, "main")
-		.addShaderStage(0, VK_SHADER_STAGE_TASK_BIT_EXT, taskModule, "main", &taskSubgroupSizeSpecialization);
-
-	const VkPipelineRenderingCreateInfo aabbRenderingCreateInfo {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
-		.colorAttachmentCount = 1,
-		.pColorAttachmentFormats = &colorAttachmentFormat,
-		.depthAttachmentFormat = depthAttachmentFormat,
+	// Every shader module is loaded by its own task, and each pipeline gets built as soon as its shaders are ready.
+	auto loadShader = [&](std::string name) {
+		return shaderLoadTasks.emplace_back(std::make_shared<ShaderModuleLoadTask>(device, std::move(name)));
 	};
+	auto aabbFragShader = loadShader("aabb_visualizer.frag.glsl");
+	auto aabbVertShader = loadShader("aabb_visualizer.vert.glsl");
 
-	// We want the AABBs to appear slightly transparent, which is why we need blending.
-	// This just essentially just multiplies the fragment shader's value with its alpha value.
-	const VkPipelineColorBlendAttachmentState aabbBlendAttachment {
-		.blendEnable = VK_TRUE,
-		.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
-		.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
-	};
+	if (renderPath == RenderPath::MeshShading) {
+		buildMeshShadingPipelines();
+	} else {
+		auto fragShader = loadShader("main.frag.glsl");
+		auto vertShader = loadShader("main.vert.glsl");
+		auto cullShader = loadShader("meshlet_cull.comp.glsl");
+		pipelineBuildTasks.emplace_back(std::make_shared<PipelineBuildTask>("vertex pipeline",
+				std::vector { fragShader, vertShader }, [this, fragShader, vertShader]() {
+			ZoneScopedN("Build vertex pipeline");
+			vk::GraphicsPipelineBuilder builder(device, nullptr, pipelineCache);
+			MaterialPassStates states;
+			setupMaterialPasses(builder, states, swapchain.image_format, meshPipelineLayout, fragShader->module);
+			for (std::uint32_t i = 0; i < materialPassCount; ++i) {
+				builder.addShaderStage(i, VK_SHADER_STAGE_VERTEX_BIT, vertShader->module, "main");
+			}
+			return builder.build(vertexPipelines.data());
+		}));
+
+		pipelineBuildTasks.emplace_back(std::make_shared<PipelineBuildTask>("meshlet cull pipeline",
+				std::vector { cullShader }, [this, cullShader]() {
+			ZoneScopedN("Build meshlet cull pipeline");
+			return vk::ComputePipelineBuilder(device, nullptr, pipelineCache)
+				.setPipelineCount(1)
+				.setPipelineLayout(0, meshPipelineLayout)
+				.setShaderStage(0, VK_SHADER_STAGE_COMPUTE_BIT, cullShader->module, "main")
+				.build(&meshletCullPipeline);
+		}));
+	}
 
-	// Create AABB pipeline
-	builder
-		.setPipelineLayout(1, meshPipelineLayout)
-		.pushPNext(1, &aabbRenderingCreateInfo)
-		.addDynamicState(1, VK_DYNAMIC_STATE_SCISSOR)
-		.addDynamicState(1, VK_DYNAMIC_STATE_VIEWPORT)
-		.setBlendAttachment(1, &aabbBlendAttachment)
-		.setTopology(1, VK_PRIMITIVE_TOPOLOGY_LINE_LIST)
-		.setDepthState(1, VK_TRUE, VK_TRUE, VK_COMPARE_OP_LESS_OR_EQUAL)
-		.setRasterState(1, VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE)
-		.setMultisampleCount(1, VK_SAMPLE_COUNT_1_BIT)
-		.setScissorCount(1, 1U)
-		.setViewportCount(1, 1U)
-		.addShaderStage(1, VK_SHADER_STAGE_FRAGMENT_BIT, aabbFragModule, "main")
-		.addShaderStage(1, VK_SHADER_STAGE_VERTEX_BIT, aabbVertModule, "main");
-
-	std::array<VkPipeline, 2> pipelines {};
-    result = builder.build(pipelines.data());
-    if (result != VK_SUCCESS) {
-        throw vulkan_error("Failed to create mesh and aabb visualizing pipeline", result);
-    }
+	pipelineBuildTasks.emplace_back(std::make_shared<PipelineBuildTask>("aabb visualizing pipeline",
+			std::vector { aabbFragShader, aabbVertShader }, [this, aabbFragShader, aabbVertShader]() {
+		ZoneScopedN("Build aabb visualizing pipeline");
+		const auto colorAttachmentFormat = swapchain.image_format;
+		const VkPipelineRenderingCreateInfo aabbRenderingCreateInfo {
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+			.colorAttachmentCount = 1,
+			.pColorAttachmentFormats = &colorAttachmentFormat,
+			.depthAttachmentFormat = VK_FORMAT_D32_SFLOAT,
+		};
 
-	meshPipeline = pipelines[0];
-	aabbVisualizingPipeline = pipelines[1];
+		// We want the AABBs to appear slightly transparent, which is why we need blending.
+		// This just essentially just multiplies the fragment shader's value with its alpha value.
+		const VkPipelineColorBlendAttachmentState aabbBlendAttachment {
+			.blendEnable = VK_TRUE,
+			.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
+			.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+		};
 
-	// We don't need the shader modules after creating the pipeline anymore.
-    vkDestroyShaderModule(device, fragModule, VK_NULL_HANDLE);
-    vkDestroyShaderModule(device, meshModule, VK_NULL_HANDLE);
-	vkDestroyShaderModule(device, taskModule, VK_NULL_HANDLE);
-	vkDestroyShaderModule(device, aabbFragModule, VK_NULL_HANDLE);
-	vkDestroyShaderModule(device, aabbVertModule, VK_NULL_HANDLE);
+		return vk::GraphicsPipelineBuilder(device, nullptr, pipelineCache)
+			.setPipelineCount(1)
+			.setPipelineLayout(0, meshPipelineLayout)
+			.pushPNext(0, &aabbRenderingCreateInfo)
+			.addDynamicState(0, VK_DYNAMIC_STATE_SCISSOR)
+			.addDynamicState(0, VK_DYNAMIC_STATE_VIEWPORT)
+			.setBlendAttachment(0, &aabbBlendAttachment)
+			.setTopology(0, VK_PRIMITIVE_TOPOLOGY_LINE_LIST)
+			.setDepthState(0, VK_TRUE, VK_TRUE, VK_COMPARE_OP_LESS_OR_EQUAL)
+			.setRasterState(0, VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE)
+			.setMultisampleCount(0, VK_SAMPLE_COUNT_1_BIT)
+			.setScissorCount(0, 1U)
+			.setViewportCount(0, 1U)
+			.addShaderStage(0, VK_SHADER_STAGE_FRAGMENT_BIT, aabbFragShader->module, "main")
+			.addShaderStage(0, VK_SHADER_STAGE_VERTEX_BIT, aabbVertShader->module, "main")
+			.build(&aabbVisualizingPipeline);
+	}));
+
+	// Only start loading the shaders now that every dependency has been set up
+	for (auto& task : shaderLoadTasks) {
+		taskScheduler.AddTaskSetToPipe(task.get());
+	}
 
     deletionQueue.push([&]() {
-        vkDestroyPipeline(device, meshPipeline, VK_NULL_HANDLE);
+		for (auto& pipeline : meshPipelines) {
+			vkDestroyPipeline(device, pipeline, VK_NULL_HANDLE);
+		}
+		for (auto& pipeline : vertexPipelines) {
+			vkDestroyPipeline(device, pipeline, VK_NULL_HANDLE);
+		}
+		vkDestroyPipeline(device, meshletCullPipeline, VK_NULL_HANDLE);
         vkDestroyPipelineLayout(device, meshPipelineLayout, VK_NULL_HANDLE);
 		vkDestroyPipeline(device, aabbVisualizingPipeline, VK_NULL_HANDLE);
     });
 }
 
+void Viewer::buildMeshShadingPipelines() {
+	ZoneScoped;
+	auto loadShader = [&](std::string name) {
+		return shaderLoadTasks.emplace_back(std::make_shared<ShaderModuleLoadTask>(device, std::move(name)));
+	};
+	auto fragShader = loadShader("main.frag.glsl");
+	auto meshShader = loadShader(getMeshShaderName(meshletLimits));
+	auto taskShader = loadShader("main.task.glsl");
+	pipelineBuildTasks.emplace_back(std::make_shared<PipelineBuildTask>("mesh pipeline",
+			std::vector { fragShader, meshShader, taskShader }, [this, fragShader, meshShader, taskShader, limits = meshletLimits]() {
+		ZoneScopedN("Build mesh pipeline");
+
+		// We specialize the task shader to have a local workgroup size which is exactly the subgroup size,
+		// to efficiently use subgroup intrinsics for counting the total number of passed meshlets.
+		VkPhysicalDeviceVulkan11Properties vulkan11Properties {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_PROPERTIES,
+		};
+		VkPhysicalDeviceProperties2 properties {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+			.pNext = &vulkan11Properties,
+		};
+		vkGetPhysicalDeviceProperties2(device.physical_device, &properties);
+		const VkSpecializationMapEntry taskSubgroupSizeSpecMapEntry {
+			.constantID = 0,
+			.offset = 0,
+			.size = sizeof(decltype(vulkan11Properties.subgroupSize)),
+		};
+		const VkSpecializationInfo taskSubgroupSizeSpecialization {
+			.mapEntryCount = 1,
+			.pMapEntries = &taskSubgroupSizeSpecMapEntry,
+			.dataSize = taskSubgroupSizeSpecMapEntry.size,
+			.pData = &vulkan11Properties.subgroupSize,
+		};
+
+		// The mesh shader's workgroup size is specialized for the current meshlet limits
+		const VkSpecializationMapEntry meshWorkgroupSizeSpecMapEntry {
+			.constantID = 0,
+			.offset = 0,
+			.size = sizeof(limits.meshWorkgroupSize),
+		};
+		const VkSpecializationInfo meshWorkgroupSizeSpecialization {
+			.mapEntryCount = 1,
+			.pMapEntries = &meshWorkgroupSizeSpecMapEntry,
+			.dataSize = meshWorkgroupSizeSpecMapEntry.size,
+			.pData = &limits.meshWorkgroupSize,
+		};
+
+		vk::GraphicsPipelineBuilder builder(device, nullptr, pipelineCache);
+		MaterialPassStates states;
+		setupMaterialPasses(builder, states, swapchain.image_format, meshPipelineLayout, fragShader->module);
+		for (std::uint32_t i = 0; i < materialPassCount; ++i) {
+			builder
+				.addShaderStage(i, VK_SHADER_STAGE_MESH_BIT_EXT, meshShader->module, "main", &meshWorkgroupSizeSpecialization)
+				.addShaderStage(i, VK_SHADER_STAGE_TASK_BIT_EXT, taskShader->module, "main", &taskSubgroupSizeSpecialization);
+		}
+		return builder.build(meshPipelines.data());
+	}));
+}
+
+void Viewer::joinPipelineBuilds() {
+	ZoneScoped;
+	const auto waitStart = std::chrono::steady_clock::now();
+	for (auto& task : pipelineBuildTasks) {
+		taskScheduler.WaitforTask(task.get());
+	}
+	const auto waitTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - waitStart);
+
+	// We don't need the shader modules after creating the pipelines anymore.
+	for (auto& task : shaderLoadTasks) {
+		taskScheduler.WaitforTask(task.get());
+		vkDestroyShaderModule(device, task->module, VK_NULL_HANDLE);
+	}
+	shaderLoadTasks.clear();
+
+	for (auto& task : pipelineBuildTasks) {
+		if (task->result != VK_SUCCESS) {
+			throw vulkan_error(fmt::format("Failed to create {}", task->name), task->result);
+		}
+		fmt::print("Built {} in {:.2f} ms ({} pipeline cache)\n", task->name, task->buildTime.count(),
+				   pipelineCacheWarm ? "warm" : "cold");
+	}
+	pipelineBuildTasks.clear();
+	fmt::print("Waited {:.2f} ms for pipeline builds before the first frame\n", waitTime.count());
+}
+
 void Viewer::createFrameData() {
 	ZoneScoped;
     frameSyncData.resize(frameOverlap);
@@ -815,6 +1274,7 @@ void Viewer::createFrameData() {
     }
 
     frameCommandPools.resize(frameOverlap);
+	frameLatencies.resize(frameOverlap);
     for (auto& frame : frameCommandPools) {
         VkCommandPoolCreateInfo commandPoolInfo = {};
         commandPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -884,21 +1344,27 @@ void multithreadedBase64Decoding(std::string_view encodedData, std::uint8_t* out
 
 void Viewer::loadGltf(const std::filesystem::path& filePath) {
 	ZoneScoped;
+	// Every file is read on the I/O threads, as the parser would otherwise block a worker on storage
+	FileReadRequest fileRead(filePath);
+	ioThreads.submit(&fileRead);
+	taskScheduler.WaitforTask(&fileRead);
+
     fastgltf::GltfDataBuffer fileBuffer;
-    if (!fileBuffer.loadFromFile(filePath)) {
+    if (!fileRead.succeeded || !fileBuffer.copyBytes(fileRead.bytes.data(), fileRead.bytes.size())) {
         throw std::runtime_error("Failed to load file");
     }
 
 	static constexpr auto supportedExtensions = fastgltf::Extensions::KHR_mesh_quantization
 		| fastgltf::Extensions::KHR_lights_punctual
-		| fastgltf::Extensions::EXT_meshopt_compression;
+		| fastgltf::Extensions::EXT_meshopt_compression
+		| fastgltf::Extensions::EXT_mesh_gpu_instancing;
 
     fastgltf::Parser parser(supportedExtensions);
     parser.setUserPointer(this);
     parser.setBase64DecodeCallback(multithreadedBase64Decoding);
 
-	// TODO: Extract buffer/image loading into async functions in the future
-	static constexpr auto gltfOptions = fastgltf::Options::LoadGLBBuffers | fastgltf::Options::LoadExternalBuffers | fastgltf::Options::LoadExternalImages | fastgltf::Options::GenerateMeshIndices;
+	// External buffers and images are read by loadExternalBuffers and the image loads instead of the parser
+	static constexpr auto gltfOptions = fastgltf::Options::LoadGLBBuffers | fastgltf::Options::GenerateMeshIndices;
 
     auto expected = parser.loadGltf(&fileBuffer, filePath.parent_path(), gltfOptions);
     if (expected.error() != fastgltf::Error::None) {
@@ -913,47 +1379,164 @@ void Viewer::loadGltf(const std::filesystem::path& filePath) {
         auto message = fastgltf::getErrorMessage(validation);
         throw std::runtime_error(std::string("Asset failed validation") + std::string(message));
     }
+
+	assetDirectory = filePath.parent_path();
+	loadExternalBuffers();
+	loadMsftLod(fileRead.bytes, filePath);
 }
 
-void Viewer::loadGltfMeshes() {
+void Viewer::loadExternalBuffers() {
+	ZoneScoped;
+	// Read every external buffer at once, so that the I/O threads can overlap the reads
+	std::vector<std::pair<std::size_t, std::unique_ptr<FileReadRequest>>> reads;
+	for (std::size_t i = 0; i < asset.buffers.size(); ++i) {
+		auto& buffer = asset.buffers[i];
+		const auto* uri = std::get_if<fastgltf::sources::URI>(&buffer.data);
+		if (uri == nullptr)
+			continue;
+		if (!uri->uri.isLocalPath()) {
+			throw std::runtime_error(fmt::format("Buffer {} does not reference a local file", i));
+		}
+		reads.emplace_back(i, std::make_unique<FileReadRequest>(assetDirectory / uri->uri.fspath(), uri->fileByteOffset, buffer.byteLength));
+	}
+
+	// Every request has to complete before we may throw, as the I/O threads still reference them until then
+	std::vector<FileReadRequest*> requests;
+	for (auto& [bufferIndex, read] : reads) {
+		requests.emplace_back(read.get());
+	}
+	for (auto& batch : ioThreads.submitReads(requests)) {
+		taskScheduler.WaitforTask(batch.get());
+	}
+	for (auto& [bufferIndex, read] : reads) {
+		if (!read->succeeded) {
+			throw std::runtime_error(fmt::format("Failed to read buffer {} from {}", bufferIndex, read->path.string()));
+		}
+		auto& buffer = asset.buffers[bufferIndex];
+		const auto mimeType = std::get<fastgltf::sources::URI>(buffer.data).mimeType;
+		buffer.data = fastgltf::sources::Vector {
+			.bytes = std::move(read->bytes),
+			.mimeType = mimeType,
+		};
+	}
+}
+
+/** Returns the JSON of a .gltf file, or only the JSON chunk of a .glb file */
+std::optional<simdjson::padded_string> getGltfJson(std::span<const std::uint8_t> fileBytes) {
+	// A GLB starts with a 12 byte header, followed by the JSON chunk's length and type
+	if (fileBytes.size() >= 20 && std::memcmp(fileBytes.data(), "glTF", 4) == 0) {
+		std::uint32_t chunkLength = 0;
+		std::memcpy(&chunkLength, &fileBytes[12], sizeof(chunkLength));
+		if (chunkLength > fileBytes.size() - 20)
+			return std::nullopt;
+		return simdjson::padded_string(reinterpret_cast<const char*>(&fileBytes[20]), chunkLength);
+	}
+	return simdjson::padded_string(reinterpret_cast<const char*>(fileBytes.data()), fileBytes.size());
+}
+
+void Viewer::loadMsftLod(std::span<const std::uint8_t> fileBytes, const std::filesystem::path& filePath) {
+	ZoneScoped;
+	nodeLods.clear();
+	nodeLods.resize(asset.nodes.size());
+
+	// Most assets don't use the extension, which we can tell before parsing the JSON again
+	auto json = getGltfJson(fileBytes);
+	if (json.has_value() && std::string_view(*json).find("MSFT_lod") == std::string_view::npos)
+		return;
+
+	simdjson::dom::parser parser;
+	simdjson::dom::element root;
+	simdjson::dom::array nodes;
+	if (!json.has_value() || parser.parse(*json).get(root) != simdjson::SUCCESS || root["nodes"].get_array().get(nodes) != simdjson::SUCCESS) {
+		fmt::print(stderr, "Failed to read MSFT_lod from {}, drawing every node at full detail\n", filePath.string());
+		return;
+	}
+
+	for (std::size_t nodeIndex = 0; auto nodeObject : nodes) {
+		if (nodeIndex >= asset.nodes.size())
+			break;
+		auto& lods = nodeLods[nodeIndex];
+		auto& node = asset.nodes[nodeIndex++];
+		simdjson::dom::array ids;
+		if (!node.meshIndex.has_value() || nodeObject.at_pointer("/extensions/MSFT_lod/ids").get_array().get(ids) != simdjson::SUCCESS)
+			continue;
+
+		// The LOD nodes only provide their mesh, and are drawn with the transform of this node
+		lods.meshIndices.emplace_back(*node.meshIndex);
+		for (auto id : ids) {
+			std::uint64_t lodNodeIndex = 0;
+			if (id.get_uint64().get(lodNodeIndex) != simdjson::SUCCESS || lodNodeIndex >= asset.nodes.size()
+				|| !asset.nodes[lodNodeIndex].meshIndex.has_value()) {
+				throw std::runtime_error(fmt::format("MSFT_lod of node {} references an invalid node", nodeIndex - 1));
+			}
+			lods.meshIndices.emplace_back(*asset.nodes[lodNodeIndex].meshIndex);
+		}
+
+		// The screen coverages are optional extras. Without them, each level is used for a quarter of the previous coverage.
+		simdjson::dom::array coverages;
+		if (nodeObject.at_pointer("/extras/MSFT_screencoverage").get_array().get(coverages) == simdjson::SUCCESS) {
+			for (auto coverage : coverages) {
+				double value = 0.0;
+				if (coverage.get_double().get(value) != simdjson::SUCCESS)
+					break;
+				lods.minScreenCoverages.emplace_back(static_cast<float>(value));
+			}
+		} else {
+			for (std::size_t i = 0; i + 1 < lods.meshIndices.size(); ++i) {
+				lods.minScreenCoverages.emplace_back(std::pow(0.25f, static_cast<float>(i + 1)));
+			}
+		}
+		lods.minScreenCoverages.resize(util::min(lods.minScreenCoverages.size(), lods.meshIndices.size()));
+	}
+}
+
+void Viewer::createMeshletSetLayout() {
 	ZoneScoped;
-	// The meshlet descriptor layout
-	std::array<VkDescriptorSetLayoutBinding, 5> layoutBindings = {{
-		// Meshlet descriptions
+	// The meshlet descriptor layout. The AABB visualization always uses a vertex shader.
+	// The geometry itself is addressed through the device addresses in the primitive records.
+	std::array<VkDescriptorSetLayoutBinding, 6> layoutBindings = {{
+		// The (indirect) draw commands
 		{
-			.binding = 0,
+			.binding = 4,
 			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 			.descriptorCount = 1,
-			.stageFlags = VK_SHADER_STAGE_MESH_BIT_EXT | VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_VERTEX_BIT,
+			.stageFlags = meshletShaderStages | VK_SHADER_STAGE_VERTEX_BIT,
 		},
-		// Vertex indices
+		// The indexed meshlet draws written by the cull pass of the vertex shading path
 		{
-			.binding = 1,
+			.binding = 5,
 			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 			.descriptorCount = 1,
-			.stageFlags = VK_SHADER_STAGE_MESH_BIT_EXT,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
 		},
-		// Primitive indices
+		// The instance transforms
 		{
-			.binding = 2,
+			.binding = 6,
 			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 			.descriptorCount = 1,
-			.stageFlags = VK_SHADER_STAGE_MESH_BIT_EXT,
+			.stageFlags = meshletShaderStages | VK_SHADER_STAGE_VERTEX_BIT,
 		},
-		// Vertices
+		// The instances of every draw
 		{
-			.binding = 3,
+			.binding = 7,
 			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 			.descriptorCount = 1,
-			.stageFlags = VK_SHADER_STAGE_MESH_BIT_EXT,
+			.stageFlags = meshletShaderStages | VK_SHADER_STAGE_VERTEX_BIT,
 		},
-		// The (indirect) draw commands
+		// The world transforms of the nodes
 		{
-			.binding = 4,
+			.binding = 8,
 			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 			.descriptorCount = 1,
-			.stageFlags = VK_SHADER_STAGE_MESH_BIT_EXT | VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_VERTEX_BIT,
-		}
+			.stageFlags = meshletShaderStages | VK_SHADER_STAGE_VERTEX_BIT,
+		},
+		// The static primitive data
+		{
+			.binding = 9,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = meshletShaderStages | VK_SHADER_STAGE_VERTEX_BIT,
+		},
 	}};
 	const VkDescriptorSetLayoutCreateInfo descriptorLayoutCreateInfo = {
 		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
@@ -968,402 +1551,1700 @@ void Viewer::loadGltfMeshes() {
 	deletionQueue.push([&]() {
 		vkDestroyDescriptorSetLayout(device, meshletSetLayout, nullptr);
 	});
+}
+
+/** The clusters of every LOD level of a primitive, ordered from the finest level to the coarsest */
+struct ClusterHierarchy {
+	std::vector<Meshlet> meshlets;
+	std::vector<unsigned int> meshletVertices;
+	std::vector<unsigned char> meshletTriangles;
+	std::size_t finestLevelMeshletCount = 0;
+	std::uint32_t levelCount = 0;
+};
+
+static constexpr std::uint32_t maxLodLevels = 16;
+static constexpr std::size_t lodGroupSize = 4; // The number of clusters which are merged and simplified together
+
+/** Returns a sphere containing all of the given spheres */
+glm::vec4 mergeBoundingSpheres(std::span<const Meshlet> clusters) {
+	glm::vec3 center(0.0f);
+	for (auto& cluster : clusters) {
+		center += glm::vec3(cluster.lodBounds);
+	}
+	center /= static_cast<float>(clusters.size());
+
+	float radius = 0.0f;
+	for (auto& cluster : clusters) {
+		radius = util::max(radius, glm::distance(center, glm::vec3(cluster.lodBounds)) + cluster.lodBounds.w);
+	}
+	return glm::vec4(center, radius);
+}
+
+/**
+ * Splits the triangles into meshlets and appends them to the hierarchy. Every new cluster is its own LOD group
+ * without a parent, and the index of the first one is returned.
+ */
+std::size_t appendClusters(ClusterHierarchy& hierarchy, std::span<const std::uint32_t> indices, std::span<const Vertex> vertices,
+						   const MeshletLimits& limits) {
+	ZoneScoped;
+	const std::size_t maxVertices = limits.maxVertices;
+	const std::size_t maxTriangles = limits.maxTriangles;
+	const float coneWeight = 0.0f; // We leave this as 0 because we're not using cluster cone culling.
+
+	std::size_t maxMeshlets = meshopt_buildMeshletsBound(indices.size(), maxVertices, maxTriangles);
+	std::vector<meshopt_Meshlet> meshlets(maxMeshlets);
+	std::vector<unsigned int> meshlet_vertices(maxMeshlets * maxVertices);
+	std::vector<unsigned char> meshlet_triangles(maxMeshlets * maxTriangles * 3);
+
+	const auto meshletCount = meshopt_buildMeshlets(
+		meshlets.data(), meshlet_vertices.data(), meshlet_triangles.data(),
+		indices.data(), indices.size(),
+		&vertices[0].position.x, vertices.size(), sizeof(Vertex),
+		maxVertices, maxTriangles, coneWeight);
+
+	const auto firstCluster = hierarchy.meshlets.size();
+	if (meshletCount == 0)
+		return firstCluster;
+
+	// Trim the buffers
+	const auto& lastMeshlet = meshlets[meshletCount - 1];
+	meshlet_vertices.resize(lastMeshlet.vertex_count + lastMeshlet.vertex_offset);
+	meshlet_triangles.resize(((lastMeshlet.triangle_count * 3 + 3) & ~3) + lastMeshlet.triangle_offset);
+	meshlets.resize(meshletCount);
+
+	const auto vertexOffset = static_cast<unsigned int>(hierarchy.meshletVertices.size());
+	const auto triangleOffset = static_cast<unsigned int>(hierarchy.meshletTriangles.size());
+	for (auto meshlet : meshlets) {
+		// Compute AABB bounds
+		auto& initialVertex = vertices[meshlet_vertices[meshlet.vertex_offset]];
+		auto min = glm::vec3(initialVertex.position), max = glm::vec3(initialVertex.position);
+		for (std::size_t i = 1; i < meshlet.vertex_count; ++i) {
+			auto& vertex = vertices[meshlet_vertices[meshlet.vertex_offset + i]];
+			min = glm::min(min, glm::vec3(vertex.position));
+			max = glm::max(max, glm::vec3(vertex.position));
+		}
+
+		// The bounding sphere is the LOD bound of the finest level, which has no error
+		const auto bounds = meshopt_computeMeshletBounds(
+			&meshlet_vertices[meshlet.vertex_offset], &meshlet_triangles[meshlet.triangle_offset], meshlet.triangle_count,
+			&vertices[0].position.x, vertices.size(), sizeof(Vertex));
+		const auto sphere = glm::vec4(bounds.center[0], bounds.center[1], bounds.center[2], bounds.radius);
+
+		meshlet.vertex_offset += vertexOffset;
+		meshlet.triangle_offset += triangleOffset;
+		glm::vec3 center = (min + max) * 0.5f;
+		hierarchy.meshlets.emplace_back(Meshlet {
+			.meshlet = meshlet,
+			.aabbExtents = max - center,
+			.aabbCenter = center,
+			.lodBounds = sphere,
+			.parentLodBounds = sphere,
+			.lodError = 0.0f,
+			.parentLodError = std::numeric_limits<float>::max(),
+		});
+	}
+	hierarchy.meshletVertices.insert(hierarchy.meshletVertices.end(), meshlet_vertices.begin(), meshlet_vertices.end());
+	hierarchy.meshletTriangles.insert(hierarchy.meshletTriangles.end(), meshlet_triangles.begin(), meshlet_triangles.end());
+	return firstCluster;
+}
+
+/**
+ * Builds the meshlets of the primitive, and then repeatedly merges groups of neighbouring clusters, simplifies
+ * them to half their triangles and splits them into meshlets again, until a level can't be simplified any further.
+ * The group borders are locked, so that any cut through the hierarchy is free of cracks.
+ */
+ClusterHierarchy buildClusterHierarchy(std::span<const std::uint32_t> indices, std::span<const Vertex> vertices, const MeshletLimits& limits) {
+	ZoneScoped;
+	ClusterHierarchy hierarchy;
+	std::size_t levelStart = appendClusters(hierarchy, indices, vertices, limits);
+	std::size_t levelEnd = hierarchy.meshlets.size();
+	hierarchy.finestLevelMeshletCount = levelEnd;
+	hierarchy.levelCount = 1;
+
+	// meshopt_simplify reports the error relative to the mesh's extents
+	const auto errorScale = meshopt_simplifyScale(&vertices[0].position.x, vertices.size(), sizeof(Vertex));
+
+	std::vector<std::uint32_t> groupIndices;
+	std::vector<std::uint32_t> simplifiedIndices;
+	while (levelEnd - levelStart > 1 && hierarchy.levelCount < maxLodLevels) {
+		// meshopt_buildMeshlets emits spatially coherent meshlets, so consecutive clusters are grouped together
+		for (auto groupStart = levelStart; groupStart < levelEnd; groupStart += lodGroupSize) {
+			const auto groupEnd = util::min(groupStart + lodGroupSize, levelEnd);
+
+			// Merge the triangles of the group, with indices into the primitive's vertices
+			groupIndices.clear();
+			for (auto i = groupStart; i < groupEnd; ++i) {
+				const auto& meshlet = hierarchy.meshlets[i].meshlet;
+				for (std::size_t j = 0; j < meshlet.triangle_count * 3; ++j) {
+					const auto localIndex = hierarchy.meshletTriangles[meshlet.triangle_offset + j];
+					groupIndices.emplace_back(hierarchy.meshletVertices[meshlet.vertex_offset + localIndex]);
+				}
+			}
+
+			// Locking the border keeps the edges shared with other groups intact, which may be drawn at another level
+			float simplificationError = 0.0f;
+			simplifiedIndices.resize(groupIndices.size());
+			simplifiedIndices.resize(meshopt_simplify(
+				simplifiedIndices.data(), groupIndices.data(), groupIndices.size(),
+				&vertices[0].position.x, vertices.size(), sizeof(Vertex),
+				groupIndices.size() / 6 * 3, 1.0f, meshopt_SimplifyLockBorder, &simplificationError));
+
+			// Groups which barely simplify stay the coarsest clusters of their region
+			if (simplifiedIndices.empty() || simplifiedIndices.size() * 100 > groupIndices.size() * 85)
+				continue;
+
+			// The group contains the bounds and errors of its clusters, so that the projected error grows with each level
+			auto group = std::span(hierarchy.meshlets).subspan(groupStart, groupEnd - groupStart);
+			const auto groupBounds = mergeBoundingSpheres(group);
+			float groupError = simplificationError * errorScale;
+			for (auto& cluster : group) {
+				groupError = util::max(groupError, cluster.lodError);
+			}
+			for (auto& cluster : group) {
+				cluster.parentLodBounds = groupBounds;
+				cluster.parentLodError = groupError;
+			}
+
+			const auto firstSimplified = appendClusters(hierarchy, simplifiedIndices, vertices, limits);
+			for (auto i = firstSimplified; i < hierarchy.meshlets.size(); ++i) {
+				hierarchy.meshlets[i].lodBounds = groupBounds;
+				hierarchy.meshlets[i].lodError = groupError;
+				hierarchy.meshlets[i].parentLodBounds = groupBounds;
+			}
+		}
+
+		if (hierarchy.meshlets.size() == levelEnd)
+			break;
+		levelStart = levelEnd;
+		levelEnd = hierarchy.meshlets.size();
+		++hierarchy.levelCount;
+	}
+	return hierarchy;
+}
+
+/** The geometry of a single primitive, before it is copied into a geometry shard */
+struct PrimitiveGeometry {
+	std::vector<Vertex> vertices;
+	ClusterHierarchy hierarchy;
+	std::vector<std::uint32_t> meshletIndices; // Only built for the vertex shading path
+	std::size_t triangleCount = 0; // At full resolution
+
+	/** The number of elements in each geometry range */
+	[[nodiscard]] std::array<std::size_t, geometryRangeCount> getCounts() const {
+		return {{ hierarchy.meshlets.size(), hierarchy.meshletVertices.size(), hierarchy.meshletTriangles.size(), vertices.size() }};
+	}
+};
+
+/** Reads the attributes of a glTF primitive and builds its clusters. Also fills in the primitive's material, bounds and meshlet counts. */
+PrimitiveGeometry buildPrimitiveGeometry(const fastgltf::Asset& asset, const fastgltf::Primitive& gltfPrimitive, const CompressedBufferDataAdapter& adapter,
+										 const MeshletLimits& limits, bool vertexShading, Primitive& primitive) {
+	ZoneScoped;
+	if (!gltfPrimitive.indicesAccessor.has_value()) {
+		throw std::runtime_error("Every primitive should have a value.");
+	}
+
+	auto* positionIt = gltfPrimitive.findAttribute("POSITION");
+	if (positionIt == gltfPrimitive.attributes.end()) {
+		throw std::runtime_error("Every primitive has a POSITION attribute.");
+	}
+
+	if (gltfPrimitive.materialIndex.has_value()) {
+		primitive.materialIndex = gltfPrimitive.materialIndex.value() + Viewer::numDefaultMaterials;
+	} else {
+		primitive.materialIndex = 0;
+	}
+
+	// Copy the positions and indices
+	PrimitiveGeometry geometry;
+	auto& vertices = geometry.vertices;
+	auto& posAccessor = asset.accessors[positionIt->second];
+	vertices.reserve(posAccessor.count);
+	auto primitiveMin = glm::vec3(std::numeric_limits<float>::max());
+	auto primitiveMax = glm::vec3(std::numeric_limits<float>::lowest());
+	fastgltf::iterateAccessor<glm::vec3>(asset, posAccessor, [&](glm::vec3 val) {
+		auto& vertex = vertices.emplace_back();
+		vertex.position = glm::vec4(val, 1.0f);
+		primitiveMin = glm::min(primitiveMin, val);
+		primitiveMax = glm::max(primitiveMax, val);
+		vertex.color = glm::vec4(1.0f);
+		vertex.uv = glm::vec2(0.0f);
+	}, adapter);
+	primitive.aabbCenter = (primitiveMin + primitiveMax) * 0.5f;
+	primitive.aabbExtents = (primitiveMax - primitiveMin) * 0.5f;
+
+	auto& indicesAccessor = asset.accessors[gltfPrimitive.indicesAccessor.value()];
+	std::vector<std::uint32_t> indices(indicesAccessor.count);
+	fastgltf::copyFromAccessor<std::uint32_t>(asset, indicesAccessor, indices.data(), adapter);
+	geometry.triangleCount = indices.size() / 3;
+
+	if (auto* colorAttribute = gltfPrimitive.findAttribute("COLOR_0"); colorAttribute != gltfPrimitive.attributes.end()) {
+		// The glTF spec allows VEC3 and VEC4 for COLOR_n, with VEC3 data having to be extended with 1.0f for the fourth component.
+		auto& colorAccessor = asset.accessors[colorAttribute->second];
+		if (colorAccessor.type == fastgltf::AccessorType::Vec4) {
+			fastgltf::iterateAccessorWithIndex<glm::vec4>(asset, asset.accessors[colorAttribute->second], [&](glm::vec4 val, std::size_t idx) {
+				vertices[idx].color = val;
+			}, adapter);
+		} else if (colorAccessor.type == fastgltf::AccessorType::Vec3) {
+			fastgltf::iterateAccessorWithIndex<glm::vec3>(asset, asset.accessors[colorAttribute->second], [&](glm::vec3 val, std::size_t idx) {
+				vertices[idx].color = glm::vec4(val, 1.0f);
+			}, adapter);
+		}
+	}
 
-	std::vector<Vertex> globalVertices;
-	std::vector<Meshlet> globalMeshlets;
-	std::vector<unsigned int> globalMeshletVertices;
-	std::vector<unsigned char> globalMeshletTriangles;
+	if (auto* uvAttribute = gltfPrimitive.findAttribute("TEXCOORD_0"); uvAttribute != gltfPrimitive.attributes.end()) {
+		fastgltf::iterateAccessorWithIndex<glm::vec2>(asset, asset.accessors[uvAttribute->second], [&](glm::vec2 val, std::size_t idx) {
+			vertices[idx].uv = val;
+		}, adapter);
+	}
+
+	// Build the clusters of every LOD level for this primitive
+	auto& hierarchy = geometry.hierarchy;
+	hierarchy = buildClusterHierarchy(indices, vertices, limits);
+	primitive.meshlet_count = hierarchy.meshlets.size();
+	primitive.finestLevelMeshletCount = hierarchy.finestLevelMeshletCount;
+
+	// The vertex shading path draws each meshlet with an index buffer. Every index sits at the same position
+	// as its micro index in the triangle buffer, and is relative to the primitive's first vertex.
+	if (vertexShading) {
+		geometry.meshletIndices.resize(hierarchy.meshletTriangles.size());
+		for (auto& cluster : hierarchy.meshlets) {
+			const auto& meshlet = cluster.meshlet;
+			for (std::size_t i = 0; i < meshlet.triangle_count * 3; ++i) {
+				const auto triangleIndex = meshlet.triangle_offset + i;
+				geometry.meshletIndices[triangleIndex] = hierarchy.meshletVertices[meshlet.vertex_offset + hierarchy.meshletTriangles[triangleIndex]];
+			}
+		}
+	}
+	return geometry;
+}
 
-	CompressedBufferDataAdapter adapter;
-	if (!adapter.decompress(asset))
+void Viewer::loadGltfMeshes() {
+	ZoneScoped;
+	GeometryShardData shard;
+
+	// The previous draws reference primitives which don't exist anymore
+	drawList = DrawList { .version = drawList.version + 1 };
+	nodeTransforms.clear();
+
+	bufferAdapter = std::make_shared<CompressedBufferDataAdapter>();
+	if (!bufferAdapter->decompress(asset))
 		throw std::runtime_error("Failed to decompress all glTF buffers");
+	const auto& adapter = *bufferAdapter;
 
 	// Generate the meshes
+	const auto vertexShading = renderPath == RenderPath::VertexShading;
 	for (auto& gltfMesh : asset.meshes) {
 		auto& mesh = meshes.emplace_back();
+		mesh.triangleCount = 0;
+		mesh.resident = true;
+		auto meshMin = glm::vec3(std::numeric_limits<float>::max());
+		auto meshMax = glm::vec3(std::numeric_limits<float>::lowest());
 
-		// We need this as we require pointer-stability for the generate task.
 		mesh.primitives.reserve(gltfMesh.primitives.size());
 		for (auto& gltfPrimitive : gltfMesh.primitives) {
-			if (!gltfPrimitive.indicesAccessor.has_value()) {
-				throw std::runtime_error("Every primitive should have a value.");
+			auto& primitive = mesh.primitives.emplace_back();
+			auto geometry = buildPrimitiveGeometry(asset, gltfPrimitive, adapter, meshletLimits, vertexShading, primitive);
+			mesh.triangleCount += geometry.triangleCount;
+			meshMin = glm::min(meshMin, primitive.aabbCenter - primitive.aabbExtents);
+			meshMax = glm::max(meshMax, primitive.aabbCenter + primitive.aabbExtents);
+
+			// Start a new shard if any of the current shard's buffers would grow beyond the limit. The offsets within
+			// a shard are 32-bit, which the limit keeps in range for every element size.
+			const auto counts = geometry.getCounts();
+			const std::array<std::size_t, geometryRangeCount> shardCounts {{
+				shard.meshlets.size(), shard.meshletVertices.size(), shard.meshletTriangles.size(), shard.vertices.size(),
+			}};
+			bool fits = true;
+			for (std::size_t i = 0; i < geometryRangeCount; ++i) {
+				const auto elementSize = getGeometryElementSize(static_cast<GeometryRange>(i));
+				if (counts[i] * elementSize > maxGeometryBufferSize || counts[i] > std::numeric_limits<std::uint32_t>::max()) {
+					throw std::runtime_error(fmt::format("A primitive of mesh {} is larger than a single buffer may be", meshes.size() - 1));
+				}
+				const auto total = static_cast<VkDeviceSize>(shardCounts[i] + counts[i]);
+				fits = fits && total * elementSize <= maxShardSize && total <= std::numeric_limits<std::uint32_t>::max();
 			}
+			if (!fits && !shard.primitives.empty()) {
+				uploadGeometryShard(shard);
+			}
+
+			std::ranges::transform(counts, primitive.geometry.counts.begin(), [](std::size_t count) {
+				return static_cast<std::uint32_t>(count);
+			});
+			shard.primitives.emplace_back(meshes.size() - 1, mesh.primitives.size() - 1);
+
+			// Append the data to the end of the shard's buffers.
+			shard.vertices.insert(shard.vertices.end(), geometry.vertices.begin(), geometry.vertices.end());
+			shard.meshlets.insert(shard.meshlets.end(), geometry.hierarchy.meshlets.begin(), geometry.hierarchy.meshlets.end());
+			shard.meshletVertices.insert(shard.meshletVertices.end(), geometry.hierarchy.meshletVertices.begin(), geometry.hierarchy.meshletVertices.end());
+			shard.meshletTriangles.insert(shard.meshletTriangles.end(), geometry.hierarchy.meshletTriangles.begin(), geometry.hierarchy.meshletTriangles.end());
+			shard.meshletIndices.insert(shard.meshletIndices.end(), geometry.meshletIndices.begin(), geometry.meshletIndices.end());
+		}
 
-			auto* positionIt = gltfPrimitive.findAttribute("POSITION");
-			if (positionIt == gltfPrimitive.attributes.end()) {
-				throw std::runtime_error("Every primitive has a POSITION attribute.");
+		const auto meshCenter = (meshMin + meshMax) * 0.5f;
+		mesh.boundingSphere = glm::vec4(meshCenter, glm::distance(meshCenter, meshMax));
+	}
+
+	if (!shard.primitives.empty()) {
+		uploadGeometryShard(shard);
+	}
+
+	// Resolve the ranges of every primitive to the device addresses of its shard
+	std::vector<PrimitiveRecord> primitives;
+	for (auto& mesh : meshes) {
+		for (auto& primitive : mesh.primitives) {
+			primitive.primitiveIndex = static_cast<std::uint32_t>(primitives.size());
+			primitives.emplace_back(getPrimitiveRecord(primitive));
+		}
+	}
+
+	auto instances = loadGltfInstances(adapter);
+	uploadMeshlets(instances, primitives);
+	primitiveRecords = std::move(primitives);
+}
+
+/**
+ * Decodes the EXT_mesh_gpu_instancing TRS attributes of a range of instances into matrices. A range can
+ * span multiple nodes, and the attributes are read with random access so that any range can be decoded.
+ */
+struct InstanceDecodeTask : public enki::ITaskSet {
+	const fastgltf::Asset& asset;
+	const CompressedBufferDataAdapter& adapter;
+	std::span<const std::size_t> nodeIndices; // The instanced nodes, ordered by their instance offset
+	std::span<const NodeInstances> nodeInstances;
+	std::span<glm::mat4> transforms;
+
+	explicit InstanceDecodeTask(std::uint32_t instanceCount, const fastgltf::Asset& asset, const CompressedBufferDataAdapter& adapter,
+								std::span<const std::size_t> nodeIndices, std::span<const NodeInstances> nodeInstances, std::span<glm::mat4> transforms)
+			: enki::ITaskSet(instanceCount, 1024), asset(asset), adapter(adapter), nodeIndices(nodeIndices), nodeInstances(nodeInstances), transforms(transforms) {}
+
+	void ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) override {
+		ZoneScoped;
+		// Find the first node of this range. The transforms start at 1, as 0 is the identity of non-instanced nodes.
+		auto nodeIt = std::upper_bound(nodeIndices.begin(), nodeIndices.end(), range.start + 1, [&](std::uint32_t instance, std::size_t nodeIndex) {
+			return instance < nodeInstances[nodeIndex].offset;
+		}) - 1;
+
+		for (auto i = range.start + 1; i < range.end + 1; ++nodeIt) {
+			auto& node = asset.nodes[*nodeIt];
+			auto& instances = nodeInstances[*nodeIt];
+			const auto findAccessor = [&](std::string_view name) -> const fastgltf::Accessor* {
+				auto it = std::find_if(node.instancingAttributes.begin(), node.instancingAttributes.end(), [&](auto& attribute) {
+					return attribute.first == name;
+				});
+				return it == node.instancingAttributes.end() ? nullptr : &asset.accessors[it->second];
+			};
+			const auto* translations = findAccessor("TRANSLATION");
+			const auto* rotations = findAccessor("ROTATION");
+			const auto* scales = findAccessor("SCALE");
+
+			for (; i < util::min(range.end + 1, instances.offset + instances.count); ++i) {
+				const auto index = i - instances.offset;
+				auto matrix = glm::mat4(1.0f);
+				if (translations != nullptr)
+					matrix = glm::translate(matrix, fastgltf::getAccessorElement<glm::vec3>(asset, *translations, index, adapter));
+				if (rotations != nullptr) {
+					const auto rotation = fastgltf::getAccessorElement<glm::vec4>(asset, *rotations, index, adapter);
+					matrix *= glm::toMat4(glm::quat::wxyz(rotation.w, rotation.x, rotation.y, rotation.z));
+				}
+				if (scales != nullptr)
+					matrix = glm::scale(matrix, fastgltf::getAccessorElement<glm::vec3>(asset, *scales, index, adapter));
+				transforms[i] = matrix;
 			}
+		}
+	}
+};
 
-			auto& primitive = mesh.primitives.emplace_back();
-			if (gltfPrimitive.materialIndex.has_value()) {
-				primitive.materialIndex = gltfPrimitive.materialIndex.value() + numDefaultMaterials;
-			} else {
-				primitive.materialIndex = 0;
+std::vector<glm::mat4> Viewer::loadGltfInstances(const CompressedBufferDataAdapter& adapter) {
+	ZoneScoped;
+	nodeInstances.assign(asset.nodes.size(), NodeInstances {});
+
+	// Assign every instanced node its range of transforms. All attributes must have the same count.
+	std::vector<std::size_t> instancedNodes;
+	std::uint32_t instanceCount = 1;
+	for (std::size_t i = 0; i < asset.nodes.size(); ++i) {
+		auto& node = asset.nodes[i];
+		if (node.instancingAttributes.empty())
+			continue;
+
+		std::size_t count = std::numeric_limits<std::size_t>::max();
+		for (auto& attribute : node.instancingAttributes) {
+			count = util::min(count, asset.accessors[attribute.second].count);
+		}
+		if (count == 0 || count > std::numeric_limits<std::uint32_t>::max() - instanceCount)
+			continue;
+
+		nodeInstances[i] = { .offset = instanceCount, .count = static_cast<std::uint32_t>(count) };
+		instanceCount += static_cast<std::uint32_t>(count);
+		instancedNodes.emplace_back(i);
+	}
+
+	std::vector<glm::mat4> transforms(instanceCount);
+	transforms[0] = glm::mat4(1.0f);
+	if (instanceCount > 1) {
+		InstanceDecodeTask task(instanceCount - 1, asset, adapter, instancedNodes, nodeInstances, transforms);
+		taskScheduler.AddTaskSetToPipe(&task);
+		taskScheduler.WaitforTask(&task);
+	}
+	return transforms;
+}
+
+MeshletLimits Viewer::getDefaultMeshletLimits() const {
+	MeshletLimits limits;
+	if (renderPath != RenderPath::MeshShading)
+		return limits;
+
+	// Use the largest workgroup size the device prefers. NVIDIA prefers 32 invocations, AMD prefers 128.
+	limits.meshWorkgroupSize = meshWorkgroupSizes.front();
+	for (auto size : meshWorkgroupSizes) {
+		if (size <= meshShaderProperties.maxPreferredMeshWorkGroupInvocations && size <= meshShaderProperties.maxMeshWorkGroupInvocations)
+			limits.meshWorkgroupSize = size;
+	}
+
+	// Devices which prefer each invocation to write a single vertex and primitive get the largest meshlets
+	// which fit into one workgroup. Otherwise, we keep the limits which work well on NVIDIA.
+	if (meshShaderProperties.prefersLocalInvocationVertexOutput || meshShaderProperties.prefersLocalInvocationPrimitiveOutput) {
+		for (auto [vertices, triangles] : meshletLimitVariants) {
+			if (vertices <= limits.meshWorkgroupSize && triangles <= limits.meshWorkgroupSize) {
+				limits.maxVertices = vertices;
+				limits.maxTriangles = triangles;
 			}
+		}
+	}
+	return limits;
+}
 
-			// Copy the positions and indices
-			auto& posAccessor = asset.accessors[positionIt->second];
-			std::vector<Vertex> vertices; vertices.reserve(posAccessor.count);
-			fastgltf::iterateAccessor<glm::vec3>(asset, posAccessor, [&](glm::vec3 val) {
-				auto& vertex = vertices.emplace_back();
-				vertex.position = glm::vec4(val, 1.0f);
-				vertex.color = glm::vec4(1.0f);
-				vertex.uv = glm::vec2(0.0f);
-			}, adapter);
+bool Viewer::supportsMeshletLimits(const MeshletLimits& limits) const {
+	// meshopt stores the triangles as 8-bit indices, and requires the triangle count to be aligned to 4
+	if (limits.maxVertices < 3 || limits.maxVertices > 255 || limits.maxTriangles < 4 || limits.maxTriangles > 512 || limits.maxTriangles % 4 != 0)
+		return false;
+	if (renderPath != RenderPath::MeshShading)
+		return true;
+
+	return !shaders::find(getMeshShaderName(limits)).empty()
+		&& limits.maxVertices <= meshShaderProperties.maxMeshOutputVertices
+		&& limits.maxTriangles <= meshShaderProperties.maxMeshOutputPrimitives
+		&& limits.meshWorkgroupSize > 0
+		&& limits.meshWorkgroupSize <= meshShaderProperties.maxMeshWorkGroupInvocations
+		&& limits.meshWorkgroupSize <= meshShaderProperties.maxMeshWorkGroupSize[0];
+}
 
-			auto& indicesAccessor = asset.accessors[gltfPrimitive.indicesAccessor.value()];
-			std::vector<std::uint32_t> indices(indicesAccessor.count);
-			fastgltf::copyFromAccessor<std::uint32_t>(asset, indicesAccessor, indices.data(), adapter);
-
-			if (auto* colorAttribute = gltfPrimitive.findAttribute("COLOR_0"); colorAttribute != gltfPrimitive.attributes.end()) {
-				// The glTF spec allows VEC3 and VEC4 for COLOR_n, with VEC3 data having to be extended with 1.0f for the fourth component.
-				auto& colorAccessor = asset.accessors[colorAttribute->second];
-				if (colorAccessor.type == fastgltf::AccessorType::Vec4) {
-					fastgltf::iterateAccessorWithIndex<glm::vec4>(asset, asset.accessors[colorAttribute->second], [&](glm::vec4 val, std::size_t idx) {
-						vertices[idx].color = val;
-					}, adapter);
-				} else if (colorAccessor.type == fastgltf::AccessorType::Vec3) {
-					fastgltf::iterateAccessorWithIndex<glm::vec3>(asset, asset.accessors[colorAttribute->second], [&](glm::vec3 val, std::size_t idx) {
-						vertices[idx].color = glm::vec4(val, 1.0f);
-					}, adapter);
+void Viewer::rebuildMeshlets(const MeshletLimits& limits) {
+	ZoneScoped;
+	assert(supportsMeshletLimits(limits));
+
+	// No frame may still use the previous meshlets or pipelines
+	vkDeviceWaitIdle(device);
+	meshletLimits = limits;
+
+	if (renderPath == RenderPath::MeshShading) {
+		for (auto& pipeline : meshPipelines) {
+			vkDestroyPipeline(device, pipeline, VK_NULL_HANDLE);
+			pipeline = VK_NULL_HANDLE;
+		}
+		buildMeshShadingPipelines();
+		for (auto& task : shaderLoadTasks) {
+			taskScheduler.AddTaskSetToPipe(task.get());
+		}
+	}
+
+	destroyMeshBuffers();
+	meshes.clear();
+	loadGltfMeshes();
+
+	joinPipelineBuilds();
+}
+
+VkResult Viewer::createGpuTransferBuffer(std::size_t byteSize, VkBuffer *buffer, VmaAllocation *allocation, VkBufferUsageFlags extraUsage) noexcept {
+	const VmaAllocationCreateInfo allocationCreateInfo {
+		.usage = VMA_MEMORY_USAGE_GPU_ONLY,
+	};
+	const VkBufferCreateInfo bufferCreateInfo {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = byteSize,
+		.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | extraUsage,
+	};
+	return vmaCreateBuffer(allocator, &bufferCreateInfo, &allocationCreateInfo,
+						   buffer, allocation, VK_NULL_HANDLE);
+}
+
+VkDeviceSize Viewer::getGeometryElementSize(GeometryRange range) const noexcept {
+	// The vertex shading path has a 32-bit index for every 8-bit triangle index, whose buffer is the larger one
+	if (range == GeometryRange::TriangleIndices && renderPath == RenderPath::VertexShading)
+		return sizeof(std::uint32_t);
+	return geometryElementSizes[static_cast<std::size_t>(range)];
+}
+
+std::uint32_t Viewer::createGeometryShard(const std::array<VkDeviceSize, geometryRangeCount>& counts,
+										  const std::array<VkDeviceSize, geometryRangeCount>& capacities) {
+	ZoneScoped;
+	// Reuse the index of a shard destroyed by compaction
+	auto& shards = globalMeshBuffers.shards;
+	auto it = std::find_if(shards.begin(), shards.end(), [](const GeometryShard& shard) { return !shard.isLive(); });
+	const auto shardIndex = static_cast<std::uint32_t>(std::distance(shards.begin(), it));
+	auto& shard = it == shards.end() ? shards.emplace_back() : *it;
+	shard = {};
+
+	const auto createBuffer = [&](GeometryBuffer& buffer, VkDeviceSize byteSize, VkBufferUsageFlags extraUsage, std::string_view name) {
+		// Compaction copies ranges out of the shard, and the shaders read the data through device addresses
+		auto result = createGpuTransferBuffer(byteSize, &buffer.handle, &buffer.allocation,
+											  extraUsage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+		vk::checkResult(result, "Failed to allocate geometry shard buffer: {}");
+		vk::setDebugUtilsName(device, buffer.handle, fmt::format("{} {}", name, shardIndex));
+		shard.byteSize += byteSize;
+
+		const VkBufferDeviceAddressInfo addressInfo {
+			.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+			.buffer = buffer.handle,
+		};
+		buffer.address = vkGetBufferDeviceAddress(device, &addressInfo);
+	};
+
+	static constexpr std::array<std::string_view, geometryRangeCount> bufferNames {{
+		"Meshlet descriptions", "Meshlet vertex indices", "Meshlet triangle indices", "Meshlet vertices",
+	}};
+	for (std::size_t i = 0; i < geometryRangeCount; ++i) {
+		// The free space is limited by the shard size, but a single primitive may exceed it. No buffer may be empty.
+		const auto range = static_cast<GeometryRange>(i);
+		const auto maxCapacity = util::min<VkDeviceSize>(maxShardSize / getGeometryElementSize(range), std::numeric_limits<std::uint32_t>::max());
+		const auto capacity = util::max<VkDeviceSize>(util::max(counts[i], util::min(capacities[i], maxCapacity)), 1);
+		createBuffer(shard.buffers[i], capacity * geometryElementSizes[i], 0, bufferNames[i]);
+		shard.allocators[i].reset(static_cast<std::uint32_t>(capacity));
+
+		if (range == GeometryRange::TriangleIndices && renderPath == RenderPath::VertexShading) {
+			// The index buffer of the vertex shading path
+			createBuffer(shard.meshletIndices, capacity * sizeof(std::uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, "Meshlet indices");
+		}
+	}
+	return shardIndex;
+}
+
+void Viewer::destroyGeometryShard(GeometryShard& shard) {
+	vmaDestroyBuffer(allocator, shard.meshletIndices.handle, shard.meshletIndices.allocation);
+	for (auto& buffer : shard.buffers | std::views::reverse) {
+		vmaDestroyBuffer(allocator, buffer.handle, buffer.allocation);
+	}
+	shard = {};
+}
+
+void Viewer::uploadGeometryShard(GeometryShardData& data) {
+	ZoneScoped;
+	// Leave a quarter of every buffer free for meshes loaded at runtime
+	const std::array<VkDeviceSize, geometryRangeCount> counts {{
+		data.meshlets.size(), data.meshletVertices.size(), data.meshletTriangles.size(), data.vertices.size(),
+	}};
+	std::array<VkDeviceSize, geometryRangeCount> capacities {};
+	std::ranges::transform(counts, capacities.begin(), [](VkDeviceSize count) { return count + count / 4; });
+	const auto shardIndex = createGeometryShard(counts, capacities);
+	auto& shard = globalMeshBuffers.shards[shardIndex];
+
+	std::vector<std::unique_ptr<BufferUploadTask>> uploadTasks;
+	const auto uploadBuffer = [&](std::span<const std::byte> bytes, const GeometryBuffer& buffer) {
+		if (!bytes.empty())
+			uploadTasks.emplace_back(BufferUploader::getInstance().uploadToBuffer(bytes, buffer.handle));
+	};
+	uploadBuffer(std::as_bytes(std::span(data.meshlets)), shard.buffers[static_cast<std::size_t>(GeometryRange::Meshlets)]);
+	uploadBuffer(std::as_bytes(std::span(data.meshletVertices)), shard.buffers[static_cast<std::size_t>(GeometryRange::VertexIndices)]);
+	uploadBuffer(std::as_bytes(std::span(data.meshletTriangles)), shard.buffers[static_cast<std::size_t>(GeometryRange::TriangleIndices)]);
+	uploadBuffer(std::as_bytes(std::span(data.vertices)), shard.buffers[static_cast<std::size_t>(GeometryRange::Vertices)]);
+	uploadBuffer(std::as_bytes(std::span(data.meshletIndices)), shard.meshletIndices);
+
+	// The primitives were appended in order, so the empty allocators hand out the offsets they have within the data
+	std::array<std::uint32_t, geometryRangeCount> offsets {};
+	for (auto [meshIndex, primitiveIndex] : data.primitives) {
+		auto& geometry = meshes[meshIndex].primitives[primitiveIndex].geometry;
+		geometry.shardIndex = shardIndex;
+		for (std::size_t i = 0; i < geometryRangeCount; ++i) {
+			if (geometry.counts[i] == 0)
+				continue;
+			geometry.ranges[i] = shard.allocators[i].allocate(geometry.counts[i]);
+			assert(geometry.ranges[i].isValid() && geometry.ranges[i].offset == offsets[i]);
+			offsets[i] += geometry.counts[i];
+		}
+	}
+
+	// Only one shard is kept in host memory at a time
+	for (auto& task : uploadTasks) {
+		taskScheduler.WaitforTask(task.get());
+	}
+	data = {};
+}
+
+std::optional<GeometryAllocation> Viewer::allocateGeometry(const std::array<std::uint32_t, geometryRangeCount>& counts, bool allowNewShard) {
+	ZoneScoped;
+	GeometryAllocation allocation { .counts = counts };
+	const auto allocateIn = [&](std::uint32_t shardIndex) {
+		auto& shard = globalMeshBuffers.shards[shardIndex];
+		allocation.shardIndex = shardIndex;
+		for (std::size_t i = 0; i < geometryRangeCount; ++i) {
+			if (counts[i] == 0)
+				continue;
+			allocation.ranges[i] = shard.allocators[i].allocate(counts[i]);
+			if (!allocation.ranges[i].isValid()) {
+				// Give back the ranges which did fit
+				for (std::size_t j = 0; j < i; ++j) {
+					shard.allocators[j].free(allocation.ranges[j]);
+					allocation.ranges[j] = {};
 				}
+				return false;
 			}
+		}
+		return true;
+	};
+
+	for (std::uint32_t i = 0; i < globalMeshBuffers.shards.size(); ++i) {
+		const auto& shard = globalMeshBuffers.shards[i];
+		if (shard.isLive() && !shard.evacuating && allocateIn(i))
+			return allocation;
+	}
+	if (!allowNewShard)
+		return std::nullopt;
+
+	// Give the new shard room for more meshes, as the next ones are likely loaded soon
+	std::array<VkDeviceSize, geometryRangeCount> elementCounts {};
+	std::array<VkDeviceSize, geometryRangeCount> capacities {};
+	for (std::size_t i = 0; i < geometryRangeCount; ++i) {
+		elementCounts[i] = counts[i];
+		capacities[i] = util::max<VkDeviceSize>(elementCounts[i] * 4, minRuntimeShardSize / geometryElementSizes[i]);
+	}
+	if (allocateIn(createGeometryShard(elementCounts, capacities)))
+		return allocation;
+	return std::nullopt;
+}
+
+void Viewer::retireGeometry(GeometryAllocation& allocation, std::uint64_t lastUsedFrame) {
+	retiredGeometry.emplace_back(lastUsedFrame, allocation);
+	allocation = {};
+}
 
-			if (auto* uvAttribute = gltfPrimitive.findAttribute("TEXCOORD_0"); uvAttribute != gltfPrimitive.attributes.end()) {
-				fastgltf::iterateAccessorWithIndex<glm::vec2>(asset, asset.accessors[uvAttribute->second], [&](glm::vec2 val, std::size_t idx) {
-					vertices[idx].uv = val;
-				}, adapter);
-			}
-
-			// These are the optimal values for NVIDIA. What about the others?
-			const std::size_t maxVertices = 64;
-			const std::size_t maxTriangles = 124; // NVIDIA wants 126 but meshopt only allows 124 for alignment reasons.
-			const float coneWeight = 0.0f; // We leave this as 0 because we're not using cluster cone culling.
-
-			// TODO: Meshlet generation and data resizing should probably be threaded, too.
-			std::size_t maxMeshlets = meshopt_buildMeshletsBound(indicesAccessor.count, maxVertices, maxTriangles);
-			std::vector<meshopt_Meshlet> meshlets(maxMeshlets);
-			std::vector<unsigned int> meshlet_vertices(maxMeshlets * maxVertices);
-			std::vector<unsigned char> meshlet_triangles(maxMeshlets * maxTriangles * 3);
-
-			// Generate the meshlets for this primitive
-			primitive.meshlet_count = meshopt_buildMeshlets(
-				meshlets.data(), meshlet_vertices.data(), meshlet_triangles.data(),
-				indices.data(), indices.size(),
-				&vertices[0].position.x, vertices.size(), sizeof(decltype(vertices)::value_type),
-				maxVertices, maxTriangles, coneWeight);
-
-			primitive.descOffset = globalMeshlets.size();
-			primitive.vertexIndicesOffset = globalMeshletVertices.size();
-			primitive.triangleIndicesOffset = globalMeshletTriangles.size();
-			primitive.verticesOffset = globalVertices.size();
-
-			// Trim the buffers
-			const auto& lastMeshlet = meshlets[primitive.meshlet_count - 1];
-			meshlet_vertices.resize(lastMeshlet.vertex_count + lastMeshlet.vertex_offset);
-			meshlet_triangles.resize(((lastMeshlet.triangle_count * 3 + 3) & ~3) + lastMeshlet.triangle_offset);
-			meshlets.resize(primitive.meshlet_count);
-
-			std::vector<Meshlet> finalMeshlets; finalMeshlets.reserve(primitive.meshlet_count);
-			for (auto& meshlet : meshlets) {
-				// Compute AABB bounds
-				auto& initialVertex = vertices[meshlet_vertices[meshlet.vertex_offset]];
-				auto min = glm::vec3(initialVertex.position), max = glm::vec3(initialVertex.position);
-
-				for (std::size_t i = 1; i < meshlet.vertex_count; ++i) {
-					std::uint32_t vertexIndex = meshlet_vertices[meshlet.vertex_offset + i];
-					auto& vertex = vertices[vertexIndex];
-
-					if (min.x > vertex.position.x)
-						min.x = vertex.position.x;
-					if (min.y > vertex.position.y)
-						min.y = vertex.position.y;
-					if (min.z > vertex.position.z)
-						min.z = vertex.position.z;
-
-					if (max.x < vertex.position.x)
-						max.x = vertex.position.x;
-					if (max.y < vertex.position.y)
-						max.y = vertex.position.y;
-					if (max.z < vertex.position.z)
-						max.z = vertex.position.z;
+void Viewer::releaseRetiredGeometry(std::uint64_t completedFrame) {
+	while (!retiredGeometry.empty() && retiredGeometry.front().first <= completedFrame) {
+		auto& allocation = retiredGeometry.front().second;
+		auto& shard = globalMeshBuffers.shards[allocation.shardIndex];
+		for (std::size_t i = 0; i < geometryRangeCount; ++i) {
+			shard.allocators[i].free(allocation.ranges[i]);
+		}
+
+		// Once the last range of an evacuated shard is released, no frame in flight reads it anymore
+		const auto empty = std::ranges::all_of(shard.allocators, [](const OffsetAllocator& allocator) {
+			return allocator.getAllocationCount() == 0;
+		});
+		if (shard.evacuating && empty) {
+			destroyGeometryShard(shard);
+		}
+		retiredGeometry.pop_front();
+	}
+}
+
+PrimitiveRecord Viewer::getPrimitiveRecord(const Primitive& primitive) const {
+	const auto& geometry = primitive.geometry;
+	const auto& shard = globalMeshBuffers.shards[geometry.shardIndex];
+	const auto getAddress = [&](GeometryRange range) {
+		const auto index = static_cast<std::size_t>(range);
+		return shard.buffers[index].address + geometry.getOffset(range) * geometryElementSizes[index];
+	};
+	return {
+		.meshlets = getAddress(GeometryRange::Meshlets),
+		.vertexIndices = getAddress(GeometryRange::VertexIndices),
+		.triangleIndices = getAddress(GeometryRange::TriangleIndices),
+		.vertices = getAddress(GeometryRange::Vertices),
+		.shardIndex = geometry.shardIndex,
+		.firstIndex = geometry.getOffset(GeometryRange::TriangleIndices),
+		.meshletCount = static_cast<std::uint32_t>(primitive.meshlet_count),
+		.materialIndex = primitive.materialIndex,
+		.aabbCenter = primitive.aabbCenter,
+		.aabbExtents = primitive.aabbExtents,
+		.finestMeshletCount = static_cast<std::uint32_t>(primitive.finestLevelMeshletCount),
+	};
+}
+
+void Viewer::uploadMeshlets(std::vector<glm::mat4>& instances, std::vector<PrimitiveRecord>& primitives) {
+	ZoneScoped;
+	std::vector<std::unique_ptr<BufferUploadTask>> uploadTasks;
+	{
+		// Create the instance transform buffer
+		auto result = createGpuTransferBuffer(instances.size() * sizeof(std::remove_reference_t<decltype(instances)>::value_type),
+											  &globalMeshBuffers.instancesHandle, &globalMeshBuffers.instancesAllocation);
+		vk::checkResult(result, "Failed to allocate instance buffer: {}");
+		vk::setDebugUtilsName(device, globalMeshBuffers.instancesHandle, "Instance transforms");
+
+		auto task = BufferUploader::getInstance().uploadToBuffer(
+			std::as_bytes(std::span{instances.begin(), instances.end()}),
+			globalMeshBuffers.instancesHandle);
+		uploadTasks.emplace_back(std::move(task));
+	}
+	if (!primitives.empty()) {
+		// Create the static primitive buffer
+		auto result = createGpuTransferBuffer(primitives.size() * sizeof(std::remove_reference_t<decltype(primitives)>::value_type),
+											  &globalMeshBuffers.primitivesHandle, &globalMeshBuffers.primitivesAllocation);
+		vk::checkResult(result, "Failed to allocate primitive buffer: {}");
+		vk::setDebugUtilsName(device, globalMeshBuffers.primitivesHandle, "Primitives");
+
+		auto task = BufferUploader::getInstance().uploadToBuffer(
+			std::as_bytes(std::span{primitives.begin(), primitives.end()}),
+			globalMeshBuffers.primitivesHandle);
+		uploadTasks.emplace_back(std::move(task));
+	}
+
+	// Rebuilding the meshlets reuses the descriptor sets, and only rewrites the buffer bindings
+	if (globalMeshBuffers.descriptors.empty()) {
+		deletionQueue.push([&]() {
+			destroyMeshBuffers();
+		});
+
+		// Allocate the primitive descriptor set
+		std::vector<VkDescriptorSetLayout> setLayouts(frameOverlap, meshletSetLayout);
+		const VkDescriptorSetAllocateInfo allocateInfo {
+			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+			.descriptorPool = descriptorPool,
+			.descriptorSetCount = static_cast<std::uint32_t>(setLayouts.size()),
+			.pSetLayouts = setLayouts.data(),
+		};
+
+		// Allocate the sets. We copy each member of the sets vector in the loop below.
+		globalMeshBuffers.descriptors.resize(allocateInfo.descriptorSetCount);
+		auto result = vkAllocateDescriptorSets(device, &allocateInfo, globalMeshBuffers.descriptors.data());
+		vk::checkResult(result, "Failed to allocate mesh buffers descriptor set: {}");
+	}
+
+	for (auto& descriptor : globalMeshBuffers.descriptors) {
+		// Update the descriptors with the buffer handles
+		std::array<VkDescriptorBufferInfo, 2> descriptorBufferInfos{{
+			{
+				.buffer = globalMeshBuffers.instancesHandle,
+				.offset = 0,
+				.range = VK_WHOLE_SIZE,
+			},
+			{
+				.buffer = globalMeshBuffers.primitivesHandle,
+				.offset = 0,
+				.range = VK_WHOLE_SIZE,
+			},
+		}};
+		std::array<VkWriteDescriptorSet, 2> descriptorWrites{{
+			{
+				.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+				.dstSet = descriptor,
+				.dstBinding = 6,
+				.dstArrayElement = 0,
+				.descriptorCount = 1,
+				.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				.pBufferInfo = &descriptorBufferInfos[0],
+			},
+			{
+				.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+				.dstSet = descriptor,
+				.dstBinding = 9,
+				.dstArrayElement = 0,
+				.descriptorCount = 1,
+				.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				.pBufferInfo = &descriptorBufferInfos[1],
+			},
+		}};
+		// Without any primitives, there is no primitive buffer to bind
+		const auto writeCount = primitives.empty() ? descriptorWrites.size() - 1 : descriptorWrites.size();
+		vkUpdateDescriptorSets(device, static_cast<std::uint32_t>(writeCount), descriptorWrites.data(), 0,
+							   nullptr);
+	}
+
+	for (auto& task : uploadTasks) {
+		taskScheduler.WaitforTask(task.get());
+	}
+}
+
+void Viewer::destroyMeshBuffers() {
+	// The loads in flight upload into the shards
+	cancelMeshLoads();
+
+	vmaDestroyBuffer(allocator, globalMeshBuffers.primitivesHandle, globalMeshBuffers.primitivesAllocation);
+	vmaDestroyBuffer(allocator, globalMeshBuffers.instancesHandle, globalMeshBuffers.instancesAllocation);
+	globalMeshBuffers.primitivesHandle = globalMeshBuffers.instancesHandle = VK_NULL_HANDLE;
+	for (auto& shard : globalMeshBuffers.shards) {
+		destroyGeometryShard(shard);
+	}
+	globalMeshBuffers.shards.clear();
+
+	// The ranges and copies refer to the destroyed shards
+	retiredGeometry.clear();
+	pendingGeometryCopies.clear();
+	pendingRecordWrites.clear();
+}
+
+struct MeshLoadJob;
+
+/** Rebuilds the clusters of one primitive per partition. This is the first stage of a MeshLoadJob. */
+struct MeshBuildTask : public enki::ITaskSet {
+	MeshLoadJob* job;
+
+	explicit MeshBuildTask(MeshLoadJob* job, std::uint32_t primitiveCount) noexcept : job(job) {
+		m_SetSize = primitiveCount;
+	}
+
+	void ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) override;
+};
+
+/** Copies the geometry into a staging buffer and submits its upload into the allocated ranges, without waiting for the GPU */
+struct MeshSubmitTask : public enki::ITaskSet {
+	MeshLoadJob* job;
+
+	explicit MeshSubmitTask(MeshLoadJob* job) noexcept : job(job) {
+		m_SetSize = 1;
+	}
+
+	void ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) override;
+};
+
+/**
+ * Loads a mesh back into the geometry heap through a build -> submit task chain. The main thread allocates the
+ * geometry ranges in between, polls the upload in Viewer::updateMeshLoads, and only then makes the mesh resident.
+ */
+struct MeshLoadJob {
+	Viewer* viewer;
+	std::size_t meshIndex;
+	MeshletLimits limits;
+	bool vertexShading;
+
+	// The tasks fill in copies, as the main thread keeps reading the mesh's primitives
+	std::vector<Primitive> primitives;
+	std::vector<PrimitiveGeometry> geometries;
+	std::vector<BufferUploadRegion> regions; // Into the allocated ranges, which only the main thread can allocate
+	bool allocated = false;
+	PendingUpload upload;
+	bool uploadSubmitted = false;
+
+	// Exceptions can't propagate out of the tasks, and the partitions of the build may fail at the same time
+	std::atomic<bool> failed = false;
+
+	MeshBuildTask buildTask;
+	MeshSubmitTask submitTask;
+
+	explicit MeshLoadJob(Viewer* viewer, std::size_t meshIndex)
+			: viewer(viewer), meshIndex(meshIndex), limits(viewer->meshletLimits), vertexShading(viewer->renderPath == RenderPath::VertexShading),
+			  primitives(viewer->meshes[meshIndex].primitives), geometries(primitives.size()),
+			  buildTask(this, static_cast<std::uint32_t>(primitives.size())), submitTask(this) {}
+};
+
+void MeshBuildTask::ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) {
+	ZoneScoped;
+	const auto& gltfMesh = job->viewer->asset.meshes[job->meshIndex];
+	for (auto i = range.start; i < range.end; ++i) {
+		try {
+			job->geometries[i] = buildPrimitiveGeometry(job->viewer->asset, gltfMesh.primitives[i], *job->viewer->bufferAdapter,
+														job->limits, job->vertexShading, job->primitives[i]);
+		} catch (const std::runtime_error& error) {
+			fmt::print(stderr, "Failed to build primitive {} of mesh {}: {}\n", i, job->meshIndex, error.what());
+			job->failed = true;
+		}
+	}
+}
+
+void MeshSubmitTask::ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) {
+	ZoneScoped;
+	try {
+		BufferUploader::getInstance().submitBufferUpload(job->regions, job->upload);
+		job->uploadSubmitted = true;
+	} catch (const vulkan_error& error) {
+		fmt::print(stderr, "Failed to submit the geometry of mesh {}: {}\n", job->meshIndex, error.what());
+		job->failed = true;
+	}
+
+	// The geometry now lives in the staging buffer
+	job->regions.clear();
+	job->geometries.clear();
+}
+
+void Viewer::loadMesh(std::size_t meshIndex) {
+	assert(meshes.size() > meshIndex);
+	ZoneScoped;
+
+	auto& mesh = meshes[meshIndex];
+	if (mesh.resident || mesh.loading)
+		return;
+	if (mesh.primitives.empty()) {
+		mesh.resident = true;
+		return;
+	}
+
+	mesh.loading = true;
+	auto& job = meshLoadJobs.emplace_back(std::make_shared<MeshLoadJob>(this, meshIndex));
+	taskScheduler.AddTaskSetToPipe(&job->buildTask);
+}
+
+void Viewer::updateMeshLoads() {
+	ZoneScoped;
+	auto& uploader = BufferUploader::getInstance();
+	for (auto it = meshLoadJobs.begin(); it != meshLoadJobs.end();) {
+		auto& job = **it;
+		if (!job.buildTask.GetIsComplete()) {
+			++it;
+			continue;
+		}
+
+		// Allocate the ranges of every primitive in any shard with enough free space, and upload into them
+		if (!job.allocated && !job.failed) {
+			for (std::size_t i = 0; i < job.primitives.size(); ++i) {
+				auto& geometry = job.geometries[i];
+				std::array<std::uint32_t, geometryRangeCount> counts {};
+				std::ranges::transform(geometry.getCounts(), counts.begin(), [](std::size_t count) {
+					return static_cast<std::uint32_t>(count);
+				});
+				auto allocation = allocateGeometry(counts, true);
+				if (!allocation.has_value()) {
+					fmt::print(stderr, "Failed to allocate the geometry of mesh {}\n", job.meshIndex);
+					for (std::size_t j = 0; j < i; ++j) {
+						retireGeometry(job.primitives[j].geometry, frameNumber);
+					}
+					job.failed = true;
+					break;
+				}
+				job.primitives[i].geometry = *allocation;
+
+				const auto& shard = globalMeshBuffers.shards[allocation->shardIndex];
+				const auto addRegion = [&](std::span<const std::byte> bytes, const GeometryBuffer& buffer, GeometryRange range, VkDeviceSize elementSize) {
+					if (!bytes.empty())
+						job.regions.push_back({ bytes, buffer.handle, allocation->getOffset(range) * elementSize });
+				};
+				addRegion(std::as_bytes(std::span(geometry.hierarchy.meshlets)), shard.buffers[static_cast<std::size_t>(GeometryRange::Meshlets)],
+						  GeometryRange::Meshlets, sizeof(Meshlet));
+				addRegion(std::as_bytes(std::span(geometry.hierarchy.meshletVertices)), shard.buffers[static_cast<std::size_t>(GeometryRange::VertexIndices)],
+						  GeometryRange::VertexIndices, sizeof(unsigned int));
+				addRegion(std::as_bytes(std::span(geometry.hierarchy.meshletTriangles)), shard.buffers[static_cast<std::size_t>(GeometryRange::TriangleIndices)],
+						  GeometryRange::TriangleIndices, sizeof(unsigned char));
+				addRegion(std::as_bytes(std::span(geometry.vertices)), shard.buffers[static_cast<std::size_t>(GeometryRange::Vertices)],
+						  GeometryRange::Vertices, sizeof(Vertex));
+				addRegion(std::as_bytes(std::span(geometry.meshletIndices)), shard.meshletIndices, GeometryRange::TriangleIndices, sizeof(std::uint32_t));
+			}
+			if (!job.failed) {
+				job.allocated = true;
+				taskScheduler.AddTaskSetToPipe(&job.submitTask);
+			}
+		}
+		if (!job.submitTask.GetIsComplete() || (job.uploadSubmitted && !uploader.isComplete(job.upload))) {
+			++it;
+			continue;
+		}
+		uploader.destroy(job.upload);
+
+		auto& mesh = meshes[job.meshIndex];
+		mesh.loading = false;
+		if (job.failed) {
+			// No frame has read the ranges, and the upload into them has finished or was never submitted
+			if (job.allocated) {
+				for (auto& primitive : job.primitives) {
+					retireGeometry(primitive.geometry, frameNumber);
+				}
+			}
+		} else {
+			// The records are written at the start of the next recorded frame, which is the first one drawing the mesh again
+			mesh.primitives = std::move(job.primitives);
+			for (auto& primitive : mesh.primitives) {
+				primitiveRecords[primitive.primitiveIndex] = getPrimitiveRecord(primitive);
+				pendingRecordWrites.emplace_back(primitive.primitiveIndex);
+			}
+			mesh.resident = true;
+		}
+		it = meshLoadJobs.erase(it);
+	}
+}
+
+void Viewer::cancelMeshLoads() {
+	ZoneScoped;
+	auto& uploader = BufferUploader::getInstance();
+	for (auto& job : meshLoadJobs) {
+		taskScheduler.WaitforTask(&job->buildTask);
+		taskScheduler.WaitforTask(&job->submitTask);
+		if (job->uploadSubmitted) {
+			auto result = vkWaitForFences(device, 1, &job->upload.fence, VK_TRUE, std::numeric_limits<std::uint64_t>::max());
+			vk::checkResult(result, "Failed to wait for mesh upload: {}");
+		}
+		uploader.destroy(job->upload);
+		meshes[job->meshIndex].loading = false;
+	}
+	meshLoadJobs.clear();
+}
+
+void Viewer::unloadMesh(std::size_t meshIndex) {
+	assert(meshes.size() > meshIndex);
+	ZoneScoped;
+
+	auto& mesh = meshes[meshIndex];
+	if (!mesh.resident)
+		return;
+
+	// The frames in flight may still draw the mesh, and the next frame may still copy into its ranges
+	for (auto& primitive : mesh.primitives) {
+		retireGeometry(primitive.geometry, frameNumber + 1);
+	}
+	mesh.resident = false;
+}
+
+void Viewer::compactGeometry() {
+	ZoneScoped;
+	// The ranges moved by the last compaction are only filled by the next frame, so they can't be moved again yet.
+	// The ranges of meshes still loading aren't moved either, so their shards can't be evacuated while they load.
+	if (!pendingGeometryCopies.empty() || !meshLoadJobs.empty())
+		return;
+
+	auto& shards = globalMeshBuffers.shards;
+	const auto getFill = [](const GeometryShard& shard) {
+		VkDeviceSize usedBytes = 0;
+		VkDeviceSize capacityBytes = 0;
+		for (std::size_t i = 0; i < geometryRangeCount; ++i) {
+			usedBytes += static_cast<VkDeviceSize>(shard.allocators[i].getSize() - shard.allocators[i].getFreeSize()) * geometryElementSizes[i];
+			capacityBytes += static_cast<VkDeviceSize>(shard.allocators[i].getSize()) * geometryElementSizes[i];
+		}
+		return static_cast<double>(usedBytes) / static_cast<double>(capacityBytes);
+	};
+
+	// Evacuate the sparsest shards first
+	std::vector<std::uint32_t> sparseShards;
+	for (std::uint32_t i = 0; i < shards.size(); ++i) {
+		if (shards[i].isLive() && !shards[i].evacuating && getFill(shards[i]) < compactionThreshold)
+			sparseShards.emplace_back(i);
+	}
+	std::ranges::sort(sparseShards, {}, [&](std::uint32_t i) { return getFill(shards[i]); });
+
+	std::vector<bool> targets(shards.size(), false);
+	bool moved = false;
+	for (auto shardIndex : sparseShards) {
+		// The ranges a shard received are only filled by the next frame, so it has to stay
+		if (targets[shardIndex])
+			continue;
+
+		auto& shard = shards[shardIndex];
+		shard.evacuating = true;
+		bool evacuated = true;
+		for (auto& mesh : meshes) {
+			if (!mesh.resident)
+				continue;
+			for (auto& primitive : mesh.primitives) {
+				if (primitive.geometry.shardIndex != shardIndex)
+					continue;
+
+				auto target = allocateGeometry(primitive.geometry.counts, false);
+				if (!target.has_value()) {
+					evacuated = false;
+					continue;
+				}
+				targets[target->shardIndex] = true;
+
+				const auto& targetShard = shards[target->shardIndex];
+				const auto copyRange = [&](const GeometryBuffer& source, const GeometryBuffer& destination, GeometryRange range, VkDeviceSize elementSize) {
+					const auto count = primitive.geometry.counts[static_cast<std::size_t>(range)];
+					if (count == 0 || source.handle == VK_NULL_HANDLE)
+						return;
+					pendingGeometryCopies.push_back({
+						.source = source.handle,
+						.destination = destination.handle,
+						.region = {
+							.srcOffset = primitive.geometry.getOffset(range) * elementSize,
+							.dstOffset = target->getOffset(range) * elementSize,
+							.size = count * elementSize,
+						},
+					});
+				};
+				for (std::size_t i = 0; i < geometryRangeCount; ++i) {
+					copyRange(shard.buffers[i], targetShard.buffers[i], static_cast<GeometryRange>(i), geometryElementSizes[i]);
+				}
+				copyRange(shard.meshletIndices, targetShard.meshletIndices, GeometryRange::TriangleIndices, sizeof(std::uint32_t));
+
+				// The frames in flight still read the old ranges, and the next frame copies from them
+				retireGeometry(primitive.geometry, frameNumber + 1);
+				primitive.geometry = *target;
+				primitiveRecords[primitive.primitiveIndex] = getPrimitiveRecord(primitive);
+				pendingRecordWrites.emplace_back(primitive.primitiveIndex);
+				moved = true;
+			}
+		}
+
+		// Keep the shard if some of its primitives didn't fit anywhere else
+		if (!evacuated) {
+			shard.evacuating = false;
+			continue;
+		}
+
+		// A shard without any ranges, not even retired ones, isn't read by any frame in flight
+		const auto empty = std::ranges::all_of(shard.allocators, [](const OffsetAllocator& allocator) {
+			return allocator.getAllocationCount() == 0;
+		});
+		if (empty) {
+			destroyGeometryShard(shard);
+		}
+	}
+
+	// The meshlet draw batches of the vertex shading path depend on the shards
+	if (moved)
+		drawList.stale = true;
+}
+
+void Viewer::recordGeometryUpdates(VkCommandBuffer cmd) {
+	if (pendingGeometryCopies.empty() && pendingRecordWrites.empty())
+		return;
+	ZoneScoped;
+
+	// The previous frames may still read the records, or the ranges the copies write before they were released
+	const VkMemoryBarrier2 writeBarrier {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+		.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+		.srcAccessMask = VK_ACCESS_2_NONE,
+		.dstStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+		.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+	};
+	const VkDependencyInfo writeDependencyInfo {
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.memoryBarrierCount = 1,
+		.pMemoryBarriers = &writeBarrier,
+	};
+	vkCmdPipelineBarrier2(cmd, &writeDependencyInfo);
+
+	for (auto& copy : pendingGeometryCopies) {
+		vkCmdCopyBuffer(cmd, copy.source, copy.destination, 1, &copy.region);
+	}
+	for (auto primitiveIndex : pendingRecordWrites) {
+		vkCmdUpdateBuffer(cmd, globalMeshBuffers.primitivesHandle, primitiveIndex * sizeof(PrimitiveRecord),
+						  sizeof(PrimitiveRecord), &primitiveRecords[primitiveIndex]);
+	}
+
+	// Every pass of this frame reads the geometry and records
+	const VkMemoryBarrier2 readBarrier {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+		.srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+		.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+		.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+		.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT,
+	};
+	const VkDependencyInfo readDependencyInfo {
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.memoryBarrierCount = 1,
+		.pMemoryBarriers = &readBarrier,
+	};
+	vkCmdPipelineBarrier2(cmd, &readDependencyInfo);
+
+	pendingGeometryCopies.clear();
+	pendingRecordWrites.clear();
+}
+
+#include <stb_image.h>
+
+/** Decoded RGBA8 pixel data of a glTF image, including its full mip chain */
+struct DecodedImage {
+	VkExtent2D extent = {};
+	std::vector<std::vector<std::uint8_t>> mips;
+};
+
+static constexpr std::uint32_t imageChannels = 4;
+
+VkExtent3D getMipExtent(VkExtent2D extent, std::uint32_t level) {
+	return {
+		.width = util::max(1U, extent.width >> level),
+		.height = util::max(1U, extent.height >> level),
+		.depth = 1,
+	};
+}
+
+/** Returns the encoded data of a glTF image stored within the asset, or nothing for images in separate files */
+std::span<const std::uint8_t> getEmbeddedImageData(const fastgltf::Asset& asset, const fastgltf::Image& image) {
+	return std::visit(fastgltf::visitor {
+		[](const auto& arg) {
+			return std::span<const std::uint8_t>();
+		},
+		[](const fastgltf::sources::Array& array) {
+			return std::span<const std::uint8_t>(array.bytes.data(), array.bytes.size());
+		},
+		[](const fastgltf::sources::Vector& vector) {
+			return std::span<const std::uint8_t>(vector.bytes.data(), vector.bytes.size());
+		},
+		[&](const fastgltf::sources::BufferView& view) {
+			auto& bufferView = asset.bufferViews[view.bufferViewIndex];
+			auto data = CompressedBufferDataAdapter::getData(asset.buffers[bufferView.bufferIndex], bufferView.byteOffset, bufferView.byteLength);
+			return std::span<const std::uint8_t>(reinterpret_cast<const std::uint8_t*>(data.data()), data.size());
+		},
+	}, image.data);
+}
+
+/** Decodes the glTF image and generates the full mip chain on the CPU */
+DecodedImage decodeImage(std::span<const std::uint8_t> encodedData, std::size_t gltfImageIdx) {
+	ZoneScoped;
+	std::uint8_t* imageData = nullptr;
+	int width = 0, height = 0, nrChannels = 0;
+	if (!encodedData.empty()) {
+		imageData = stbi_load_from_memory(encodedData.data(), static_cast<int>(encodedData.size()), &width, &height, &nrChannels, imageChannels);
+	}
+
+	DecodedImage decoded;
+	if (imageData == nullptr) {
+		// Fall back to a single white pixel so that a broken image doesn't take down the whole load.
+		fmt::print(stderr, "Failed to decode image {}: {}\n", gltfImageIdx, stbi_failure_reason());
+		decoded.extent = { 1, 1 };
+		decoded.mips.emplace_back(imageChannels, std::uint8_t(255));
+		return decoded;
+	}
+
+	decoded.extent = { static_cast<std::uint32_t>(width), static_cast<std::uint32_t>(height) };
+	const auto mipCount = static_cast<std::uint32_t>(std::floor(std::log2(util::max(width, height)))) + 1;
+	decoded.mips.resize(mipCount);
+	decoded.mips[0].assign(imageData, imageData + static_cast<std::size_t>(width) * height * imageChannels);
+	stbi_image_free(imageData);
+
+	// Generate the remaining levels with a simple 2x2 box filter. The texel at the far edge of
+	// odd-sized levels is clamped, which is good enough for the purpose of streaming.
+	for (std::uint32_t level = 1; level < mipCount; ++level) {
+		const auto src = getMipExtent(decoded.extent, level - 1);
+		const auto dst = getMipExtent(decoded.extent, level);
+		auto& srcData = decoded.mips[level - 1];
+		auto& dstData = decoded.mips[level];
+		dstData.resize(static_cast<std::size_t>(dst.width) * dst.height * imageChannels);
+
+		for (std::uint32_t y = 0; y < dst.height; ++y) {
+			const auto y0 = util::min(y * 2, src.height - 1);
+			const auto y1 = util::min(y * 2 + 1, src.height - 1);
+			for (std::uint32_t x = 0; x < dst.width; ++x) {
+				const auto x0 = util::min(x * 2, src.width - 1);
+				const auto x1 = util::min(x * 2 + 1, src.width - 1);
+				for (std::uint32_t c = 0; c < imageChannels; ++c) {
+					const std::uint32_t sum = srcData[(y0 * src.width + x0) * imageChannels + c]
+						+ srcData[(y0 * src.width + x1) * imageChannels + c]
+						+ srcData[(y1 * src.width + x0) * imageChannels + c]
+						+ srcData[(y1 * src.width + x1) * imageChannels + c];
+					dstData[(y * dst.width + x) * imageChannels + c] = static_cast<std::uint8_t>((sum + 2) / 4);
 				}
+			}
+		}
+	}
+	return decoded;
+}
+
+/** The create info of a glTF image with mipLevels mips at full resolution, of which the top droppedMips are left out */
+VkImageCreateInfo getTextureCreateInfo(VkExtent2D extent, std::uint32_t mipLevels, std::uint32_t droppedMips) {
+	return {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+		.imageType = VK_IMAGE_TYPE_2D,
+		.format = VK_FORMAT_R8G8B8A8_SRGB,
+		.extent = getMipExtent(extent, droppedMips),
+		.mipLevels = mipLevels - droppedMips,
+		.arrayLayers = 1,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.tiling = VK_IMAGE_TILING_OPTIMAL,
+		.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+	};
+}
+
+VkDeviceSize getAllocationSize(VmaAllocator allocator, VmaAllocation allocation) {
+	VmaAllocationInfo info;
+	vmaGetAllocationInfo(allocator, allocation, &info);
+	return info.size;
+}
+
+struct ImageLoadJob;
+
+/** Decodes the image and generates its mip chain. This is the first stage of an ImageLoadJob. */
+struct ImageDecodeTask : public enki::ITaskSet {
+	ImageLoadJob* job;
+
+	explicit ImageDecodeTask(ImageLoadJob* job) noexcept : job(job) {
+		m_SetSize = 1;
+	}
+
+	void ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) override;
+};
+
+/** Creates the image and submits the copy from a staging buffer, without waiting for the GPU */
+struct ImageSubmitTask : public enki::ITaskSet {
+	enki::Dependency dependency;
+	ImageLoadJob* job;
+
+	explicit ImageSubmitTask(ImageLoadJob* job) noexcept : job(job) {
+		m_SetSize = 1;
+	}
+
+	void ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) override;
+};
+
+/** Creates the image view. The image only gets bound to a descriptor on the main thread once its copy has finished. */
+struct ImageViewTask : public enki::ITaskSet {
+	enki::Dependency dependency;
+	ImageLoadJob* job;
+
+	explicit ImageViewTask(ImageLoadJob* job) noexcept : job(job) {
+		m_SetSize = 1;
+	}
+
+	void ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) override;
+};
+
+/**
+ * Loads a glTF image, or recreates it with fewer mips for the residency manager, through a chain of
+ * decode -> submit -> view tasks. None of the tasks block on another task or on a fence; the main
+ * thread polls the upload in Viewer::updateImageLoads and swaps the image in once it is complete.
+ */
+struct ImageLoadJob {
+	Viewer* viewer;
+	std::size_t imageIdx;
+	std::uint32_t droppedMips;
+
+	DecodedImage decoded;
+	VkExtent2D extent = {};
+	std::uint32_t mipLevels = 0;
+	SampledImage image;
+	PendingUpload upload;
+	bool uploadSubmitted = false;
+
+	// Exceptions can't propagate out of the tasks, so they record the first failure for the main thread
+	VkResult result = VK_SUCCESS;
+	const char* failedStep = nullptr;
+	std::chrono::steady_clock::duration busyTime {}; // Summed over the tasks, which never run at the same time
+
+	FileReadRequest readRequest;
+	// Until the read has started the decode, none of the tasks are in flight and all of them report being complete
+	std::atomic<bool> readPending = false;
+	ImageDecodeTask decodeTask;
+	ImageSubmitTask submitTask;
+	ImageViewTask viewTask;
+
+	explicit ImageLoadJob(Viewer* viewer, std::size_t imageIdx, std::uint32_t droppedMips)
+			: viewer(viewer), imageIdx(imageIdx), droppedMips(droppedMips), decodeTask(this), submitTask(this), viewTask(this) {
+		// Images in separate files are first read on the I/O threads, which start the decode as soon as the file
+		// has been read. Reloads for the residency manager read them again.
+		const auto& image = viewer->asset.images[imageIdx - Viewer::numDefaultTextures];
+		if (const auto* uri = std::get_if<fastgltf::sources::URI>(&image.data); uri != nullptr && uri->uri.isLocalPath()) {
+			readRequest.path = viewer->assetDirectory / uri->uri.fspath();
+			readRequest.offset = uri->fileByteOffset;
+			readPending = true;
+			readRequest.onRead = [this](FileReadRequest&) {
+				// Adding the decode marks the tasks depending on it as incomplete, so it has to come first
+				taskScheduler.AddTaskSetToPipe(&decodeTask);
+				readPending.store(false, std::memory_order_release);
+			};
+		}
+		submitTask.SetDependency(submitTask.dependency, &decodeTask);
+		viewTask.SetDependency(viewTask.dependency, &submitTask);
+	}
+
+	[[nodiscard]] bool readsFile() const noexcept {
+		return !readRequest.path.empty();
+	}
+
+	void fail(VkResult failure, const char* step) noexcept {
+		result = failure;
+		failedStep = step;
+	}
+};
+
+/** Adds the time until the end of the scope to the busy time of the job */
+class ScopedJobTimer {
+	ImageLoadJob& job;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+public:
+	explicit ScopedJobTimer(ImageLoadJob& job) noexcept : job(job) {}
+	~ScopedJobTimer() {
+		job.busyTime += std::chrono::steady_clock::now() - start;
+	}
+};
+
+void ImageDecodeTask::ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) {
+	ZoneScoped;
+	ScopedJobTimer timer(*job);
+	const auto gltfImageIdx = job->imageIdx - Viewer::numDefaultTextures;
+	if (job->readsFile()) {
+		if (!job->readRequest.succeeded) {
+			fmt::print(stderr, "Failed to read image {} from {}\n", gltfImageIdx, job->readRequest.path.string());
+		}
+		job->decoded = decodeImage(job->readRequest.bytes, gltfImageIdx);
+		job->readRequest.bytes = std::vector<std::uint8_t>(); // Free the encoded data right away
+	} else {
+		job->decoded = decodeImage(getEmbeddedImageData(job->viewer->asset, job->viewer->asset.images[gltfImageIdx]), gltfImageIdx);
+	}
+	job->extent = job->decoded.extent;
+	job->mipLevels = static_cast<std::uint32_t>(job->decoded.mips.size());
+	job->droppedMips = util::min(job->droppedMips, job->mipLevels - 1);
+}
+
+void ImageSubmitTask::ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) {
+	ZoneScoped;
+	ScopedJobTimer timer(*job);
+	auto& decoded = job->decoded;
+	const auto imageInfo = getTextureCreateInfo(decoded.extent, job->mipLevels, job->droppedMips);
+	const VmaAllocationCreateInfo allocationInfo {
+		.usage = VMA_MEMORY_USAGE_GPU_ONLY,
+		.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	};
+	auto result = vmaCreateImage(job->viewer->allocator, &imageInfo, &allocationInfo,
+								 &job->image.image, &job->image.allocation, nullptr);
+	if (result != VK_SUCCESS) {
+		job->fail(result, "create image");
+		decoded = {};
+		return;
+	}
+
+	std::vector<std::span<const std::byte>> mips;
+	for (auto i = job->droppedMips; i < job->mipLevels; ++i) {
+		mips.emplace_back(std::as_bytes(std::span(decoded.mips[i].begin(), decoded.mips[i].end())));
+	}
+	try {
+		BufferUploader::getInstance().submitImageUpload(mips, job->image.image, imageInfo.extent,
+														VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, imageChannels, job->upload);
+		job->uploadSubmitted = true;
+	} catch (const vulkan_error& error) {
+		job->fail(error.what_result(), "submit image upload");
+	}
+
+	// The pixel data now lives in the staging buffer
+	decoded = {};
+}
+
+void ImageViewTask::ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) {
+	ZoneScoped;
+	ScopedJobTimer timer(*job);
+	if (job->result != VK_SUCCESS)
+		return;
+
+	const VkImageViewCreateInfo imageViewInfo {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+		.image = job->image.image,
+		.viewType = VK_IMAGE_VIEW_TYPE_2D,
+		.format = VK_FORMAT_R8G8B8A8_SRGB,
+		.subresourceRange = {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.levelCount = job->mipLevels - job->droppedMips,
+			.layerCount = 1,
+		},
+	};
+	auto result = vkCreateImageView(job->viewer->device, &imageViewInfo, VK_NULL_HANDLE, &job->image.imageView);
+	if (result != VK_SUCCESS) {
+		job->fail(result, "create image view");
+		return;
+	}
+	vk::setDebugUtilsName(job->viewer->device, job->image.imageView,
+						  job->viewer->asset.images[job->imageIdx - Viewer::numDefaultTextures].name.c_str());
+}
 
-				glm::vec3 center = (min + max) * 0.5f;
-				finalMeshlets.emplace_back(Meshlet {
-					.meshlet = meshlet,
-					.aabbExtents = max - center,
-					.aabbCenter = center,
-				});
-			}
+void Viewer::queueImageLoad(std::size_t imageIdx, std::uint32_t droppedMips) {
+	imageResidency[imageIdx].changePending = true;
+	queuedImageLoads.emplace_back(imageIdx, droppedMips);
+}
 
-			// Append the data to the end of the global buffers.
-			globalVertices.insert(globalVertices.end(), vertices.begin(), vertices.end());
-			globalMeshlets.insert(globalMeshlets.end(), finalMeshlets.begin(), finalMeshlets.end());
-			globalMeshletVertices.insert(globalMeshletVertices.end(), meshlet_vertices.begin(), meshlet_vertices.end());
-			globalMeshletTriangles.insert(globalMeshletTriangles.end(), meshlet_triangles.begin(), meshlet_triangles.end());
+void Viewer::updateImageLoads() {
+	ZoneScoped;
+	auto& uploader = BufferUploader::getInstance();
+
+	// Swap in every image whose upload has finished on the GPU
+	bool installedImages = false;
+	for (auto it = imageLoadJobs.begin(); it != imageLoadJobs.end();) {
+		auto& job = **it;
+		if (job.readPending.load(std::memory_order_acquire) || !job.viewTask.GetIsComplete()
+				|| (job.uploadSubmitted && !uploader.isComplete(job.upload))) {
+			++it;
+			continue;
+		}
+		uploader.destroy(job.upload);
+		if (job.result == VK_SUCCESS) {
+			installImage(job);
+			installedImages = true;
+		} else {
+			discardImageLoad(job);
 		}
+		it = imageLoadJobs.erase(it);
+	}
+	if (installedImages) {
+		writeMaterialBuffer();
 	}
 
-	uploadMeshlets(globalMeshlets, globalMeshletVertices, globalMeshletTriangles, globalVertices);
-}
+	std::erase_if(imageReadBatches, [](const auto& batch) { return batch->GetIsComplete(); });
 
-VkResult Viewer::createGpuTransferBuffer(std::size_t byteSize, VkBuffer *buffer, VmaAllocation *allocation) noexcept {
-	const VmaAllocationCreateInfo allocationCreateInfo {
-		.usage = VMA_MEMORY_USAGE_GPU_ONLY,
-	};
-	const VkBufferCreateInfo bufferCreateInfo {
-		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-		.size = byteSize,
-		.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-	};
-	return vmaCreateBuffer(allocator, &bufferCreateInfo, &allocationCreateInfo,
-						   buffer, allocation, VK_NULL_HANDLE);
+	// Start new jobs. We limit the amount in flight, as each one holds its staging memory until it's polled here.
+	// The files of all new jobs are read together, so that the I/O threads can keep many reads in flight.
+	const auto maxImageLoadsInFlight = static_cast<std::size_t>(ioThreads.getComputeThreadCount()) * 2;
+	std::vector<FileReadRequest*> reads;
+	while (!queuedImageLoads.empty() && imageLoadJobs.size() < maxImageLoadsInFlight) {
+		auto [imageIdx, droppedMips] = queuedImageLoads.front();
+		queuedImageLoads.pop_front();
+
+		auto job = std::make_shared<ImageLoadJob>(this, imageIdx, droppedMips);
+		if (job->readsFile()) {
+			reads.emplace_back(&job->readRequest);
+		} else {
+			taskScheduler.AddTaskSetToPipe(&job->decodeTask);
+		}
+		imageLoadJobs.emplace_back(std::move(job));
+	}
+	for (auto& batch : ioThreads.submitReads(reads)) {
+		imageReadBatches.emplace_back(std::move(batch));
+	}
 }
 
-void Viewer::uploadMeshlets(std::vector<Meshlet>& meshlets,
-							std::vector<unsigned int>& meshletVertices, std::vector<unsigned char>& meshletTriangles,
-							std::vector<Vertex>& vertices) {
+void Viewer::waitForImageLoad() {
 	ZoneScoped;
-	std::vector<std::unique_ptr<BufferUploadTask>> uploadTasks;
-	{
-		// Create the meshlet description buffer
-		auto result = createGpuTransferBuffer(meshlets.size() * sizeof(std::remove_reference_t<decltype(meshlets)>::value_type),
-											  &globalMeshBuffers.descHandle, &globalMeshBuffers.descAllocation);
-		vk::checkResult(result, "Failed to allocate meshlet description buffer: {}");
-		vk::setDebugUtilsName(device, globalMeshBuffers.descHandle, "Meshlet descriptions");
+	if (imageLoadJobs.empty())
+		return;
 
-		auto task = BufferUploader::getInstance().uploadToBuffer(
-			std::as_bytes(std::span{meshlets.begin(), meshlets.end()}),
-			globalMeshBuffers.descHandle);
-		uploadTasks.emplace_back(std::move(task));
+	auto& job = *imageLoadJobs.front();
+	if (job.readPending.load(std::memory_order_acquire)) {
+		// The reads of a batch complete in any order, so we wait for every batch still reading
+		for (auto& batch : imageReadBatches) {
+			taskScheduler.WaitforTask(batch.get());
+		}
 	}
-	{
-		// Create the vertex index buffer
-		auto result = createGpuTransferBuffer(meshletVertices.size() * sizeof(std::remove_reference_t<decltype(meshletVertices)>::value_type),
-											  &globalMeshBuffers.vertexIndiciesHandle, &globalMeshBuffers.vertexIndiciesAllocation);
-		vk::checkResult(result, "Failed to allocate vertex index buffer: {}");
-		vk::setDebugUtilsName(device, globalMeshBuffers.vertexIndiciesHandle, "Meshlet vertex indices");
-
-		auto task = BufferUploader::getInstance().uploadToBuffer(
-			std::as_bytes(std::span{meshletVertices.begin(), meshletVertices.end()}),
-			globalMeshBuffers.vertexIndiciesHandle);
-		uploadTasks.emplace_back(std::move(task));
+	taskScheduler.WaitforTask(&job.viewTask);
+	if (job.uploadSubmitted) {
+		auto result = vkWaitForFences(device, 1, &job.upload.fence, VK_TRUE, std::numeric_limits<std::uint64_t>::max());
+		vk::checkResult(result, "Failed to wait for image upload: {}");
 	}
-	{
-		// Create the meshlet description buffer
-		auto result = createGpuTransferBuffer(meshletTriangles.size() * sizeof(std::remove_reference_t<decltype(meshletTriangles)>::value_type),
-											  &globalMeshBuffers.triangleIndicesHandle, &globalMeshBuffers.triangleIndicesAllocation);
-		vk::checkResult(result, "Failed to allocate triangle index buffer: {}");
-		vk::setDebugUtilsName(device, globalMeshBuffers.triangleIndicesHandle, "Meshlet triangle indices");
+}
 
-		auto task = BufferUploader::getInstance().uploadToBuffer(
-			std::as_bytes(std::span{meshletTriangles.begin(), meshletTriangles.end()}),
-			globalMeshBuffers.triangleIndicesHandle);
-		uploadTasks.emplace_back(std::move(task));
+void Viewer::updateTextureResidency() {
+	ZoneScoped;
+	// Gather the budget and usage of all DEVICE_LOCAL heaps
+	std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> budgets {};
+	vmaGetHeapBudgets(allocator, budgets.data());
+	const VkPhysicalDeviceMemoryProperties* memoryProperties = nullptr;
+	vmaGetMemoryProperties(allocator, &memoryProperties);
+
+	residencyStats.budget = 0;
+	residencyStats.usage = 0;
+	for (std::uint32_t i = 0; i < memoryProperties->memoryHeapCount; ++i) {
+		if ((memoryProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) == 0)
+			continue;
+		residencyStats.budget += budgets[i].budget;
+		residencyStats.usage += budgets[i].usage;
 	}
-	{
-		// Create the vertex buffer
-		auto result = createGpuTransferBuffer(vertices.size() * sizeof(std::remove_reference_t<decltype(vertices)>::value_type),
-											  &globalMeshBuffers.verticesHandle, &globalMeshBuffers.verticesAllocation);
-		vk::checkResult(result, "Failed to allocate vertex buffer: {}");
-		vk::setDebugUtilsName(device, globalMeshBuffers.verticesHandle, "Meshlet vertices");
 
-		auto task = BufferUploader::getInstance().uploadToBuffer(
-			std::as_bytes(std::span{vertices.begin(), vertices.end()}),
-			globalMeshBuffers.verticesHandle);
-		uploadTasks.emplace_back(std::move(task));
+	residencyStats.residentBytes = 0;
+	for (auto& residency : imageResidency) {
+		residencyStats.residentBytes += residency.residentBytes;
 	}
 
-	deletionQueue.push([&]() {
-		vmaDestroyBuffer(allocator, globalMeshBuffers.verticesHandle, globalMeshBuffers.verticesAllocation);
-		vmaDestroyBuffer(allocator, globalMeshBuffers.triangleIndicesHandle, globalMeshBuffers.triangleIndicesAllocation);
-		vmaDestroyBuffer(allocator, globalMeshBuffers.vertexIndiciesHandle, globalMeshBuffers.vertexIndiciesAllocation);
-		vmaDestroyBuffer(allocator, globalMeshBuffers.descHandle, globalMeshBuffers.descAllocation);
-	});
+	// The user can limit texture memory explicitly, otherwise we stay within what VMA reports for the whole device.
+	const bool useTextureBudget = textureBudgetMiB > 0.0f;
+	const auto limit = useTextureBudget ? static_cast<VkDeviceSize>(static_cast<double>(textureBudgetMiB) * 1024 * 1024) : residencyStats.budget;
+	const auto current = useTextureBudget ? residencyStats.residentBytes : residencyStats.usage;
 
-	// Allocate the primitive descriptor set
-	std::array<VkDescriptorSetLayout, frameOverlap> setLayouts {};
-	std::fill(setLayouts.begin(), setLayouts.end(), meshletSetLayout);
-	const VkDescriptorSetAllocateInfo allocateInfo {
-		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-		.descriptorPool = descriptorPool,
-		.descriptorSetCount = static_cast<std::uint32_t>(setLayouts.size()),
-		.pSetLayouts = setLayouts.data(),
-	};
+	// Initial loads take priority over residency changes
+	if (!queuedImageLoads.empty() || imageLoadJobs.size() >= maxResidencyTasksInFlight)
+		return;
 
-	// Allocate the sets. We copy each member of the sets vector in the loop below.
-	globalMeshBuffers.descriptors.resize(allocateInfo.descriptorSetCount);
-	auto result = vkAllocateDescriptorSets(device, &allocateInfo, globalMeshBuffers.descriptors.data());
-	vk::checkResult(result, "Failed to allocate mesh buffers descriptor set: {}");
+	if (static_cast<double>(current) > static_cast<double>(limit) * residencyHighWatermark) {
+		// Under pressure: drop the top mip of the least recently used cold texture.
+		std::optional<std::size_t> coldest;
+		for (auto i = numDefaultTextures; i < imageResidency.size(); ++i) {
+			auto& residency = imageResidency[i];
+			if (residency.changePending || frameNumber - residency.lastUsedFrame < residencyColdFrames)
+				continue;
+			const auto remainingExtent = util::max(residency.extent.width, residency.extent.height) >> (residency.droppedMips + 1);
+			if (remainingExtent < minResidentExtent)
+				continue;
+			if (!coldest.has_value() || residency.lastUsedFrame < imageResidency[*coldest].lastUsedFrame)
+				coldest = i;
+		}
 
-	for (auto& descriptor : globalMeshBuffers.descriptors) {
-		// Update the descriptors with the buffer handles
-		std::array<VkDescriptorBufferInfo, 4> descriptorBufferInfos{{
-			{
-				.buffer = globalMeshBuffers.descHandle,
-				.offset = 0,
-				.range = VK_WHOLE_SIZE,
-			},
-			{
-				.buffer = globalMeshBuffers.vertexIndiciesHandle,
-				.offset = 0,
-				.range = VK_WHOLE_SIZE,
-			},
-			{
-				.buffer = globalMeshBuffers.triangleIndicesHandle,
-				.offset = 0,
-				.range = VK_WHOLE_SIZE,
-			},
-			{
-				.buffer = globalMeshBuffers.verticesHandle,
-				.offset = 0,
-				.range = VK_WHOLE_SIZE,
-			},
-		}};
-		std::array<VkWriteDescriptorSet, 4> descriptorWrites{{
-			{
-				.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-				.dstSet = descriptor,
-				.dstBinding = 0,
-				.dstArrayElement = 0,
-				.descriptorCount = 1,
-				.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-				.pBufferInfo = &descriptorBufferInfos[0],
-			},
-			{
-				.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-				.dstSet = descriptor,
-				.dstBinding = 1,
-				.dstArrayElement = 0,
-				.descriptorCount = 1,
-				.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-				.pBufferInfo = &descriptorBufferInfos[1],
-			},
-			{
-				.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-				.dstSet = descriptor,
-				.dstBinding = 2,
-				.dstArrayElement = 0,
-				.descriptorCount = 1,
-				.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-				.pBufferInfo = &descriptorBufferInfos[2],
-			},
-			{
-				.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-				.dstSet = descriptor,
-				.dstBinding = 3,
-				.dstArrayElement = 0,
-				.descriptorCount = 1,
-				.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-				.pBufferInfo = &descriptorBufferInfos[3],
-			}
-		}};
-		vkUpdateDescriptorSets(device, static_cast<std::uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0,
-							   nullptr);
-	}
+		if (coldest.has_value()) {
+			queueImageLoad(*coldest, imageResidency[*coldest].droppedMips + 1);
+			++residencyStats.evictions;
+		}
+	} else {
+		// Restore the most recently used texture with dropped mips, if the full image fits into the budget.
+		std::optional<std::size_t> hottest;
+		for (auto i = numDefaultTextures; i < imageResidency.size(); ++i) {
+			auto& residency = imageResidency[i];
+			if (residency.changePending || residency.droppedMips == 0 || frameNumber - residency.lastUsedFrame >= residencyColdFrames)
+				continue;
+			if (!hottest.has_value() || residency.lastUsedFrame > imageResidency[*hottest].lastUsedFrame)
+				hottest = i;
+		}
 
-	for (auto& task : uploadTasks) {
-		taskScheduler.WaitforTask(task.get());
+		if (hottest.has_value()) {
+			// The driver tells us the size of the full image without having to create it
+			auto& residency = imageResidency[*hottest];
+			const auto imageInfo = getTextureCreateInfo(residency.extent, residency.mipLevels, 0);
+			const VkDeviceImageMemoryRequirements requirementsInfo {
+				.sType = VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS,
+				.pCreateInfo = &imageInfo,
+			};
+			VkMemoryRequirements2 requirements {
+				.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+			};
+			vkGetDeviceImageMemoryRequirements(device, &requirementsInfo, &requirements);
+			const auto restoredBytes = requirements.memoryRequirements.size;
+			if (static_cast<double>(current + restoredBytes - residency.residentBytes) < static_cast<double>(limit) * residencyLowWatermark) {
+				queueImageLoad(*hottest, 0);
+				++residencyStats.restores;
+			}
+		}
 	}
 }
 
-#include <stb_image.h>
-
-struct ImageLoadTask : public enki::ITaskSet {
-	Viewer* viewer;
-	std::size_t imageIdx;
+void Viewer::installImage(ImageLoadJob& job) {
+	ZoneScoped;
+	// Frames in flight may still sample the previous image, so we only destroy it once they have retired.
+	auto& current = images[job.imageIdx];
+	const bool initialLoad = current.image == VK_NULL_HANDLE;
+	if (!initialLoad) {
+		deferredDestruction.destroyImageView(frameNumber, current.imageView);
+		deferredDestruction.destroyImage(frameNumber, current.image, current.allocation);
+	}
+	current = job.image;
+
+	auto& residency = imageResidency[job.imageIdx];
+	residency.extent = job.extent;
+	residency.mipLevels = job.mipLevels;
+	residency.droppedMips = job.droppedMips;
+	residency.residentBytes = getAllocationSize(allocator, job.image.allocation);
+	residency.changePending = false;
+
+	// We can't rewrite descriptors which pending frames use, so every texture using this image gets
+	// a new slot and the materials are pointed at those. Until its first load, a texture uses the
+	// default texture in slot 0.
+	const auto gltfImageIdx = job.imageIdx - numDefaultTextures;
+	for (std::size_t i = 0; i < asset.textures.size(); ++i) {
+		auto& texture = asset.textures[i];
+		if (!texture.imageIndex.has_value() || *texture.imageIndex != gltfImageIdx)
+			continue;
+
+		auto sampler = samplers[texture.samplerIndex.has_value() ? *texture.samplerIndex + numDefaultSamplers : 0];
+		auto oldSlot = gltfTextureSlots[i];
+		gltfTextureSlots[i] = allocateTextureSlot(job.image.imageView, sampler);
+		if (oldSlot != 0) {
+			freeTextureSlot(oldSlot);
+		}
+	}
 
-	explicit ImageLoadTask(Viewer* viewer, std::size_t imageIdx) noexcept : viewer(viewer), imageIdx(imageIdx) {
-		m_SetSize = 1;
+	if (initialLoad) {
+		countInitialImageLoad(job);
 	}
+}
 
-	// We'll use the range to operate over multiple images
-	void ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) override {
-		ZoneScoped;
-		// m_SetSize = 1, so range will always be 0,1
-		auto& image = viewer->asset.images[imageIdx - Viewer::numDefaultTextures];
-
-		std::uint8_t* imageData = nullptr;
-		VkExtent3D imageExtent;
-		imageExtent.depth = 1;
-		static constexpr auto channels = 4;
-
-		// Load and decode the image data using stbi from the various sources.
-		std::visit(fastgltf::visitor {
-			[](auto arg) { },
-			[&](fastgltf::sources::Array& vector) {
-				int width = 0, height = 0, nrChannels = 0;
-				imageData = stbi_load_from_memory(vector.bytes.data(), static_cast<int>(vector.bytes.size()), &width, &height, &nrChannels, channels);
-				imageExtent.width = width;
-				imageExtent.height = height;
-			},
-			[&](fastgltf::sources::BufferView& view) {
-				auto& bufferView = viewer->asset.bufferViews[view.bufferViewIndex];
-				auto& buffer = viewer->asset.buffers[bufferView.bufferIndex];
-				// Yes, we've already loaded every buffer into some GL buffer. However, with GL it's simpler
-				// to just copy the buffer data again for the texture. Besides, this is just an example.
-				std::visit(fastgltf::visitor {
-					// We only care about VectorWithMime here, because we specify LoadExternalBuffers, meaning
-					// all buffers are already loaded into a vector.
-					[](auto& arg) {},
-					[&](fastgltf::sources::Array& vector) {
-						int width = 0, height = 0, nrChannels = 0;
-						imageData = stbi_load_from_memory(vector.bytes.data() + bufferView.byteOffset, static_cast<int>(bufferView.byteLength), &width, &height, &nrChannels, channels);
-						imageExtent.width = width;
-						imageExtent.height = height;
-					}
-				}, buffer.data);
-			},
-		}, image.data);
-
-		SampledImage& sampledImage = viewer->images[imageIdx];
-
-		const VkImageCreateInfo imageInfo {
-			.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-			.imageType = VK_IMAGE_TYPE_2D,
-			.format = VK_FORMAT_R8G8B8A8_SRGB,
-			.extent = imageExtent,
-			.mipLevels = 1,
-			.arrayLayers = 1,
-			.samples = VK_SAMPLE_COUNT_1_BIT,
-			.tiling = VK_IMAGE_TILING_OPTIMAL,
-			.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-			.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-		};
-		const VmaAllocationCreateInfo allocationInfo {
-			.usage = VMA_MEMORY_USAGE_GPU_ONLY,
-			.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		};
-		vmaCreateImage(viewer->allocator, &imageInfo, &allocationInfo,
-					   &sampledImage.image, &sampledImage.allocation, nullptr);
+void Viewer::discardImageLoad(ImageLoadJob& job) {
+	ZoneScoped;
+	fmt::print(stderr, "Failed to {} for image {}: {}\n", job.failedStep, job.imageIdx - numDefaultTextures, job.result);
 
-		// Create and schedule the ImageUploadTask.
-		auto data = std::span<const std::byte> { reinterpret_cast<std::byte*>(imageData),
-			imageExtent.width * imageExtent.height * sizeof(std::byte) * channels };
-		ImageUploadTask uploadTask(data, sampledImage.image, imageExtent, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, channels);
-		taskScheduler.AddTaskSetToPipe(&uploadTask);
+	// The image was never bound to a descriptor, and its copy has completed if it was submitted
+	vkDestroyImageView(device, job.image.imageView, VK_NULL_HANDLE);
+	vmaDestroyImage(allocator, job.image.image, job.image.allocation);
+	imageResidency[job.imageIdx].changePending = false;
 
-		const VkImageViewCreateInfo imageViewInfo {
-			.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-			.image = sampledImage.image,
-			.viewType = VK_IMAGE_VIEW_TYPE_2D,
-			.format = imageInfo.format,
-			.subresourceRange = {
-				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-				.levelCount = 1,
-				.layerCount = 1,
-			},
-		};
-		vkCreateImageView(viewer->device, &imageViewInfo, VK_NULL_HANDLE, &sampledImage.imageView);
-		vk::setDebugUtilsName(viewer->device, sampledImage.imageView, image.name.c_str());
+	// An image which fails its first load keeps using the default texture
+	if (images[job.imageIdx].image == VK_NULL_HANDLE) {
+		countInitialImageLoad(job);
+	}
+}
 
-		taskScheduler.WaitforTask(&uploadTask);
+void Viewer::countInitialImageLoad(const ImageLoadJob& job) {
+	imageLoadStats.taskTime += job.busyTime;
+	if (--imageLoadStats.remaining != 0)
+		return;
 
-		stbi_image_free(imageData);
-	}
-};
+	imageLoadStats.loadTime = std::chrono::steady_clock::now() - imageLoadStats.startTime;
+	const auto wallTime = std::chrono::duration<double>(imageLoadStats.loadTime).count();
+	const auto taskTime = std::chrono::duration<double>(imageLoadStats.taskTime).count();
+	const auto computeThreads = ioThreads.getComputeThreadCount();
+	const auto io = ioThreads.getStatistics();
+	fmt::print("Loaded {} images in {:.2f} s, image tasks busy {:.0f}% of {} threads, {:.2f} ms I/O wait for {:.2f} MiB "
+			   "across {} I/O threads ({}, {:.0f} MiB/s)\n",
+			   asset.images.size(), wallTime, taskTime / (wallTime * computeThreads) * 100.0, computeThreads,
+			   io.waitTime.count(), static_cast<double>(io.bytes) / (1024.0 * 1024.0), ioThreads.getThreadCount(),
+			   ioThreads.getBackendName(), io.getBandwidth());
+}
 
 void Viewer::createDefaultImages() {
 	ZoneScoped;
@@ -1396,9 +3277,10 @@ void Viewer::createDefaultImages() {
 
 	// We use R8G8B8A8_UNORM, so we need to use 8-bit integers for the colors here.
 	std::array<std::uint8_t, 4> white {{ 255, 255, 255, 255 }};
-	auto data = std::span<const std::byte> { reinterpret_cast<std::byte*>(white.data()), sizeof(white) };
-	ImageUploadTask uploadTask(data, defaultTexture.image, imageInfo.extent, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 4);
-	taskScheduler.AddTaskSetToPipe(&uploadTask);
+	const std::array<std::span<const std::byte>, 1> mips {{ std::as_bytes(std::span(white)) }};
+	auto& uploader = BufferUploader::getInstance();
+	PendingUpload upload;
+	uploader.submitImageUpload(mips, defaultTexture.image, imageInfo.extent, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 4, upload);
 
 	const VkImageViewCreateInfo imageViewInfo {
 		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
@@ -1415,7 +3297,10 @@ void Viewer::createDefaultImages() {
 	vk::checkResult(result, "Failed to create default image view: {}");
 	vk::setDebugUtilsName(device, defaultTexture.imageView, "Default image view");
 
-	taskScheduler.WaitforTask(&uploadTask);
+	// Every material can fall back to this image, so it has to be ready before the first frame.
+	// This runs on the main thread, so no worker is blocked by this wait.
+	vkWaitForFences(device, 1, &upload.fence, VK_TRUE, UINT64_MAX);
+	uploader.destroy(upload);
 }
 
 VkFilter getVulkanFilter(fastgltf::Filter filter) {
@@ -1457,24 +3342,23 @@ VkSamplerAddressMode getVulkanAddressMode(fastgltf::Wrap wrap) {
 	}
 }
 
-void Viewer::loadGltfImages() {
+void Viewer::createMaterialDescriptors() {
 	ZoneScoped;
-	// Schedule image loading first
-	images.resize(numDefaultTextures + asset.images.size());
-	std::vector<std::unique_ptr<ImageLoadTask>> loadTasks; loadTasks.reserve(asset.images.size());
-	for (auto i = numDefaultTextures; i < asset.images.size() + numDefaultTextures; ++i) {
-		auto task = std::make_unique<ImageLoadTask>(this, i);
-		taskScheduler.AddTaskSetToPipe(task.get());
-		loadTasks.emplace_back(std::move(task));
-	}
-
-	createDefaultImages();
+	// The texture binding is a bindless array sized at runtime. UPDATE_AFTER_BIND lets us write new
+	// textures into free slots while frames using this set are still in flight.
+	VkPhysicalDeviceVulkan12Properties vulkan12Properties {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES,
+	};
+	VkPhysicalDeviceProperties2 properties {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+		.pNext = &vulkan12Properties,
+	};
+	vkGetPhysicalDeviceProperties2(device.physical_device, &properties);
+	const auto textureCapacity = util::min(maxBindlessTextures,
+		util::min(vulkan12Properties.maxDescriptorSetUpdateAfterBindSampledImages,
+				  vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSampledImages));
+	textureSlots.init(textureCapacity);
 
-	// Create the material descriptor layout
-	// TODO: We currently use a fixed size for the descriptorCount of the image samplers.
-	//       Using VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT we could change the descriptor size.
-	// TODO: We currently dont use UPDATE_AFTER_BIND, making us use either frameOverlap count of sets, or restricting
-	//       us to a fixed set of textures for rendering.
 	std::array<VkDescriptorSetLayoutBinding, 2> layoutBindings = {{
 		{
 			.binding = 0,
@@ -1485,13 +3369,14 @@ void Viewer::loadGltfImages() {
 		{
 			.binding = 1,
 			.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-			.descriptorCount = static_cast<std::uint32_t>(asset.textures.size() + numDefaultTextures),
+			.descriptorCount = textureCapacity,
 			.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
 		}
 	}};
 	std::array<VkDescriptorBindingFlags, layoutBindings.max_size()> layoutBindingFlags = {{
 		0,
-		0, // VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT,
+		VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT
+			| VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT,
 	}};
 	const VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo {
 		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
@@ -1501,6 +3386,7 @@ void Viewer::loadGltfImages() {
 	const VkDescriptorSetLayoutCreateInfo descriptorLayoutCreateInfo {
 		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
 		.pNext = &bindingFlagsInfo,
+		.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
 		.bindingCount = static_cast<std::uint32_t>(layoutBindings.size()),
 		.pBindings = layoutBindings.data(),
 	};
@@ -1512,15 +3398,74 @@ void Viewer::loadGltfImages() {
 		vkDestroyDescriptorSetLayout(device, materialSetLayout, nullptr);
 	});
 
+	// Sets using UPDATE_AFTER_BIND layouts have to come from a pool with the matching flag. We keep this
+	// separate from the mega pool so that its descriptors don't count against the update-after-bind limits.
+	std::array<VkDescriptorPoolSize, 2> poolSizes = {{
+		{
+			.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+		},
+		{
+			.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			.descriptorCount = textureCapacity,
+		}
+	}};
+	const VkDescriptorPoolCreateInfo poolCreateInfo {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+		.maxSets = 1,
+		.poolSizeCount = static_cast<std::uint32_t>(poolSizes.size()),
+		.pPoolSizes = poolSizes.data(),
+	};
+	result = vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &materialDescriptorPool);
+	vk::checkResult(result, "Failed to create material descriptor pool: {}");
+	deletionQueue.push([&]() {
+		vkDestroyDescriptorPool(device, materialDescriptorPool, nullptr);
+	});
+
 	// Allocate the material descriptor
+	const VkDescriptorSetVariableDescriptorCountAllocateInfo variableCountInfo {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO,
+		.descriptorSetCount = 1,
+		.pDescriptorCounts = &textureCapacity,
+	};
 	const VkDescriptorSetAllocateInfo allocateInfo {
 		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-		.descriptorPool = descriptorPool,
+		.pNext = &variableCountInfo,
+		.descriptorPool = materialDescriptorPool,
 		.descriptorSetCount = 1,
 		.pSetLayouts = &materialSetLayout,
 	};
 	result = vkAllocateDescriptorSets(device, &allocateInfo, &materialSet);
 	vk::checkResult(result, "Failed to allocate material descriptor set: {}");
+}
+
+void Viewer::loadGltfImages() {
+	ZoneScoped;
+	// The material descriptors are created without the asset, so that the pipelines don't have to wait for it
+	if (asset.textures.size() + numDefaultTextures > textureSlots.getCapacity()) {
+		throw std::runtime_error("The glTF has more textures than the device supports in a bindless array");
+	}
+
+	// Queue every glTF image. The loads are started and completed by updateImageLoads, which keeps
+	// getting called every frame, so textures stream in while we're already rendering.
+	images.resize(numDefaultTextures + asset.images.size());
+	imageResidency.resize(images.size());
+	imageLoadStats = {
+		.startTime = std::chrono::steady_clock::now(),
+		.remaining = asset.images.size(),
+	};
+	for (auto i = numDefaultTextures; i < asset.images.size() + numDefaultTextures; ++i) {
+		queueImageLoad(i, 0);
+	}
+	updateImageLoads();
+
+	createDefaultImages();
+
+	// The default texture always occupies slot 0. Every glTF texture uses it until its image has been loaded.
+	[[maybe_unused]] auto defaultSlot = textureSlots.allocate();
+	assert(defaultSlot.has_value() && *defaultSlot == 0);
+	gltfTextureSlots.assign(asset.textures.size(), 0);
 
 	// While we're here, also load the materials
 	loadGltfMaterials();
@@ -1537,7 +3482,7 @@ void Viewer::loadGltfImages() {
 		.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
 		.maxLod = VK_LOD_CLAMP_NONE,
 	};
-	result = vkCreateSampler(device, &samplerInfo, nullptr, &samplers[0]);
+	auto result = vkCreateSampler(device, &samplerInfo, nullptr, &samplers[0]);
 
 	// Create the glTF samplers
 	for (auto i = 0; i < asset.samplers.size(); ++i) {
@@ -1552,59 +3497,116 @@ void Viewer::loadGltfImages() {
 		result = vkCreateSampler(device, &samplerInfo, nullptr, &samplers[numDefaultSamplers + i]);
 	}
 
-	// Finish all texture decode and upload tasks
-	for (auto& task : loadTasks) {
-		taskScheduler.WaitforTask(task.get());
-	}
+	// Write the default texture into its slot
+	updateTextureSlot(0, images[0].imageView, samplers[0]);
+}
 
-	// Update the texture descriptor
-	std::vector<VkWriteDescriptorSet> writes; writes.reserve(asset.textures.size() + numDefaultTextures);
-	std::vector<VkDescriptorImageInfo> infos; infos.reserve(writes.capacity());
+std::uint32_t Viewer::allocateTextureSlot(VkImageView imageView, VkSampler sampler) {
+	ZoneScoped;
+	auto slot = textureSlots.allocate();
+	if (!slot.has_value()) {
+		throw std::runtime_error("Ran out of bindless texture slots");
+	}
+	updateTextureSlot(*slot, imageView, sampler);
+	return *slot;
+}
 
-	// Write the default texture
-	infos.emplace_back(VkDescriptorImageInfo {
-		.sampler = samplers[0],
-		.imageView = images[0].imageView,
+void Viewer::updateTextureSlot(std::uint32_t slot, VkImageView imageView, VkSampler sampler) {
+	assert(slot < textureSlots.getCapacity());
+	const VkDescriptorImageInfo imageInfo {
+		.sampler = sampler,
+		.imageView = imageView,
 		.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-	});
-	writes.emplace_back(VkWriteDescriptorSet {
+	};
+	const VkWriteDescriptorSet write {
 		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
 		.dstSet = materialSet,
 		.dstBinding = 1,
-		.dstArrayElement = 0U,
+		.dstArrayElement = slot,
 		.descriptorCount = 1,
 		.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-		.pImageInfo = &infos.back(),
-	});
+		.pImageInfo = &imageInfo,
+	};
+	vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
 
-	// Write the glTF textures
-	for (std::size_t i = 0; i < asset.textures.size(); ++i) {
-		auto& texture = asset.textures[i];
+void Viewer::freeTextureSlot(std::uint32_t slot) {
+	// Slot 0 is the default texture and always stays alive.
+	assert(slot != 0);
+	textureSlots.free(slot, frameNumber);
+}
 
-		// Well map a glTF texture to a single combined image sampler
-		infos.emplace_back(VkDescriptorImageInfo {
-			.sampler = samplers[texture.samplerIndex.has_value() ? *texture.samplerIndex + numDefaultSamplers : 0],
-			.imageView = images[texture.imageIndex.has_value() ? *texture.imageIndex + numDefaultTextures : 0].imageView,
-			.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-		});
+void Viewer::loadGltfMaterials() {
+	ZoneScoped;
+	// Remember which image each material samples, so that drawMesh can mark the image as used.
+	materialImages.resize(asset.materials.size() + numDefaultMaterials);
+	materialImages[0] = std::nullopt;
+	for (std::size_t i = 0; auto& gltfMaterial : asset.materials) {
+		auto& materialImage = materialImages[numDefaultMaterials + i++];
+		materialImage = std::nullopt;
+		if (!gltfMaterial.pbrData.baseColorTexture.has_value())
+			continue;
+		auto& texture = asset.textures[gltfMaterial.pbrData.baseColorTexture->textureIndex];
+		if (texture.imageIndex.has_value())
+			materialImage = *texture.imageIndex + numDefaultTextures;
+	}
 
-		writes.emplace_back(VkWriteDescriptorSet {
-			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-			.dstSet = materialSet,
-			.dstBinding = 1,
-			.dstArrayElement = static_cast<std::uint32_t>(i),
-			.descriptorCount = 1,
-			.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-			.pImageInfo = &infos.back(),
-		});
+	// Sort each material into the pipeline variant matching its alpha mode. The default material is opaque.
+	materialPasses.resize(asset.materials.size() + numDefaultMaterials);
+	materialPasses[0] = MaterialPass::Opaque;
+	for (std::size_t i = 0; auto& gltfMaterial : asset.materials) {
+		auto& pass = materialPasses[numDefaultMaterials + i++];
+		switch (gltfMaterial.alphaMode) {
+			case fastgltf::AlphaMode::Opaque: pass = MaterialPass::Opaque; break;
+			case fastgltf::AlphaMode::Mask: pass = MaterialPass::Mask; break;
+			case fastgltf::AlphaMode::Blend: pass = MaterialPass::Blend; break;
+		}
 	}
-	vkUpdateDescriptorSets(device, writes.size(), writes.data(), 0, nullptr);
+
+	// Create the material buffer. Its contents are written by the frames themselves, see recordMaterialUpdates.
+	const VmaAllocationCreateInfo allocationCreateInfo {
+		.usage = VMA_MEMORY_USAGE_GPU_ONLY,
+	};
+	const VkBufferCreateInfo bufferCreateInfo {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = (asset.materials.size() + numDefaultMaterials) * sizeof(Material),
+		.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+	};
+	auto result = vmaCreateBuffer(allocator, &bufferCreateInfo, &allocationCreateInfo,
+								  &materialBuffer, &materialAllocation, VK_NULL_HANDLE);
+	vk::checkResult(result, "Failed to allocate material buffer");
+	vk::setDebugUtilsName(device, materialBuffer, "Material buffer");
+
+	deletionQueue.push([&]() {
+		vmaDestroyBuffer(allocator, materialBuffer, materialAllocation);
+	});
+
+	writeMaterialBuffer();
+
+	// Update the material descriptor
+	const VkDescriptorBufferInfo bufferInfo {
+		.buffer = materialBuffer,
+		.offset = 0,
+		.range = VK_WHOLE_SIZE,
+	};
+	const VkWriteDescriptorSet write {
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.dstSet = materialSet,
+		.dstBinding = 0,
+		.dstArrayElement = 0,
+		.descriptorCount = 1,
+		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		.pBufferInfo = &bufferInfo,
+	};
+	vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
 }
 
-void Viewer::loadGltfMaterials() {
+void Viewer::writeMaterialBuffer() {
 	ZoneScoped;
 	// Create the material buffer data
-	std::vector<Material> materials; materials.reserve(asset.materials.size());
+	auto& materials = materialData;
+	materials.clear();
+	materials.reserve(asset.materials.size() + numDefaultMaterials);
 
 	// Add the default material
 	materials.emplace_back(Material {
@@ -1617,54 +3619,61 @@ void Viewer::loadGltfMaterials() {
 		auto& mat = materials.emplace_back();
 		mat.albedoFactor = glm::make_vec4(gltfMaterial.pbrData.baseColorFactor.data());
 		if (gltfMaterial.pbrData.baseColorTexture.has_value()) {
-			mat.albedoIndex = gltfMaterial.pbrData.baseColorTexture->textureIndex;
+			mat.albedoIndex = gltfTextureSlots[gltfMaterial.pbrData.baseColorTexture->textureIndex];
 		} else {
 			mat.albedoIndex = 0;
 		}
 		mat.alphaCutoff = gltfMaterial.alphaCutoff;
 	}
 
-	// Create the material buffer
-	const VmaAllocationCreateInfo allocationCreateInfo {
-		.usage = VMA_MEMORY_USAGE_CPU_TO_GPU,
-		.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-	};
-	const VkBufferCreateInfo bufferCreateInfo {
-		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-		.size = materials.size() * sizeof(decltype(materials)::value_type),
-		.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-	};
-	auto result = vmaCreateBuffer(allocator, &bufferCreateInfo, &allocationCreateInfo,
-								  &materialBuffer, &materialAllocation, VK_NULL_HANDLE);
-	vk::checkResult(result, "Failed to allocate material buffer");
-	vk::setDebugUtilsName(device, materialBuffer, "Material buffer");
+	// Frames in flight still read the buffer, so we can't write it from the host here
+	materialsDirty = true;
+}
 
-	deletionQueue.push([&]() {
-		vmaDestroyBuffer(allocator, materialBuffer, materialAllocation);
-	});
+void Viewer::recordMaterialUpdates(VkCommandBuffer cmd) {
+	if (!materialsDirty)
+		return;
+	ZoneScoped;
 
-	// Copy the material data to the buffer
-	{
-		vk::ScopedMap<Material> map(allocator, materialAllocation);
-		std::memcpy(map.get(), materials.data(), bufferCreateInfo.size);
+	// The previous frames may still read the old materials. Their texture slots stay valid until they have
+	// retired, so it doesn't matter which version of the materials they see.
+	const VkMemoryBarrier2 writeBarrier {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+		.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+		.srcAccessMask = VK_ACCESS_2_NONE,
+		.dstStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+		.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+	};
+	const VkDependencyInfo writeDependencyInfo {
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.memoryBarrierCount = 1,
+		.pMemoryBarriers = &writeBarrier,
+	};
+	vkCmdPipelineBarrier2(cmd, &writeDependencyInfo);
+
+	// vkCmdUpdateBuffer is limited to 64 KiB per call
+	static constexpr VkDeviceSize maxUpdateSize = 65536;
+	const auto bytes = std::as_bytes(std::span(materialData));
+	for (VkDeviceSize offset = 0; offset < bytes.size(); offset += maxUpdateSize) {
+		const auto size = util::min<VkDeviceSize>(bytes.size() - offset, maxUpdateSize);
+		vkCmdUpdateBuffer(cmd, materialBuffer, offset, size, bytes.data() + offset);
 	}
 
-	// Update the material descriptor
-	const VkDescriptorBufferInfo bufferInfo {
-		.buffer = materialBuffer,
-		.offset = 0,
-		.range = VK_WHOLE_SIZE,
+	const VkMemoryBarrier2 readBarrier {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+		.srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+		.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+		.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+		.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT,
 	};
-	const VkWriteDescriptorSet write {
-		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-		.dstSet = materialSet,
-		.dstBinding = 0,
-		.dstArrayElement = 0,
-		.descriptorCount = 1,
-		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-		.pBufferInfo = &bufferInfo,
+	const VkDependencyInfo readDependencyInfo {
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.memoryBarrierCount = 1,
+		.pMemoryBarriers = &readBarrier,
 	};
-	vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+	vkCmdPipelineBarrier2(cmd, &readDependencyInfo);
+
+	materialsDirty = false;
 }
 
 glm::mat4 Viewer::getCameraProjectionMatrix(fastgltf::Camera& camera) const {
@@ -1721,82 +3730,287 @@ glm::mat4 getTransformMatrix(const fastgltf::Node& node, glm::mat4x4& base) {
 	return base;
 }
 
-void Viewer::drawNode(std::vector<PrimitiveDraw>& cmd, std::vector<VkDrawIndirectCommand>& aabbCmd, std::size_t nodeIndex, glm::mat4 matrix) {
+void Viewer::drawNode(std::vector<MeshReference>& references, std::size_t nodeIndex, glm::mat4 matrix) {
 	assert(asset.nodes.size() > nodeIndex);
 	ZoneScoped;
 
 	auto& node = asset.nodes[nodeIndex];
 	matrix = getTransformMatrix(node, matrix);
 
+	// Only the transforms which changed are uploaded, to every frame in flight
+	if (matrix != nodeTransforms[nodeIndex]) {
+		nodeTransforms[nodeIndex] = matrix;
+		for (auto& drawBuffer : drawBuffers) {
+			drawBuffer.dirtyTransforms.emplace_back(static_cast<std::uint32_t>(nodeIndex));
+		}
+	}
+
 	if (node.meshIndex.has_value()) {
-		drawMesh(cmd, aabbCmd, node.meshIndex.value(), matrix);
+		const auto instances = nodeInstances[nodeIndex];
+		discreteLodStats.fullDetailTriangles += meshes[*node.meshIndex].triangleCount * instances.count;
+		if (auto meshIndex = selectNodeLod(nodeIndex, *node.meshIndex, matrix); meshIndex.has_value()) {
+			// Meshes unloaded from the geometry heap are skipped
+			if (meshes[*meshIndex].resident) {
+				discreteLodStats.drawnTriangles += meshes[*meshIndex].triangleCount * instances.count;
+				references.push_back({
+					.meshIndex = static_cast<std::uint32_t>(*meshIndex),
+					.nodeIndex = static_cast<std::uint32_t>(nodeIndex),
+					.instances = instances,
+				});
+			}
+		} else {
+			++discreteLodStats.culledNodes;
+		}
 	}
 
 	for (auto& child : node.children) {
-		drawNode(cmd, aabbCmd, child, matrix);
+		drawNode(references, child, matrix);
+	}
+}
+
+std::optional<std::size_t> Viewer::selectNodeLod(std::size_t nodeIndex, std::size_t meshIndex, const glm::mat4& matrix) {
+	auto& lods = nodeLods[nodeIndex];
+	if (lods.meshIndices.empty())
+		return meshIndex;
+
+	// The screen coverage is the projected diameter of the finest level's bounding sphere relative to the screen height
+	const auto& sphere = meshes[meshIndex].boundingSphere;
+	const auto scale = util::max(glm::length(glm::vec3(matrix[0])), util::max(glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2]))));
+	const auto center = glm::vec3(matrix * glm::vec4(glm::vec3(sphere), 1.0f));
+	const auto radius = sphere.w * scale;
+	const auto distance = glm::distance(center, lodOrigin);
+	const auto coverage = distance <= radius ? 1.0f : util::min(1.0f, radius * lodProjectionScale / distance);
+
+	// The coverage has to pass each threshold by the hysteresis margin before the level changes,
+	// which avoids switching back and forth every frame around a threshold.
+	std::size_t level = 0;
+	for (; level < lods.minScreenCoverages.size(); ++level) {
+		const auto margin = level < lods.currentLevel ? 1.0f + lodHysteresis : 1.0f - lodHysteresis;
+		if (coverage >= lods.minScreenCoverages[level] * margin)
+			break;
+	}
+	lods.currentLevel = level;
+
+	if (level >= lods.meshIndices.size())
+		return std::nullopt;
+	return lods.meshIndices[level];
+}
+
+std::uint32_t Viewer::getMaxInstancesPerDraw(std::size_t meshletCount) const {
+	if (meshletCount == 0)
+		return std::numeric_limits<std::uint32_t>::max();
+
+	if (renderPath == RenderPath::MeshShading) {
+		// Every instance is one row of task workgroups, each of which handles up to 128 meshlets
+		const auto groupCountX = static_cast<std::uint32_t>((meshletCount + 128 - 1) / 128);
+		return util::min(meshShaderProperties.maxTaskWorkGroupCount[1], meshShaderProperties.maxTaskWorkGroupTotalCount / groupCountX);
 	}
+
+	// The cull pass has one invocation per meshlet of every instance in the x dimension
+	static constexpr std::uint64_t cullWorkgroupSize = 64;
+	const auto maxInvocations = static_cast<std::uint64_t>(device.physical_device.properties.limits.maxComputeWorkGroupCount[0]) * cullWorkgroupSize;
+	return static_cast<std::uint32_t>(util::min<std::uint64_t>(maxInvocations / meshletCount, std::numeric_limits<std::uint32_t>::max()));
 }
 
-void Viewer::drawMesh(std::vector<PrimitiveDraw>& cmd, std::vector<VkDrawIndirectCommand>& aabbCmd, std::size_t meshIndex, glm::mat4 matrix) {
+void Viewer::drawMesh(std::array<std::vector<PrimitiveDraw>, materialPassCount>& passDraws,
+					  std::array<std::vector<VkDrawIndirectCommand>, materialPassCount>& passAabbDraws, std::size_t meshIndex, DrawRange instances) {
 	assert(meshes.size() > meshIndex);
 	ZoneScoped;
 
 	auto& mesh = meshes[meshIndex];
 
 	for (auto& primitive : mesh.primitives) {
-		auto& draw = cmd.emplace_back();
-
-		// Dispatch so many groups that we only have to use up to 128 16-bit indices in the shared payload.
-		const VkDrawMeshTasksIndirectCommandEXT indirectCommand {
-			.groupCountX = static_cast<std::uint32_t>((primitive.meshlet_count + 128 - 1) / 128),
-			.groupCountY = 1,
-			.groupCountZ = 1,
-		};
-		draw.command = indirectCommand;
-		draw.modelMatrix = matrix;
-		draw.descOffset = primitive.descOffset;
-		draw.vertexIndicesOffset = primitive.vertexIndicesOffset;
-		draw.triangleIndicesOffset = primitive.triangleIndicesOffset;
-		draw.verticesOffset = primitive.verticesOffset;
-		draw.meshletCount = static_cast<std::uint32_t>(primitive.meshlet_count);
-		draw.materialIndex = primitive.materialIndex;
-
-		// Create the AABB draw command
-		auto& aabb = aabbCmd.emplace_back();
-		aabb.vertexCount = 12 * 2; // 12 edges with each 2 vertices
-		aabb.instanceCount = draw.meshletCount;
-		aabb.firstVertex = 0;
-		aabb.firstInstance = 0;
+		// Primitives without any meshlets have nothing to draw, and the shaders divide by their meshlet count
+		if (primitive.meshlet_count == 0)
+			continue;
+
+		// Bucket the draws by the pipeline variant of their material, so that each variant can be drawn
+		// with a single indirect draw. The AABB draws are bucketed the same way, as they use gl_DrawID too.
+		const auto pass = static_cast<std::size_t>(materialPasses[primitive.materialIndex]);
+
+		// A single draw covers every instance, unless there are more than a dispatch can hold
+		const auto maxInstances = getMaxInstancesPerDraw(primitive.meshlet_count);
+		for (std::uint32_t first = 0; first < instances.count; first += maxInstances) {
+			const auto instanceCount = util::min(instances.count - first, maxInstances);
+			auto& draw = passDraws[pass].emplace_back();
+
+			// Dispatch so many groups that we only have to use up to 128 16-bit indices in the shared payload.
+			// Every instance gets its own row of groups.
+			const VkDrawMeshTasksIndirectCommandEXT indirectCommand {
+				.groupCountX = static_cast<std::uint32_t>((primitive.meshlet_count + 128 - 1) / 128),
+				.groupCountY = instanceCount,
+				.groupCountZ = 1,
+			};
+			draw.command = indirectCommand;
+			draw.primitiveIndex = primitive.primitiveIndex;
+			draw.instanceOffset = instances.offset + first;
+			draw.instanceCount = instanceCount;
+
+			// Create the AABB draw command
+			auto& aabb = passAabbDraws[pass].emplace_back();
+			aabb.vertexCount = 12 * 2; // 12 edges with each 2 vertices
+			aabb.instanceCount = static_cast<std::uint32_t>(primitive.finestLevelMeshletCount) * instanceCount; // Only the finest LOD level
+			aabb.firstVertex = 0;
+			aabb.firstInstance = 0;
+		}
 	}
 }
 
-void Viewer::updateDrawBuffer(std::size_t currentFrame) {
+void Viewer::buildDrawList(std::vector<MeshReference>&& references) {
 	ZoneScoped;
-	assert(drawBuffers.size() > currentFrame);
+	const auto version = drawList.version;
+	drawList = DrawList { .references = std::move(references), .version = version + 1 };
+
+	// Group the references by their mesh, so that each primitive is drawn once for every node referencing
+	// its mesh. The draw instances of a mesh are contiguous, and shared by all of its primitives.
+	std::vector<DrawRange> meshInstances(meshes.size(), DrawRange { .offset = 0, .count = 0 });
+	for (auto& reference : drawList.references) {
+		meshInstances[reference.meshIndex].count += reference.instances.count;
+	}
 
-	auto& currentDrawBuffer = drawBuffers[currentFrame];
+	std::uint32_t instanceOffset = 0;
+	for (auto& range : meshInstances) {
+		range.offset = instanceOffset;
+		instanceOffset += range.count;
+	}
+
+	drawList.instances.resize(instanceOffset);
+	std::vector<std::uint32_t> cursors(meshes.size());
+	std::transform(meshInstances.begin(), meshInstances.end(), cursors.begin(), [](const DrawRange& range) { return range.offset; });
+	for (auto& reference : drawList.references) {
+		auto& cursor = cursors[reference.meshIndex];
+		for (std::uint32_t i = 0; i < reference.instances.count; ++i) {
+			drawList.instances[cursor++] = { .nodeIndex = reference.nodeIndex, .instanceIndex = reference.instances.offset + i };
+		}
+	}
+
+	std::array<std::vector<PrimitiveDraw>, materialPassCount> passDraws;
+	std::array<std::vector<VkDrawIndirectCommand>, materialPassCount> passAabbDraws;
+	for (std::size_t i = 0; i < meshes.size(); ++i) {
+		if (meshInstances[i].count > 0)
+			drawMesh(passDraws, passAabbDraws, i, meshInstances[i]);
+	}
+
+	// Concatenate the passes. As the draws are ordered by their pass, so are the meshlet draws of the vertex
+	// shading path. Each instance has its own meshlet draws, placed one after another.
+	for (std::size_t i = 0; i < materialPassCount; ++i) {
+		// Each shard's meshlet draws are drawn with its own index buffer, so the draws of a pass are ordered by their
+		// shard. The shards are filled in the order of the meshes when loading, but not once meshes are loaded at runtime.
+		const auto getShard = [&](std::size_t draw) { return primitiveRecords[passDraws[i][draw].primitiveIndex].shardIndex; };
+		std::vector<std::size_t> order(passDraws[i].size());
+		std::iota(order.begin(), order.end(), 0);
+		if (!std::ranges::is_sorted(order, {}, getShard)) {
+			std::ranges::stable_sort(order, {}, getShard);
+			std::vector<PrimitiveDraw> sortedDraws; sortedDraws.reserve(order.size());
+			std::vector<VkDrawIndirectCommand> sortedAabbDraws; sortedAabbDraws.reserve(order.size());
+			for (auto draw : order) {
+				sortedDraws.emplace_back(passDraws[i][draw]);
+				sortedAabbDraws.emplace_back(passAabbDraws[i][draw]);
+			}
+			passDraws[i] = std::move(sortedDraws);
+			passAabbDraws[i] = std::move(sortedAabbDraws);
+		}
+
+		drawList.passDraws[i] = { .offset = static_cast<std::uint32_t>(drawList.draws.size()), .count = static_cast<std::uint32_t>(passDraws[i].size()) };
+		for (auto& draw : passDraws[i]) {
+			const auto& primitive = primitiveRecords[draw.primitiveIndex];
+			const auto drawMeshletCount = static_cast<std::uint64_t>(primitive.meshletCount) * draw.instanceCount;
+			draw.meshletDrawOffset = static_cast<std::uint32_t>(drawList.meshletCount);
+
+			auto& batches = drawList.passMeshletDraws[i];
+			assert(batches.empty() || batches.back().shardIndex <= primitive.shardIndex);
+			if (batches.empty() || batches.back().shardIndex != primitive.shardIndex) {
+				batches.push_back({ .shardIndex = primitive.shardIndex, .draws = { .offset = draw.meshletDrawOffset, .count = 0 } });
+			}
+			batches.back().draws.count += static_cast<std::uint32_t>(drawMeshletCount);
+
+			drawList.meshletCount += drawMeshletCount;
+			drawList.maxDrawMeshletCount = static_cast<std::uint32_t>(util::max<std::uint64_t>(drawList.maxDrawMeshletCount, drawMeshletCount));
+		}
+
+		drawList.draws.insert(drawList.draws.end(), passDraws[i].begin(), passDraws[i].end());
+		drawList.aabbDraws.insert(drawList.aabbDraws.end(), passAabbDraws[i].begin(), passAabbDraws[i].end());
+	}
+}
 
-	std::vector<PrimitiveDraw> draws;
-	std::vector<VkDrawIndirectCommand> aabbDraws;
+void Viewer::updateDrawList() {
+	ZoneScoped;
+	const auto buildStart = std::chrono::steady_clock::now();
+	discreteLodStats = {};
+	drawListBuildMs = 0.0;
 
 	if (asset.scenes.empty() || sceneIndex >= asset.scenes.size())
 		return;
 
+	if (nodeTransforms.size() != asset.nodes.size()) {
+		// NaN never compares equal, so every node is marked dirty when it is first visited
+		nodeTransforms.assign(asset.nodes.size(), glm::mat4(std::numeric_limits<float>::quiet_NaN()));
+	}
+
+	std::vector<MeshReference> references;
 	auto& scene = asset.scenes[sceneIndex];
 	for (auto& nodeIdx : scene.nodeIndices) {
-		drawNode(draws, aabbDraws, nodeIdx, glm::mat4(1.0f));
+		drawNode(references, nodeIdx, glm::mat4(1.0f));
+	}
+
+	// The draws only change if a node references another mesh or LOD level, or compaction moved primitives
+	if (drawList.stale || references != drawList.references) {
+		buildDrawList(std::move(references));
 	}
+	markVisibleTextures();
+	drawListBuildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+}
 
-	// TODO: This limits our primitive count to 4.2 billion. Can we set this limit somewhere else,
-	//		 or could we dispatch multiple indirect draws to remove the uint32_t limit?
-	currentDrawBuffer.drawCount = static_cast<std::uint32_t>(draws.size());
+/** The CPU counterpart of getRejectingFrustumPlane in culling.glsl.h, for an AABB in the space of the transform */
+bool isAabbInFrustum(const std::array<glm::vec4, 6>& frustum, const glm::mat4& transform, glm::vec3 center, glm::vec3 extents) {
+	const auto worldCenter = glm::vec3(transform * glm::vec4(center, 1.0f));
+	const auto worldExtents = glm::mat3(glm::abs(glm::vec3(transform[0])), glm::abs(glm::vec3(transform[1])), glm::abs(glm::vec3(transform[2]))) * extents;
+	for (const auto& plane : frustum) {
+		const auto radius = glm::dot(worldExtents, glm::abs(glm::vec3(plane)));
+		const auto distance = glm::dot(glm::vec3(plane), worldCenter) - plane.w;
+		if (-radius > distance)
+			return false;
+	}
+	return true;
+}
 
-	auto byteSize = currentDrawBuffer.drawCount * sizeof(decltype(draws)::value_type);
-	if (currentDrawBuffer.primitiveDrawBufferSize < byteSize) {
-		if (currentDrawBuffer.primitiveDrawHandle != VK_NULL_HANDLE) {
-			vmaDestroyBuffer(allocator, currentDrawBuffer.primitiveDrawHandle,
-							 currentDrawBuffer.primitiveDrawAllocation);
+void Viewer::markVisibleTextures() {
+	ZoneScoped;
+	// Only textures of primitives which are at least partially inside the frustum count as used, so that the
+	// textures of everything off-screen go cold. The EXT_mesh_gpu_instancing transforms are not kept on the CPU,
+	// which is why instanced nodes always count as visible.
+	for (const auto& reference : drawList.references) {
+		const auto& transform = nodeTransforms[reference.nodeIndex];
+		const bool instanced = reference.instances != NodeInstances {};
+		for (const auto& primitive : meshes[reference.meshIndex].primitives) {
+			const auto& imageIdx = materialImages[primitive.materialIndex];
+			if (!imageIdx.has_value())
+				continue;
+			if (!instanced && !isAabbInFrustum(frameCamera.frustum, transform, primitive.aabbCenter, primitive.aabbExtents))
+				continue;
+			imageResidency[*imageIdx].lastUsedFrame = frameNumber;
 		}
+	}
+}
+
+void Viewer::updateDrawBuffer(std::size_t currentFrame) {
+	ZoneScoped;
+	assert(drawBuffers.size() > currentFrame);
+
+	auto& currentDrawBuffer = drawBuffers[currentFrame];
+
+	const auto uploadStart = std::chrono::steady_clock::now();
+	if (asset.scenes.empty() || sceneIndex >= asset.scenes.size())
+		return;
+
+	// Creates or grows one of the frame's host-visible buffers. Returns true if the buffer was recreated.
+	const auto ensureBuffer = [&](VkBuffer& handle, VmaAllocation& allocation, VkDeviceSize& bufferSize, VkDeviceSize size,
+								  VkBufferUsageFlags usage, std::uint32_t binding, std::string_view name) {
+		if (size == 0 || bufferSize >= size)
+			return false;
+
+		// The buffer belongs to this frame, but the queue keeps this independent of the number of frames in flight
+		deferredDestruction.destroyBuffer(frameNumber, handle, allocation);
 
 		const VmaAllocationCreateInfo allocationCreateInfo {
 			.usage = VMA_MEMORY_USAGE_CPU_TO_GPU,
@@ -1804,78 +4018,149 @@ void Viewer::updateDrawBuffer(std::size_t currentFrame) {
 		};
 		const VkBufferCreateInfo bufferCreateInfo {
 			.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-			.size = byteSize,
-			.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			.size = size,
+			.usage = usage,
 		};
-		auto result = vmaCreateBuffer(allocator, &bufferCreateInfo, &allocationCreateInfo,
-							   &currentDrawBuffer.primitiveDrawHandle, &currentDrawBuffer.primitiveDrawAllocation, VK_NULL_HANDLE);
-		vk::checkResult(result, "Failed to allocate indirect draw buffer: {}");
-		vk::setDebugUtilsName(device, currentDrawBuffer.primitiveDrawHandle, fmt::format("Indirect draw buffer {}", currentFrame));
-		currentDrawBuffer.primitiveDrawBufferSize = byteSize;
+		auto result = vmaCreateBuffer(allocator, &bufferCreateInfo, &allocationCreateInfo, &handle, &allocation, VK_NULL_HANDLE);
+		vk::checkResult(result, "Failed to allocate draw data buffer: {}");
+		vk::setDebugUtilsName(device, handle, fmt::format("{} {}", name, currentFrame));
+		bufferSize = size;
+
+		if (binding == UINT32_MAX)
+			return true;
 
-		// Update the descriptor
 		const VkDescriptorBufferInfo bufferInfo {
-			.buffer = currentDrawBuffer.primitiveDrawHandle,
+			.buffer = handle,
 			.offset = 0,
 			.range = VK_WHOLE_SIZE,
 		};
 		const VkWriteDescriptorSet writeDescriptor {
 			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
 			.dstSet = globalMeshBuffers.descriptors[currentFrame],
-			.dstBinding = 4,
+			.dstBinding = binding,
 			.dstArrayElement = 0,
 			.descriptorCount = 1,
 			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 			.pBufferInfo = &bufferInfo,
 		};
 		vkUpdateDescriptorSets(device, 1, &writeDescriptor, 0, nullptr);
+		return true;
+	};
+
+	VkDeviceSize uploadBytes = 0;
+
+	// Each frame in flight has its own copy of the draws, which is only uploaded once for every version of the draw list
+	if (currentDrawBuffer.drawListVersion != drawList.version) {
+		ZoneScopedN("Upload draw list");
+		const auto drawBytes = std::span(drawList.draws).size_bytes();
+		ensureBuffer(currentDrawBuffer.primitiveDrawHandle, currentDrawBuffer.primitiveDrawAllocation, currentDrawBuffer.primitiveDrawBufferSize,
+					 drawBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, 4, "Indirect draw buffer");
+		if (!drawList.draws.empty()) {
+			vk::ScopedMap<PrimitiveDraw> map(allocator, currentDrawBuffer.primitiveDrawAllocation);
+			std::copy(drawList.draws.begin(), drawList.draws.end(), map.get());
+		}
+
+		const auto aabbBytes = std::span(drawList.aabbDraws).size_bytes();
+		ensureBuffer(currentDrawBuffer.aabbDrawHandle, currentDrawBuffer.aabbDrawAllocation, currentDrawBuffer.aabbDrawBufferSize,
+					 aabbBytes, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, UINT32_MAX, "Indirect AABB draw buffer");
+		if (!drawList.aabbDraws.empty()) {
+			vk::ScopedMap<VkDrawIndirectCommand> map(allocator, currentDrawBuffer.aabbDrawAllocation);
+			std::copy(drawList.aabbDraws.begin(), drawList.aabbDraws.end(), map.get());
+		}
+
+		const auto instanceBytes = std::span(drawList.instances).size_bytes();
+		ensureBuffer(currentDrawBuffer.drawInstanceHandle, currentDrawBuffer.drawInstanceAllocation, currentDrawBuffer.drawInstanceBufferSize,
+					 instanceBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 7, "Draw instances");
+		if (!drawList.instances.empty()) {
+			vk::ScopedMap<DrawInstance> map(allocator, currentDrawBuffer.drawInstanceAllocation);
+			std::copy(drawList.instances.begin(), drawList.instances.end(), map.get());
+		}
+
+		// TODO: This limits our primitive count to 4.2 billion. Can we set this limit somewhere else,
+		//		 or could we dispatch multiple indirect draws to remove the uint32_t limit?
+		currentDrawBuffer.drawCount = static_cast<std::uint32_t>(drawList.draws.size());
+		currentDrawBuffer.passDraws = drawList.passDraws;
+		currentDrawBuffer.passMeshletDraws = drawList.passMeshletDraws;
+		currentDrawBuffer.meshletCount = drawList.meshletCount;
+		currentDrawBuffer.maxDrawMeshletCount = drawList.maxDrawMeshletCount;
+		currentDrawBuffer.drawListVersion = drawList.version;
+		uploadBytes += drawBytes + aabbBytes + instanceBytes;
 	}
 
-	{
-		vk::ScopedMap<PrimitiveDraw> map(allocator, currentDrawBuffer.primitiveDrawAllocation);
+	// The transform buffer holds every node, so that the draw instances stay valid when other nodes move
+	const auto transformBytes = asset.nodes.size() * sizeof(NodeTransform);
+	if (ensureBuffer(currentDrawBuffer.transformHandle, currentDrawBuffer.transformAllocation, currentDrawBuffer.transformBufferSize,
+					 transformBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 8, "Node transforms")) {
+		currentDrawBuffer.dirtyTransforms.resize(asset.nodes.size());
+		std::iota(currentDrawBuffer.dirtyTransforms.begin(), currentDrawBuffer.dirtyTransforms.end(), 0U);
+	}
+	if (!currentDrawBuffer.dirtyTransforms.empty()) {
+		ZoneScopedN("Upload dirty transforms");
+		vk::ScopedMap<NodeTransform> map(allocator, currentDrawBuffer.transformAllocation);
 		auto* data = map.get();
-		std::copy(draws.begin(), draws.end(), data);
+		for (auto nodeIndex : currentDrawBuffer.dirtyTransforms) {
+			// Store the rows, as the last one of an affine transform is always (0, 0, 0, 1)
+			const auto transposed = glm::transpose(nodeTransforms[nodeIndex]);
+			data[nodeIndex].rows = { transposed[0], transposed[1], transposed[2] };
+		}
+		uploadBytes += currentDrawBuffer.dirtyTransforms.size() * sizeof(NodeTransform);
+		currentDrawBuffer.dirtyTransforms.clear();
 	}
 
-	// Resize the AABB visualizing draw buffer
-	auto aabbByteSize = currentDrawBuffer.drawCount * sizeof(decltype(aabbDraws)::value_type);
-	if (currentDrawBuffer.aabbDrawBufferSize < aabbByteSize) {
-		if (currentDrawBuffer.aabbDrawHandle != VK_NULL_HANDLE) {
-			vmaDestroyBuffer(allocator, currentDrawBuffer.aabbDrawHandle, currentDrawBuffer.aabbDrawAllocation);
-		}
+	drawListStats = {
+		.drawCount = currentDrawBuffer.drawCount,
+		.instanceCount = drawList.instances.size(),
+		.indirectBytes = std::span(drawList.draws).size_bytes(),
+		.instanceBytes = std::span(drawList.instances).size_bytes() + transformBytes,
+		.uploadBytes = uploadBytes,
+		.buildMs = drawListBuildMs + std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - uploadStart).count(),
+	};
+
+	// Resize the meshlet draw buffer, which only the GPU writes to
+	auto meshletDrawByteSize = currentDrawBuffer.meshletCount * sizeof(VkDrawIndexedIndirectCommand);
+	if (renderPath == RenderPath::VertexShading && currentDrawBuffer.meshletDrawBufferSize < meshletDrawByteSize) {
+		deferredDestruction.destroyBuffer(frameNumber, currentDrawBuffer.meshletDrawHandle, currentDrawBuffer.meshletDrawAllocation);
 
 		const VmaAllocationCreateInfo allocationCreateInfo {
-			.usage = VMA_MEMORY_USAGE_CPU_TO_GPU,
-			.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+			.usage = VMA_MEMORY_USAGE_GPU_ONLY,
 		};
 		const VkBufferCreateInfo bufferCreateInfo {
 			.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-			.size = aabbByteSize,
-			.usage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			.size = meshletDrawByteSize,
+			.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
 		};
 		auto result = vmaCreateBuffer(allocator, &bufferCreateInfo, &allocationCreateInfo,
-									  &currentDrawBuffer.aabbDrawHandle, &currentDrawBuffer.aabbDrawAllocation, VK_NULL_HANDLE);
-		vk::checkResult(result, "Failed to allocate indirect AABB draw buffer: {}");
-		vk::setDebugUtilsName(device, currentDrawBuffer.aabbDrawHandle, fmt::format("Indirect AABB draw buffer {}", currentFrame));
-		currentDrawBuffer.aabbDrawBufferSize = aabbByteSize;
-	}
+									  &currentDrawBuffer.meshletDrawHandle, &currentDrawBuffer.meshletDrawAllocation, VK_NULL_HANDLE);
+		vk::checkResult(result, "Failed to allocate indirect meshlet draw buffer: {}");
+		vk::setDebugUtilsName(device, currentDrawBuffer.meshletDrawHandle, fmt::format("Indirect meshlet draw buffer {}", currentFrame));
+		currentDrawBuffer.meshletDrawBufferSize = meshletDrawByteSize;
 
-	{
-		vk::ScopedMap<VkDrawIndirectCommand> map(allocator, currentDrawBuffer.aabbDrawAllocation);
-		auto* data = map.get();
-		std::copy(aabbDraws.begin(), aabbDraws.end(), data);
+		const VkDescriptorBufferInfo bufferInfo {
+			.buffer = currentDrawBuffer.meshletDrawHandle,
+			.offset = 0,
+			.range = VK_WHOLE_SIZE,
+		};
+		const VkWriteDescriptorSet writeDescriptor {
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = globalMeshBuffers.descriptors[currentFrame],
+			.dstBinding = 5,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.pBufferInfo = &bufferInfo,
+		};
+		vkUpdateDescriptorSets(device, 1, &writeDescriptor, 0, nullptr);
 	}
 }
 
-void Viewer::updateCameraBuffer(std::size_t currentFrame) {
-	assert(cameraBuffers.size() > currentFrame);
+void Viewer::updateCamera() {
 	ZoneScoped;
+	// Calculate new camera matrices, which updateCameraBuffer copies to the GPU
+	auto& camera = frameCamera;
 
-	// Calculate new camera matrices, upload to GPU
-	auto& cameraBuffer = cameraBuffers[currentFrame];
-	vk::ScopedMap<Camera> map(allocator, cameraBuffer.allocation);
-	auto& camera = *map.get();
-
+	// The camera position and the vertical projection scale, which the LOD selection needs
+	glm::vec3 cameraPosition;
+	float projectionScale;
 	if (cameraIndex.has_value()) {
 		auto& scene = asset.scenes[sceneIndex];
 
@@ -1898,6 +4183,8 @@ void Viewer::updateCameraBuffer(std::size_t currentFrame) {
 		}
 
 		auto projectionMatrix = getCameraProjectionMatrix(asset.cameras[*cameraIndex]);
+		cameraPosition = glm::vec3(glm::affineInverse(viewMatrix)[3]);
+		projectionScale = std::abs(projectionMatrix[1][1]);
 
 		projectionMatrix[1][1] *= -1;
 		camera.viewProjectionMatrix = projectionMatrix * viewMatrix;
@@ -1914,6 +4201,8 @@ void Viewer::updateCameraBuffer(std::size_t currentFrame) {
 		static constexpr auto fov = glm::radians(75.0f);
 		const auto aspectRatio = static_cast<float>(swapchain.extent.width) / static_cast<float>(swapchain.extent.height);
 		auto projectionMatrix = glm::perspective(fov, aspectRatio, zNear, zFar);
+		cameraPosition = movement.position;
+		projectionScale = projectionMatrix[1][1];
 
 		// Invert the Y-Axis to use the same coordinate system as glTF.
 		projectionMatrix[1][1] *= -1;
@@ -1934,6 +4223,62 @@ void Viewer::updateCameraBuffer(std::size_t currentFrame) {
 			plane /= glm::length(glm::vec3(plane));
 			plane.w = -plane.w;
 		}
+
+		// An error of e at distance d covers e / d * projectionScale * height / 2 pixels
+		lodOrigin = cameraPosition;
+		lodProjectionScale = projectionScale;
+		camera.lodOrigin = cameraPosition;
+		camera.lodErrorScale = lodErrorThreshold > 0.0f
+			? projectionScale * 0.5f * static_cast<float>(swapchain.extent.height) / lodErrorThreshold
+			: std::numeric_limits<float>::max();
+	}
+}
+
+void Viewer::updateCameraBuffer(std::size_t currentFrame) {
+	assert(cameraBuffers.size() > currentFrame);
+	ZoneScoped;
+	vk::ScopedMap<Camera> map(allocator, cameraBuffers[currentFrame].allocation);
+	*map.get() = frameCamera;
+}
+
+void Viewer::readFrameStatistics(std::size_t currentFrame) {
+	ZoneScoped;
+	{
+		vk::ScopedMap<CullingStats> map(allocator, cameraBuffers[currentFrame].cullingStatsAllocation);
+		cullingStats = *map.get();
+		*map.get() = {};
+	}
+
+	if (pipelineStatisticsPools.empty())
+		return;
+
+	// The frame's fence has been waited upon, so this only fails if the query was never written to,
+	// as is the case for the first frames.
+	std::array<std::uint64_t, 5> values = {};
+	auto result = vkGetQueryPoolResults(device, pipelineStatisticsPools[currentFrame], 0, 1,
+										sizeof(values), values.data(), sizeof(values), VK_QUERY_RESULT_64_BIT);
+	if (result == VK_SUCCESS) {
+		// The task and mesh shader invocations come last, so they are simply zero if unsupported
+		pipelineStatistics = {
+			.clippingInvocations = values[0],
+			.clippingPrimitives = values[1],
+			.fragmentShaderInvocations = values[2],
+			.taskShaderInvocations = values[3],
+			.meshShaderInvocations = values[4],
+		};
+		vkResetQueryPool(device, pipelineStatisticsPools[currentFrame], 0, 1);
+	}
+}
+
+void Viewer::applyCameraPathFrame(const CameraPathFrame& frame) {
+	movement.position = frame.position;
+	movement.direction = frame.direction;
+	movement.velocity = glm::vec3(0.0f);
+	movement.accelerationVector = glm::vec3(0.0f);
+	if (frame.cameraIndex.has_value() && *frame.cameraIndex < cameraNodes.size()) {
+		cameraIndex = *frame.cameraIndex;
+	} else {
+		cameraIndex.reset();
 	}
 }
 
@@ -1951,9 +4296,342 @@ void Viewer::updateCameraNodes(std::size_t nodeIndex) {
 		cameraNodes.emplace_back(&node);
 	}
 
-	for (auto& child : node.children) {
-		updateCameraNodes(child);
+	for (auto& child : node.children) {
+		updateCameraNodes(child);
+	}
+}
+
+void Viewer::pollFrameLatencies() {
+	ZoneScoped;
+	for (std::size_t i = 0; i < frameLatencies.size(); ++i) {
+		if (frameLatencies[i].frameNumber == 0 || frameLatencies[i].latencyMs.has_value())
+			continue;
+		if (vkGetFenceStatus(device, frameSyncData[i].presentFinished) == VK_SUCCESS)
+			completeFrameLatency(i, std::chrono::steady_clock::now());
+	}
+}
+
+void Viewer::completeFrameLatency(std::size_t frameIndex, std::chrono::steady_clock::time_point completionTime) {
+	auto& latency = frameLatencies[frameIndex];
+	if (latency.frameNumber == 0 || latency.latencyMs.has_value())
+		return;
+
+	latency.latencyMs = std::chrono::duration<double, std::milli>(completionTime - latency.inputTime).count();
+	auto& stats = latencyStats;
+	stats.lastMs = *latency.latencyMs;
+	stats.history[stats.sampleCount++ % stats.history.size()] = stats.lastMs;
+	const auto count = util::min(stats.sampleCount, stats.history.size());
+	stats.averageMs = std::accumulate(stats.history.begin(), stats.history.begin() + count, 0.0) / static_cast<double>(count);
+}
+
+void Viewer::prepareFrameCpu() {
+	ZoneScoped;
+	// A frame which finished while we were busy is only measured here, so its latency is at most one frame too high
+	pollFrameLatencies();
+
+	// The LOD selection of the draw list uses the camera of this frame
+	updateCamera();
+	updateDrawList();
+}
+
+void Viewer::prepareFrame(std::size_t currentFrame) {
+	ZoneScoped;
+	auto& sync = frameSyncData[currentFrame];
+
+	// Wait for the last frame with the current index to have finished presenting, so that we can start
+	// using the semaphores and command buffers. Only the copies into the frame's buffers have to wait for this.
+	vkWaitForFences(device, 1, &sync.presentFinished, VK_TRUE, UINT64_MAX);
+	completeFrameLatency(currentFrame, std::chrono::steady_clock::now());
+	vkResetFences(device, 1, &sync.presentFinished);
+
+	// Every frame up to frameNumber - frameOverlap has now retired, so their texture slots can be reused
+	// and the objects they used can be destroyed.
+	++frameNumber;
+	if (frameNumber > frameOverlap) {
+		textureSlots.recycle(frameNumber - frameOverlap);
+		deferredDestruction.release(frameNumber - frameOverlap);
+		releaseRetiredGeometry(frameNumber - frameOverlap);
+	}
+	frameLatencies[currentFrame] = {
+		.frameNumber = frameNumber,
+		.inputTime = inputTime,
+	};
+
+	// Read the GPU timings and statistics of the frame which previously used these resources
+	gpuProfiler.beginFrame(currentFrame, frameNumber);
+	readFrameStatistics(currentFrame);
+
+	// Swap in finished image and mesh loads, and evict or restore texture mips depending on the memory budget
+	updateImageLoads();
+	updateMeshLoads();
+	updateTextureResidency();
+
+	// Copy the camera and the draw list prepared by prepareFrameCpu
+	updateCameraBuffer(currentFrame);
+	updateDrawBuffer(currentFrame);
+
+	// Reset the command pool
+	vkResetCommandPool(device, frameCommandPools[currentFrame].pool, 0);
+}
+
+void Viewer::recordFrame(VkCommandBuffer cmd, std::size_t currentFrame, VkImage colorImage, VkImageView colorImageView) {
+	ZoneScoped;
+	auto& drawBuffer = drawBuffers[currentFrame];
+	std::array<VkDescriptorSet, 3> descriptorBinds {{
+		cameraBuffers[currentFrame].cameraSet, // Set 0
+		globalMeshBuffers.descriptors[currentFrame], // Set 1
+		materialSet, // Set 2
+	}};
+
+	// Move the geometry of compacted shards, and write the records of primitives which moved or were loaded
+	recordGeometryUpdates(cmd);
+	recordMaterialUpdates(cmd);
+
+	if (renderPath == RenderPath::VertexShading && drawBuffer.meshletCount > 0) {
+		TracyVkZone(tracyCtx, cmd, "Meshlet culling");
+		vk::ScopedGpuZone cullZone(gpuProfiler, cmd, "Meshlet culling");
+
+		// Cull every meshlet in a compute pass, which writes one indexed draw per meshlet. The y dimension
+		// selects the draw, and is limited by the device, which is why we might need multiple dispatches.
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, meshletCullPipeline);
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, meshPipelineLayout,
+								0, 2, descriptorBinds.data(), 0, nullptr);
+
+		const auto& maxGroupCount = device.physical_device.properties.limits.maxComputeWorkGroupCount;
+		static constexpr std::uint32_t cullWorkgroupSize = 64;
+		const auto groupCountX = (drawBuffer.maxDrawMeshletCount + cullWorkgroupSize - 1) / cullWorkgroupSize;
+		for (std::uint32_t first = 0; first < drawBuffer.drawCount; first += maxGroupCount[1]) {
+			const MeshPushConstants pushConstants {
+				.drawIdOffset = first,
+			};
+			vkCmdPushConstants(cmd, meshPipelineLayout, meshletShaderStages, 0, sizeof(pushConstants), &pushConstants);
+			vkCmdDispatch(cmd, groupCountX, util::min(drawBuffer.drawCount - first, maxGroupCount[1]), 1);
+		}
+
+		// The draws are consumed as indirect commands, and the culling counters are read by the host
+		const std::array<VkMemoryBarrier2, 2> cullBarriers {{
+			{
+				.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+				.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+				.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+				.dstStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+				.dstAccessMask = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT,
+			},
+			{
+				.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+				.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+				.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+				.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT,
+				.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT,
+			},
+		}};
+		const VkDependencyInfo cullDependencyInfo {
+			.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+			.memoryBarrierCount = static_cast<std::uint32_t>(cullBarriers.size()),
+			.pMemoryBarriers = cullBarriers.data(),
+		};
+		vkCmdPipelineBarrier2(cmd, &cullDependencyInfo);
+	}
+
+	{
+		TracyVkZone(tracyCtx, cmd, "Mesh shading");
+
+		// Transition the color image from UNDEFINED -> COLOR_ATTACHMENT_OPTIMAL for rendering
+		// Transition the depth image from UNDEFINED -> DEPTH_ATTACHMENT_OPTIMAL
+		std::array<VkImageMemoryBarrier2, 2> imageBarriers = {{
+			{
+				.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+				.srcStageMask = VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT,
+				.srcAccessMask = VK_ACCESS_2_NONE,
+				.dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+				.dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+				.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+				.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.image = colorImage,
+				.subresourceRange = {
+					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+					.levelCount = 1,
+					.layerCount = 1,
+				},
+			},
+			{
+				.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+				.srcStageMask = VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT,
+				.srcAccessMask = VK_ACCESS_2_NONE,
+				.dstStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT,
+				.dstAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+				.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+				.newLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.image = depthImage,
+				.subresourceRange = {
+					.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+					.levelCount = 1,
+					.layerCount = 1,
+				},
+			}
+		}};
+		const VkDependencyInfo dependencyInfo {
+			.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+			.imageMemoryBarrierCount = static_cast<std::uint32_t>(imageBarriers.size()),
+			.pImageMemoryBarriers = imageBarriers.data(),
+		};
+		vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+
+		const VkRenderingAttachmentInfo colorAttachment {
+			.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+			.imageView = colorImageView,
+			.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+			.resolveMode = VK_RESOLVE_MODE_NONE,
+			.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+			.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+		};
+		const VkRenderingAttachmentInfo depthAttachment {
+			.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+			.imageView = depthImageView,
+			.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+			.resolveMode = VK_RESOLVE_MODE_NONE,
+			.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+			.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+			.clearValue = {1.0f, 0.0f},
+		};
+		const VkRenderingInfo renderingInfo {
+			.sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+			.renderArea = {
+				.offset = {},
+				.extent = swapchain.extent,
+			},
+			.layerCount = 1,
+			.colorAttachmentCount = 1,
+			.pColorAttachments = &colorAttachment,
+			.pDepthAttachment = &depthAttachment,
+		};
+		vkCmdBeginRendering(cmd, &renderingInfo);
+
+		// Bind the camera descriptor set
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, meshPipelineLayout,
+								0, static_cast<std::uint32_t>(descriptorBinds.size()), descriptorBinds.data(),
+								0, nullptr);
+
+		const VkViewport viewport = {
+			.x = 0.0F,
+			.y = 0.0F,
+			.width = static_cast<float>(swapchain.extent.width),
+			.height = static_cast<float>(swapchain.extent.height),
+			.minDepth = 0.0F,
+			.maxDepth = 1.0F,
+		};
+		vkCmdSetViewport(cmd, 0, 1, &viewport);
+
+		const VkRect2D scissor = renderingInfo.renderArea;
+		vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+		// Only the meshlet passes are included in the pipeline statistics
+		if (!pipelineStatisticsPools.empty())
+			vkCmdBeginQuery(cmd, pipelineStatisticsPools[currentFrame], 0, 0);
+
+		// Draw each material pass with its own pipeline variant. Opaque geometry comes first, so that
+		// masked and blended geometry behind it gets rejected by the early depth test.
+		static constexpr std::array<std::string_view, materialPassCount> passNames {{
+			"Mesh shading (opaque)", "Mesh shading (mask)", "Mesh shading (blend)",
+		}};
+		static constexpr std::array<std::string_view, materialPassCount> vertexPassNames {{
+			"Vertex shading (opaque)", "Vertex shading (mask)", "Vertex shading (blend)",
+		}};
+		if (renderPath == RenderPath::MeshShading) {
+			for (std::size_t i = 0; i < materialPassCount; ++i) {
+				auto& passDraws = drawBuffer.passDraws[i];
+				if (passDraws.count == 0)
+					continue;
+
+				vk::ScopedGpuZone passZone(gpuProfiler, cmd, passNames[i]);
+				vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, meshPipelines[i]);
+
+				const MeshPushConstants pushConstants {
+					.drawIdOffset = passDraws.offset,
+				};
+				vkCmdPushConstants(cmd, meshPipelineLayout, meshletShaderStages, 0, sizeof(pushConstants), &pushConstants);
+
+				vkCmdDrawMeshTasksIndirectEXT(cmd,
+											  drawBuffer.primitiveDrawHandle,
+											  passDraws.offset * sizeof(PrimitiveDraw),
+											  passDraws.count,
+											  sizeof(PrimitiveDraw));
+			}
+		} else {
+			// Every meshlet has its own draw, culled meshlets simply have an instance count of zero.
+			// The draw count is limited by maxDrawIndirectCount, so we might need multiple draws per pass.
+			// Each geometry shard has its own index buffer, so the passes are split into one batch per shard.
+			const auto maxDrawCount = device.physical_device.properties.limits.maxDrawIndirectCount;
+			for (std::size_t i = 0; i < materialPassCount; ++i) {
+				auto& batches = drawBuffer.passMeshletDraws[i];
+				if (batches.empty())
+					continue;
+
+				vk::ScopedGpuZone passZone(gpuProfiler, cmd, vertexPassNames[i]);
+				vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, vertexPipelines[i]);
+				for (auto& [shardIndex, passDraws] : batches) {
+					vkCmdBindIndexBuffer(cmd, globalMeshBuffers.shards[shardIndex].meshletIndices.handle, 0, VK_INDEX_TYPE_UINT32);
+					for (std::uint32_t first = 0; first < passDraws.count; first += maxDrawCount) {
+						// The vertex shader finds the instance of each meshlet draw from its index
+						const MeshPushConstants pushConstants {
+							.drawIdOffset = passDraws.offset + first,
+						};
+						vkCmdPushConstants(cmd, meshPipelineLayout, meshletShaderStages, 0, sizeof(pushConstants), &pushConstants);
+						vkCmdDrawIndexedIndirect(cmd, drawBuffer.meshletDrawHandle,
+												 (passDraws.offset + first) * sizeof(VkDrawIndexedIndirectCommand),
+												 util::min(passDraws.count - first, maxDrawCount),
+												 sizeof(VkDrawIndexedIndirectCommand));
+					}
+				}
+			}
+		}
+
+		if (!pipelineStatisticsPools.empty())
+			vkCmdEndQuery(cmd, pipelineStatisticsPools[currentFrame], 0);
+
+		if (enableAabbVisualization) {
+			// Visualize the AABBs. We don't need to rebind descriptor sets as we use the same pipeline layout as the mesh pipeline
+			vk::ScopedGpuZone aabbZone(gpuProfiler, cmd, "AABB visualization");
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, aabbVisualizingPipeline);
+
+			vkCmdDrawIndirect(cmd, drawBuffer.aabbDrawHandle, 0,
+							  drawBuffer.drawCount,
+							  sizeof(VkDrawIndirectCommand));
+		}
+
+		vkCmdEndRendering(cmd);
+	}
+
+	if (renderPath == RenderPath::MeshShading) {
+		// Make the culling counters written by the task shader visible to the host
+		const VkMemoryBarrier2 statsBarrier {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+			.srcStageMask = VK_PIPELINE_STAGE_2_TASK_SHADER_BIT_EXT,
+			.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+			.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT,
+			.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT,
+		};
+		const VkDependencyInfo statsDependencyInfo {
+			.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+			.memoryBarrierCount = 1,
+			.pMemoryBarriers = &statsBarrier,
+		};
+		vkCmdPipelineBarrier2(cmd, &statsDependencyInfo);
+	}
+
+	// Draw UI
+	{
+		TracyVkZone(tracyCtx, cmd, "ImGui rendering");
+		vk::ScopedGpuZone uiZone(gpuProfiler, cmd, "ImGui rendering");
+
+		auto extent = glm::u32vec2(swapchain.extent.width, swapchain.extent.height);
+		imgui.draw(cmd, colorImageView, extent, currentFrame);
 	}
+
 }
 
 void Viewer::renderUi() {
@@ -2013,125 +4691,923 @@ void Viewer::renderUi() {
 
 		ImGui::Checkbox("Enable AABB visualization", &enableAabbVisualization);
 		ImGui::Checkbox("Freeze Camera frustum", &freezeCameraFrustum);
+		ImGui::SliderFloat("LOD error threshold", &lodErrorThreshold, 0.0f, 16.0f, "%.1f px");
+		ImGui::SliderFloat("MSFT_lod hysteresis", &lodHysteresis, 0.0f, 0.5f, "%.2f");
+		ImGui::Text("Triangles: %llu of %llu at full detail", static_cast<unsigned long long>(discreteLodStats.drawnTriangles),
+					static_cast<unsigned long long>(discreteLodStats.fullDetailTriangles));
+		ImGui::Text("Nodes culled by MSFT_lod: %u", discreteLodStats.culledNodes);
+		ImGui::Text("Draws: %u for %llu instances, built in %.2f ms", drawListStats.drawCount,
+					static_cast<unsigned long long>(drawListStats.instanceCount), drawListStats.buildMs);
+		ImGui::Text("Draw data: %.1f KiB indirect, %.1f KiB instances", static_cast<double>(drawListStats.indirectBytes) / 1024.0,
+					static_cast<double>(drawListStats.instanceBytes) / 1024.0);
+		ImGui::Text("Uploaded this frame: %.1f KiB", static_cast<double>(drawListStats.uploadBytes) / 1024.0);
+		ImGui::Text("Latency: %.2f ms, average %.2f ms with %zu frames in flight", latencyStats.lastMs, latencyStats.averageMs, frameOverlap);
+
+		VkDeviceSize geometryBytes = 0;
+		VkDeviceSize usedGeometryBytes = 0;
+		std::size_t shardCount = 0;
+		for (auto& shard : globalMeshBuffers.shards) {
+			if (!shard.isLive())
+				continue;
+			geometryBytes += shard.byteSize;
+			for (std::size_t i = 0; i < geometryRangeCount; ++i) {
+				usedGeometryBytes += static_cast<VkDeviceSize>(shard.allocators[i].getSize() - shard.allocators[i].getFreeSize()) * geometryElementSizes[i];
+			}
+			++shardCount;
+		}
+		ImGui::Text("Geometry: %.1f of %.1f MiB used in %zu shards", static_cast<double>(usedGeometryBytes) / (1024.0 * 1024.0),
+					static_cast<double>(geometryBytes) / (1024.0 * 1024.0), shardCount);
+		if (ImGui::Button("Compact geometry")) {
+			compactGeometry();
+		}
+
+		ImGui::BeginDisabled(meshes.empty());
+		ImGui::InputInt("Mesh", &selectedMeshIndex);
+		selectedMeshIndex = std::clamp(selectedMeshIndex, 0, util::max(static_cast<int>(meshes.size()) - 1, 0));
+		if (!meshes.empty()) {
+			const auto meshIndex = static_cast<std::size_t>(selectedMeshIndex);
+			ImGui::SameLine();
+			ImGui::BeginDisabled(meshes[meshIndex].loading);
+			if (ImGui::Button(meshes[meshIndex].loading ? "Loading" : meshes[meshIndex].resident ? "Unload" : "Load")) {
+				if (meshes[meshIndex].resident) {
+					unloadMesh(meshIndex);
+				} else {
+					loadMesh(meshIndex);
+				}
+			}
+			ImGui::EndDisabled();
+		}
+		ImGui::EndDisabled();
+	}
+	ImGui::End();
+
+	if (ImGui::Begin("Texture residency", nullptr, ImGuiWindowFlags_AlwaysAutoResize)) {
+		static constexpr auto toMiB = [](VkDeviceSize bytes) {
+			return static_cast<double>(bytes) / (1024.0 * 1024.0);
+		};
+		ImGui::Text("VRAM usage: %.1f / %.1f MiB", toMiB(residencyStats.usage), toMiB(residencyStats.budget));
+		ImGui::Text("Resident textures: %.1f MiB", toMiB(residencyStats.residentBytes));
+		ImGui::Text("Evictions: %zu, restores: %zu, pending: %zu",
+					residencyStats.evictions, residencyStats.restores, imageLoadJobs.size() + queuedImageLoads.size());
+		ImGui::Text("Texture slots: %u / %u", textureSlots.getUsedCount(), textureSlots.getCapacity());
+
+		ImGui::DragFloat("Texture budget", &textureBudgetMiB, 1.0f, 0.0f, 16384.0f, textureBudgetMiB > 0.0f ? "%.0f MiB" : "VMA budget");
+	}
+	ImGui::End();
+
+	if (ImGui::Begin("GPU timings", nullptr, ImGuiWindowFlags_AlwaysAutoResize)) {
+		ImGui::Text("Render path: %s", renderPath == RenderPath::MeshShading ? "mesh shading" : "vertex shading");
+		ImGui::Text("Meshlet limits: %u vertices, %u triangles", meshletLimits.maxVertices, meshletLimits.maxTriangles);
+		if (renderPath == RenderPath::MeshShading) {
+			ImGui::Text("Mesh workgroup size: %u", meshletLimits.meshWorkgroupSize);
+		}
+		if (ImGui::BeginTable("gpu_timings", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+			ImGui::TableSetupColumn("Pass");
+			ImGui::TableSetupColumn("Last");
+			ImGui::TableSetupColumn("Average");
+			ImGui::TableHeadersRow();
+			for (auto& scope : gpuProfiler.getStats()) {
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn();
+				ImGui::TextUnformatted(scope.name.c_str());
+				ImGui::TableNextColumn();
+				ImGui::Text("%.3f ms", scope.lastMs);
+				ImGui::TableNextColumn();
+				ImGui::Text("%.3f ms", scope.averageMs);
+			}
+			ImGui::EndTable();
+		}
+
+		ImGui::SeparatorText("Culling");
+		const auto percentage = [](std::uint64_t value, std::uint64_t total) {
+			return total == 0 ? 0.0 : static_cast<double>(value) * 100.0 / static_cast<double>(total);
+		};
+		ImGui::Text("Tested: %u, emitted: %u (%.1f%%)", cullingStats.meshletsTested, cullingStats.meshletsEmitted,
+					percentage(cullingStats.meshletsEmitted, cullingStats.meshletsTested));
+		static constexpr std::array<const char*, 6> planeNames = {{ "left", "right", "bottom", "top", "near", "far" }};
+		for (std::size_t i = 0; i < planeNames.size(); ++i) {
+			ImGui::Text("Rejected by %s plane: %u", planeNames[i], cullingStats.frustumRejections[i]);
+		}
+		ImGui::Text("Rejected by LOD selection: %u", cullingStats.lodRejections);
+		ImGui::Text("Instances rejected: %u", cullingStats.instanceRejections);
+
+		if (pipelineStatisticsFlags != 0) {
+			ImGui::SeparatorText("Pipeline statistics");
+			if (pipelineStatisticsFlags & VK_QUERY_PIPELINE_STATISTIC_TASK_SHADER_INVOCATIONS_BIT_EXT) {
+				ImGui::Text("Task shader invocations: %llu", static_cast<unsigned long long>(pipelineStatistics.taskShaderInvocations));
+				ImGui::Text("Mesh shader invocations: %llu", static_cast<unsigned long long>(pipelineStatistics.meshShaderInvocations));
+			}
+			ImGui::Text("Clipping primitives: %llu / %llu",
+						static_cast<unsigned long long>(pipelineStatistics.clippingPrimitives),
+						static_cast<unsigned long long>(pipelineStatistics.clippingInvocations));
+			ImGui::Text("Fragment shader invocations: %llu", static_cast<unsigned long long>(pipelineStatistics.fragmentShaderInvocations));
+		}
+
+		ImGui::SeparatorText("Export");
+		ImGui::BeginDisabled(gpuProfiler.isWritingCsv());
+		ImGui::InputText("CSV file", &gpuProfilerCsvPath);
+		ImGui::EndDisabled();
+		bool writeCsv = gpuProfiler.isWritingCsv();
+		if (ImGui::Checkbox("Write CSV", &writeCsv)) {
+			if (!writeCsv) {
+				gpuProfiler.stopCsv();
+			} else if (!gpuProfiler.startCsv(gpuProfilerCsvPath)) {
+				fmt::print(stderr, "Failed to open {}\n", gpuProfilerCsvPath);
+			}
+		}
 	}
 	ImGui::End();
 
 	ImGui::Render();
 }
 
+/**
+ * Camera paths are stored as text, with one frame per line. A line is either "free px py pz dx dy dz" for
+ * the free camera's position and direction, or "gltf i" for the i-th glTF camera in the scene.
+ */
+std::vector<CameraPathFrame> loadCameraPath(const std::filesystem::path& path) {
+	ZoneScoped;
+	std::ifstream file(path);
+	if (!file.is_open()) {
+		throw std::runtime_error(fmt::format("Failed to open camera path {}", path.string()));
+	}
+
+	std::vector<CameraPathFrame> frames;
+	std::string type;
+	while (file >> type) {
+		auto& frame = frames.emplace_back();
+		if (type == "free") {
+			file >> frame.position.x >> frame.position.y >> frame.position.z
+				 >> frame.direction.x >> frame.direction.y >> frame.direction.z;
+		} else if (type == "gltf") {
+			std::size_t cameraIndex = 0;
+			file >> cameraIndex;
+			frame.cameraIndex = cameraIndex;
+		} else {
+			file.setstate(std::ios::failbit);
+		}
+		if (file.fail()) {
+			throw std::runtime_error(fmt::format("Invalid camera path {} at frame {}", path.string(), frames.size() - 1));
+		}
+	}
+	return frames;
+}
+
+void saveCameraPath(const std::filesystem::path& path, std::span<const CameraPathFrame> frames) {
+	ZoneScoped;
+	std::ofstream file(path, std::ios::out | std::ios::trunc);
+	if (!file.is_open()) {
+		throw std::runtime_error(fmt::format("Failed to open camera path {}", path.string()));
+	}
+	for (auto& frame : frames) {
+		if (frame.cameraIndex.has_value()) {
+			file << fmt::format("gltf {}\n", *frame.cameraIndex);
+		} else {
+			file << fmt::format("free {} {} {} {} {} {}\n", frame.position.x, frame.position.y, frame.position.z,
+								frame.direction.x, frame.direction.y, frame.direction.z);
+		}
+	}
+}
+
+/** Options for --headless, which renders a fixed number of frames into offscreen images without a window */
+struct HeadlessOptions {
+	VkExtent2D extent = {};
+	std::uint32_t frameCount = 1000;
+	std::filesystem::path timingsFile; // The timings are printed to stdout if this is empty
+	std::filesystem::path imageFile; // The last frame is written as a PNG if this is not empty
+	std::vector<CameraPathFrame> cameraPath; // Replayed one frame at a time, which then also sets the frame count
+};
+
+struct FrameTiming {
+	double cpuMs = 0.0; // The time from starting the frame until its submission, excluding the wait for the frame slot
+	double gpuMs = 0.0;
+	std::uint64_t meshletCount = 0;
+	double drawListMs = 0.0; // The time updateDrawBuffer took to build and upload the draws
+	std::uint64_t uploadBytes = 0; // The draw data and transforms written to the frame's buffers
+	double latencyMs = 0.0; // The time from applying the frame's camera until its fence was observed as signaled
+};
+
+/** Returns the nearest-rank percentile of the sorted values */
+double getPercentile(std::span<const double> sortedValues, double percentile) {
+	assert(!sortedValues.empty());
+	const auto rank = static_cast<std::size_t>(std::ceil(percentile / 100.0 * static_cast<double>(sortedValues.size())));
+	return sortedValues[std::clamp<std::size_t>(rank, 1, sortedValues.size()) - 1];
+}
+
+std::string formatTimingSummary(std::vector<double> values) {
+	if (values.empty())
+		return "{}";
+	std::sort(values.begin(), values.end());
+	const auto sum = std::accumulate(values.begin(), values.end(), 0.0);
+	return fmt::format(R"({{ "mean": {:.4f}, "min": {:.4f}, "max": {:.4f}, "p50": {:.4f}, "p95": {:.4f}, "p99": {:.4f} }})",
+					   sum / static_cast<double>(values.size()), values.front(), values.back(),
+					   getPercentile(values, 50.0), getPercentile(values, 95.0), getPercentile(values, 99.0));
+}
+
+/** Renders the requested frames into the offscreen images and returns their CPU and GPU timings */
+std::vector<FrameTiming> renderHeadlessFrames(Viewer& viewer, const HeadlessOptions& options) {
+	ZoneScoped;
+	const auto extent = viewer.swapchain.extent;
+
+	// Let every image finish its initial load, so that each run renders and measures the same work
+	{
+		ZoneScopedN("Wait for initial image loads");
+		viewer.updateImageLoads();
+		while (viewer.imageLoadStats.remaining > 0) {
+			viewer.waitForImageLoad();
+			viewer.updateImageLoads();
+		}
+	}
+
+	// Each frame in flight writes two timestamps, one at the start and one at the end of its command buffer
+	const VkQueryPoolCreateInfo queryPoolInfo {
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.queryType = VK_QUERY_TYPE_TIMESTAMP,
+		.queryCount = static_cast<std::uint32_t>(2 * viewer.frameOverlap),
+	};
+	VkQueryPool queryPool = VK_NULL_HANDLE;
+	auto result = vkCreateQueryPool(viewer.device, &queryPoolInfo, VK_NULL_HANDLE, &queryPool);
+	vk::checkResult(result, "Failed to create timestamp query pool: {}");
+	vkResetQueryPool(viewer.device, queryPool, 0, queryPoolInfo.queryCount);
+
+	std::vector<FrameTiming> timings(options.frameCount);
+	std::vector<std::optional<std::uint32_t>> queriedFrames(viewer.frameOverlap); // The frame which last wrote the timestamps of each slot
+	const auto timestampPeriod = static_cast<double>(viewer.device.physical_device.properties.limits.timestampPeriod);
+	auto readTimestamps = [&](std::size_t slot) {
+		if (!queriedFrames[slot].has_value())
+			return;
+		std::array<std::uint64_t, 2> timestamps = {};
+		auto result = vkGetQueryPoolResults(viewer.device, queryPool, static_cast<std::uint32_t>(slot * 2), 2,
+											sizeof(timestamps), timestamps.data(), sizeof(std::uint64_t),
+											VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+		vk::checkResult(result, "Failed to read timestamp queries: {}");
+		timings[*queriedFrames[slot]].gpuMs = static_cast<double>(timestamps[1] - timestamps[0]) * timestampPeriod / 1e6;
+		queriedFrames[slot].reset();
+	};
+
+	// The frames of earlier runs, like those of a meshlet limit sweep, have lower frame numbers
+	const auto firstFrameNumber = viewer.frameNumber + 1;
+	auto readLatency = [&](std::size_t slot, std::chrono::steady_clock::time_point completionTime) {
+		viewer.completeFrameLatency(slot, completionTime);
+		const auto& latency = viewer.frameLatencies[slot];
+		if (latency.latencyMs.has_value() && latency.frameNumber >= firstFrameNumber)
+			timings[latency.frameNumber - firstFrameNumber].latencyMs = *latency.latencyMs;
+	};
+
+	// The last frame is copied into this buffer, if it should be written to disk
+	VkBuffer readbackBuffer = VK_NULL_HANDLE;
+	VmaAllocation readbackAllocation = VK_NULL_HANDLE;
+	const VkDeviceSize readbackSize = static_cast<VkDeviceSize>(extent.width) * extent.height * 4;
+	if (!options.imageFile.empty()) {
+		const VmaAllocationCreateInfo allocationInfo {
+			.usage = VMA_MEMORY_USAGE_GPU_TO_CPU,
+		};
+		const VkBufferCreateInfo bufferInfo {
+			.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+			.size = readbackSize,
+			.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		};
+		result = vmaCreateBuffer(viewer.allocator, &bufferInfo, &allocationInfo, &readbackBuffer, &readbackAllocation, VK_NULL_HANDLE);
+		vk::checkResult(result, "Failed to create readback buffer: {}");
+		vk::setDebugUtilsName(viewer.device, readbackBuffer, "Offscreen readback buffer");
+	}
+
+	std::size_t currentFrame = 0;
+	for (std::uint32_t i = 0; i < options.frameCount; ++i) {
+		FrameMarkStart("frame");
+		const auto cpuStart = std::chrono::steady_clock::now();
+		viewer.inputTime = cpuStart;
+
+		// Use a fixed time step, so that every run renders the same frames
+		viewer.deltaTime = 1.0f / 60.0f;
+		if (!options.cameraPath.empty()) {
+			viewer.applyCameraPathFrame(options.cameraPath[i % options.cameraPath.size()]);
+		}
+		auto& io = ImGui::GetIO();
+		io.DisplaySize = ImVec2(static_cast<float>(extent.width), static_cast<float>(extent.height));
+		io.DeltaTime = viewer.deltaTime;
+		viewer.imgui.newFrame();
+		ImGui::NewFrame();
+		viewer.renderUi();
+		viewer.prepareFrameCpu();
+
+		// The wait for the frame slot is excluded from the CPU time, so that it only measures the work of this frame.
+		// prepareFrame waits on the same fence again, which then returns immediately.
+		currentFrame = ++currentFrame % viewer.frameOverlap;
+		auto& frameSyncData = viewer.frameSyncData[currentFrame];
+		const auto waitStart = std::chrono::steady_clock::now();
+		vkWaitForFences(viewer.device, 1, &frameSyncData.presentFinished, VK_TRUE, UINT64_MAX);
+		const auto waitEnd = std::chrono::steady_clock::now();
+		readTimestamps(currentFrame);
+		readLatency(currentFrame, waitEnd);
+
+		viewer.prepareFrame(currentFrame);
+		timings[i].meshletCount = viewer.drawBuffers[currentFrame].meshletCount;
+		timings[i].drawListMs = viewer.drawListStats.buildMs;
+		timings[i].uploadBytes = viewer.drawListStats.uploadBytes;
+		auto& cmd = viewer.frameCommandPools[currentFrame].commandBuffers.front();
+
+		const VkCommandBufferBeginInfo beginInfo = {
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+			.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+		};
+		vkBeginCommandBuffer(cmd, &beginInfo);
+
+		// The previous results of this slot have already been read above
+		const auto firstQuery = static_cast<std::uint32_t>(currentFrame * 2);
+		vkResetQueryPool(viewer.device, queryPool, firstQuery, 2);
+		vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, queryPool, firstQuery);
+
+		auto colorImage = viewer.swapchainImages[currentFrame];
+		viewer.recordFrame(cmd, currentFrame, colorImage, viewer.swapchainImageViews[currentFrame]);
+
+		if (i + 1 == options.frameCount && readbackBuffer != VK_NULL_HANDLE) {
+			const VkImageMemoryBarrier2 imageBarrier {
+				.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+				.srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+				.srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+				.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+				.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT,
+				.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+				.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.image = colorImage,
+				.subresourceRange = {
+					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+					.levelCount = 1,
+					.layerCount = 1,
+				},
+			};
+			const VkDependencyInfo dependencyInfo {
+				.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+				.imageMemoryBarrierCount = 1,
+				.pImageMemoryBarriers = &imageBarrier,
+			};
+			vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+
+			const VkBufferImageCopy region {
+				.bufferOffset = 0,
+				.imageSubresource = {
+					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+					.mipLevel = 0,
+					.baseArrayLayer = 0,
+					.layerCount = 1,
+				},
+				.imageExtent = { extent.width, extent.height, 1 },
+			};
+			vkCmdCopyImageToBuffer(cmd, colorImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer, 1, &region);
+		}
+
+		vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, queryPool, firstQuery + 1);
+
+		// Always collect at the end of the main command buffer.
+		TracyVkCollect(viewer.tracyCtx, cmd);
+
+		vkEndCommandBuffer(cmd);
+
+		// Without a swapchain, there are no semaphores to wait on or to signal
+		const VkSubmitInfo submitInfo {
+			.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+			.commandBufferCount = 1,
+			.pCommandBuffers = &cmd,
+		};
+		{
+			auto queueLock = viewer.lockGraphicsQueue();
+			result = vkQueueSubmit(viewer.graphicsQueue, 1, &submitInfo, frameSyncData.presentFinished);
+		}
+		if (result != VK_SUCCESS) {
+			throw vulkan_error("Failed to submit to queue", result);
+		}
+		queriedFrames[currentFrame] = i;
+
+		timings[i].cpuMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cpuStart - (waitEnd - waitStart)).count();
+		FrameMarkEnd("frame");
+	}
+
+	vkDeviceWaitIdle(viewer.device);
+	const auto idleTime = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < viewer.frameOverlap; ++i) {
+		readTimestamps(i);
+		readLatency(i, idleTime);
+	}
+	vkDestroyQueryPool(viewer.device, queryPool, VK_NULL_HANDLE);
+
+	if (readbackBuffer != VK_NULL_HANDLE) {
+		vmaInvalidateAllocation(viewer.allocator, readbackAllocation, 0, VK_WHOLE_SIZE);
+		{
+			vk::ScopedMap<std::uint8_t> map(viewer.allocator, readbackAllocation);
+			auto* pixels = map.get();
+
+			// The clear color has no alpha, which would make the background of the image transparent.
+			for (VkDeviceSize i = 3; i < readbackSize; i += 4) {
+				pixels[i] = 255;
+			}
+			const auto width = static_cast<int>(extent.width);
+			if (stbi_write_png(options.imageFile.string().c_str(), width, static_cast<int>(extent.height), 4, pixels, width * 4) == 0) {
+				fmt::print(stderr, "Failed to write the last frame to {}\n", options.imageFile.string());
+			}
+		}
+		vmaDestroyBuffer(viewer.allocator, readbackBuffer, readbackAllocation);
+	}
+	return timings;
+}
+
+/** Prints the report to stdout, or writes it to the timings file if one was given */
+void writeHeadlessReport(const HeadlessOptions& options, const std::string& json) {
+	if (options.timingsFile.empty()) {
+		fmt::print("{}", json);
+	} else {
+		std::ofstream file(options.timingsFile, std::ios::out | std::ios::trunc);
+		if (!file.is_open()) {
+			throw std::runtime_error(fmt::format("Failed to open {}", options.timingsFile.string()));
+		}
+		file << json;
+	}
+}
+
+std::string formatMeshletLimits(const MeshletLimits& limits) {
+	return fmt::format(R"({{ "maxVertices": {}, "maxTriangles": {}, "meshWorkgroupSize": {} }})",
+					   limits.maxVertices, limits.maxTriangles, limits.meshWorkgroupSize);
+}
+
+/** Renders the requested frames and reports their CPU and GPU timings as JSON */
+void renderHeadless(Viewer& viewer, const HeadlessOptions& options, std::chrono::duration<double, std::milli> startupTime) {
+	ZoneScoped;
+	const auto extent = viewer.swapchain.extent;
+	const auto timings = renderHeadlessFrames(viewer, options);
+
+	// Write the timings as JSON
+	std::vector<double> cpuTimes; cpuTimes.reserve(timings.size());
+	std::vector<double> gpuTimes; gpuTimes.reserve(timings.size());
+	std::vector<double> meshletCounts; meshletCounts.reserve(timings.size());
+	std::vector<double> drawListTimes; drawListTimes.reserve(timings.size());
+	std::vector<double> uploadSizes; uploadSizes.reserve(timings.size());
+	std::vector<double> latencies; latencies.reserve(timings.size());
+	std::string frames;
+	for (std::size_t i = 0; auto& timing : timings) {
+		cpuTimes.emplace_back(timing.cpuMs);
+		gpuTimes.emplace_back(timing.gpuMs);
+		meshletCounts.emplace_back(static_cast<double>(timing.meshletCount));
+		drawListTimes.emplace_back(timing.drawListMs);
+		uploadSizes.emplace_back(static_cast<double>(timing.uploadBytes));
+		latencies.emplace_back(timing.latencyMs);
+		frames += fmt::format(R"(		{{ "cpuMs": {:.4f}, "gpuMs": {:.4f}, "meshlets": {}, "drawListMs": {:.4f}, "uploadBytes": {}, "latencyMs": {:.4f} }}{})",
+							  timing.cpuMs, timing.gpuMs, timing.meshletCount, timing.drawListMs, timing.uploadBytes, timing.latencyMs,
+							  ++i < timings.size() ? ",\n" : "\n");
+	}
+	const auto& drawList = viewer.drawListStats;
+	const auto io = ioThreads.getStatistics();
+	const auto json = fmt::format(R"({{
+	"device": "{}",
+	"renderPath": "{}",
+	"meshletLimits": {},
+	"width": {},
+	"height": {},
+	"frameCount": {},
+	"framesInFlight": {},
+	"cameraPathFrames": {},
+	"startupMs": {:.2f},
+	"imageLoadMs": {:.2f},
+	"io": {{ "backend": "{}", "threads": {}, "queueDepth": {}, "requests": {}, "bytes": {}, "waitMs": {:.2f}, "busyMs": {:.2f}, "mibPerSecond": {:.1f} }},
+	"cpuMs": {},
+	"gpuMs": {},
+	"meshlets": {},
+	"drawListMs": {},
+	"uploadBytes": {},
+	"latencyMs": {},
+	"drawList": {{ "draws": {}, "instances": {}, "indirectBytes": {}, "instanceBytes": {} }},
+	"frames": [
+{}	]
+}}
+)", viewer.device.physical_device.properties.deviceName,
+		viewer.renderPath == RenderPath::MeshShading ? "mesh" : "vertex", formatMeshletLimits(viewer.meshletLimits),
+		extent.width, extent.height, options.frameCount, viewer.frameOverlap,
+		options.cameraPath.size(), startupTime.count(), viewer.imageLoadStats.loadTime.count(),
+		ioThreads.getBackendName(), ioThreads.getThreadCount(), ioThreads.getQueueDepth(), io.requests, io.bytes, io.waitTime.count(),
+		io.busyTime.count(), io.getBandwidth(),
+		formatTimingSummary(std::move(cpuTimes)), formatTimingSummary(std::move(gpuTimes)),
+		formatTimingSummary(std::move(meshletCounts)), formatTimingSummary(std::move(drawListTimes)),
+		formatTimingSummary(std::move(uploadSizes)), formatTimingSummary(std::move(latencies)),
+		drawList.drawCount, drawList.instanceCount, drawList.indirectBytes, drawList.instanceBytes, frames);
+	writeHeadlessReport(options, json);
+}
+
+/**
+ * Renders the requested frames once for every supported combination of meshlet limits and mesh workgroup
+ * sizes, and reports the configuration with the lowest median GPU frame time.
+ */
+void sweepMeshletLimits(Viewer& viewer, const HeadlessOptions& options) {
+	ZoneScoped;
+	std::vector<MeshletLimits> configurations;
+	for (auto [vertices, triangles] : meshletLimitVariants) {
+		// The workgroup size only matters for the mesh shader
+		for (auto workgroupSize : meshWorkgroupSizes) {
+			const MeshletLimits limits {
+				.maxVertices = vertices,
+				.maxTriangles = triangles,
+				.meshWorkgroupSize = viewer.renderPath == RenderPath::MeshShading ? workgroupSize : MeshletLimits{}.meshWorkgroupSize,
+			};
+			if (viewer.supportsMeshletLimits(limits))
+				configurations.emplace_back(limits);
+			if (viewer.renderPath != RenderPath::MeshShading)
+				break;
+		}
+	}
+	if (configurations.empty()) {
+		throw std::runtime_error("The device supports none of the compiled meshlet limits");
+	}
+
+	// The dumped image is only written for the first configuration, as every configuration renders the same frames
+	auto sweepOptions = options;
+	std::string results;
+	std::optional<std::pair<MeshletLimits, double>> fastest;
+	for (std::size_t i = 0; auto& limits : configurations) {
+		fmt::print(stderr, "Rendering with {}x{} meshlets and a mesh workgroup size of {}\n",
+				   limits.maxVertices, limits.maxTriangles, limits.meshWorkgroupSize);
+		viewer.rebuildMeshlets(limits);
+		const auto timings = renderHeadlessFrames(viewer, sweepOptions);
+		sweepOptions.imageFile.clear();
+
+		std::vector<double> cpuTimes; cpuTimes.reserve(timings.size());
+		std::vector<double> gpuTimes; gpuTimes.reserve(timings.size());
+		std::vector<double> meshletCounts; meshletCounts.reserve(timings.size());
+		for (auto& timing : timings) {
+			cpuTimes.emplace_back(timing.cpuMs);
+			gpuTimes.emplace_back(timing.gpuMs);
+			meshletCounts.emplace_back(static_cast<double>(timing.meshletCount));
+		}
+
+		std::sort(gpuTimes.begin(), gpuTimes.end());
+		const auto gpuMedian = getPercentile(gpuTimes, 50.0);
+		if (!fastest.has_value() || gpuMedian < fastest->second) {
+			fastest = std::make_pair(limits, gpuMedian);
+		}
+
+		results += fmt::format(R"(		{{ "meshletLimits": {}, "cpuMs": {}, "gpuMs": {}, "meshlets": {} }}{})",
+							   formatMeshletLimits(limits), formatTimingSummary(std::move(cpuTimes)),
+							   formatTimingSummary(std::move(gpuTimes)), formatTimingSummary(std::move(meshletCounts)),
+							   ++i < configurations.size() ? ",\n" : "\n");
+	}
+
+	const auto extent = viewer.swapchain.extent;
+	const auto json = fmt::format(R"({{
+	"device": "{}",
+	"renderPath": "{}",
+	"width": {},
+	"height": {},
+	"frameCount": {},
+	"cameraPathFrames": {},
+	"fastest": {},
+	"configurations": [
+{}	]
+}}
+)", viewer.device.physical_device.properties.deviceName,
+		viewer.renderPath == RenderPath::MeshShading ? "mesh" : "vertex", extent.width, extent.height, options.frameCount,
+		options.cameraPath.size(), formatMeshletLimits(fastest->first), results);
+	writeHeadlessReport(options, json);
+}
+
 #ifdef _MSC_VER
 int wmain(int argc, wchar_t* argv[]) {
-	if (argc < 2) {
-		fmt::print("No glTF file specified\n");
-		return -1;
-	}
-	std::filesystem::path gltfFile { argv[1] };
 #else
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
-		fmt::print("No glTF file specified\n");
-        return -1;
-    }
-	std::filesystem::path gltfFile { argv[1] };
 #endif
+	// Paths accept both narrow and wide strings, which lets us parse the arguments the same way on every platform.
+	std::vector<std::filesystem::path> arguments(argv + 1, argv + argc);
+	std::filesystem::path gltfFile;
+	std::optional<HeadlessOptions> headlessOptions;
+	std::filesystem::path cameraRecordFile;
+	std::filesystem::path cameraReplayFile;
+	std::optional<RenderPath> forcedRenderPath;
+	std::optional<std::pair<std::uint32_t, std::uint32_t>> forcedMeshletLimits;
+	std::optional<std::uint32_t> forcedMeshWorkgroupSize;
+	std::optional<VkDeviceSize> forcedMaxShardSize;
+	std::size_t frameOverlap = defaultFrameOverlap;
+	std::uint32_t ioThreadCount = IoThreads::defaultThreadCount;
+	std::uint32_t ioQueueDepth = IoThreads::defaultQueueDepth;
+	std::optional<IoBackend> forcedIoBackend;
+	bool sweepMeshletLimitsRequested = false;
+	for (std::size_t i = 0; i < arguments.size(); ++i) {
+		const auto argument = arguments[i].string();
+		const bool hasValue = i + 1 < arguments.size();
+		if (argument == "--headless" && hasValue) {
+			auto& options = headlessOptions.emplace();
+			const auto value = arguments[++i].string();
+			if (std::sscanf(value.c_str(), "%ux%u", &options.extent.width, &options.extent.height) != 2
+				|| options.extent.width == 0 || options.extent.height == 0) {
+				fmt::print("Invalid headless resolution {}, expected e.g. 1920x1080\n", value);
+				return -1;
+			}
+		} else if (argument == "--render-path" && hasValue) {
+			const auto value = arguments[++i].string();
+			if (value == "mesh") {
+				forcedRenderPath = RenderPath::MeshShading;
+			} else if (value == "vertex") {
+				forcedRenderPath = RenderPath::VertexShading;
+			} else if (value != "auto") {
+				fmt::print("Invalid render path {}, expected auto, mesh or vertex\n", value);
+				return -1;
+			}
+		} else if (argument == "--meshlet-limits" && hasValue) {
+			const auto value = arguments[++i].string();
+			auto& limits = forcedMeshletLimits.emplace();
+			if (std::sscanf(value.c_str(), "%ux%u", &limits.first, &limits.second) != 2) {
+				fmt::print("Invalid meshlet limits {}, expected e.g. 64x124\n", value);
+				return -1;
+			}
+		} else if (argument == "--mesh-workgroup-size" && hasValue) {
+			const auto value = arguments[++i].string();
+			auto& size = forcedMeshWorkgroupSize.emplace();
+			auto [ptr, error] = std::from_chars(value.data(), value.data() + value.size(), size);
+			if (error != std::errc() || size == 0) {
+				fmt::print("Invalid mesh workgroup size {}\n", value);
+				return -1;
+			}
+		} else if (argument == "--max-shard-size" && hasValue) {
+			const auto value = arguments[++i].string();
+			std::uint64_t mebibytes = 0;
+			auto [ptr, error] = std::from_chars(value.data(), value.data() + value.size(), mebibytes);
+			if (error != std::errc() || mebibytes == 0) {
+				fmt::print("Invalid shard size {}, expected a size in MiB\n", value);
+				return -1;
+			}
+			forcedMaxShardSize = mebibytes * 1024 * 1024;
+		} else if (argument == "--frames-in-flight" && hasValue) {
+			const auto value = arguments[++i].string();
+			auto [ptr, error] = std::from_chars(value.data(), value.data() + value.size(), frameOverlap);
+			if (error != std::errc() || frameOverlap == 0 || frameOverlap > maxFrameOverlap) {
+				fmt::print("Invalid number of frames in flight {}, expected 1 to {}\n", value, maxFrameOverlap);
+				return -1;
+			}
+		} else if ((argument == "--io-threads" || argument == "--io-queue-depth") && hasValue) {
+			const auto value = arguments[++i].string();
+			auto& count = argument == "--io-threads" ? ioThreadCount : ioQueueDepth;
+			auto [ptr, error] = std::from_chars(value.data(), value.data() + value.size(), count);
+			if (error != std::errc() || count == 0) {
+				fmt::print("Invalid value {} for {}\n", value, argument);
+				return -1;
+			}
+		} else if (argument == "--io-backend" && hasValue) {
+			const auto value = arguments[++i].string();
+			if (value == "io_uring") {
+				forcedIoBackend = IoBackend::IoUring;
+			} else if (value == "blocking") {
+				forcedIoBackend = IoBackend::Blocking;
+			} else if (value != "auto") {
+				fmt::print("Invalid I/O backend {}, expected auto, io_uring or blocking\n", value);
+				return -1;
+			}
+		} else if (argument == "--sweep-meshlet-limits") {
+			sweepMeshletLimitsRequested = true;
+		} else if (argument == "--record-camera" && hasValue) {
+			cameraRecordFile = arguments[++i];
+		} else if ((argument == "--frames" || argument == "--timings" || argument == "--dump" || argument == "--replay-camera") && hasValue) {
+			if (!headlessOptions.has_value()) {
+				fmt::print("{} requires --headless\n", argument);
+				return -1;
+			}
+			if (argument == "--frames") {
+				const auto value = arguments[++i].string();
+				auto [ptr, error] = std::from_chars(value.data(), value.data() + value.size(), headlessOptions->frameCount);
+				if (error != std::errc() || headlessOptions->frameCount == 0) {
+					fmt::print("Invalid frame count {}\n", value);
+					return -1;
+				}
+			} else if (argument == "--timings") {
+				headlessOptions->timingsFile = arguments[++i];
+			} else if (argument == "--replay-camera") {
+				cameraReplayFile = arguments[++i];
+			} else {
+				headlessOptions->imageFile = arguments[++i];
+			}
+		} else {
+			gltfFile = arguments[i];
+		}
+	}
 
+	if (gltfFile.empty()) {
+		fmt::print("No glTF file specified\n");
+		fmt::print("Usage: vk_gltf_viewer [--render-path auto|mesh|vertex] [--meshlet-limits VxT] [--mesh-workgroup-size N] [--max-shard-size MiB] [--frames-in-flight N] [--io-threads N] [--io-queue-depth N] [--io-backend auto|io_uring|blocking] [--record-camera path.txt] "
+				   "[--headless WxH [--frames N] [--replay-camera path.txt] [--timings file.json] [--dump frame.png] [--sweep-meshlet-limits]] file.gltf\n");
+		return -1;
+	}
+	if (sweepMeshletLimitsRequested && !headlessOptions.has_value()) {
+		fmt::print("--sweep-meshlet-limits requires --headless\n");
+		return -1;
+	}
+	if (headlessOptions.has_value() && !cameraRecordFile.empty()) {
+		fmt::print("--record-camera requires the interactive mode\n");
+		return -1;
+	}
 	if (!std::filesystem::is_regular_file(gltfFile)) {
 		return -1;
 	}
 
-	taskScheduler.Initialize();
+	// The I/O threads are created on top of one compute thread per core, as they spend most of their time blocked
+	enki::TaskSchedulerConfig schedulerConfig;
+	schedulerConfig.numTaskThreadsToCreate += ioThreadCount;
+	taskScheduler.Initialize(schedulerConfig);
+	ioThreads.start(ioThreadCount, ioQueueDepth, forcedIoBackend.value_or(IoBackend::IoUring));
+	if (forcedIoBackend == IoBackend::IoUring && ioThreads.getBackend() != IoBackend::IoUring) {
+		fmt::print("io_uring is {}, reading files with {}\n",
+				   IoThreads::isIoUringSupported() ? "unavailable" : "not supported by this build", ioThreads.getBackendName());
+	}
+	const auto startupStart = std::chrono::steady_clock::now();
 
     Viewer viewer {};
+	viewer.headless = headlessOptions.has_value();
+	viewer.forcedRenderPath = forcedRenderPath;
+	viewer.forcedMaxShardSize = forcedMaxShardSize;
+	viewer.frameOverlap = frameOverlap;
 
     glfwSetErrorCallback(glfwErrorCallback);
 
     try {
-		// Load the glTF asset
-		viewer.loadGltf(gltfFile);
+		// Every startup step declares the state it reads and writes, so that the steps which don't depend on each
+		// other run concurrently. GLFW has to be called from the main thread, which is why those steps are pinned to it.
+		TaskGraph startup;
+		const GLFWvidmode* videoMode = nullptr;
+		const auto pipelineCacheFile = std::filesystem::current_path() / "cache/pipelines.cache";
+
+		startup.add("load glTF", {}, {"asset"}, [&]() {
+			viewer.loadGltf(gltfFile);
+		});
 
-		// Initialize GLFW
-        if (glfwInit() != GLFW_TRUE) {
-            throw std::runtime_error("Failed to initialize glfw");
-        }
+		// Initialize GLFW. Headless rendering does not need a window or a display at all.
+		startup.add("init GLFW", {}, {"glfw"}, [&]() {
+			if (!viewer.headless && glfwInit() != GLFW_TRUE) {
+				throw std::runtime_error("Failed to initialize glfw");
+			}
+		}, TaskGraph::Thread::Main);
+
+		startup.add("create instance", {"glfw"}, {"instance"}, [&]() {
+			viewer.setupVulkanInstance();
+		});
 
-        // Setup the Vulkan instance
-        viewer.setupVulkanInstance();
+		startup.add("create window", {"glfw"}, {"window"}, [&]() {
+			if (viewer.headless)
+				return;
 
-        // Create the window
-        auto* mainMonitor = glfwGetPrimaryMonitor();
-        const auto* videoMode = glfwGetVideoMode(mainMonitor);
+			auto* mainMonitor = glfwGetPrimaryMonitor();
+			videoMode = glfwGetVideoMode(mainMonitor);
 
-        glfwDefaultWindowHints();
-        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+			glfwDefaultWindowHints();
+			glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
 
-        viewer.window = glfwCreateWindow(
-                static_cast<int>(static_cast<float>(videoMode->width) * 0.9f),
-                static_cast<int>(static_cast<float>(videoMode->height) * 0.9f),
-                "vk_viewer", nullptr, nullptr);
+			viewer.window = glfwCreateWindow(
+					static_cast<int>(static_cast<float>(videoMode->width) * 0.9f),
+					static_cast<int>(static_cast<float>(videoMode->height) * 0.9f),
+					"vk_viewer", nullptr, nullptr);
 
-        if (viewer.window == nullptr) {
-            throw std::runtime_error("Failed to create window");
-        }
+			if (viewer.window == nullptr) {
+				throw std::runtime_error("Failed to create window");
+			}
 
-        glfwSetWindowUserPointer(viewer.window, &viewer);
-        glfwSetWindowSizeCallback(viewer.window, glfwResizeCallback);
+			glfwSetWindowUserPointer(viewer.window, &viewer);
+			glfwSetWindowSizeCallback(viewer.window, glfwResizeCallback);
 
-		glfwSetKeyCallback(viewer.window, keyCallback);
-		glfwSetCursorPosCallback(viewer.window, cursorCallback);
-		// glfwSetInputMode(viewer.window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+			glfwSetKeyCallback(viewer.window, keyCallback);
+			glfwSetCursorPosCallback(viewer.window, cursorCallback);
+			// glfwSetInputMode(viewer.window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
-		IMGUI_CHECKVERSION();
-		ImGui::CreateContext();
-		ImGui::StyleColorsDark();
+			IMGUI_CHECKVERSION();
+			ImGui::CreateContext();
+			ImGui::StyleColorsDark();
+		}, TaskGraph::Thread::Main);
 
-        // Create the Vulkan surface
-        auto surfaceResult = glfwCreateWindowSurface(viewer.instance, viewer.window, nullptr, &viewer.surface);
-        if (surfaceResult != VK_SUCCESS) {
-            throw vulkan_error("Failed to create window surface", surfaceResult);
-        }
-        viewer.deletionQueue.push([&]() {
-            vkDestroySurfaceKHR(viewer.instance, viewer.surface, nullptr);
-        });
+		startup.add("create surface", {"instance", "window"}, {"surface"}, [&]() {
+			if (viewer.headless)
+				return;
+
+			auto surfaceResult = glfwCreateWindowSurface(viewer.instance, viewer.window, nullptr, &viewer.surface);
+			if (surfaceResult != VK_SUCCESS) {
+				throw vulkan_error("Failed to create window surface", surfaceResult);
+			}
+			viewer.deletionQueue.push([&]() {
+				vkDestroySurfaceKHR(viewer.instance, viewer.surface, nullptr);
+			});
+		});
 
-        // Create the Vulkan device
-        viewer.setupVulkanDevice();
+		startup.add("create device", {"instance", "surface"}, {"device"}, [&]() {
+			viewer.setupVulkanDevice();
 
-		// Create the MEGA descriptor pool
-		viewer.createDescriptorPool();
+			// Override the default meshlet limits of the device
+			if (forcedMeshletLimits.has_value()) {
+				viewer.meshletLimits.maxVertices = forcedMeshletLimits->first;
+				viewer.meshletLimits.maxTriangles = forcedMeshletLimits->second;
+			}
+			if (forcedMeshWorkgroupSize.has_value()) {
+				viewer.meshletLimits.meshWorkgroupSize = *forcedMeshWorkgroupSize;
+			}
+			if (!viewer.supportsMeshletLimits(viewer.meshletLimits)) {
+				throw std::runtime_error(fmt::format("Unsupported meshlet limits {}x{} with a mesh workgroup size of {}",
+					viewer.meshletLimits.maxVertices, viewer.meshletLimits.maxTriangles, viewer.meshletLimits.meshWorkgroupSize));
+			}
+			fmt::print("Using {}x{} meshlets with a mesh workgroup size of {}\n",
+					   viewer.meshletLimits.maxVertices, viewer.meshletLimits.maxTriangles, viewer.meshletLimits.meshWorkgroupSize);
+		});
 
-		// Build the camera descriptors and buffers
-		viewer.buildCameraDescriptor();
+		// Load the pipeline cache shared by all pipelines
+		startup.add("load pipeline cache", {"device"}, {"pipeline cache"}, [&]() {
+			vk::PipelineCacheLoadTask cacheLoadTask(viewer.device, viewer.device.physical_device.properties,
+													&viewer.pipelineCache, pipelineCacheFile);
+			ioThreads.submit(&cacheLoadTask);
+			taskScheduler.WaitforTask(&cacheLoadTask);
+			vk::checkResult(cacheLoadTask.getResult(), "Failed to create pipeline cache: {}");
+			viewer.pipelineCacheWarm = cacheLoadTask.wasLoadedFromDisk();
+			viewer.deletionQueue.push([&]() {
+				vk::PipelineCacheSaveTask cacheSaveTask(viewer.device, &viewer.pipelineCache, pipelineCacheFile);
+				ioThreads.submit(&cacheSaveTask);
+				taskScheduler.WaitforTask(&cacheSaveTask);
+				if (!cacheSaveTask.didSucceed()) {
+					fmt::print(stderr, "Failed to save pipeline cache to {}\n", pipelineCacheFile.string());
+				}
+				vkDestroyPipelineCache(viewer.device, viewer.pipelineCache, nullptr);
+			});
+		});
 
-		// This also creates the descriptor layout required for the pipeline creation later.
-		viewer.loadGltfMeshes();
+		// Create the swapchain. The pipelines need to know its format.
+		startup.add("create swapchain", {"device", "window"}, {"swapchain"}, [&]() {
+			if (viewer.headless) {
+				viewer.createOffscreenTargets(headlessOptions->extent.width, headlessOptions->extent.height);
+			} else {
+				viewer.rebuildSwapchain(videoMode->width, videoMode->height);
+			}
+		});
 
-		viewer.loadGltfImages();
+		// Create the MEGA descriptor pool. Allocating sets from it writes to the pool, which orders those steps.
+		startup.add("create descriptor pool", {"device"}, {"descriptor pool"}, [&]() {
+			viewer.createDescriptorPool();
+		});
 
-        // Create the swapchain
-        viewer.rebuildSwapchain(videoMode->width, videoMode->height);
+		startup.add("create camera descriptors", {"device"}, {"camera descriptors", "descriptor pool"}, [&]() {
+			viewer.buildCameraDescriptor();
+		});
 
-		// Build the mesh pipeline
-        viewer.buildMeshPipeline();
+		startup.add("create statistics queries", {"device"}, {"statistics queries"}, [&]() {
+			viewer.createStatisticsQueries();
+		});
 
-		// Resize the drawBuffers vector
-		viewer.drawBuffers.resize(frameOverlap);
+		// Create the remaining descriptor layouts required for the pipeline creation
+		startup.add("create meshlet layout", {"device"}, {"meshlet layout"}, [&]() {
+			viewer.createMeshletSetLayout();
+		});
 
-		// Setup ImGui. This requires the swapchain to already exist to know the format
-		auto imguiResult = viewer.imgui.init(viewer.device, viewer.allocator, viewer.window, viewer.swapchain.image_format);
-		vk::checkResult(imguiResult, "Failed to create ImGui rendering context: {}");
-		auto& io = ImGui::GetIO();
-		io.ConfigFlags |= ImGuiConfigFlags_IsSRGB;
-		io.Fonts->AddFontDefault();
-		viewer.imgui.createFontAtlas();
-		viewer.deletionQueue.push([&]() {
-			viewer.imgui.destroy();
+		startup.add("create material descriptors", {"device"}, {"material descriptors"}, [&]() {
+			viewer.createMaterialDescriptors();
 		});
 
-		// Init ImGui frame data
-		viewer.imgui.initFrameData(frameOverlap);
+		// Start building the mesh pipelines in the background
+		startup.add("start pipeline builds", {"device", "pipeline cache", "swapchain", "camera descriptors", "meshlet layout", "material descriptors"},
+					{"pipelines"}, [&]() {
+			viewer.buildMeshPipeline();
+		});
+
+		// Setup ImGui. This requires the swapchain to already exist to know the format.
+		// Its pipeline is also built in the background.
+		startup.add("init ImGui", {"device", "pipeline cache", "window", "swapchain"}, {"imgui"}, [&]() {
+			auto imguiResult = viewer.imgui.init(viewer.device, viewer.allocator, viewer.window, viewer.swapchain.image_format,
+												 viewer.pipelineCache);
+			vk::checkResult(imguiResult, "Failed to create ImGui rendering context: {}");
+			auto& io = ImGui::GetIO();
+			io.ConfigFlags |= ImGuiConfigFlags_IsSRGB;
+			io.Fonts->AddFontDefault();
+			viewer.imgui.createFontAtlas();
+			viewer.deletionQueue.push([&]() {
+				viewer.imgui.destroy();
+			});
+
+			// Init ImGui frame data
+			viewer.imgui.initFrameData(viewer.frameOverlap);
+		}, TaskGraph::Thread::Main);
+
+		// Load the glTF data while the pipelines are compiling
+		startup.add("load meshes", {"asset", "device", "meshlet layout"}, {"meshes", "descriptor pool"}, [&]() {
+			viewer.loadGltfMeshes();
+		});
+
+		// The image loads are continued by every frame on the main thread
+		startup.add("load images", {"asset", "device", "material descriptors"}, {"images"}, [&]() {
+			viewer.loadGltfImages();
+		}, TaskGraph::Thread::Main);
+
+		// Creates the required fences and semaphores for frame sync
+		startup.add("create frame data", {"device"}, {"frame data"}, [&]() {
+			viewer.drawBuffers.resize(viewer.frameOverlap);
+			viewer.createFrameData();
+		});
+
+		// Every pipeline has to be ready before the first frame
+		startup.add("join pipeline builds", {}, {"pipelines", "imgui"}, [&]() {
+			viewer.joinPipelineBuilds();
+			auto imguiResult = viewer.imgui.joinPipelineBuild();
+			vk::checkResult(imguiResult, "Failed to create ImGui pipeline: {}");
+			fmt::print("Built ImGui pipeline in {:.2f} ms ({} pipeline cache)\n", viewer.imgui.getPipelineBuildTime().count(),
+					   viewer.pipelineCacheWarm ? "warm" : "cold");
+		});
 
-        // Creates the required fences and semaphores for frame sync
-        viewer.createFrameData();
+		startup.run();
 
 		// Set scene defaults and give every object a readable name, if required and empty.
 		viewer.sceneIndex = viewer.asset.defaultScene.value_or(0);
@@ -2147,14 +5623,35 @@ int main(int argc, char* argv[]) {
 			viewer.updateCameraNodes(node);
 		}
 
+		const auto startupTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupStart);
+		fmt::print("Startup took {:.2f} ms\n", startupTime.count());
+		startup.printCriticalPath();
+
+		if (viewer.headless) {
+			// A replayed camera path renders each of its frames exactly once
+			if (!cameraReplayFile.empty()) {
+				headlessOptions->cameraPath = loadCameraPath(cameraReplayFile);
+				if (headlessOptions->cameraPath.empty()) {
+					throw std::runtime_error(fmt::format("Camera path {} has no frames", cameraReplayFile.string()));
+				}
+				headlessOptions->frameCount = static_cast<std::uint32_t>(headlessOptions->cameraPath.size());
+			}
+			if (sweepMeshletLimitsRequested) {
+				sweepMeshletLimits(viewer, *headlessOptions);
+			} else {
+				renderHeadless(viewer, *headlessOptions, startupTime);
+			}
+		}
+
 		// The render loop
         std::size_t currentFrame = 0;
-        while (glfwWindowShouldClose(viewer.window) != GLFW_TRUE) {
+        while (!viewer.headless && glfwWindowShouldClose(viewer.window) != GLFW_TRUE) {
             if (!viewer.swapchainNeedsRebuild) {
 				// Reset the acceleration before updating it through input events
 				viewer.movement.accelerationVector = glm::vec3(0.0f);
 
                 glfwPollEvents();
+				viewer.inputTime = std::chrono::steady_clock::now();
             } else {
                 // This will wait until we get an event, like the resize event which will recreate the swapchain.
                 glfwWaitEvents();
@@ -2173,24 +5670,22 @@ int main(int argc, char* argv[]) {
 
 			viewer.renderUi();
 
-            currentFrame = ++currentFrame % frameOverlap;
-            auto& frameSyncData = viewer.frameSyncData[currentFrame];
-
-            // Wait for the last frame with the current index to have finished presenting, so that we can start
-            // using the semaphores and command buffers.
-            vkWaitForFences(viewer.device, 1, &frameSyncData.presentFinished, VK_TRUE, UINT64_MAX);
-            vkResetFences(viewer.device, 1, &frameSyncData.presentFinished);
+			// Everything up to here only touches CPU memory, and overlaps with the GPU working on the frames in flight
+			viewer.prepareFrameCpu();
 
-			// Update the camera matrices
-			viewer.updateCameraBuffer(currentFrame);
+            currentFrame = ++currentFrame % viewer.frameOverlap;
+            auto& frameSyncData = viewer.frameSyncData[currentFrame];
 
-			// Update the draw-list
-			viewer.updateDrawBuffer(currentFrame);
+			viewer.prepareFrame(currentFrame);
+            auto& cmd = viewer.frameCommandPools[currentFrame].commandBuffers.front();
 
-            // Reset the command pool
-            auto& commandPool = viewer.frameCommandPools[currentFrame];
-            vkResetCommandPool(viewer.device, commandPool.pool, 0);
-            auto& cmd = commandPool.commandBuffers.front();
+			if (!cameraRecordFile.empty()) {
+				viewer.recordedCameraPath.emplace_back(CameraPathFrame {
+					.position = viewer.movement.position,
+					.direction = viewer.movement.direction,
+					.cameraIndex = viewer.cameraIndex,
+				});
+			}
 
             // Acquire the next swapchain image
             std::uint32_t swapchainImageIndex = 0;
@@ -2212,133 +5707,7 @@ int main(int argc, char* argv[]) {
             };
             vkBeginCommandBuffer(cmd, &beginInfo);
 
-            {
-				TracyVkZone(viewer.tracyCtx, cmd, "Mesh shading");
-
-				// Transition the swapchain image from UNDEFINED -> COLOR_ATTACHMENT_OPTIMAL for rendering
-				// Transition the depth image from UNDEFINED -> DEPTH_ATTACHMENT_OPTIMAL
-				std::array<VkImageMemoryBarrier2, 2> imageBarriers = {{
-					{
-						.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
-						.srcStageMask = VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT,
-						.srcAccessMask = VK_ACCESS_2_NONE,
-						.dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
-						.dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
-						.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-						.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-						.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-						.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-						.image = viewer.swapchainImages[swapchainImageIndex],
-						.subresourceRange = {
-							.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-							.levelCount = 1,
-							.layerCount = 1,
-						},
-					},
-					{
-						.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
-						.srcStageMask = VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT,
-						.srcAccessMask = VK_ACCESS_2_NONE,
-						.dstStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT,
-						.dstAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
-						.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-						.newLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
-						.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-						.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-						.image = viewer.depthImage,
-						.subresourceRange = {
-							.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
-							.levelCount = 1,
-							.layerCount = 1,
-						},
-					}
-				}};
-				const VkDependencyInfo dependencyInfo {
-					.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-					.imageMemoryBarrierCount = static_cast<std::uint32_t>(imageBarriers.size()),
-					.pImageMemoryBarriers = imageBarriers.data(),
-				};
-				vkCmdPipelineBarrier2(cmd, &dependencyInfo);
-
-				const VkRenderingAttachmentInfo swapchainAttachment {
-					.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-					.imageView = viewer.swapchainImageViews[swapchainImageIndex],
-					.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-					.resolveMode = VK_RESOLVE_MODE_NONE,
-					.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-					.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-				};
-				const VkRenderingAttachmentInfo depthAttachment {
-					.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-					.imageView = viewer.depthImageView,
-					.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
-					.resolveMode = VK_RESOLVE_MODE_NONE,
-					.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-					.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-					.clearValue = {1.0f, 0.0f},
-				};
-				const VkRenderingInfo renderingInfo {
-					.sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
-					.renderArea = {
-						.offset = {},
-						.extent = viewer.swapchain.extent,
-					},
-					.layerCount = 1,
-					.colorAttachmentCount = 1,
-					.pColorAttachments = &swapchainAttachment,
-					.pDepthAttachment = &depthAttachment,
-				};
-				vkCmdBeginRendering(cmd, &renderingInfo);
-
-				vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, viewer.meshPipeline);
-
-				std::array<VkDescriptorSet, 3> descriptorBinds {{
-					viewer.cameraBuffers[currentFrame].cameraSet, // Set 0
-					viewer.globalMeshBuffers.descriptors[currentFrame], // Set 1
- 					viewer.materialSet, // Set 2
-				}};
-				// Bind the camera descriptor set
-				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, viewer.meshPipelineLayout,
-										0, static_cast<std::uint32_t>(descriptorBinds.size()), descriptorBinds.data(),
-										0, nullptr);
-
-				const VkViewport viewport = {
-					.x = 0.0F,
-					.y = 0.0F,
-					.width = static_cast<float>(viewer.swapchain.extent.width),
-					.height = static_cast<float>(viewer.swapchain.extent.height),
-					.minDepth = 0.0F,
-					.maxDepth = 1.0F,
-				};
-				vkCmdSetViewport(cmd, 0, 1, &viewport);
-
-				const VkRect2D scissor = renderingInfo.renderArea;
-				vkCmdSetScissor(cmd, 0, 1, &scissor);
-
-				vkCmdDrawMeshTasksIndirectEXT(cmd,
-											  viewer.drawBuffers[currentFrame].primitiveDrawHandle, 0,
-											  viewer.drawBuffers[currentFrame].drawCount,
-											  sizeof(PrimitiveDraw));
-
-				if (viewer.enableAabbVisualization) {
-					// Visualize the AABBs. We don't need to rebind descriptor sets as we use the same pipeline layout as the mesh pipeline
-					vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, viewer.aabbVisualizingPipeline);
-
-					vkCmdDrawIndirect(cmd, viewer.drawBuffers[currentFrame].aabbDrawHandle, 0,
-									  viewer.drawBuffers[currentFrame].drawCount,
-									  sizeof(VkDrawIndirectCommand));
-				}
-
-				vkCmdEndRendering(cmd);
-            }
-
-			// Draw UI
-			{
-				TracyVkZone(viewer.tracyCtx, cmd, "ImGui rendering");
-
-				auto extent = glm::u32vec2(viewer.swapchain.extent.width, viewer.swapchain.extent.height);
-				viewer.imgui.draw(cmd, viewer.swapchainImageViews[swapchainImageIndex], extent, currentFrame);
-			}
+			viewer.recordFrame(cmd, currentFrame, viewer.swapchainImages[swapchainImageIndex], viewer.swapchainImageViews[swapchainImageIndex]);
 
             // Transition the swapchain image from COLOR_ATTACHMENT -> PRESENT_SRC_KHR
 			const VkImageMemoryBarrier2 swapchainImageBarrier {
@@ -2383,6 +5752,7 @@ int main(int argc, char* argv[]) {
 				.signalSemaphoreCount = 1,
 				.pSignalSemaphores = &frameSyncData.renderingFinished,
 			};
+            auto queueLock = viewer.lockGraphicsQueue();
             auto submitResult = vkQueueSubmit(viewer.graphicsQueue, 1, &submitInfo, frameSyncData.presentFinished);
             if (submitResult != VK_SUCCESS) {
                 throw vulkan_error("Failed to submit to queue", submitResult);
@@ -2398,6 +5768,7 @@ int main(int argc, char* argv[]) {
 				.pImageIndices = &swapchainImageIndex,
 			};
             auto presentResult = vkQueuePresentKHR(viewer.graphicsQueue, &presentInfo);
+			queueLock = {};
             if (presentResult == VK_ERROR_OUT_OF_DATE_KHR || presentResult == VK_SUBOPTIMAL_KHR) {
                 viewer.swapchainNeedsRebuild = true;
                 continue;
@@ -2408,6 +5779,11 @@ int main(int argc, char* argv[]) {
 
 			FrameMarkEnd("frame");
         }
+
+		if (!cameraRecordFile.empty()) {
+			saveCameraPath(cameraRecordFile, viewer.recordedCameraPath);
+			fmt::print("Recorded {} frames of camera movement to {}\n", viewer.recordedCameraPath.size(), cameraRecordFile.string());
+		}
     } catch (const vulkan_error& error) {
 		fmt::print("{}: {}\n", error.what(), error.what_result());
     } catch (const std::runtime_error& error) {
@@ -2419,6 +5795,18 @@ int main(int argc, char* argv[]) {
 
 		taskScheduler.WaitforAll();
 
+		// Destroy the objects replaced while frames were in flight, and textures whose load never got to be swapped in
+		viewer.deferredDestruction.flush();
+		for (auto& job : viewer.imageLoadJobs) {
+			if (job->upload.fence != VK_NULL_HANDLE) {
+				BufferUploader::getInstance().destroy(job->upload);
+			}
+			vkDestroyImageView(viewer.device, job->image.imageView, VK_NULL_HANDLE);
+			vmaDestroyImage(viewer.allocator, job->image.image, job->image.allocation);
+		}
+		viewer.imageLoadJobs.clear();
+		viewer.imageReadBatches.clear();
+
 		// Destroy the samplers
 		for (auto& sampler: viewer.samplers) {
 			vkDestroySampler(viewer.device, sampler, VK_NULL_HANDLE);
@@ -2434,6 +5822,9 @@ int main(int argc, char* argv[]) {
 		for (auto& drawBuffer: viewer.drawBuffers) {
 			vmaDestroyBuffer(viewer.allocator, drawBuffer.aabbDrawHandle, drawBuffer.aabbDrawAllocation);
 			vmaDestroyBuffer(viewer.allocator, drawBuffer.primitiveDrawHandle, drawBuffer.primitiveDrawAllocation);
+			vmaDestroyBuffer(viewer.allocator, drawBuffer.meshletDrawHandle, drawBuffer.meshletDrawAllocation);
+			vmaDestroyBuffer(viewer.allocator, drawBuffer.drawInstanceHandle, drawBuffer.drawInstanceAllocation);
+			vmaDestroyBuffer(viewer.allocator, drawBuffer.transformHandle, drawBuffer.transformAllocation);
 		}
 
 		// Destroys everything. We leave this out of the try-catch block to make sure it gets executed.
@@ -2441,6 +5832,8 @@ int main(int argc, char* argv[]) {
 		// with this paradigm is quite hard.
 		for (auto& view : viewer.swapchainImageViews)
 			vkDestroyImageView(viewer.device, view, nullptr);
+		for (std::size_t i = 0; i < viewer.offscreenImageAllocations.size(); ++i)
+			vmaDestroyImage(viewer.allocator, viewer.swapchainImages[i], viewer.offscreenImageAllocations[i]);
 		vkb::destroy_swapchain(viewer.swapchain);
 		vkDestroyImageView(viewer.device, viewer.depthImageView, VK_NULL_HANDLE);
 		vmaDestroyImage(viewer.allocator, viewer.depthImage, viewer.depthImageAllocation);
@@ -2448,8 +5841,10 @@ int main(int argc, char* argv[]) {
 		viewer.flushObjects();
 	}
 
-    glfwDestroyWindow(viewer.window);
-    glfwTerminate();
+	if (!viewer.headless) {
+		glfwDestroyWindow(viewer.window);
+		glfwTerminate();
+	}
 
     taskScheduler.WaitforAllAndShutdown();
 
@@ -0,0 +1,196 @@
+#include <bit>
+#include <cassert>
+
+#include <vk_gltf_viewer/offset_allocator.hpp>
+
+namespace {
+	struct BinIndex {
+		std::uint32_t firstLevel;
+		std::uint32_t secondLevel;
+	};
+
+	template <std::uint32_t secondLevelBits>
+	constexpr BinIndex getBinIndex(std::uint32_t size) noexcept {
+		constexpr auto secondLevelCount = 1U << secondLevelBits;
+		const auto firstLevel = static_cast<std::uint32_t>(std::bit_width(size)) - 1;
+		// Sizes below secondLevelCount are shifted up, so that each of their bins holds exactly one size
+		const auto secondLevel = firstLevel < secondLevelBits
+			? (size << (secondLevelBits - firstLevel)) ^ secondLevelCount
+			: (size >> (firstLevel - secondLevelBits)) ^ secondLevelCount;
+		return { firstLevel, secondLevel };
+	}
+} // namespace
+
+OffsetAllocator::OffsetAllocator(std::uint32_t size) {
+	reset(size);
+}
+
+void OffsetAllocator::reset(std::uint32_t newSize) {
+	size = newSize;
+	freeSize = 0;
+	allocationCount = 0;
+	firstLevelBitmap = 0;
+	secondLevelBitmaps.fill(0);
+	binHeads.fill(invalidIndex);
+	nodes.clear();
+	unusedNodes.clear();
+
+	if (size > 0) {
+		insertFreeNode(createNode(0, size));
+	}
+}
+
+std::uint32_t OffsetAllocator::createNode(std::uint32_t offset, std::uint32_t nodeSize) {
+	std::uint32_t index;
+	if (!unusedNodes.empty()) {
+		index = unusedNodes.back();
+		unusedNodes.pop_back();
+		nodes[index] = {};
+	} else {
+		index = static_cast<std::uint32_t>(nodes.size());
+		nodes.emplace_back();
+	}
+	nodes[index].offset = offset;
+	nodes[index].size = nodeSize;
+	return index;
+}
+
+void OffsetAllocator::insertFreeNode(std::uint32_t nodeIndex) {
+	auto& node = nodes[nodeIndex];
+	const auto [firstLevel, secondLevel] = getBinIndex<secondLevelBits>(node.size);
+	const auto bin = firstLevel * secondLevelCount + secondLevel;
+
+	node.used = false;
+	node.previousFree = invalidIndex;
+	node.nextFree = binHeads[bin];
+	if (node.nextFree != invalidIndex)
+		nodes[node.nextFree].previousFree = nodeIndex;
+	binHeads[bin] = nodeIndex;
+
+	firstLevelBitmap |= 1U << firstLevel;
+	secondLevelBitmaps[firstLevel] |= static_cast<std::uint8_t>(1U << secondLevel);
+	freeSize += node.size;
+}
+
+void OffsetAllocator::removeFreeNode(std::uint32_t nodeIndex) {
+	auto& node = nodes[nodeIndex];
+	const auto [firstLevel, secondLevel] = getBinIndex<secondLevelBits>(node.size);
+	const auto bin = firstLevel * secondLevelCount + secondLevel;
+
+	if (node.previousFree != invalidIndex) {
+		nodes[node.previousFree].nextFree = node.nextFree;
+	} else {
+		binHeads[bin] = node.nextFree;
+	}
+	if (node.nextFree != invalidIndex)
+		nodes[node.nextFree].previousFree = node.previousFree;
+
+	if (binHeads[bin] == invalidIndex) {
+		secondLevelBitmaps[firstLevel] &= static_cast<std::uint8_t>(~(1U << secondLevel));
+		if (secondLevelBitmaps[firstLevel] == 0)
+			firstLevelBitmap &= ~(1U << firstLevel);
+	}
+	freeSize -= node.size;
+}
+
+OffsetAllocator::Allocation OffsetAllocator::allocate(std::uint32_t allocationSize) {
+	if (allocationSize == 0 || allocationSize > freeSize)
+		return {};
+
+	// Round the size up to the next bin, so that every range in the bin we find is large enough
+	const auto exactBin = getBinIndex<secondLevelBits>(allocationSize);
+	auto bin = exactBin;
+	if (bin.firstLevel >= secondLevelBits) {
+		const auto roundedSize = static_cast<std::uint64_t>(allocationSize) + (1ULL << (bin.firstLevel - secondLevelBits)) - 1;
+		bin = roundedSize > std::numeric_limits<std::uint32_t>::max()
+			? BinIndex { firstLevelCount, 0 }
+			: getBinIndex<secondLevelBits>(static_cast<std::uint32_t>(roundedSize));
+	}
+
+	// Find the smallest non-empty bin at or above that bin
+	auto nodeIndex = invalidIndex;
+	if (bin.firstLevel < firstLevelCount) {
+		auto firstLevel = bin.firstLevel;
+		auto secondLevelMap = static_cast<std::uint32_t>(secondLevelBitmaps[firstLevel]) & (~0U << bin.secondLevel);
+		if (secondLevelMap == 0) {
+			const auto firstLevelMap = firstLevel + 1 < firstLevelCount ? firstLevelBitmap & (~0U << (firstLevel + 1)) : 0U;
+			firstLevel = static_cast<std::uint32_t>(std::countr_zero(firstLevelMap));
+			secondLevelMap = firstLevelMap != 0 ? secondLevelBitmaps[firstLevel] : 0U;
+		}
+		if (secondLevelMap != 0)
+			nodeIndex = binHeads[firstLevel * secondLevelCount + static_cast<std::uint32_t>(std::countr_zero(secondLevelMap))];
+	}
+
+	// Otherwise, a range in the allocation's own bin might still be large enough. This matters for nearly full
+	// allocators, whose last free range would never fit an allocation of exactly its size.
+	if (nodeIndex == invalidIndex) {
+		nodeIndex = binHeads[exactBin.firstLevel * secondLevelCount + exactBin.secondLevel];
+		while (nodeIndex != invalidIndex && nodes[nodeIndex].size < allocationSize)
+			nodeIndex = nodes[nodeIndex].nextFree;
+		if (nodeIndex == invalidIndex)
+			return {};
+	}
+
+	assert(nodes[nodeIndex].size >= allocationSize);
+	removeFreeNode(nodeIndex);
+
+	// Return the remainder of the range to the free bins
+	if (nodes[nodeIndex].size > allocationSize) {
+		const auto remainderIndex = createNode(nodes[nodeIndex].offset + allocationSize, nodes[nodeIndex].size - allocationSize);
+		auto& node = nodes[nodeIndex];
+		auto& remainder = nodes[remainderIndex];
+		remainder.previousNeighbour = nodeIndex;
+		remainder.nextNeighbour = node.nextNeighbour;
+		if (node.nextNeighbour != invalidIndex)
+			nodes[node.nextNeighbour].previousNeighbour = remainderIndex;
+		node.nextNeighbour = remainderIndex;
+		node.size = allocationSize;
+		insertFreeNode(remainderIndex);
+	}
+
+	nodes[nodeIndex].used = true;
+	++allocationCount;
+	return { .offset = nodes[nodeIndex].offset, .node = nodeIndex };
+}
+
+void OffsetAllocator::free(Allocation allocation) {
+	if (!allocation.isValid())
+		return;
+	assert(allocation.node < nodes.size() && nodes[allocation.node].used);
+	auto nodeIndex = allocation.node;
+	--allocationCount;
+
+	// Merge the range with its free neighbours
+	if (const auto previous = nodes[nodeIndex].previousNeighbour; previous != invalidIndex && !nodes[previous].used) {
+		removeFreeNode(previous);
+		nodes[previous].size += nodes[nodeIndex].size;
+		nodes[previous].nextNeighbour = nodes[nodeIndex].nextNeighbour;
+		if (nodes[nodeIndex].nextNeighbour != invalidIndex)
+			nodes[nodes[nodeIndex].nextNeighbour].previousNeighbour = previous;
+		unusedNodes.emplace_back(nodeIndex);
+		nodeIndex = previous;
+	}
+	if (const auto next = nodes[nodeIndex].nextNeighbour; next != invalidIndex && !nodes[next].used) {
+		removeFreeNode(next);
+		nodes[nodeIndex].size += nodes[next].size;
+		nodes[nodeIndex].nextNeighbour = nodes[next].nextNeighbour;
+		if (nodes[next].nextNeighbour != invalidIndex)
+			nodes[nodes[next].nextNeighbour].previousNeighbour = nodeIndex;
+		unusedNodes.emplace_back(next);
+	}
+
+	insertFreeNode(nodeIndex);
+}
+
+std::uint32_t OffsetAllocator::getLargestFreeRange() const noexcept {
+	if (firstLevelBitmap == 0)
+		return 0;
+
+	// The lower bound of the largest non-empty bin
+	const auto firstLevel = static_cast<std::uint32_t>(std::bit_width(firstLevelBitmap)) - 1;
+	const auto secondLevel = static_cast<std::uint32_t>(std::bit_width(static_cast<std::uint32_t>(secondLevelBitmaps[firstLevel]))) - 1;
+	const auto binSize = static_cast<std::uint64_t>(secondLevelCount + secondLevel);
+	return firstLevel < secondLevelBits
+		? static_cast<std::uint32_t>(binSize >> (secondLevelBits - firstLevel))
+		: static_cast<std::uint32_t>(binSize << (firstLevel - secondLevelBits));
+}
@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <ranges>
+#include <stdexcept>
+
+#include <tracy/Tracy.hpp>
+
+#include <fmt/format.h>
+
+#include <vk_gltf_viewer/scheduler.hpp>
+#include <vk_gltf_viewer/task_graph.hpp>
+
+void TaskGraph::NodeTask::ExecuteRange(enki::TaskSetPartition range, std::uint32_t threadnum) {
+	node.execute();
+}
+
+void TaskGraph::PinnedNodeTask::Execute() {
+	node.execute();
+}
+
+void TaskGraph::Node::execute() {
+	ZoneScoped;
+	ZoneName(name.data(), name.size());
+	start = Clock::now();
+	if (!graph.failed) {
+		// Exceptions can't propagate out of enkiTS tasks, so we keep them until the graph has completed
+		try {
+			function();
+		} catch (...) {
+			exception = std::current_exception();
+			graph.failed = true;
+		}
+	}
+	end = Clock::now();
+}
+
+enki::ICompletable* TaskGraph::Node::getTask() const noexcept {
+	if (pinnedTask)
+		return pinnedTask.get();
+	return task.get();
+}
+
+void TaskGraph::add(std::string name, std::initializer_list<std::string_view> inputs, std::initializer_list<std::string_view> outputs,
+					std::function<void()> function, Thread thread) {
+	const auto index = nodes.size();
+	auto& node = *nodes.emplace_back(std::make_unique<Node>(Node {
+		.graph = *this,
+		.name = std::move(name),
+		.function = std::move(function),
+		.thread = thread,
+	}));
+
+	for (auto input : inputs) {
+		auto it = resources.find(std::string(input));
+		if (it == resources.end()) {
+			throw std::runtime_error(fmt::format("Step {} reads {}, which no previous step writes", node.name, input));
+		}
+		node.dependencies.emplace_back(it->second.writer);
+		it->second.readers.emplace_back(index);
+	}
+	for (auto output : outputs) {
+		auto [it, inserted] = resources.try_emplace(std::string(output), Resource { .writer = index });
+		if (inserted)
+			continue;
+		auto& resource = it->second;
+		node.dependencies.emplace_back(resource.writer);
+		node.dependencies.insert(node.dependencies.end(), resource.readers.begin(), resource.readers.end());
+		resource = { .writer = index };
+	}
+	std::erase(node.dependencies, index);
+	std::ranges::sort(node.dependencies);
+	node.dependencies.erase(std::ranges::unique(node.dependencies).begin(), node.dependencies.end());
+
+	if (thread == Thread::Main) {
+		node.pinnedTask = std::make_unique<PinnedNodeTask>(node);
+	} else {
+		node.task = std::make_unique<NodeTask>(node);
+	}
+
+	// None of the tasks have been started yet, so enkiTS can't miss the completion of any dependency
+	node.taskDependencies = std::vector<enki::Dependency>(node.dependencies.size());
+	for (std::size_t i = 0; i < node.dependencies.size(); ++i) {
+		node.getTask()->SetDependency(node.taskDependencies[i], nodes[node.dependencies[i]]->getTask());
+	}
+}
+
+void TaskGraph::run() {
+	ZoneScoped;
+	startTime = Clock::now();
+	failed = false;
+
+	// Only the steps without any dependencies are started here. enkiTS starts every other
+	// step once its dependencies have completed.
+	const auto mainThread = taskScheduler.GetThreadNum();
+	for (auto& node : nodes) {
+		if (node->pinnedTask)
+			node->pinnedTask->threadNum = mainThread;
+	}
+	for (auto& node : nodes) {
+		if (!node->dependencies.empty())
+			continue;
+		if (node->pinnedTask) {
+			taskScheduler.AddPinnedTask(node->pinnedTask.get());
+		} else {
+			taskScheduler.AddTaskSetToPipe(node->task.get());
+		}
+	}
+
+	// Waiting on this thread also runs the steps pinned to it
+	for (auto& node : nodes) {
+		taskScheduler.WaitforTask(node->getTask());
+	}
+
+	for (auto& node : nodes) {
+		if (node->exception)
+			std::rethrow_exception(node->exception);
+	}
+}
+
+void TaskGraph::printCriticalPath() const {
+	if (nodes.empty())
+		return;
+
+	// Walk back from the step which finished last, always following the dependency which finished last
+	std::vector<const Node*> path;
+	const auto& last = *std::ranges::max_element(nodes, {}, [](const auto& node) { return node->end; });
+	for (const Node* node = last.get(); node != nullptr;) {
+		path.emplace_back(node);
+		const Node* latest = nullptr;
+		for (auto dependency : node->dependencies) {
+			const auto* candidate = nodes[dependency].get();
+			if (latest == nullptr || candidate->end > latest->end)
+				latest = candidate;
+		}
+		node = latest;
+	}
+
+	using Milliseconds = std::chrono::duration<double, std::milli>;
+	fmt::print("Critical path ({:.2f} ms):\n", Milliseconds(last->end - startTime).count());
+	auto ready = startTime;
+	for (const auto* node : path | std::views::reverse) {
+		// The time between a step's dependencies completing and the step starting is spent waiting for a thread
+		fmt::print("  {:<28} {:8.2f} ms (+{:.2f} ms queued)\n", node->name,
+				   Milliseconds(node->end - node->start).count(), Milliseconds(node->start - ready).count());
+		ready = node->end;
+	}
+}
@@ -0,0 +1,85 @@
+#include <tracy/Tracy.hpp>
+
+#include <vulkan/deferred_destruction.hpp>
+
+void vk::DeferredDestructionQueue::init(VkDevice newDevice, VmaAllocator newAllocator) {
+	device = newDevice;
+	allocator = newAllocator;
+}
+
+vk::DeferredDestructionQueue::Batch& vk::DeferredDestructionQueue::getBatch(std::uint64_t lastUsedFrame) {
+	if (!batches.empty() && batches.back().frameNumber >= lastUsedFrame)
+		return batches.back();
+
+	// Reuse the arrays of a released batch
+	auto& batch = batches.emplace_back();
+	if (!freeBatches.empty()) {
+		batch = std::move(freeBatches.back());
+		freeBatches.pop_back();
+	}
+	batch.frameNumber = lastUsedFrame;
+	return batch;
+}
+
+void vk::DeferredDestructionQueue::destroyBuffer(std::uint64_t lastUsedFrame, VkBuffer buffer, VmaAllocation allocation) {
+	if (buffer == VK_NULL_HANDLE)
+		return;
+	getBatch(lastUsedFrame).buffers.emplace_back(buffer, allocation);
+	++pendingCount;
+}
+
+void vk::DeferredDestructionQueue::destroyImage(std::uint64_t lastUsedFrame, VkImage image, VmaAllocation allocation) {
+	if (image == VK_NULL_HANDLE)
+		return;
+	getBatch(lastUsedFrame).images.emplace_back(image, allocation);
+	++pendingCount;
+}
+
+void vk::DeferredDestructionQueue::destroyImageView(std::uint64_t lastUsedFrame, VkImageView imageView) {
+	if (imageView == VK_NULL_HANDLE)
+		return;
+	getBatch(lastUsedFrame).imageViews.emplace_back(imageView);
+	++pendingCount;
+}
+
+void vk::DeferredDestructionQueue::destroySwapchain(std::uint64_t lastUsedFrame, VkSwapchainKHR swapchain) {
+	if (swapchain == VK_NULL_HANDLE)
+		return;
+	getBatch(lastUsedFrame).swapchains.emplace_back(swapchain);
+	++pendingCount;
+}
+
+void vk::DeferredDestructionQueue::destroyBatch(Batch& batch) {
+	// Views are destroyed before the images they reference
+	for (auto& imageView : batch.imageViews) {
+		vkDestroyImageView(device, imageView, VK_NULL_HANDLE);
+	}
+	for (auto& [image, allocation] : batch.images) {
+		vmaDestroyImage(allocator, image, allocation);
+	}
+	for (auto& [buffer, allocation] : batch.buffers) {
+		vmaDestroyBuffer(allocator, buffer, allocation);
+	}
+	for (auto& swapchain : batch.swapchains) {
+		vkDestroySwapchainKHR(device, swapchain, VK_NULL_HANDLE);
+	}
+
+	pendingCount -= batch.imageViews.size() + batch.images.size() + batch.buffers.size() + batch.swapchains.size();
+	batch.imageViews.clear();
+	batch.images.clear();
+	batch.buffers.clear();
+	batch.swapchains.clear();
+}
+
+void vk::DeferredDestructionQueue::release(std::uint64_t completedFrame) {
+	ZoneScoped;
+	while (!batches.empty() && batches.front().frameNumber <= completedFrame) {
+		destroyBatch(batches.front());
+		freeBatches.emplace_back(std::move(batches.front()));
+		batches.pop_front();
+	}
+}
+
+void vk::DeferredDestructionQueue::flush() {
+	release(UINT64_MAX);
+}
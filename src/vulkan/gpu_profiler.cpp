@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+
+#include <tracy/Tracy.hpp>
+
+#include <vulkan/gpu_profiler.hpp>
+#include <vulkan/debug_utils.hpp>
+
+VkResult vk::GpuProfiler::init(VkDevice newDevice, float newTimestampPeriod, std::uint32_t timestampValidBits, std::size_t frameCount) {
+	ZoneScoped;
+	device = newDevice;
+	timestampPeriod = static_cast<double>(newTimestampPeriod);
+	timestampMask = timestampValidBits >= 64 ? ~0ULL : (1ULL << timestampValidBits) - 1;
+	if (timestampValidBits == 0) {
+		// The queue does not support timestamps at all
+		return VK_ERROR_FEATURE_NOT_PRESENT;
+	}
+
+	const VkQueryPoolCreateInfo poolInfo {
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.queryType = VK_QUERY_TYPE_TIMESTAMP,
+		.queryCount = maxScopesPerFrame * 2,
+	};
+	frames.resize(frameCount);
+	for (std::size_t i = 0; auto& frame : frames) {
+		auto result = vkCreateQueryPool(device, &poolInfo, VK_NULL_HANDLE, &frame.pool);
+		if (result != VK_SUCCESS) {
+			return result;
+		}
+		vk::setDebugUtilsName(device, frame.pool, fmt::format("GPU profiler queries {}", i++));
+
+		// Queries have to be reset before their first use
+		vkResetQueryPool(device, frame.pool, 0, poolInfo.queryCount);
+	}
+	return VK_SUCCESS;
+}
+
+void vk::GpuProfiler::destroy() {
+	stopCsv();
+	for (auto& frame : frames) {
+		vkDestroyQueryPool(device, frame.pool, VK_NULL_HANDLE);
+	}
+	frames.clear();
+}
+
+std::size_t vk::GpuProfiler::getScopeIndex(std::string_view name) {
+	auto it = std::find_if(stats.begin(), stats.end(), [&](const ScopeStats& scope) {
+		return scope.name == name;
+	});
+	if (it != stats.end())
+		return static_cast<std::size_t>(std::distance(stats.begin(), it));
+
+	stats.emplace_back().name = name;
+	return stats.size() - 1;
+}
+
+void vk::GpuProfiler::readResults(FrameQueries& frame) {
+	ZoneScoped;
+	if (frame.scopes.empty())
+		return;
+
+	const auto queryCount = static_cast<std::uint32_t>(frame.scopes.size() * 2);
+	std::array<std::uint64_t, maxScopesPerFrame * 2> timestamps = {};
+	auto result = vkGetQueryPoolResults(device, frame.pool, 0, queryCount, queryCount * sizeof(std::uint64_t),
+										timestamps.data(), sizeof(std::uint64_t), VK_QUERY_RESULT_64_BIT);
+
+	// The frame's fence has been waited upon, so the results should always be available.
+	if (result == VK_SUCCESS) {
+		for (std::size_t i = 0; i < frame.scopes.size(); ++i) {
+			const auto ticks = (timestamps[i * 2 + 1] - timestamps[i * 2]) & timestampMask;
+			auto& scope = stats[frame.scopes[i]];
+			scope.lastMs = static_cast<double>(ticks) * timestampPeriod / 1e6;
+			scope.history[scope.sampleCount++ % historySize] = scope.lastMs;
+
+			const auto samples = std::min(scope.sampleCount, historySize);
+			scope.averageMs = std::accumulate(scope.history.begin(), scope.history.begin() + samples, 0.0) / static_cast<double>(samples);
+
+			if (csvFile.is_open()) {
+				csvFile << frame.frameNumber << ',' << scope.name << ',' << scope.lastMs << '\n';
+			}
+		}
+	}
+
+	vkResetQueryPool(device, frame.pool, 0, queryCount);
+	frame.scopes.clear();
+}
+
+void vk::GpuProfiler::beginFrame(std::size_t frameIndex, std::uint64_t frameNumber) {
+	ZoneScoped;
+	if (frames.empty())
+		return;
+	assert(frameIndex < frames.size());
+	currentFrame = frameIndex;
+	auto& frame = frames[currentFrame];
+	readResults(frame);
+	frame.frameNumber = frameNumber;
+}
+
+std::uint32_t vk::GpuProfiler::beginScope(VkCommandBuffer cmd, std::string_view name) {
+	if (frames.empty())
+		return UINT32_MAX;
+
+	auto& frame = frames[currentFrame];
+	if (frame.scopes.size() >= maxScopesPerFrame)
+		return UINT32_MAX;
+
+	const auto scope = static_cast<std::uint32_t>(frame.scopes.size());
+	frame.scopes.emplace_back(getScopeIndex(name));
+	vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, frame.pool, scope * 2);
+	return scope;
+}
+
+void vk::GpuProfiler::endScope(VkCommandBuffer cmd, std::uint32_t scope) {
+	if (scope == UINT32_MAX)
+		return;
+	vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, frames[currentFrame].pool, scope * 2 + 1);
+}
+
+bool vk::GpuProfiler::startCsv(const std::filesystem::path& path) {
+	stopCsv();
+	csvFile.open(path, std::ios::out | std::ios::trunc);
+	if (!csvFile.is_open())
+		return false;
+	csvFile << "frame,pass,ms\n";
+	return true;
+}
+
+void vk::GpuProfiler::stopCsv() {
+	if (csvFile.is_open())
+		csvFile.close();
+}
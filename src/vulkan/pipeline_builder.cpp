@@ -1,36 +1,25 @@
 #include <cassert>
-#include <fstream>
 
 #include <tracy/Tracy.hpp>
 
 #include <vulkan/pipeline_builder.hpp>
 
-VkResult vk::loadShaderModule(std::filesystem::path filePath, VkDevice device, VkShaderModule *pShaderModule) {
-    std::error_code error;
-    auto length = static_cast<std::streamsize>(std::filesystem::file_size(filePath, error));
-    if (error) {
-        return VK_ERROR_UNKNOWN;
+VkResult vk::loadShaderModule(std::span<const std::uint32_t> code, VkDevice device, VkShaderModule *pShaderModule) {
+    if (code.empty()) {
+        return VK_ERROR_INITIALIZATION_FAILED;
     }
 
-    std::ifstream file(filePath, std::ios::binary);
-    if (!file.is_open()) {
-        return VK_ERROR_UNKNOWN;
-    }
-
-    auto buffer = std::make_unique_for_overwrite<std::uint32_t[]>(length / sizeof(std::uint32_t));
-    file.read((char*)buffer.get(), length);
-
     const VkShaderModuleCreateInfo createInfo = {
         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-        .codeSize = static_cast<std::uint32_t>(length),
-        .pCode = buffer.get(),
+        .codeSize = code.size_bytes(),
+        .pCode = code.data(),
     };
 
     return vkCreateShaderModule(device, &createInfo, VK_NULL_HANDLE, pShaderModule);
 }
 
-vk::PipelineBuilder::PipelineBuilder(VkDevice device, VkPhysicalDevice physicalDevice)
-        : device(device), physicalDevice(physicalDevice) {}
+vk::PipelineBuilder::PipelineBuilder(VkDevice device, VkPhysicalDevice physicalDevice, VkPipelineCache pipelineCache)
+        : device(device), physicalDevice(physicalDevice), pipelineCache(pipelineCache) {}
 
 
 vk::PipelineBuilder& vk::PipelineBuilder::setPipelineCache(VkPipelineCache cache) {
@@ -38,8 +27,8 @@ vk::PipelineBuilder& vk::PipelineBuilder::setPipelineCache(VkPipelineCache cache
     return *this;
 }
 
-vk::ComputePipelineBuilder::ComputePipelineBuilder(VkDevice device, VkPhysicalDevice physicalDevice)
-        : PipelineBuilder(device, physicalDevice) {}
+vk::ComputePipelineBuilder::ComputePipelineBuilder(VkDevice device, VkPhysicalDevice physicalDevice, VkPipelineCache pipelineCache)
+        : PipelineBuilder(device, physicalDevice, pipelineCache) {}
 
 VkResult vk::ComputePipelineBuilder::build(VkPipeline* pipeline) noexcept {
     ZoneScoped;
@@ -58,6 +47,11 @@ vk::ComputePipelineBuilder& vk::ComputePipelineBuilder::pushPNext(std::uint32_t
     return *this;
 }
 
+vk::ComputePipelineBuilder& vk::ComputePipelineBuilder::setPipelineCache(VkPipelineCache cache) {
+    pipelineCache = cache;
+    return *this;
+}
+
 vk::ComputePipelineBuilder& vk::ComputePipelineBuilder::setPipelineCount(std::uint32_t count) {
     ZoneScoped;
     pipelineInfos.resize(count);
@@ -92,8 +86,8 @@ vk::ComputePipelineBuilder& vk::ComputePipelineBuilder::setShaderStage(std::uint
     return *this;
 }
 
-vk::GraphicsPipelineBuilder::GraphicsPipelineBuilder(VkDevice device, VkPhysicalDevice physicalDevice)
-        : PipelineBuilder(device, physicalDevice) {}
+vk::GraphicsPipelineBuilder::GraphicsPipelineBuilder(VkDevice device, VkPhysicalDevice physicalDevice, VkPipelineCache pipelineCache)
+        : PipelineBuilder(device, physicalDevice, pipelineCache) {}
 
 vk::GraphicsPipelineBuilder& vk::GraphicsPipelineBuilder::addDynamicState(std::uint32_t idx, VkDynamicState state) {
     ZoneScoped;